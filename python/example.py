@@ -0,0 +1,41 @@
+#!/usr/bin/env python3
+# Prints the mean Fv/Fm of every recording in a session file and how fast the
+# frames were loaded:
+#
+#     python3 example.py images/session-1715227602742149.pam
+
+import sys
+import time
+
+import numpy
+
+import pam
+
+
+def main(path):
+    start = time.perf_counter()
+    session = pam.Recording(path)
+
+    # Frames are views into the mapped file, numpy doesn't copy them
+    total = 0
+    for i in range(len(session)):
+        total += numpy.asarray(session.frame(i)).nbytes
+    elapsed = time.perf_counter() - start
+    print(f"{len(session)} frames, {total / 1e6:.1f} MB in {elapsed * 1e3:.1f} ms ({total / 1e9 / elapsed:.2f} GB/s)")
+
+    for recording in session.recordings():
+        try:
+            f0, fm = session.pam_frames(recording)
+        except ValueError:
+            continue
+
+        fvfm = numpy.asarray(session.fvfm(recording))
+        valid = numpy.count_nonzero(~numpy.isnan(fvfm))
+        print(f"recording {recording}: F0 frame {f0}, Fm frame {fm}, mean Fv/Fm {numpy.nanmean(fvfm):.3f} over {valid} pixels")
+
+
+if __name__ == "__main__":
+    if len(sys.argv) != 2:
+        print("Usage: example.py SESSION_FILE")
+        sys.exit(1)
+    main(sys.argv[1])
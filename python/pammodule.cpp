@@ -0,0 +1,543 @@
+// *****************************************************************************
+//
+// pammodule.cpp
+// Python bindings for session files and the fluorescence kernels. Frames and
+// result maps are pam.Image objects that export the buffer protocol, so
+// numpy.asarray() wraps them without a copy:
+//
+//     rec = pam.Recording("images/session-1715227602742149.pam")
+//     for r in rec.recordings():
+//         fvfm = numpy.asarray(rec.fvfm(r))
+//     f0 = numpy.asarray(rec.frame(0))     # view into the mapped file
+//
+// Frame images keep their Recording open; close() fails while any exist.
+//
+// *****************************************************************************
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <cstring>
+#include <new>
+#include <string>
+
+#include "recording.h"
+#include "fluorescence.h"
+
+// -----------------------------------------------------------------------------
+// pam.Image
+
+typedef struct
+{
+    PyObject_HEAD
+    PyObject* owner;            // Keeps the data alive, or null if owned
+    float* owned;
+    const uint8_t* data;
+    char format[2];
+    Py_ssize_t itemsize;
+    Py_ssize_t shape[2];
+    Py_ssize_t strides[2];
+    uint32_t bits;
+} ImageObject;
+
+typedef struct
+{
+    PyObject_HEAD
+    RecordingReader* reader;
+    Py_ssize_t exports;         // Frame images still pointing into the mapping
+} RecordingObject;
+
+static PyTypeObject ImageType = {PyVarObject_HEAD_INIT(NULL, 0)};
+static PyTypeObject RecordingType = {PyVarObject_HEAD_INIT(NULL, 0)};
+
+static void Image_dealloc(ImageObject* self)
+{
+    if (self->owner != nullptr && PyObject_TypeCheck(self->owner, &RecordingType))
+    {
+        reinterpret_cast<RecordingObject*>(self->owner)->exports--;
+    }
+    Py_XDECREF(self->owner);
+    delete[] self->owned;
+    Py_TYPE(self)->tp_free(reinterpret_cast<PyObject*>(self));
+}
+
+static int Image_getbuffer(ImageObject* self, Py_buffer* view, int flags)
+{
+    if (flags & PyBUF_WRITABLE)
+    {
+        PyErr_SetString(PyExc_BufferError, "pam.Image is read only");
+        view->obj = nullptr;
+        return -1;
+    }
+
+    bool contiguous = self->strides[0] == self->shape[1] * self->itemsize;
+    if ((flags & PyBUF_STRIDES) != PyBUF_STRIDES && !contiguous)
+    {
+        PyErr_SetString(PyExc_BufferError, "frame rows are padded, a strided buffer is needed");
+        view->obj = nullptr;
+        return -1;
+    }
+
+    view->obj = reinterpret_cast<PyObject*>(self);
+    Py_INCREF(self);
+    view->buf = const_cast<uint8_t*>(self->data);
+    view->len = self->shape[0] * self->shape[1] * self->itemsize;
+    view->readonly = 1;
+    view->itemsize = self->itemsize;
+    view->format = (flags & PyBUF_FORMAT) ? self->format : nullptr;
+    view->ndim = 2;
+    view->shape = (flags & PyBUF_ND) ? self->shape : nullptr;
+    view->strides = ((flags & PyBUF_STRIDES) == PyBUF_STRIDES) ? self->strides : nullptr;
+    view->suboffsets = nullptr;
+    view->internal = nullptr;
+    return 0;
+}
+
+static PyBufferProcs Image_as_buffer = {(getbufferproc)Image_getbuffer, nullptr};
+
+static PyObject* Image_getShape(ImageObject* self, void*)
+{
+    return Py_BuildValue("(nn)", self->shape[0], self->shape[1]);
+}
+
+static PyObject* Image_getFormat(ImageObject* self, void*)
+{
+    return PyUnicode_FromString(self->format);
+}
+
+static PyObject* Image_getBits(ImageObject* self, void*)
+{
+    return PyLong_FromUnsignedLong(self->bits);
+}
+
+static PyGetSetDef Image_getset[] = {
+    {"shape", (getter)Image_getShape, nullptr, "(height, width)", nullptr},
+    {"format", (getter)Image_getFormat, nullptr, "struct format of a pixel", nullptr},
+    {"bits", (getter)Image_getBits, nullptr, "significant bits per pixel, 0 for maps", nullptr},
+    {nullptr}
+};
+
+static ImageObject* newImage()
+{
+    ImageObject* image = PyObject_New(ImageObject, &ImageType);
+    if (image != nullptr)
+    {
+        image->owner = nullptr;
+        image->owned = nullptr;
+        image->data = nullptr;
+        image->bits = 0;
+    }
+    return image;
+}
+
+// Wraps a frame in the mapped file
+static PyObject* imageFromFrame(RecordingObject* owner, const ImageView& view)
+{
+    ImageObject* image = newImage();
+    if (image == nullptr)
+    {
+        return nullptr;
+    }
+
+    Py_INCREF(owner);
+    owner->exports++;
+    image->owner = reinterpret_cast<PyObject*>(owner);
+    image->data = view.data;
+    image->itemsize = view.bytesPerPixel();
+    strcpy(image->format, (image->itemsize == 2) ? "H" : "B");
+    image->shape[0] = view.height;
+    image->shape[1] = view.width;
+    image->strides[0] = view.stride;
+    image->strides[1] = image->itemsize;
+    image->bits = view.bits;
+    return reinterpret_cast<PyObject*>(image);
+}
+
+// A float map the image owns
+static ImageObject* newMap(uint32_t width, uint32_t height)
+{
+    ImageObject* image = newImage();
+    if (image == nullptr)
+    {
+        return nullptr;
+    }
+
+    image->owned = new (std::nothrow) float[static_cast<size_t>(width) * height];
+    if (image->owned == nullptr)
+    {
+        Py_DECREF(image);
+        PyErr_NoMemory();
+        return nullptr;
+    }
+    image->data = reinterpret_cast<const uint8_t*>(image->owned);
+    image->itemsize = sizeof(float);
+    strcpy(image->format, "f");
+    image->shape[0] = height;
+    image->shape[1] = width;
+    image->strides[0] = width * sizeof(float);
+    image->strides[1] = sizeof(float);
+    return image;
+}
+
+// -----------------------------------------------------------------------------
+// Buffers from Python (pam.Image, numpy arrays, ...) as ImageViews
+
+struct HeldView
+{
+    Py_buffer buffer;
+    bool held = false;
+    ~HeldView() { if (held) PyBuffer_Release(&buffer); }
+};
+
+static bool viewFromObject(PyObject* obj, int bits, HeldView& held, ImageView& view)
+{
+    if (PyObject_GetBuffer(obj, &held.buffer, PyBUF_RECORDS_RO) != 0)
+    {
+        return false;
+    }
+    held.held = true;
+
+    Py_buffer& b = held.buffer;
+    const char* format = b.format ? b.format : "B";
+    if (format[0] == '<' || format[0] == '=' || format[0] == '@')
+    {
+        format++;
+    }
+    bool is8 = strcmp(format, "B") == 0 && b.itemsize == 1;
+    bool is16 = strcmp(format, "H") == 0 && b.itemsize == 2;
+    if (b.ndim != 2 || !(is8 || is16) || (b.strides != nullptr && b.strides[1] != b.itemsize))
+    {
+        PyErr_SetString(PyExc_ValueError, "expected a 2D uint8 or uint16 image with contiguous rows");
+        return false;
+    }
+
+    view.data = static_cast<const uint8_t*>(b.buf);
+    view.height = static_cast<uint32_t>(b.shape[0]);
+    view.width = static_cast<uint32_t>(b.shape[1]);
+    view.stride = static_cast<uint32_t>(b.strides ? b.strides[0] : b.shape[1] * b.itemsize);
+
+    // pam.Image knows its significant bits, otherwise assume the full range
+    if (bits <= 0 && PyObject_TypeCheck(obj, &ImageType))
+    {
+        bits = reinterpret_cast<ImageObject*>(obj)->bits;
+    }
+    view.bits = (bits > 0) ? bits : (is16 ? 16 : 8);
+    if ((view.bits > 8) != is16)
+    {
+        PyErr_SetString(PyExc_ValueError, "bits doesn't match the pixel size");
+        return false;
+    }
+    return true;
+}
+
+static PyObject* fvfmMap(const ImageView& f0, const ImageView& fm, float threshold)
+{
+    if (f0.data == nullptr || fm.data == nullptr || !Fluorescence::sameShape(f0, fm))
+    {
+        PyErr_SetString(PyExc_ValueError, "F0 and Fm are not images of the same size and format");
+        return nullptr;
+    }
+
+    ImageObject* map = newMap(f0.width, f0.height);
+    if (map == nullptr)
+    {
+        return nullptr;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    Fluorescence::fvfm(f0, fm, map->owned, threshold);
+    Py_END_ALLOW_THREADS
+
+    return reinterpret_cast<PyObject*>(map);
+}
+
+// -----------------------------------------------------------------------------
+// pam.Recording
+
+static int Recording_init(RecordingObject* self, PyObject* args, PyObject* kwds)
+{
+    static const char* kwlist[] = {"path", nullptr};
+    const char* path;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "s", const_cast<char**>(kwlist), &path))
+    {
+        return -1;
+    }
+
+    if (self->exports > 0)
+    {
+        PyErr_SetString(PyExc_BufferError, "frames of this recording are still in use");
+        return -1;
+    }
+
+    delete self->reader;
+    self->reader = new RecordingReader();
+    bool ok;
+    Py_BEGIN_ALLOW_THREADS
+    ok = self->reader->open(path);
+    Py_END_ALLOW_THREADS
+    if (!ok)
+    {
+        PyErr_Format(PyExc_IOError, "unable to open session file %s", path);
+        return -1;
+    }
+    return 0;
+}
+
+static PyObject* Recording_new(PyTypeObject* type, PyObject*, PyObject*)
+{
+    RecordingObject* self = reinterpret_cast<RecordingObject*>(type->tp_alloc(type, 0));
+    if (self != nullptr)
+    {
+        self->reader = nullptr;
+        self->exports = 0;
+    }
+    return reinterpret_cast<PyObject*>(self);
+}
+
+static void Recording_dealloc(RecordingObject* self)
+{
+    delete self->reader;
+    Py_TYPE(self)->tp_free(reinterpret_cast<PyObject*>(self));
+}
+
+static bool checkOpen(RecordingObject* self)
+{
+    if (self->reader == nullptr || !self->reader->isOpen())
+    {
+        PyErr_SetString(PyExc_ValueError, "recording is closed");
+        return false;
+    }
+    return true;
+}
+
+static Py_ssize_t Recording_len(RecordingObject* self)
+{
+    return (self->reader != nullptr) ? self->reader->getFrameCount() : 0;
+}
+
+static PyObject* Recording_frame(RecordingObject* self, PyObject* args)
+{
+    Py_ssize_t i;
+    if (!PyArg_ParseTuple(args, "n", &i) || !checkOpen(self))
+    {
+        return nullptr;
+    }
+    if (i < 0)
+    {
+        i += self->reader->getFrameCount();
+    }
+
+    ImageView view = self->reader->getImage(i);
+    if (i < 0 || static_cast<size_t>(i) >= self->reader->getFrameCount())
+    {
+        PyErr_SetString(PyExc_IndexError, "frame index out of range");
+        return nullptr;
+    }
+    if (view.data == nullptr)
+    {
+        PyErr_SetString(PyExc_ValueError, "frame header doesn't describe an image");
+        return nullptr;
+    }
+    return imageFromFrame(self, view);
+}
+
+static PyObject* Recording_header(RecordingObject* self, PyObject* args)
+{
+    Py_ssize_t i;
+    if (!PyArg_ParseTuple(args, "n", &i) || !checkOpen(self))
+    {
+        return nullptr;
+    }
+
+    const FrameHeader* h = (i >= 0) ? self->reader->getHeader(i) : nullptr;
+    if (h == nullptr)
+    {
+        PyErr_SetString(PyExc_IndexError, "frame index out of range");
+        return nullptr;
+    }
+    return Py_BuildValue("{s:I,s:I,s:I,s:I,s:I,s:I,s:I,s:K,s:K,s:L}",
+        "width", h->width, "height", h->height, "pixel_type", h->pixel_type, "bits", h->bits,
+        "stride", h->stride, "recording", h->recording, "frame", h->frame,
+        "block_id", static_cast<unsigned long long>(h->block_id), "timestamp", static_cast<unsigned long long>(h->timestamp),
+        "wall_us", static_cast<long long>(h->wall_us));
+}
+
+static PyObject* Recording_recordings(RecordingObject* self, PyObject*)
+{
+    if (!checkOpen(self))
+    {
+        return nullptr;
+    }
+
+    std::vector<uint32_t> recordings = self->reader->getRecordings();
+    PyObject* list = PyList_New(recordings.size());
+    for (size_t i = 0; list != nullptr && i < recordings.size(); i++)
+    {
+        PyList_SET_ITEM(list, i, PyLong_FromUnsignedLong(recordings[i]));
+    }
+    return list;
+}
+
+static PyObject* Recording_frames(RecordingObject* self, PyObject* args)
+{
+    unsigned int recording;
+    if (!PyArg_ParseTuple(args, "I", &recording) || !checkOpen(self))
+    {
+        return nullptr;
+    }
+
+    std::vector<size_t> frames = self->reader->getFrames(recording);
+    PyObject* list = PyList_New(frames.size());
+    for (size_t i = 0; list != nullptr && i < frames.size(); i++)
+    {
+        PyList_SET_ITEM(list, i, PyLong_FromSize_t(frames[i]));
+    }
+    return list;
+}
+
+static PyObject* Recording_pamFrames(RecordingObject* self, PyObject* args)
+{
+    unsigned int recording;
+    if (!PyArg_ParseTuple(args, "I", &recording) || !checkOpen(self))
+    {
+        return nullptr;
+    }
+
+    size_t f0, fm;
+    if (!self->reader->getPamFrames(recording, f0, fm))
+    {
+        PyErr_Format(PyExc_ValueError, "recording %u has no F0/Fm pair", recording);
+        return nullptr;
+    }
+    return Py_BuildValue("(nn)", static_cast<Py_ssize_t>(f0), static_cast<Py_ssize_t>(fm));
+}
+
+static PyObject* Recording_fvfm(RecordingObject* self, PyObject* args, PyObject* kwds)
+{
+    static const char* kwlist[] = {"recording", "threshold", nullptr};
+    unsigned int recording;
+    float threshold = DEFAULT_FM_THRESHOLD;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "I|f", const_cast<char**>(kwlist), &recording, &threshold) || !checkOpen(self))
+    {
+        return nullptr;
+    }
+
+    size_t f0, fm;
+    if (!self->reader->getPamFrames(recording, f0, fm))
+    {
+        PyErr_Format(PyExc_ValueError, "recording %u has no F0/Fm pair", recording);
+        return nullptr;
+    }
+    return fvfmMap(self->reader->getImage(f0), self->reader->getImage(fm), threshold);
+}
+
+static PyObject* Recording_close(RecordingObject* self, PyObject*)
+{
+    if (self->exports > 0)
+    {
+        PyErr_SetString(PyExc_BufferError, "frames of this recording are still in use");
+        return nullptr;
+    }
+    if (self->reader != nullptr)
+    {
+        self->reader->close();
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject* Recording_getCreated(RecordingObject* self, void*)
+{
+    return PyLong_FromLongLong((self->reader != nullptr) ? self->reader->getCreated() : 0);
+}
+
+static PyMethodDef Recording_methods[] = {
+    {"frame", (PyCFunction)Recording_frame, METH_VARARGS, "frame(i) -> Image viewing frame i in place"},
+    {"header", (PyCFunction)Recording_header, METH_VARARGS, "header(i) -> dict of frame i's header"},
+    {"recordings", (PyCFunction)Recording_recordings, METH_NOARGS, "recording numbers in file order"},
+    {"frames", (PyCFunction)Recording_frames, METH_VARARGS, "frames(recording) -> frame indexes"},
+    {"pam_frames", (PyCFunction)Recording_pamFrames, METH_VARARGS, "pam_frames(recording) -> (F0 index, Fm index)"},
+    {"fvfm", (PyCFunction)Recording_fvfm, METH_VARARGS | METH_KEYWORDS, "fvfm(recording, threshold=0.02) -> float32 Image"},
+    {"close", (PyCFunction)Recording_close, METH_NOARGS, "unmap the file"},
+    {nullptr}
+};
+
+static PyGetSetDef Recording_getset[] = {
+    {"created", (getter)Recording_getCreated, nullptr, "session start, microseconds since the epoch", nullptr},
+    {nullptr}
+};
+
+static PySequenceMethods Recording_as_sequence = {(lenfunc)Recording_len};
+
+// -----------------------------------------------------------------------------
+// Module functions
+
+static PyObject* pam_fvfm(PyObject*, PyObject* args, PyObject* kwds)
+{
+    static const char* kwlist[] = {"f0", "fm", "bits", "threshold", nullptr};
+    PyObject* f0_obj;
+    PyObject* fm_obj;
+    int bits = 0;
+    float threshold = DEFAULT_FM_THRESHOLD;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "OO|if", const_cast<char**>(kwlist), &f0_obj, &fm_obj, &bits, &threshold))
+    {
+        return nullptr;
+    }
+
+    HeldView f0_held, fm_held;
+    ImageView f0, fm;
+    if (!viewFromObject(f0_obj, bits, f0_held, f0) || !viewFromObject(fm_obj, bits, fm_held, fm))
+    {
+        return nullptr;
+    }
+    return fvfmMap(f0, fm, threshold);
+}
+
+static PyMethodDef pam_methods[] = {
+    {"fvfm", (PyCFunction)pam_fvfm, METH_VARARGS | METH_KEYWORDS,
+     "fvfm(f0, fm, bits=0, threshold=0.02) -> float32 Image of (Fm - F0) / Fm, NaN below threshold"},
+    {nullptr}
+};
+
+static struct PyModuleDef pam_module = {
+    PyModuleDef_HEAD_INIT, "pam", "PAM session files and fluorescence kernels", -1, pam_methods
+};
+
+PyMODINIT_FUNC PyInit_pam()
+{
+    ImageType.tp_name = "pam.Image";
+    ImageType.tp_basicsize = sizeof(ImageObject);
+    ImageType.tp_dealloc = (destructor)Image_dealloc;
+    ImageType.tp_as_buffer = &Image_as_buffer;
+    ImageType.tp_getset = Image_getset;
+    ImageType.tp_flags = Py_TPFLAGS_DEFAULT;
+    ImageType.tp_doc = "2D image or map, use numpy.asarray() to view it";
+
+    RecordingType.tp_name = "pam.Recording";
+    RecordingType.tp_basicsize = sizeof(RecordingObject);
+    RecordingType.tp_new = Recording_new;
+    RecordingType.tp_init = (initproc)Recording_init;
+    RecordingType.tp_dealloc = (destructor)Recording_dealloc;
+    RecordingType.tp_methods = Recording_methods;
+    RecordingType.tp_getset = Recording_getset;
+    RecordingType.tp_as_sequence = &Recording_as_sequence;
+    RecordingType.tp_flags = Py_TPFLAGS_DEFAULT;
+    RecordingType.tp_doc = "Recording(path): memory mapped session file";
+
+    if (PyType_Ready(&ImageType) < 0 || PyType_Ready(&RecordingType) < 0)
+    {
+        return nullptr;
+    }
+
+    PyObject* module = PyModule_Create(&pam_module);
+    if (module == nullptr)
+    {
+        return nullptr;
+    }
+
+    Py_INCREF(&ImageType);
+    Py_INCREF(&RecordingType);
+    PyModule_AddObject(module, "Image", reinterpret_cast<PyObject*>(&ImageType));
+    PyModule_AddObject(module, "Recording", reinterpret_cast<PyObject*>(&RecordingType));
+    PyModule_AddIntConstant(module, "SESSION_MAGIC", SESSION_MAGIC);
+    return module;
+}
@@ -0,0 +1,19 @@
+# Builds the pam module from the project sources:
+#
+#     cd python && python3 setup.py build_ext --inplace
+
+import os
+from setuptools import setup, Extension
+
+here = os.path.dirname(os.path.abspath(__file__))
+src = os.path.relpath(os.path.join(here, "..", "src"), here)
+
+pam = Extension(
+    "pam",
+    sources=["pammodule.cpp", os.path.join(src, "recording.cpp"), os.path.join(src, "fluorescence.cpp")],
+    include_dirs=[src],
+    extra_compile_args=["-std=c++14", "-O3"],
+    language="c++",
+)
+
+setup(name="pam", version="0.1", description="PAM session files and fluorescence kernels", ext_modules=[pam])
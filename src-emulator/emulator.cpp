@@ -0,0 +1,767 @@
+#include "emulator.h"
+#include "genicam.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define BOOTSTRAP_SIZE 0x1000
+#define MIN_HEARTBEAT_TIMEOUT 500       // (ms)
+#define MIN_PACKET_SIZE 576
+#define MAX_PACKET_SIZE 9000
+#define IDLE_WAIT 100000000             // (ns) longest the acquisition thread sleeps
+
+GigeEmulator::GigeEmulator(const EmulatorOptions& _options) :
+    options(_options), fd(-1), wake_fd(-1), start_ns(now()), bootstrap(BOOTSTRAP_SIZE, 0), device(EMU_REG_END - EMU_REG_BASE, 0),
+    xml(GENICAM_XML), ccp(0), last_heartbeat(0), acquiring(false), frames_left(0), pending_triggers(0), next_frame(0), next_line(0),
+    dirty(true), frame_index(0), running(false)
+{
+    memset(&controller, 0, sizeof(controller));
+
+    // Reads of the description come in whole words
+    xml.resize((xml.size() + 3) & ~size_t(3), '\0');
+
+    struct in_addr ip = {};
+    inet_pton(AF_INET, options.ip.c_str(), &ip);
+    uint32_t host_ip = ntohl(ip.s_addr);
+
+    // Locally administered MAC, unique per GVCP port
+    setReg(GEV_REG_VERSION, 0x00020000);
+    setReg(GEV_REG_DEVICE_MODE, 0x80000001);
+    setReg(GEV_REG_MAC_HIGH, 0x0250);
+    setReg(GEV_REG_MAC_LOW, 0x414d0000 | options.port);
+    setReg(GEV_REG_IP_CONFIG_OPTIONS, 0x00000006);
+    setReg(GEV_REG_IP_CONFIG_CURRENT, 0x00000006);
+    setReg(GEV_REG_CURRENT_IP, host_ip);
+    setReg(GEV_REG_SUBNET_MASK, ((host_ip >> 24) == 127) ? 0xff000000 : 0xffffff00);
+    Gvcp::putString(&bootstrap[GEV_REG_MANUFACTURER], "PAM", 32);
+    Gvcp::putString(&bootstrap[GEV_REG_MODEL], options.model, 32);
+    Gvcp::putString(&bootstrap[GEV_REG_DEVICE_VERSION], "1.0", 32);
+    Gvcp::putString(&bootstrap[GEV_REG_MANUFACTURER_INFO], "Emulated camera", 48);
+    Gvcp::putString(&bootstrap[GEV_REG_SERIAL], options.serial, 16);
+    std::ostringstream url;
+    url << "Local:pam_emulator.xml;" << std::hex << EMULATOR_XML_ADDRESS << ";" << xml.size();
+    Gvcp::putString(&bootstrap[GEV_REG_FIRST_URL], url.str(), 512);
+    setReg(GEV_REG_INTERFACES, 1);
+    setReg(GEV_REG_STREAM_CHANNELS, 1);
+
+    // User name, serial number, concatenation, WRITEMEM and PACKETRESEND
+    setReg(GEV_REG_GVCP_CAPABILITY, 0xc0000007);
+    setReg(GEV_REG_HEARTBEAT_TIMEOUT, DEFAULT_HEARTBEAT_TIMEOUT);
+    setReg(GEV_REG_TICK_FREQUENCY_HIGH, static_cast<uint32_t>(static_cast<uint64_t>(EMULATOR_TICK_FREQUENCY) >> 32));
+    setReg(GEV_REG_TICK_FREQUENCY_LOW, static_cast<uint32_t>(EMULATOR_TICK_FREQUENCY));
+    setReg(GEV_REG_SCPS0, DEFAULT_GVSP_PACKET_SIZE);
+
+    // The camera comes up as the receiver leaves it, triggered from line 5
+    setReg(EMU_REG_WIDTH, options.width);
+    setReg(EMU_REG_HEIGHT, options.height);
+    setReg(EMU_REG_WIDTH_MAX, options.width);
+    setReg(EMU_REG_HEIGHT_MAX, options.height);
+    setReg(EMU_REG_PIXEL_FORMAT, options.pixel_format);
+    setReg(EMU_REG_BINNING_H, 1);
+    setReg(EMU_REG_BINNING_V, 1);
+    setReg(EMU_REG_ACQ_MODE, EMU_CONTINUOUS);
+    setReg(EMU_REG_ACQ_FRAME_COUNT, 1);
+    float fps = static_cast<float>(options.fps);
+    float exposure = 1000.0f;
+    float gain = 1.0f;
+    uint32_t bits;
+    memcpy(&bits, &fps, 4);
+    setReg(EMU_REG_ACQ_FRAME_RATE, bits);
+    memcpy(&bits, &exposure, 4);
+    setReg(EMU_REG_EXPOSURE, bits);
+    memcpy(&bits, &gain, 4);
+    setReg(EMU_REG_GAIN, bits);
+    setReg(EMU_REG_TRIGGER_MODE, 0);
+    setReg(EMU_REG_TRIGGER_SOURCE, 1);
+    updatePayload();
+}
+
+GigeEmulator::~GigeEmulator()
+{
+    stop();
+}
+
+int64_t GigeEmulator::now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool GigeEmulator::start()
+{
+    fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    setsockopt(fd, SOL_SOCKET, SO_BROADCAST, &one, sizeof(one));
+
+    // Any address, discovery is broadcast
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(options.port);
+    if (fd < 0 || bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0)
+    {
+        std::cout << "Emulator: unable to open GVCP port " << options.port << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    if (!sender.open(options.ip, 0))
+    {
+        return false;
+    }
+    sender.setLoss(options.loss, options.reorder, options.seed);
+
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    running = true;
+    control = std::thread(&GigeEmulator::runControl, this);
+    acquisition = std::thread(&GigeEmulator::runAcquisition, this);
+    std::cout << "Emulator: " << options.model << " (" << options.serial << ") at " << options.ip << ":" << options.port << std::endl;
+    return true;
+}
+
+void GigeEmulator::stop()
+{
+    if (!running)
+    {
+        return;
+    }
+
+    running = false;
+    uint64_t one = 1;
+    if (write(wake_fd, &one, sizeof(one)) < 0)
+    {
+        std::cout << "Emulator: unable to wake the control thread: " << strerror(errno) << std::endl;
+    }
+    cv.notify_all();
+    control.join();
+    acquisition.join();
+    sender.close();
+    ::close(fd);
+    ::close(wake_fd);
+    fd = wake_fd = -1;
+}
+
+EmulatorStats GigeEmulator::getStats()
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    EmulatorStats s = stats;
+    s.stream = sender.getStats();
+    return s;
+}
+
+uint32_t GigeEmulator::reg(uint32_t address)
+{
+    const uint8_t* p = memory(address, 4);
+    return (p != nullptr) ? Gvsp::get32(p) : 0;
+}
+
+void GigeEmulator::setReg(uint32_t address, uint32_t value)
+{
+    uint8_t* p = const_cast<uint8_t*>(memory(address, 4));
+    if (p != nullptr)
+    {
+        Gvsp::put32(p, value);
+    }
+}
+
+float GigeEmulator::regFloat(uint32_t address)
+{
+    uint32_t bits = reg(address);
+    float f;
+    memcpy(&f, &bits, 4);
+    return f;
+}
+
+const uint8_t* GigeEmulator::memory(uint32_t address, size_t n)
+{
+    if (address + n <= BOOTSTRAP_SIZE)
+    {
+        return &bootstrap[address];
+    }
+    if (address >= EMU_REG_BASE && address + n <= EMU_REG_END)
+    {
+        return &device[address - EMU_REG_BASE];
+    }
+    if (address >= EMULATOR_XML_ADDRESS && address + n <= EMULATOR_XML_ADDRESS + xml.size())
+    {
+        return reinterpret_cast<const uint8_t*>(xml.data()) + (address - EMULATOR_XML_ADDRESS);
+    }
+    return nullptr;
+}
+
+void GigeEmulator::updatePayload()
+{
+    setReg(EMU_REG_PAYLOAD_SIZE, static_cast<uint32_t>(Gvsp::imageBytes(reg(EMU_REG_PIXEL_FORMAT), reg(EMU_REG_WIDTH), reg(EMU_REG_HEIGHT))));
+    dirty = true;
+}
+
+bool GigeEmulator::hasControl(const struct sockaddr_in& from)
+{
+    return ccp != 0 && from.sin_addr.s_addr == controller.sin_addr.s_addr && from.sin_port == controller.sin_port;
+}
+
+void GigeEmulator::checkHeartbeat(int64_t t)
+{
+    if (ccp != 0 && t - last_heartbeat > static_cast<int64_t>(reg(GEV_REG_HEARTBEAT_TIMEOUT)) * 1000000)
+    {
+        std::cout << "Emulator: heartbeat expired, control released" << std::endl;
+        ccp = 0;
+        setReg(GEV_REG_CCP, 0);
+        stopAcquisition();
+        stats.heartbeat_expired++;
+    }
+}
+
+uint16_t GigeEmulator::readReg(uint32_t address, uint32_t& value)
+{
+    if (address % 4 != 0 || memory(address, 4) == nullptr)
+    {
+        return GEV_STATUS_INVALID_ADDRESS;
+    }
+    value = reg(address);
+    return GEV_STATUS_SUCCESS;
+}
+
+uint16_t GigeEmulator::writeReg(uint32_t address, uint32_t value, const struct sockaddr_in& from)
+{
+    if (address % 4 != 0 || memory(address, 4) == nullptr)
+    {
+        return GEV_STATUS_INVALID_ADDRESS;
+    }
+
+    // Taking control is the one write allowed without it
+    if (address == GEV_REG_CCP)
+    {
+        if (ccp != 0 && !hasControl(from))
+        {
+            return GEV_STATUS_ACCESS_DENIED;
+        }
+        ccp = value & (GEV_CCP_EXCLUSIVE | GEV_CCP_CONTROL);
+        setReg(GEV_REG_CCP, ccp);
+        if (ccp != 0)
+        {
+            controller = from;
+            last_heartbeat = now();
+        }
+        else
+        {
+            stopAcquisition();
+        }
+        return GEV_STATUS_SUCCESS;
+    }
+    if (!hasControl(from))
+    {
+        return GEV_STATUS_ACCESS_DENIED;
+    }
+
+    bool locked = reg(EMU_REG_TL_LOCKED) != 0;
+    float f;
+    memcpy(&f, &value, 4);
+    switch (address)
+    {
+        case GEV_REG_HEARTBEAT_TIMEOUT:
+            setReg(address, std::max<uint32_t>(value, MIN_HEARTBEAT_TIMEOUT));
+            break;
+
+        case GEV_REG_TIMESTAMP_CONTROL:
+            if (value & 1)
+            {
+                start_ns = now();
+            }
+            if (value & 2)
+            {
+                uint64_t ticks = now() - start_ns;
+                setReg(GEV_REG_TIMESTAMP_HIGH, static_cast<uint32_t>(ticks >> 32));
+                setReg(GEV_REG_TIMESTAMP_LOW, static_cast<uint32_t>(ticks));
+            }
+            break;
+
+        case GEV_REG_SCPS0:
+            setReg(address, std::min<uint32_t>(std::max<uint32_t>(value & 0xffff, MIN_PACKET_SIZE), MAX_PACKET_SIZE));
+            break;
+
+        case GEV_REG_SCP0:
+        case GEV_REG_SCPD0:
+        case GEV_REG_SCDA0:
+            setReg(address, value);
+            break;
+
+        case EMU_REG_WIDTH:
+        case EMU_REG_HEIGHT:
+        {
+            uint32_t max = reg(address == EMU_REG_WIDTH ? EMU_REG_WIDTH_MAX : EMU_REG_HEIGHT_MAX);
+            if (locked || acquiring)
+            {
+                return GEV_STATUS_WRITE_PROTECT;
+            }
+            if (value < 16 || value > max)
+            {
+                return GEV_STATUS_INVALID_PARAMETER;
+            }
+            setReg(address, value);
+            updatePayload();
+            break;
+        }
+
+        case EMU_REG_PIXEL_FORMAT:
+            if (locked || acquiring)
+            {
+                return GEV_STATUS_WRITE_PROTECT;
+            }
+            if (value != GVSP_PIX_MONO8 && value != GVSP_PIX_MONO12)
+            {
+                return GEV_STATUS_INVALID_PARAMETER;
+            }
+            setReg(address, value);
+            updatePayload();
+            break;
+
+        // Binning sets the image size to the binned sensor
+        case EMU_REG_BINNING_H:
+        case EMU_REG_BINNING_V:
+        {
+            bool horizontal = address == EMU_REG_BINNING_H;
+            if (locked || acquiring)
+            {
+                return GEV_STATUS_WRITE_PROTECT;
+            }
+            if (value != 1 && value != 2)
+            {
+                return GEV_STATUS_INVALID_PARAMETER;
+            }
+            setReg(address, value);
+            uint32_t sensor = horizontal ? options.width : options.height;
+            setReg(horizontal ? EMU_REG_WIDTH_MAX : EMU_REG_HEIGHT_MAX, sensor / value);
+            setReg(horizontal ? EMU_REG_WIDTH : EMU_REG_HEIGHT, sensor / value);
+            updatePayload();
+            break;
+        }
+
+        case EMU_REG_ACQ_MODE:
+            if (value > EMU_MULTI_FRAME)
+            {
+                return GEV_STATUS_INVALID_PARAMETER;
+            }
+            setReg(address, value);
+            break;
+
+        case EMU_REG_ACQ_FRAME_COUNT:
+            setReg(address, std::max<uint32_t>(value, 1));
+            break;
+
+        case EMU_REG_ACQ_FRAME_RATE:
+            if (!(f > 0.0f))
+            {
+                return GEV_STATUS_INVALID_PARAMETER;
+            }
+            setReg(address, value);
+            break;
+
+        case EMU_REG_EXPOSURE:
+        case EMU_REG_GAIN:
+            if (!(f > 0.0f))
+            {
+                return GEV_STATUS_INVALID_PARAMETER;
+            }
+            setReg(address, value);
+            dirty = true;
+            break;
+
+        case EMU_REG_TRIGGER_MODE:
+        case EMU_REG_TRIGGER_SOURCE:
+        case EMU_REG_TL_LOCKED:
+            setReg(address, value ? 1 : 0);
+            break;
+
+        case EMU_REG_ACQ_START:
+            startAcquisition();
+            break;
+
+        case EMU_REG_ACQ_STOP:
+            stopAcquisition();
+            break;
+
+        case EMU_REG_TRIGGER_SOFTWARE:
+            if (reg(EMU_REG_TRIGGER_SOURCE) == 0)
+            {
+                trigger();
+            }
+            break;
+
+        default:
+            if (address >= GEV_REG_USER_NAME && address < GEV_REG_USER_NAME + 16)
+            {
+                setReg(address, value);
+                break;
+            }
+            return GEV_STATUS_WRITE_PROTECT;
+    }
+
+    cv.notify_all();
+    return GEV_STATUS_SUCCESS;
+}
+
+void GigeEmulator::startAcquisition()
+{
+    if (acquiring)
+    {
+        return;
+    }
+
+    struct in_addr dest;
+    dest.s_addr = htonl(reg(GEV_REG_SCDA0));
+    char ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &dest, ip, sizeof(ip));
+    uint16_t port = reg(GEV_REG_SCP0) & 0xffff;
+    if (port == 0)
+    {
+        std::cout << "Emulator: acquisition started with no stream destination" << std::endl;
+    }
+    sender.setDestination(ip, port);
+    sender.setPacketSize(reg(GEV_REG_SCPS0) & 0xffff);
+
+    uint32_t mode = reg(EMU_REG_ACQ_MODE);
+    frames_left = (mode == EMU_MULTI_FRAME) ? reg(EMU_REG_ACQ_FRAME_COUNT) : (mode == EMU_SINGLE_FRAME) ? 1 : 0;
+    pending_triggers = 0;
+    next_frame = next_line = now();
+    acquiring = true;
+    stats.acquisitions++;
+    cv.notify_all();
+
+    static const char* modes[] = {"Continuous", "SingleFrame", "MultiFrame"};
+    std::cout << "Emulator: acquisition started, " << modes[std::min<uint32_t>(mode, 2)];
+    if (mode == EMU_MULTI_FRAME)
+    {
+        std::cout << " " << frames_left;
+    }
+    if (reg(EMU_REG_TRIGGER_MODE) != 0)
+    {
+        std::cout << ", triggered from " << (reg(EMU_REG_TRIGGER_SOURCE) ? "Line5" : "Software");
+    }
+    std::cout << ", " << reg(EMU_REG_WIDTH) << "x" << reg(EMU_REG_HEIGHT) << " to " << ip << ":" << port << std::endl;
+}
+
+void GigeEmulator::stopAcquisition()
+{
+    acquiring = false;
+    pending_triggers = 0;
+}
+
+void GigeEmulator::trigger()
+{
+    if (!acquiring || reg(EMU_REG_TRIGGER_MODE) == 0)
+    {
+        stats.ignored_triggers++;
+        return;
+    }
+    pending_triggers++;
+    stats.triggers++;
+    cv.notify_all();
+}
+
+void GigeEmulator::render()
+{
+    uint32_t width = reg(EMU_REG_WIDTH);
+    uint32_t height = reg(EMU_REG_HEIGHT);
+    bool mono12 = reg(EMU_REG_PIXEL_FORMAT) == GVSP_PIX_MONO12;
+    size_t pixels = static_cast<size_t>(width) * height;
+    if (dirty)
+    {
+        // A dim gradient with a grid of bright discs for plants, as bright as
+        // the exposure and gain make it
+        float scale = std::min(regFloat(EMU_REG_EXPOSURE) / 1000.0f * regFloat(EMU_REG_GAIN), 4.0f);
+        float full = mono12 ? 4095.0f : 255.0f;
+        float r = std::max(width, height) / 40.0f;
+        base.resize(pixels * (mono12 ? 2 : 1));
+        for (uint32_t y = 0; y < height; y++)
+        {
+            for (uint32_t x = 0; x < width; x++)
+            {
+                float dx = std::fmod(x, 4 * r) - 2 * r;
+                float dy = std::fmod(y, 4 * r) - 2 * r;
+                float level = 0.05f + 0.05f * x / width + ((dx * dx + dy * dy < r * r) ? 0.4f : 0.0f);
+                uint16_t v = static_cast<uint16_t>(std::min(level * scale, 1.0f) * full);
+                size_t i = static_cast<size_t>(y) * width + x;
+                if (mono12)
+                {
+                    base[2 * i] = v & 0xff;
+                    base[2 * i + 1] = v >> 8;
+                }
+                else
+                {
+                    base[i] = static_cast<uint8_t>(v);
+                }
+            }
+        }
+        dirty = false;
+    }
+
+    // A bright bar moves down a row band per frame, and the frame index
+    // goes in the first 8 bytes
+    image = base;
+    size_t row = static_cast<size_t>(width) * (mono12 ? 2 : 1);
+    uint32_t band = std::max<uint32_t>(height / 64, 1);
+    uint32_t first = static_cast<uint32_t>((frame_index * band) % height);
+    for (uint32_t y = first; y < std::min(first + band, height); y++)
+    {
+        memset(image.data() + y * row, 0xff, row);
+    }
+    if (mono12)
+    {
+        for (size_t i = first * row + 1; i < std::min<size_t>(first + band, height) * row; i += 2)
+        {
+            image[i] = 0x0f;
+        }
+    }
+    for (int b = 0; b < 8 && static_cast<size_t>(b) < image.size(); b++)
+    {
+        image[b] = static_cast<uint8_t>(frame_index >> (8 * b));
+    }
+}
+
+void GigeEmulator::sendFrame(std::unique_lock<std::mutex>& lock, int64_t t)
+{
+    render();
+    bool streaming = (reg(GEV_REG_SCP0) & 0xffff) != 0;
+    uint32_t width = reg(EMU_REG_WIDTH);
+    uint32_t height = reg(EMU_REG_HEIGHT);
+    uint32_t pixel_format = reg(EMU_REG_PIXEL_FORMAT);
+    uint64_t timestamp = t - start_ns;
+    frame_index++;
+    if (frames_left > 0 && --frames_left == 0)
+    {
+        // MultiFrame and SingleFrame end by themselves
+        acquiring = false;
+        uint32_t count = (reg(EMU_REG_ACQ_MODE) == EMU_MULTI_FRAME) ? reg(EMU_REG_ACQ_FRAME_COUNT) : 1;
+        std::cout << "Emulator: acquisition done after " << count << " frames" << std::endl;
+    }
+
+    // Sent without the lock so commands and resends are answered meanwhile
+    lock.unlock();
+    if (streaming)
+    {
+        sender.sendFrame(image.data(), width, height, pixel_format, timestamp);
+    }
+    lock.lock();
+}
+
+void GigeEmulator::runAcquisition()
+{
+    std::unique_lock<std::mutex> lock(mtx);
+    while (running)
+    {
+        int64_t t = now();
+        int64_t wake = t + IDLE_WAIT;
+        checkHeartbeat(t);
+
+        if (acquiring && reg(EMU_REG_TRIGGER_MODE) != 0)
+        {
+            // Line pulses come at a fixed rate whether or not frames keep up
+            if (reg(EMU_REG_TRIGGER_SOURCE) == 1 && options.line_rate > 0.0)
+            {
+                int64_t period = static_cast<int64_t>(1e9 / options.line_rate);
+                if (t >= next_line)
+                {
+                    trigger();
+                    next_line = std::max(next_line + period, t);
+                }
+                wake = std::min(wake, next_line);
+            }
+            if (pending_triggers > 0)
+            {
+                pending_triggers--;
+                sendFrame(lock, t);
+                continue;
+            }
+        }
+        else if (acquiring)
+        {
+            if (t >= next_frame)
+            {
+                sendFrame(lock, t);
+                int64_t period = static_cast<int64_t>(1e9 / regFloat(EMU_REG_ACQ_FRAME_RATE));
+                next_frame += period;
+                if (next_frame < t)
+                {
+                    stats.late_frames++;
+                    next_frame = t + period;
+                }
+                continue;
+            }
+            wake = std::min(wake, next_frame);
+        }
+
+        cv.wait_for(lock, std::chrono::nanoseconds(std::max<int64_t>(wake - t, 0)));
+    }
+}
+
+size_t GigeEmulator::discoveryAck(uint8_t* out, uint16_t req_id)
+{
+    // The payload is the start of the bootstrap registers
+    size_t h = Gvcp::writeAck(out, GEV_STATUS_SUCCESS, GVCP_DISCOVERY_ACK, GVCP_DISCOVERY_SIZE, req_id);
+    memcpy(out + h, bootstrap.data(), GVCP_DISCOVERY_SIZE);
+    stats.discoveries++;
+    return h + GVCP_DISCOVERY_SIZE;
+}
+
+void GigeEmulator::handleCommand(const uint8_t* p, size_t n, const struct sockaddr_in& from)
+{
+    if (n < GVCP_HEADER_SIZE || p[0] != GVCP_KEY)
+    {
+        return;
+    }
+    uint8_t flags = p[1];
+    uint16_t command = Gvsp::get16(p + 2);
+    uint16_t length = std::min<size_t>(Gvsp::get16(p + 4), n - GVCP_HEADER_SIZE);
+    uint16_t req_id = Gvsp::get16(p + 6);
+    const uint8_t* data = p + GVCP_HEADER_SIZE;
+
+    if (command == GVCP_PACKETRESEND_CMD)
+    {
+        GvspResend r;
+        if (Gvsp::parseResend(p, n, r))
+        {
+            sender.resend(r);
+        }
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mtx);
+    stats.commands++;
+    if (hasControl(from))
+    {
+        last_heartbeat = now();
+    }
+
+    uint8_t out[GVCP_HEADER_SIZE + GVCP_MAX_PAYLOAD];
+    uint8_t* payload = out + GVCP_HEADER_SIZE;
+    uint16_t status = GEV_STATUS_SUCCESS;
+    uint16_t answer = command + 1;
+    size_t size = 0;
+    switch (command)
+    {
+        case GVCP_DISCOVERY_CMD:
+        {
+            size_t len = discoveryAck(out, req_id);
+            sendto(fd, out, len, 0, reinterpret_cast<const struct sockaddr*>(&from), sizeof(from));
+            return;
+        }
+
+        // Registers up to the first error are answered
+        case GVCP_READREG_CMD:
+            for (size_t i = 0; i + 4 <= length && size + 4 <= GVCP_MAX_PAYLOAD && status == GEV_STATUS_SUCCESS; i += 4)
+            {
+                uint32_t value = 0;
+                status = readReg(Gvsp::get32(data + i), value);
+                if (status == GEV_STATUS_SUCCESS)
+                {
+                    Gvsp::put32(payload + size, value);
+                    size += 4;
+                }
+            }
+            break;
+
+        case GVCP_WRITEREG_CMD:
+        {
+            uint16_t index = 0;
+            for (size_t i = 0; i + 8 <= length && status == GEV_STATUS_SUCCESS; i += 8)
+            {
+                status = writeReg(Gvsp::get32(data + i), Gvsp::get32(data + i + 4), from);
+                index += (status == GEV_STATUS_SUCCESS);
+            }
+            Gvsp::put16(payload, 0);
+            Gvsp::put16(payload + 2, index);
+            size = 4;
+            break;
+        }
+
+        case GVCP_READMEM_CMD:
+        {
+            uint32_t address = (length >= 8) ? Gvsp::get32(data) : 0;
+            uint16_t count = (length >= 8) ? Gvsp::get16(data + 6) : 0;
+            const uint8_t* src = memory(address, count);
+            Gvsp::put32(payload, address);
+            size = 4;
+            if (length < 8 || count % 4 != 0 || count > GVCP_MAX_READMEM)
+            {
+                status = GEV_STATUS_INVALID_PARAMETER;
+            }
+            else if (src == nullptr)
+            {
+                status = GEV_STATUS_INVALID_ADDRESS;
+            }
+            else
+            {
+                memcpy(payload + 4, src, count);
+                size += count;
+            }
+            break;
+        }
+
+        // Written a word at a time, as registers
+        case GVCP_WRITEMEM_CMD:
+        {
+            uint32_t address = (length >= 4) ? Gvsp::get32(data) : 0;
+            uint16_t index = 0;
+            if (length < 8 || (length - 4) % 4 != 0)
+            {
+                status = GEV_STATUS_INVALID_PARAMETER;
+            }
+            for (size_t i = 4; i + 4 <= length && status == GEV_STATUS_SUCCESS; i += 4)
+            {
+                status = writeReg(address + static_cast<uint32_t>(i - 4), Gvsp::get32(data + i), from);
+                index += (status == GEV_STATUS_SUCCESS) ? 4 : 0;
+            }
+            Gvsp::put16(payload, 0);
+            Gvsp::put16(payload + 2, index);
+            size = 4;
+            break;
+        }
+
+        default:
+            status = GEV_STATUS_NOT_IMPLEMENTED;
+            break;
+    }
+
+    if (flags & GVCP_FLAG_ACK)
+    {
+        Gvcp::writeAck(out, status, answer, static_cast<uint16_t>(size), req_id);
+        sendto(fd, out, GVCP_HEADER_SIZE + size, 0, reinterpret_cast<const struct sockaddr*>(&from), sizeof(from));
+    }
+}
+
+void GigeEmulator::runControl()
+{
+    uint8_t buf[GVSP_MAX_PACKET];
+    struct pollfd fds[2] = {{fd, POLLIN, 0}, {wake_fd, POLLIN, 0}};
+    while (running)
+    {
+        if (poll(fds, 2, -1) < 0 && errno != EINTR)
+        {
+            std::cout << "Emulator: poll failed: " << strerror(errno) << std::endl;
+            break;
+        }
+        if (fds[1].revents & POLLIN)
+        {
+            break;
+        }
+        if (fds[0].revents & POLLIN)
+        {
+            struct sockaddr_in from = {};
+            socklen_t len = sizeof(from);
+            ssize_t n = recvfrom(fd, buf, sizeof(buf), 0, reinterpret_cast<struct sockaddr*>(&from), &len);
+            if (n > 0)
+            {
+                handleCommand(buf, n, from);
+            }
+        }
+    }
+}
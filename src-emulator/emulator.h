@@ -0,0 +1,173 @@
+// *****************************************************************************
+//
+// emulator.h
+// A GigE Vision camera in software, for load testing without the JAI
+// camera. It answers discovery and the register and memory commands on the
+// GVCP port, serves a GenICam description (genicam.h) with the features the
+// receiver uses, and streams synthetic Mono8 or Mono12 frames with
+// GvspSender to the address in the stream channel registers.
+//
+// Acquisition follows the camera: Continuous streams at the frame rate,
+// SingleFrame and MultiFrame stop by themselves after 1 and
+// AcquisitionFrameCount frames. With TriggerMode On a frame is sent per
+// trigger instead, from TriggerSoftware or, with TriggerSource Line5, from
+// emulated line pulses at line_rate. Triggers outside an acquisition are
+// ignored, as on the camera.
+//
+// Writes need the control channel privilege, which is lost with the
+// stream if no command arrives from the controlling application for the
+// heartbeat timeout. Loss and reordering set on the sender apply to the
+// stream and to resent packets.
+//
+// *****************************************************************************
+
+
+#ifndef __EMULATOR_H__
+#define __EMULATOR_H__
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <netinet/in.h>
+
+#include "gvcp.h"
+#include "gvspsender.h"
+
+#define DEFAULT_EMULATOR_WIDTH 2048
+#define DEFAULT_EMULATOR_HEIGHT 1536
+#define DEFAULT_EMULATOR_FPS 30.0
+#define DEFAULT_HEARTBEAT_TIMEOUT 3000      // (ms)
+#define EMULATOR_TICK_FREQUENCY 1000000000  // Timestamp ticks per second
+#define EMULATOR_XML_ADDRESS 0x20000
+
+// Device registers behind the GenICam features (genicam.h)
+#define EMU_REG_BASE 0x10000
+#define EMU_REG_WIDTH 0x10000
+#define EMU_REG_HEIGHT 0x10004
+#define EMU_REG_WIDTH_MAX 0x10008
+#define EMU_REG_HEIGHT_MAX 0x1000C
+#define EMU_REG_PIXEL_FORMAT 0x10010
+#define EMU_REG_PAYLOAD_SIZE 0x10014
+#define EMU_REG_BINNING_H 0x10018
+#define EMU_REG_BINNING_V 0x1001C
+#define EMU_REG_ACQ_MODE 0x10020        // 0 Continuous, 1 SingleFrame, 2 MultiFrame
+#define EMU_REG_ACQ_FRAME_COUNT 0x10024
+#define EMU_REG_ACQ_START 0x10028
+#define EMU_REG_ACQ_STOP 0x1002C
+#define EMU_REG_ACQ_FRAME_RATE 0x10030     // float
+#define EMU_REG_TRIGGER_MODE 0x10034    // 0 Off, 1 On
+#define EMU_REG_TRIGGER_SOURCE 0x10038  // 0 Software, 1 Line5
+#define EMU_REG_TRIGGER_SOFTWARE 0x1003C
+#define EMU_REG_EXPOSURE 0x10040        // float (us)
+#define EMU_REG_GAIN 0x10044            // float
+#define EMU_REG_TL_LOCKED 0x10048
+#define EMU_REG_END 0x10100
+
+enum EmulatorAcquisitionMode
+{
+    EMU_CONTINUOUS = 0,
+    EMU_SINGLE_FRAME = 1,
+    EMU_MULTI_FRAME = 2
+};
+
+struct EmulatorOptions
+{
+    std::string ip = "127.0.0.1";   // Reported in discovery, the address the host reaches
+    uint16_t port = GVCP_PORT;
+    uint32_t width = DEFAULT_EMULATOR_WIDTH;
+    uint32_t height = DEFAULT_EMULATOR_HEIGHT;
+    uint32_t pixel_format = GVSP_PIX_MONO8;
+    double fps = DEFAULT_EMULATOR_FPS;
+    double line_rate = 0.0;         // (Hz) Line5 pulses, 0 for none
+    double loss = 0.0;
+    double reorder = 0.0;
+    uint32_t seed = 1;
+    std::string model = "PAM Emulator";
+    std::string serial = "EMU0001";
+};
+
+struct EmulatorStats
+{
+    uint64_t commands = 0;
+    uint64_t discoveries = 0;
+    uint64_t triggers = 0;
+    uint64_t ignored_triggers = 0;  // Arrived outside an acquisition
+    uint64_t late_frames = 0;       // Frame times missed, the sender was behind
+    uint64_t acquisitions = 0;
+    uint64_t heartbeat_expired = 0;
+    GvspSenderStats stream;
+};
+
+class GigeEmulator
+{
+    public:
+        GigeEmulator(const EmulatorOptions& _options);
+        ~GigeEmulator();
+
+        bool start();
+        void stop();
+        EmulatorStats getStats();
+
+    private:
+        void runControl();
+        void runAcquisition();
+        void handleCommand(const uint8_t* p, size_t n, const struct sockaddr_in& from);
+        size_t discoveryAck(uint8_t* out, uint16_t req_id);
+        uint16_t readReg(uint32_t address, uint32_t& value);
+        uint16_t writeReg(uint32_t address, uint32_t value, const struct sockaddr_in& from);
+        const uint8_t* memory(uint32_t address, size_t n);
+        bool hasControl(const struct sockaddr_in& from);
+        void checkHeartbeat(int64_t t);
+
+        void startAcquisition();
+        void stopAcquisition();
+        void trigger();
+        void sendFrame(std::unique_lock<std::mutex>& lock, int64_t t);
+        void render();
+
+        uint32_t reg(uint32_t address);
+        void setReg(uint32_t address, uint32_t value);
+        float regFloat(uint32_t address);
+        void updatePayload();
+
+        static int64_t now();
+
+    private:
+        EmulatorOptions options;
+        int fd;
+        int wake_fd;
+        int64_t start_ns;
+
+        std::vector<uint8_t> bootstrap;     // 0x0000 - 0x0FFF
+        std::vector<uint8_t> device;        // EMU_REG_BASE - EMU_REG_END
+        std::string xml;
+
+        struct sockaddr_in controller;      // Holds the privilege if ccp is set
+        uint32_t ccp;
+        int64_t last_heartbeat;
+
+        GvspSender sender;
+        bool acquiring;
+        uint32_t frames_left;
+        unsigned int pending_triggers;
+        int64_t next_frame;
+        int64_t next_line;
+        std::vector<uint8_t> image;
+        std::vector<uint8_t> base;          // Image before the moving bar, for the current settings
+        bool dirty;                         // Geometry, format, exposure or gain changed
+        uint64_t frame_index;
+
+        std::thread control;
+        std::thread acquisition;
+        std::atomic<bool> running;
+        std::mutex mtx;                     // Registers, acquisition state and stats
+        std::condition_variable cv;
+        EmulatorStats stats;
+};
+
+
+#endif // __EMULATOR_H__
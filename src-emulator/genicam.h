@@ -0,0 +1,537 @@
+// *****************************************************************************
+//
+// genicam.h
+// GenICam description of the emulator, read by the host from
+// EMULATOR_XML_ADDRESS (the first URL register points at it). It has the
+// standard GigE Vision transport features and the camera features the
+// receiver sets, on the device registers in emulator.h.
+//
+// *****************************************************************************
+
+
+#ifndef __GENICAM_H__
+#define __GENICAM_H__
+
+static const char GENICAM_XML[] = R"XML(<?xml version="1.0" encoding="utf-8"?>
+<RegisterDescription ModelName="PAM_Emulator" VendorName="PAM" ToolTip="Emulated GigE Vision camera"
+    StandardNameSpace="GEV" SchemaMajorVersion="1" SchemaMinorVersion="1" SchemaSubMinorVersion="0"
+    MajorVersion="1" MinorVersion="0" SubMinorVersion="0"
+    ProductGuid="5B3C9E2A-7C41-4D8E-9A61-0F2E4B6D8C10" VersionGuid="8D1F6A3B-2E59-4C70-B8A4-3C7D9E1F5A22"
+    xmlns="http://www.genicam.org/GenApi/Version_1_1"
+    xmlns:xsi="http://www.w3.org/2001/XMLSchema-instance"
+    xsi:schemaLocation="http://www.genicam.org/GenApi/Version_1_1 http://www.genicam.org/GenApi/GenApiSchema_Version_1_1.xsd">
+
+  <Category Name="Root" NameSpace="Standard">
+    <pFeature>DeviceControl</pFeature>
+    <pFeature>ImageFormatControl</pFeature>
+    <pFeature>AcquisitionControl</pFeature>
+    <pFeature>AnalogControl</pFeature>
+    <pFeature>TransportLayerControl</pFeature>
+  </Category>
+
+  <Category Name="DeviceControl" NameSpace="Standard">
+    <pFeature>DeviceVendorName</pFeature>
+    <pFeature>DeviceModelName</pFeature>
+    <pFeature>DeviceVersion</pFeature>
+    <pFeature>DeviceID</pFeature>
+    <pFeature>DeviceUserID</pFeature>
+  </Category>
+
+  <Category Name="ImageFormatControl" NameSpace="Standard">
+    <pFeature>Width</pFeature>
+    <pFeature>Height</pFeature>
+    <pFeature>WidthMax</pFeature>
+    <pFeature>HeightMax</pFeature>
+    <pFeature>PixelFormat</pFeature>
+    <pFeature>BinningHorizontal</pFeature>
+    <pFeature>BinningVertical</pFeature>
+  </Category>
+
+  <Category Name="AcquisitionControl" NameSpace="Standard">
+    <pFeature>AcquisitionMode</pFeature>
+    <pFeature>AcquisitionStart</pFeature>
+    <pFeature>AcquisitionStop</pFeature>
+    <pFeature>AcquisitionFrameCount</pFeature>
+    <pFeature>AcquisitionFrameRate</pFeature>
+    <pFeature>TriggerMode</pFeature>
+    <pFeature>TriggerSource</pFeature>
+    <pFeature>TriggerSoftware</pFeature>
+    <pFeature>ExposureTime</pFeature>
+  </Category>
+
+  <Category Name="AnalogControl" NameSpace="Standard">
+    <pFeature>Gain</pFeature>
+  </Category>
+
+  <Category Name="TransportLayerControl" NameSpace="Standard">
+    <pFeature>PayloadSize</pFeature>
+    <pFeature>TLParamsLocked</pFeature>
+    <pFeature>GevCurrentIPAddress</pFeature>
+    <pFeature>GevCurrentSubnetMask</pFeature>
+    <pFeature>GevMACAddress</pFeature>
+    <pFeature>GevCCP</pFeature>
+    <pFeature>GevHeartbeatTimeout</pFeature>
+    <pFeature>GevTimestampTickFrequency</pFeature>
+    <pFeature>GevTimestampControlLatch</pFeature>
+    <pFeature>GevTimestampControlReset</pFeature>
+    <pFeature>GevTimestampValue</pFeature>
+    <pFeature>GevSCPHostPort</pFeature>
+    <pFeature>GevSCPSPacketSize</pFeature>
+    <pFeature>GevSCPD</pFeature>
+    <pFeature>GevSCDA</pFeature>
+  </Category>
+
+  <!-- Device control -->
+
+  <StringReg Name="DeviceVendorName" NameSpace="Standard">
+    <Address>0x0048</Address>
+    <Length>32</Length>
+    <AccessMode>RO</AccessMode>
+    <pPort>Device</pPort>
+  </StringReg>
+
+  <StringReg Name="DeviceModelName" NameSpace="Standard">
+    <Address>0x0068</Address>
+    <Length>32</Length>
+    <AccessMode>RO</AccessMode>
+    <pPort>Device</pPort>
+  </StringReg>
+
+  <StringReg Name="DeviceVersion" NameSpace="Standard">
+    <Address>0x0088</Address>
+    <Length>32</Length>
+    <AccessMode>RO</AccessMode>
+    <pPort>Device</pPort>
+  </StringReg>
+
+  <StringReg Name="DeviceID" NameSpace="Standard">
+    <Address>0x00D8</Address>
+    <Length>16</Length>
+    <AccessMode>RO</AccessMode>
+    <pPort>Device</pPort>
+  </StringReg>
+
+  <StringReg Name="DeviceUserID" NameSpace="Standard">
+    <Address>0x00E8</Address>
+    <Length>16</Length>
+    <AccessMode>RW</AccessMode>
+    <pPort>Device</pPort>
+  </StringReg>
+
+  <!-- Image format -->
+
+  <Integer Name="Width" NameSpace="Standard">
+    <pValue>WidthReg</pValue>
+    <Min>16</Min>
+    <pMax>WidthMax</pMax>
+    <Inc>16</Inc>
+  </Integer>
+  <IntReg Name="WidthReg">
+    <Address>0x10000</Address>
+    <Length>4</Length>
+    <AccessMode>RW</AccessMode>
+    <pPort>Device</pPort>
+    <Sign>Unsigned</Sign>
+    <Endianess>BigEndian</Endianess>
+  </IntReg>
+
+  <Integer Name="Height" NameSpace="Standard">
+    <pValue>HeightReg</pValue>
+    <Min>16</Min>
+    <pMax>HeightMax</pMax>
+    <Inc>2</Inc>
+  </Integer>
+  <IntReg Name="HeightReg">
+    <Address>0x10004</Address>
+    <Length>4</Length>
+    <AccessMode>RW</AccessMode>
+    <pPort>Device</pPort>
+    <Sign>Unsigned</Sign>
+    <Endianess>BigEndian</Endianess>
+  </IntReg>
+
+  <IntReg Name="WidthMax" NameSpace="Standard">
+    <Address>0x10008</Address>
+    <Length>4</Length>
+    <AccessMode>RO</AccessMode>
+    <pPort>Device</pPort>
+    <Sign>Unsigned</Sign>
+    <Endianess>BigEndian</Endianess>
+  </IntReg>
+
+  <IntReg Name="HeightMax" NameSpace="Standard">
+    <Address>0x1000C</Address>
+    <Length>4</Length>
+    <AccessMode>RO</AccessMode>
+    <pPort>Device</pPort>
+    <Sign>Unsigned</Sign>
+    <Endianess>BigEndian</Endianess>
+  </IntReg>
+
+  <Enumeration Name="PixelFormat" NameSpace="Standard">
+    <EnumEntry Name="Mono8" NameSpace="Standard">
+      <Value>0x01080001</Value>
+    </EnumEntry>
+    <EnumEntry Name="Mono12" NameSpace="Standard">
+      <Value>0x01100005</Value>
+    </EnumEntry>
+    <pValue>PixelFormatReg</pValue>
+  </Enumeration>
+  <IntReg Name="PixelFormatReg">
+    <Address>0x10010</Address>
+    <Length>4</Length>
+    <AccessMode>RW</AccessMode>
+    <pPort>Device</pPort>
+    <Sign>Unsigned</Sign>
+    <Endianess>BigEndian</Endianess>
+  </IntReg>
+
+  <Integer Name="BinningHorizontal" NameSpace="Standard">
+    <pValue>BinningHorizontalReg</pValue>
+    <Min>1</Min>
+    <Max>2</Max>
+  </Integer>
+  <IntReg Name="BinningHorizontalReg">
+    <Address>0x10018</Address>
+    <Length>4</Length>
+    <AccessMode>RW</AccessMode>
+    <pPort>Device</pPort>
+    <Sign>Unsigned</Sign>
+    <Endianess>BigEndian</Endianess>
+  </IntReg>
+
+  <Integer Name="BinningVertical" NameSpace="Standard">
+    <pValue>BinningVerticalReg</pValue>
+    <Min>1</Min>
+    <Max>2</Max>
+  </Integer>
+  <IntReg Name="BinningVerticalReg">
+    <Address>0x1001C</Address>
+    <Length>4</Length>
+    <AccessMode>RW</AccessMode>
+    <pPort>Device</pPort>
+    <Sign>Unsigned</Sign>
+    <Endianess>BigEndian</Endianess>
+  </IntReg>
+
+  <!-- Acquisition -->
+
+  <Enumeration Name="AcquisitionMode" NameSpace="Standard">
+    <EnumEntry Name="Continuous" NameSpace="Standard">
+      <Value>0</Value>
+    </EnumEntry>
+    <EnumEntry Name="SingleFrame" NameSpace="Standard">
+      <Value>1</Value>
+    </EnumEntry>
+    <EnumEntry Name="MultiFrame" NameSpace="Standard">
+      <Value>2</Value>
+    </EnumEntry>
+    <pValue>AcquisitionModeReg</pValue>
+  </Enumeration>
+  <IntReg Name="AcquisitionModeReg">
+    <Address>0x10020</Address>
+    <Length>4</Length>
+    <AccessMode>RW</AccessMode>
+    <pPort>Device</pPort>
+    <Sign>Unsigned</Sign>
+    <Endianess>BigEndian</Endianess>
+  </IntReg>
+
+  <Integer Name="AcquisitionFrameCount" NameSpace="Standard">
+    <pValue>AcquisitionFrameCountReg</pValue>
+    <Min>1</Min>
+    <Max>65535</Max>
+  </Integer>
+  <IntReg Name="AcquisitionFrameCountReg">
+    <Address>0x10024</Address>
+    <Length>4</Length>
+    <AccessMode>RW</AccessMode>
+    <pPort>Device</pPort>
+    <Sign>Unsigned</Sign>
+    <Endianess>BigEndian</Endianess>
+  </IntReg>
+
+  <Command Name="AcquisitionStart" NameSpace="Standard">
+    <pValue>AcquisitionStartReg</pValue>
+    <CommandValue>1</CommandValue>
+  </Command>
+  <IntReg Name="AcquisitionStartReg">
+    <Address>0x10028</Address>
+    <Length>4</Length>
+    <AccessMode>WO</AccessMode>
+    <pPort>Device</pPort>
+    <Sign>Unsigned</Sign>
+    <Endianess>BigEndian</Endianess>
+  </IntReg>
+
+  <Command Name="AcquisitionStop" NameSpace="Standard">
+    <pValue>AcquisitionStopReg</pValue>
+    <CommandValue>1</CommandValue>
+  </Command>
+  <IntReg Name="AcquisitionStopReg">
+    <Address>0x1002C</Address>
+    <Length>4</Length>
+    <AccessMode>WO</AccessMode>
+    <pPort>Device</pPort>
+    <Sign>Unsigned</Sign>
+    <Endianess>BigEndian</Endianess>
+  </IntReg>
+
+  <Float Name="AcquisitionFrameRate" NameSpace="Standard">
+    <pValue>AcquisitionFrameRateReg</pValue>
+    <Min>0.1</Min>
+    <Max>1000.0</Max>
+    <Unit>Hz</Unit>
+  </Float>
+  <FloatReg Name="AcquisitionFrameRateReg">
+    <Address>0x10030</Address>
+    <Length>4</Length>
+    <AccessMode>RW</AccessMode>
+    <pPort>Device</pPort>
+    <Endianess>BigEndian</Endianess>
+  </FloatReg>
+
+  <Enumeration Name="TriggerMode" NameSpace="Standard">
+    <EnumEntry Name="Off" NameSpace="Standard">
+      <Value>0</Value>
+    </EnumEntry>
+    <EnumEntry Name="On" NameSpace="Standard">
+      <Value>1</Value>
+    </EnumEntry>
+    <pValue>TriggerModeReg</pValue>
+  </Enumeration>
+  <IntReg Name="TriggerModeReg">
+    <Address>0x10034</Address>
+    <Length>4</Length>
+    <AccessMode>RW</AccessMode>
+    <pPort>Device</pPort>
+    <Sign>Unsigned</Sign>
+    <Endianess>BigEndian</Endianess>
+  </IntReg>
+
+  <Enumeration Name="TriggerSource" NameSpace="Standard">
+    <EnumEntry Name="Software" NameSpace="Standard">
+      <Value>0</Value>
+    </EnumEntry>
+    <EnumEntry Name="Line5" NameSpace="Standard">
+      <Value>1</Value>
+    </EnumEntry>
+    <pValue>TriggerSourceReg</pValue>
+  </Enumeration>
+  <IntReg Name="TriggerSourceReg">
+    <Address>0x10038</Address>
+    <Length>4</Length>
+    <AccessMode>RW</AccessMode>
+    <pPort>Device</pPort>
+    <Sign>Unsigned</Sign>
+    <Endianess>BigEndian</Endianess>
+  </IntReg>
+
+  <Command Name="TriggerSoftware" NameSpace="Standard">
+    <pValue>TriggerSoftwareReg</pValue>
+    <CommandValue>1</CommandValue>
+  </Command>
+  <IntReg Name="TriggerSoftwareReg">
+    <Address>0x1003C</Address>
+    <Length>4</Length>
+    <AccessMode>WO</AccessMode>
+    <pPort>Device</pPort>
+    <Sign>Unsigned</Sign>
+    <Endianess>BigEndian</Endianess>
+  </IntReg>
+
+  <Float Name="ExposureTime" NameSpace="Standard">
+    <pValue>ExposureTimeReg</pValue>
+    <Min>10.0</Min>
+    <Max>1000000.0</Max>
+    <Unit>us</Unit>
+  </Float>
+  <FloatReg Name="ExposureTimeReg">
+    <Address>0x10040</Address>
+    <Length>4</Length>
+    <AccessMode>RW</AccessMode>
+    <pPort>Device</pPort>
+    <Endianess>BigEndian</Endianess>
+  </FloatReg>
+
+  <Float Name="Gain" NameSpace="Standard">
+    <pValue>GainReg</pValue>
+    <Min>1.0</Min>
+    <Max>16.0</Max>
+  </Float>
+  <FloatReg Name="GainReg">
+    <Address>0x10044</Address>
+    <Length>4</Length>
+    <AccessMode>RW</AccessMode>
+    <pPort>Device</pPort>
+    <Endianess>BigEndian</Endianess>
+  </FloatReg>
+
+  <!-- Transport layer -->
+
+  <IntReg Name="PayloadSize" NameSpace="Standard">
+    <Address>0x10014</Address>
+    <Length>4</Length>
+    <AccessMode>RO</AccessMode>
+    <pPort>Device</pPort>
+    <Cachable>NoCache</Cachable>
+    <Sign>Unsigned</Sign>
+    <Endianess>BigEndian</Endianess>
+  </IntReg>
+
+  <Integer Name="TLParamsLocked" NameSpace="Standard">
+    <pValue>TLParamsLockedReg</pValue>
+    <Min>0</Min>
+    <Max>1</Max>
+  </Integer>
+  <IntReg Name="TLParamsLockedReg">
+    <Address>0x10048</Address>
+    <Length>4</Length>
+    <AccessMode>RW</AccessMode>
+    <pPort>Device</pPort>
+    <Sign>Unsigned</Sign>
+    <Endianess>BigEndian</Endianess>
+  </IntReg>
+
+  <IntReg Name="GevCurrentIPAddress" NameSpace="Standard">
+    <Address>0x0024</Address>
+    <Length>4</Length>
+    <AccessMode>RO</AccessMode>
+    <pPort>Device</pPort>
+    <Sign>Unsigned</Sign>
+    <Endianess>BigEndian</Endianess>
+  </IntReg>
+
+  <IntReg Name="GevCurrentSubnetMask" NameSpace="Standard">
+    <Address>0x0034</Address>
+    <Length>4</Length>
+    <AccessMode>RO</AccessMode>
+    <pPort>Device</pPort>
+    <Sign>Unsigned</Sign>
+    <Endianess>BigEndian</Endianess>
+  </IntReg>
+
+  <IntReg Name="GevMACAddress" NameSpace="Standard">
+    <Address>0x0008</Address>
+    <Length>8</Length>
+    <AccessMode>RO</AccessMode>
+    <pPort>Device</pPort>
+    <Sign>Unsigned</Sign>
+    <Endianess>BigEndian</Endianess>
+  </IntReg>
+
+  <Enumeration Name="GevCCP" NameSpace="Standard">
+    <EnumEntry Name="OpenAccess" NameSpace="Standard">
+      <Value>0</Value>
+    </EnumEntry>
+    <EnumEntry Name="ExclusiveAccess" NameSpace="Standard">
+      <Value>1</Value>
+    </EnumEntry>
+    <EnumEntry Name="ControlAccess" NameSpace="Standard">
+      <Value>2</Value>
+    </EnumEntry>
+    <pValue>GevCCPReg</pValue>
+  </Enumeration>
+  <MaskedIntReg Name="GevCCPReg">
+    <Address>0x0A00</Address>
+    <Length>4</Length>
+    <AccessMode>RW</AccessMode>
+    <pPort>Device</pPort>
+    <LSB>31</LSB>
+    <MSB>30</MSB>
+    <Sign>Unsigned</Sign>
+    <Endianess>BigEndian</Endianess>
+  </MaskedIntReg>
+
+  <IntReg Name="GevHeartbeatTimeout" NameSpace="Standard">
+    <Address>0x0938</Address>
+    <Length>4</Length>
+    <AccessMode>RW</AccessMode>
+    <pPort>Device</pPort>
+    <Sign>Unsigned</Sign>
+    <Endianess>BigEndian</Endianess>
+  </IntReg>
+
+  <IntReg Name="GevTimestampTickFrequency" NameSpace="Standard">
+    <Address>0x093C</Address>
+    <Length>8</Length>
+    <AccessMode>RO</AccessMode>
+    <pPort>Device</pPort>
+    <Sign>Unsigned</Sign>
+    <Endianess>BigEndian</Endianess>
+  </IntReg>
+
+  <Command Name="GevTimestampControlLatch" NameSpace="Standard">
+    <pValue>GevTimestampControlReg</pValue>
+    <CommandValue>2</CommandValue>
+  </Command>
+  <Command Name="GevTimestampControlReset" NameSpace="Standard">
+    <pValue>GevTimestampControlReg</pValue>
+    <CommandValue>1</CommandValue>
+  </Command>
+  <IntReg Name="GevTimestampControlReg">
+    <Address>0x0944</Address>
+    <Length>4</Length>
+    <AccessMode>WO</AccessMode>
+    <pPort>Device</pPort>
+    <Sign>Unsigned</Sign>
+    <Endianess>BigEndian</Endianess>
+  </IntReg>
+
+  <IntReg Name="GevTimestampValue" NameSpace="Standard">
+    <Address>0x0948</Address>
+    <Length>8</Length>
+    <AccessMode>RO</AccessMode>
+    <pPort>Device</pPort>
+    <Cachable>NoCache</Cachable>
+    <Sign>Unsigned</Sign>
+    <Endianess>BigEndian</Endianess>
+  </IntReg>
+
+  <MaskedIntReg Name="GevSCPHostPort" NameSpace="Standard">
+    <Address>0x0D00</Address>
+    <Length>4</Length>
+    <AccessMode>RW</AccessMode>
+    <pPort>Device</pPort>
+    <LSB>31</LSB>
+    <MSB>16</MSB>
+    <Sign>Unsigned</Sign>
+    <Endianess>BigEndian</Endianess>
+  </MaskedIntReg>
+
+  <MaskedIntReg Name="GevSCPSPacketSize" NameSpace="Standard">
+    <Address>0x0D04</Address>
+    <Length>4</Length>
+    <AccessMode>RW</AccessMode>
+    <pPort>Device</pPort>
+    <LSB>31</LSB>
+    <MSB>16</MSB>
+    <Sign>Unsigned</Sign>
+    <Endianess>BigEndian</Endianess>
+  </MaskedIntReg>
+
+  <IntReg Name="GevSCPD" NameSpace="Standard">
+    <Address>0x0D08</Address>
+    <Length>4</Length>
+    <AccessMode>RW</AccessMode>
+    <pPort>Device</pPort>
+    <Sign>Unsigned</Sign>
+    <Endianess>BigEndian</Endianess>
+  </IntReg>
+
+  <IntReg Name="GevSCDA" NameSpace="Standard">
+    <Address>0x0D18</Address>
+    <Length>4</Length>
+    <AccessMode>RW</AccessMode>
+    <pPort>Device</pPort>
+    <Sign>Unsigned</Sign>
+    <Endianess>BigEndian</Endianess>
+  </IntReg>
+
+  <Port Name="Device" NameSpace="Standard">
+  </Port>
+
+</RegisterDescription>
+)XML";
+
+#endif // __GENICAM_H__
@@ -0,0 +1,112 @@
+// *****************************************************************************
+//
+// gvcp.h
+// GigE Vision control protocol (GVCP) commands, acknowledges and bootstrap
+// registers used by the emulator and its load test client. The command
+// header and PACKETRESEND_CMD are in src/gvsp.h.
+//
+// An acknowledge starts with
+//
+//     status (16) | answer (16) | payload length (16) | ack id (16)
+//
+// where the ack id is the request id of the command. All fields are big
+// endian, and register addresses and values are 32 bit.
+//
+// *****************************************************************************
+
+
+#ifndef __GVCP_H__
+#define __GVCP_H__
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include "gvsp.h"
+
+#define GVCP_DISCOVERY_CMD 0x0002
+#define GVCP_DISCOVERY_ACK 0x0003
+#define GVCP_READREG_CMD 0x0080
+#define GVCP_READREG_ACK 0x0081
+#define GVCP_WRITEREG_CMD 0x0082
+#define GVCP_WRITEREG_ACK 0x0083
+#define GVCP_READMEM_CMD 0x0084
+#define GVCP_READMEM_ACK 0x0085
+#define GVCP_WRITEMEM_CMD 0x0086
+#define GVCP_WRITEMEM_ACK 0x0087
+
+#define GVCP_DISCOVERY_SIZE 248     // Discovery acknowledge payload
+#define GVCP_MAX_PAYLOAD 540        // Largest command or acknowledge payload
+#define GVCP_MAX_READMEM 536        // Bytes per READMEM
+
+#define GEV_STATUS_SUCCESS 0x0000
+#define GEV_STATUS_NOT_IMPLEMENTED 0x8001
+#define GEV_STATUS_INVALID_PARAMETER 0x8002
+#define GEV_STATUS_INVALID_ADDRESS 0x8003
+#define GEV_STATUS_WRITE_PROTECT 0x8004
+#define GEV_STATUS_ACCESS_DENIED 0x8006
+
+// Bootstrap registers
+#define GEV_REG_VERSION 0x0000
+#define GEV_REG_DEVICE_MODE 0x0004
+#define GEV_REG_MAC_HIGH 0x0008
+#define GEV_REG_MAC_LOW 0x000C
+#define GEV_REG_IP_CONFIG_OPTIONS 0x0010
+#define GEV_REG_IP_CONFIG_CURRENT 0x0014
+#define GEV_REG_CURRENT_IP 0x0024
+#define GEV_REG_SUBNET_MASK 0x0034
+#define GEV_REG_GATEWAY 0x0044
+#define GEV_REG_MANUFACTURER 0x0048     // 32 byte strings from here
+#define GEV_REG_MODEL 0x0068
+#define GEV_REG_DEVICE_VERSION 0x0088
+#define GEV_REG_MANUFACTURER_INFO 0x00A8    // 48 bytes
+#define GEV_REG_SERIAL 0x00D8           // 16 bytes
+#define GEV_REG_USER_NAME 0x00E8        // 16 bytes
+#define GEV_REG_FIRST_URL 0x0200        // 512 bytes
+#define GEV_REG_SECOND_URL 0x0400
+#define GEV_REG_INTERFACES 0x0600
+#define GEV_REG_MESSAGE_CHANNELS 0x0900
+#define GEV_REG_STREAM_CHANNELS 0x0904
+#define GEV_REG_GVCP_CAPABILITY 0x0934
+#define GEV_REG_HEARTBEAT_TIMEOUT 0x0938    // (ms)
+#define GEV_REG_TICK_FREQUENCY_HIGH 0x093C
+#define GEV_REG_TICK_FREQUENCY_LOW 0x0940
+#define GEV_REG_TIMESTAMP_CONTROL 0x0944    // 1 resets, 2 latches
+#define GEV_REG_TIMESTAMP_HIGH 0x0948
+#define GEV_REG_TIMESTAMP_LOW 0x094C
+#define GEV_REG_CCP 0x0A00              // Control channel privilege
+#define GEV_REG_SCP0 0x0D00             // Stream channel host port, low 16 bits
+#define GEV_REG_SCPS0 0x0D04            // Stream channel packet size, low 16 bits
+#define GEV_REG_SCPD0 0x0D08            // Stream channel packet delay
+#define GEV_REG_SCDA0 0x0D18            // Stream channel destination address
+
+#define GEV_CCP_EXCLUSIVE 0x00000001
+#define GEV_CCP_CONTROL 0x00000002
+
+namespace Gvcp
+{
+    // Returns the header length
+    inline size_t writeAck(uint8_t* p, uint16_t status, uint16_t answer, uint16_t length, uint16_t ack_id)
+    {
+        Gvsp::put16(p, status);
+        Gvsp::put16(p + 2, answer);
+        Gvsp::put16(p + 4, length);
+        Gvsp::put16(p + 6, ack_id);
+        return GVCP_HEADER_SIZE;
+    }
+
+    // Fixed width, zero padded string fields
+    inline void putString(uint8_t* p, const std::string& s, size_t width)
+    {
+        memset(p, 0, width);
+        memcpy(p, s.data(), std::min(s.size(), width - 1));
+    }
+
+    inline std::string getString(const uint8_t* p, size_t width)
+    {
+        return std::string(reinterpret_cast<const char*>(p), strnlen(reinterpret_cast<const char*>(p), width));
+    }
+}
+
+#endif // __GVCP_H__
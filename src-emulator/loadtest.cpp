@@ -0,0 +1,406 @@
+// *****************************************************************************
+//
+// loadtest.cpp
+// Drives a GigE Vision device (normally pam-emulator) over GVCP and takes
+// its stream with GvspReceiver. It discovers the device, takes control,
+// reads the GenICam description, points the stream channel at itself, then
+//
+//   1. streams Continuous at --fps for --seconds,
+//   2. runs MultiFrame with software triggers, sending two triggers more
+//      than the frame count, which the device has to ignore.
+//
+// For each phase it prints the packet and byte rates, frame completeness,
+// resends and kernel drops. Loss and reordering are set on the emulator.
+//
+// ./build/loadtest [--device IP] [--port N] [--host IP] [--seconds S] [--fps F]
+//                  [--packet-size N] [--frames N] [--resend 0|1]
+//
+// *****************************************************************************
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "emulator.h"
+#include "gvcp.h"
+#include "gvspreceiver.h"
+#include "framestats.h"
+
+#define GVCP_TIMEOUT 200        // (ms) per try
+#define GVCP_RETRIES 3
+#define HEARTBEAT_PERIOD 1000   // (ms)
+
+struct Options
+{
+    std::string device = "127.0.0.1";
+    uint16_t port = GVCP_PORT;
+    std::string host = "127.0.0.1";
+    double seconds = 5.0;
+    double fps = DEFAULT_EMULATOR_FPS;
+    uint32_t packet_size = DEFAULT_GVSP_PACKET_SIZE;
+    uint32_t frames = 20;
+    bool resend = true;
+};
+
+// Commands one at a time, retried on timeout
+class GvcpClient
+{
+    public:
+        bool open(const std::string& ip, uint16_t port)
+        {
+            fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+            int one = 1;
+            setsockopt(fd, SOL_SOCKET, SO_BROADCAST, &one, sizeof(one));
+            device.sin_family = AF_INET;
+            device.sin_port = htons(port);
+            return fd >= 0 && inet_pton(AF_INET, ip.c_str(), &device.sin_addr) == 1;
+        }
+
+        ~GvcpClient()
+        {
+            if (fd >= 0)
+            {
+                close(fd);
+            }
+        }
+
+        // Returns the acknowledge payload size, -1 on timeout
+        int command(uint16_t cmd, const uint8_t* payload, uint16_t length, uint8_t* reply, uint16_t& status)
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            req_id = (req_id == 0xffff) ? 1 : req_id + 1;
+            uint8_t out[GVCP_HEADER_SIZE + GVCP_MAX_PAYLOAD];
+            Gvsp::writeCommand(out, GVCP_FLAG_ACK, cmd, length, req_id);
+            if (length > 0)
+            {
+                memcpy(out + GVCP_HEADER_SIZE, payload, length);
+            }
+
+            for (int tries = 0; tries < GVCP_RETRIES; tries++)
+            {
+                sendto(fd, out, GVCP_HEADER_SIZE + length, 0, reinterpret_cast<struct sockaddr*>(&device), sizeof(device));
+                struct pollfd pfd = {fd, POLLIN, 0};
+                while (poll(&pfd, 1, GVCP_TIMEOUT) > 0)
+                {
+                    uint8_t in[GVCP_HEADER_SIZE + GVCP_MAX_PAYLOAD];
+                    ssize_t n = recv(fd, in, sizeof(in), 0);
+                    if (n >= GVCP_HEADER_SIZE && Gvsp::get16(in + 2) == cmd + 1 && Gvsp::get16(in + 6) == req_id)
+                    {
+                        status = Gvsp::get16(in);
+                        int size = std::min<int>(Gvsp::get16(in + 4), n - GVCP_HEADER_SIZE);
+                        memcpy(reply, in + GVCP_HEADER_SIZE, size);
+                        return size;
+                    }
+                }
+            }
+            return -1;
+        }
+
+        bool readReg(uint32_t address, uint32_t& value)
+        {
+            uint8_t a[4];
+            uint8_t reply[GVCP_MAX_PAYLOAD];
+            uint16_t status;
+            Gvsp::put32(a, address);
+            if (command(GVCP_READREG_CMD, a, 4, reply, status) != 4 || status != GEV_STATUS_SUCCESS)
+            {
+                return false;
+            }
+            value = Gvsp::get32(reply);
+            return true;
+        }
+
+        bool writeReg(uint32_t address, uint32_t value)
+        {
+            uint8_t a[8];
+            uint8_t reply[GVCP_MAX_PAYLOAD];
+            uint16_t status;
+            Gvsp::put32(a, address);
+            Gvsp::put32(a + 4, value);
+            return command(GVCP_WRITEREG_CMD, a, 8, reply, status) >= 0 && status == GEV_STATUS_SUCCESS;
+        }
+
+        bool writeFloat(uint32_t address, float value)
+        {
+            uint32_t bits;
+            memcpy(&bits, &value, 4);
+            return writeReg(address, bits);
+        }
+
+        bool readMem(uint32_t address, uint16_t count, uint8_t* out)
+        {
+            uint8_t a[8];
+            uint8_t reply[GVCP_MAX_PAYLOAD];
+            uint16_t status;
+            Gvsp::put32(a, address);
+            Gvsp::put16(a + 4, 0);
+            Gvsp::put16(a + 6, count);
+            if (command(GVCP_READMEM_CMD, a, 8, reply, status) != 4 + count || status != GEV_STATUS_SUCCESS)
+            {
+                return false;
+            }
+            memcpy(out, reply + 4, count);
+            return true;
+        }
+
+    private:
+        int fd = -1;
+        struct sockaddr_in device = {};
+        uint16_t req_id = 0;
+        std::mutex mtx;
+};
+
+static bool parseArgs(int argc, char* argv[], Options& opt)
+{
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        std::string arg = argv[i];
+        std::string val = argv[i + 1];
+        try
+        {
+            if (arg == "--device") opt.device = val;
+            else if (arg == "--port") opt.port = std::stoi(val);
+            else if (arg == "--host") opt.host = val;
+            else if (arg == "--seconds") opt.seconds = std::stod(val);
+            else if (arg == "--fps") opt.fps = std::stod(val);
+            else if (arg == "--packet-size") opt.packet_size = std::stoul(val);
+            else if (arg == "--frames") opt.frames = std::stoul(val);
+            else if (arg == "--resend") opt.resend = std::stoi(val) != 0;
+            else
+            {
+                std::cout << "Unknown option " << arg << std::endl;
+                return false;
+            }
+        }
+        catch (const std::exception&)
+        {
+            std::cout << "Bad value for " << arg << ": " << val << std::endl;
+            return false;
+        }
+    }
+    return argc % 2 == 1;
+}
+
+static bool discover(GvcpClient& gvcp)
+{
+    uint8_t reply[GVCP_MAX_PAYLOAD];
+    uint16_t status;
+    if (gvcp.command(GVCP_DISCOVERY_CMD, nullptr, 0, reply, status) != GVCP_DISCOVERY_SIZE)
+    {
+        return false;
+    }
+
+    struct in_addr ip;
+    ip.s_addr = htonl(Gvsp::get32(reply + GEV_REG_CURRENT_IP));
+    std::cout << "Found " << Gvcp::getString(reply + GEV_REG_MANUFACTURER, 32) << " " << Gvcp::getString(reply + GEV_REG_MODEL, 32)
+              << " (" << Gvcp::getString(reply + GEV_REG_SERIAL, 16) << ") at " << inet_ntoa(ip) << ", MAC " << std::hex << std::setfill('0');
+    for (int i = 0; i < 6; i++)
+    {
+        std::cout << (i ? ":" : "") << std::setw(2) << static_cast<int>(reply[GEV_REG_MAC_HIGH + 2 + i]);
+    }
+    std::cout << std::dec << std::setfill(' ') << std::endl;
+    return true;
+}
+
+// The description URL is "Local:name;address;length" in hex
+static bool readDescription(GvcpClient& gvcp, size_t& size)
+{
+    uint8_t url[512];
+    for (uint16_t i = 0; i < sizeof(url); i += 256)
+    {
+        if (!gvcp.readMem(GEV_REG_FIRST_URL + i, 256, url + i))
+        {
+            return false;
+        }
+    }
+    std::string s = Gvcp::getString(url, sizeof(url));
+    size_t a = s.find(';');
+    size_t b = s.find(';', a + 1);
+    if (s.compare(0, 6, "Local:") != 0 || a == std::string::npos || b == std::string::npos)
+    {
+        return false;
+    }
+    uint32_t address = std::stoul(s.substr(a + 1, b - a - 1), nullptr, 16);
+    size_t length = std::stoul(s.substr(b + 1), nullptr, 16);
+
+    std::string xml;
+    uint8_t chunk[GVCP_MAX_READMEM];
+    for (size_t off = 0; off < length; off += GVCP_MAX_READMEM)
+    {
+        uint16_t n = static_cast<uint16_t>(std::min<size_t>(GVCP_MAX_READMEM, length - off));
+        if (!gvcp.readMem(address + off, n, chunk))
+        {
+            return false;
+        }
+        xml.append(reinterpret_cast<char*>(chunk), n);
+    }
+    size = xml.size();
+    std::cout << "Read " << s.substr(6, a - 6) << " (" << size << " bytes)" << std::endl;
+    return xml.find("<RegisterDescription") != std::string::npos;
+}
+
+struct Phase
+{
+    std::atomic<uint64_t> frames{0};
+    std::atomic<uint64_t> complete{0};
+    std::atomic<uint64_t> repeated{0};      // Frame index seen before
+    std::set<uint64_t> seen;
+    std::mutex mtx;
+};
+
+static void report(const char* name, Phase& phase, const GvspStats& a, const GvspStats& b, double seconds, FrameStatsRing& frame_stats)
+{
+    FrameStatsSummary s = frame_stats.summary(DEFAULT_FRAME_STATS);
+    uint64_t packets = b.packets - a.packets;
+    std::cout << std::fixed << std::setprecision(1) << std::setw(12) << name << "  "
+              << std::setw(7) << packets / seconds / 1e3 << " kpkt/s  " << std::setw(6) << (b.bytes - a.bytes) / seconds / 1e6 << " MB/s  "
+              << phase.frames << " frames, " << phase.complete << " complete, " << phase.repeated << " repeated  "
+              << "resends " << b.resend_requests - a.resend_requests << " (" << b.resend_packets - a.resend_packets << " packets, "
+              << b.resent_received - a.resent_received << " recovered)  kernel drops " << b.socket_drops - a.socket_drops << std::endl
+              << std::setw(12) << "" << "  " << s.describe() << ", reassembly " << s.reassembly_mean_us / 1e3 << " ms mean" << std::endl;
+    frame_stats.clear();
+}
+
+int main(int argc, char* argv[])
+{
+    Options opt;
+    if (!parseArgs(argc, argv, opt))
+    {
+        std::cout << "Usage: " << argv[0] << " [--device IP] [--port N] [--host IP] [--seconds S] [--fps F] "
+                  << "[--packet-size N] [--frames N] [--resend 0|1]" << std::endl;
+        return 1;
+    }
+
+    GvcpClient gvcp;
+    size_t xml_size = 0;
+    if (!gvcp.open(opt.device, opt.port) || !discover(gvcp))
+    {
+        std::cout << "No device at " << opt.device << ":" << opt.port << std::endl;
+        return 1;
+    }
+    if (!gvcp.writeReg(GEV_REG_CCP, GEV_CCP_CONTROL) || !readDescription(gvcp, xml_size))
+    {
+        std::cout << "Unable to take control or read the description" << std::endl;
+        return 1;
+    }
+
+    // Reads keep the control channel alive
+    std::atomic<bool> done(false);
+    std::thread heartbeat([&]()
+    {
+        while (!done)
+        {
+            uint32_t ccp;
+            gvcp.readReg(GEV_REG_CCP, ccp);
+            for (int i = 0; i < HEARTBEAT_PERIOD / 10 && !done; i++)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+        }
+    });
+
+    uint32_t payload = 0;
+    gvcp.readReg(EMU_REG_PAYLOAD_SIZE, payload);
+    GvspReceiver receiver;
+    struct in_addr host;
+    if (payload == 0 || !receiver.open(0, payload, DEFAULT_GVSP_BUFFERS, opt.packet_size) || inet_pton(AF_INET, opt.host.c_str(), &host) != 1)
+    {
+        done = true;
+        heartbeat.join();
+        return 1;
+    }
+    receiver.setDevice(opt.device, opt.port);
+    receiver.setResend(opt.resend);
+    FrameStatsRing frame_stats;
+    receiver.setFrameStats(&frame_stats);
+    gvcp.writeReg(GEV_REG_SCDA0, ntohl(host.s_addr));
+    gvcp.writeReg(GEV_REG_SCP0, receiver.getPort());
+    gvcp.writeReg(GEV_REG_SCPS0, opt.packet_size);
+    std::cout << "Streaming to " << opt.host << ":" << receiver.getPort() << ", " << payload << " byte frames, "
+              << opt.packet_size << " byte packets, socket buffer " << (receiver.getSocketBuffer() >> 20) << " MB" << std::endl;
+
+    std::atomic<Phase*> phase(nullptr);
+    receiver.start([&](GvspFrame* f)
+    {
+        Phase* p = phase;
+        if (p != nullptr)
+        {
+            p->frames++;
+            if (f->stats.complete)
+            {
+                p->complete++;
+                uint64_t index = 0;
+                memcpy(&index, f->data.data(), 8);
+                std::lock_guard<std::mutex> lock(p->mtx);
+                p->repeated += !p->seen.insert(index).second;
+            }
+        }
+        receiver.release(f);
+    });
+
+    bool ok = true;
+
+    // 1. Free running
+    Phase continuous;
+    phase = &continuous;
+    GvspStats a = receiver.getStats();
+    gvcp.writeReg(EMU_REG_TRIGGER_MODE, 0);
+    gvcp.writeReg(EMU_REG_ACQ_MODE, EMU_CONTINUOUS);
+    gvcp.writeFloat(EMU_REG_ACQ_FRAME_RATE, static_cast<float>(opt.fps));
+    gvcp.writeReg(EMU_REG_TL_LOCKED, 1);
+    auto t0 = std::chrono::steady_clock::now();
+    gvcp.writeReg(EMU_REG_ACQ_START, 1);
+    std::this_thread::sleep_for(std::chrono::milliseconds(static_cast<int64_t>(opt.seconds * 1000)));
+    gvcp.writeReg(EMU_REG_ACQ_STOP, 1);
+    std::this_thread::sleep_for(std::chrono::milliseconds(DEFAULT_GVSP_FRAME_TIMEOUT * 2));
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    report("Continuous", continuous, a, receiver.getStats(), seconds, frame_stats);
+    ok = ok && continuous.repeated == 0 && continuous.frames > 0;
+
+    // 2. Triggered MultiFrame, the extra triggers come after it has ended
+    Phase multi;
+    phase = &multi;
+    a = receiver.getStats();
+    gvcp.writeReg(EMU_REG_TL_LOCKED, 0);
+    gvcp.writeReg(EMU_REG_ACQ_MODE, EMU_MULTI_FRAME);
+    gvcp.writeReg(EMU_REG_ACQ_FRAME_COUNT, opt.frames);
+    gvcp.writeReg(EMU_REG_TRIGGER_MODE, 1);
+    gvcp.writeReg(EMU_REG_TRIGGER_SOURCE, 0);
+    gvcp.writeReg(EMU_REG_TL_LOCKED, 1);
+    t0 = std::chrono::steady_clock::now();
+    gvcp.writeReg(EMU_REG_ACQ_START, 1);
+    for (uint32_t i = 0; i < opt.frames + 2; i++)
+    {
+        gvcp.writeReg(EMU_REG_TRIGGER_SOFTWARE, 1);
+        std::this_thread::sleep_for(std::chrono::microseconds(static_cast<int64_t>(1e6 / opt.fps)));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(DEFAULT_GVSP_FRAME_TIMEOUT * 2));
+    seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    report("MultiFrame", multi, a, receiver.getStats(), seconds, frame_stats);
+    bool exact = multi.frames == opt.frames;
+    if (!exact)
+    {
+        std::cout << "MultiFrame " << opt.frames << " gave " << multi.frames << " frames" << std::endl;
+    }
+    ok = ok && exact && multi.repeated == 0;
+
+    gvcp.writeReg(EMU_REG_TL_LOCKED, 0);
+    gvcp.writeReg(GEV_REG_CCP, 0);
+    done = true;
+    heartbeat.join();
+    receiver.stop();
+    phase = nullptr;
+
+    std::cout << (ok ? "ok" : "FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,146 @@
+// *****************************************************************************
+//
+// main.cpp
+// Runs the GigE Vision camera emulator until interrupted, printing the
+// stream rates once a second. See emulator.h, and loadtest.cpp for a client
+// that drives it with the in tree GVSP receiver.
+//
+// On a veth pair the host side finds it like the camera:
+//
+//     ip link add pam0 type veth peer name pam1
+//     ip addr add 192.168.50.1/24 dev pam0 && ip addr add 192.168.50.2/24 dev pam1
+//     ip link set pam0 up mtu 9000 && ip link set pam1 up mtu 9000
+//     ./build/pam-emulator --ip 192.168.50.2
+//
+// *****************************************************************************
+
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "emulator.h"
+
+static std::atomic<bool> s_stop(false);
+
+static void onSignal(int)
+{
+    s_stop = true;
+}
+
+static void usage(const char* name)
+{
+    std::cout << "Usage: " << name << " [options]" << std::endl
+              << "  --ip ADDR           Address reported to the host (default 127.0.0.1)" << std::endl
+              << "  --port N            GVCP port (default " << GVCP_PORT << ")" << std::endl
+              << "  --width N           Sensor width (default " << DEFAULT_EMULATOR_WIDTH << ")" << std::endl
+              << "  --height N          Sensor height (default " << DEFAULT_EMULATOR_HEIGHT << ")" << std::endl
+              << "  --format mono8|mono12  Pixel format (default mono8)" << std::endl
+              << "  --fps F             Frame rate in Continuous mode (default " << DEFAULT_EMULATOR_FPS << ")" << std::endl
+              << "  --line-rate F       Line5 trigger pulses per second (default 0, none)" << std::endl
+              << "  --loss P            Fraction of stream packets dropped (default 0)" << std::endl
+              << "  --reorder P         Fraction of stream packets swapped with the next (default 0)" << std::endl
+              << "  --seed N            Seed for loss and reordering (default 1)" << std::endl
+              << "  --model NAME        Model name (default \"PAM Emulator\")" << std::endl
+              << "  --serial STR        Serial number (default EMU0001)" << std::endl;
+}
+
+static bool parseArgs(int argc, char* argv[], EmulatorOptions& opt)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--help" || arg == "-h" || i + 1 >= argc)
+        {
+            return false;
+        }
+
+        std::string val = argv[++i];
+        try
+        {
+            if (arg == "--ip") opt.ip = val;
+            else if (arg == "--port") opt.port = std::stoi(val);
+            else if (arg == "--width") opt.width = std::stoul(val);
+            else if (arg == "--height") opt.height = std::stoul(val);
+            else if (arg == "--format" && val == "mono8") opt.pixel_format = GVSP_PIX_MONO8;
+            else if (arg == "--format" && val == "mono12") opt.pixel_format = GVSP_PIX_MONO12;
+            else if (arg == "--fps") opt.fps = std::stod(val);
+            else if (arg == "--line-rate") opt.line_rate = std::stod(val);
+            else if (arg == "--loss") opt.loss = std::stod(val);
+            else if (arg == "--reorder") opt.reorder = std::stod(val);
+            else if (arg == "--seed") opt.seed = std::stoul(val);
+            else if (arg == "--model") opt.model = val;
+            else if (arg == "--serial") opt.serial = val;
+            else
+            {
+                std::cout << "Unknown option " << arg << std::endl;
+                return false;
+            }
+        }
+        catch (const std::exception&)
+        {
+            std::cout << "Bad value for " << arg << ": " << val << std::endl;
+            return false;
+        }
+    }
+
+    if (opt.width < 16 || opt.height < 16 || opt.fps <= 0.0)
+    {
+        std::cout << "The image must be at least 16x16 and the frame rate above 0" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    EmulatorOptions opt;
+    if (!parseArgs(argc, argv, opt))
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    GigeEmulator emulator(opt);
+    if (!emulator.start())
+    {
+        return 1;
+    }
+    std::signal(SIGINT, onSignal);
+    std::signal(SIGTERM, onSignal);
+
+    EmulatorStats last = emulator.getStats();
+    auto t0 = std::chrono::steady_clock::now();
+    std::cout << std::fixed << std::setprecision(1);
+    while (!s_stop)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        auto t1 = std::chrono::steady_clock::now();
+        double seconds = std::chrono::duration<double>(t1 - t0).count();
+        if (seconds < 1.0)
+        {
+            continue;
+        }
+
+        // Only printed while something is happening
+        EmulatorStats s = emulator.getStats();
+        if (s.stream.packets != last.stream.packets || s.commands != last.commands)
+        {
+            std::cout << (s.stream.frames - last.stream.frames) / seconds << " fps  "
+                      << (s.stream.bytes - last.stream.bytes) / seconds / 1e6 << " MB/s  "
+                      << "dropped " << s.stream.dropped - last.stream.dropped << "  "
+                      << "resend requests " << s.stream.resend_requests - last.stream.resend_requests << "  "
+                      << "resent " << s.stream.resent - last.stream.resent << "  "
+                      << "late " << s.late_frames - last.late_frames << "  "
+                      << "triggers " << s.triggers - last.triggers << " (" << s.ignored_triggers - last.ignored_triggers << " ignored)" << std::endl;
+        }
+        last = s;
+        t0 = t1;
+    }
+
+    emulator.stop();
+    return 0;
+}
@@ -0,0 +1,85 @@
+// Cost of the Fv/Fm preview at full resolution: the Fv/Fm kernel on a
+// synthetic 12 bit F0/Fm pair, then false colouring the float map and a raw
+// 16 bit frame with each palette. Reports the median of the runs.
+//
+// ./build/colormapbench.out [width] [height] [runs]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+#include "colormap.h"
+#include "fluorescence.h"
+
+template<typename F>
+static double medianMs(int runs, F fn)
+{
+    std::vector<double> ms;
+    for (int i = 0; i < runs; i++)
+    {
+        auto t0 = std::chrono::steady_clock::now();
+        fn();
+        ms.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count());
+    }
+    std::sort(ms.begin(), ms.end());
+    return ms[ms.size() / 2];
+}
+
+int main(int argc, char* argv[])
+{
+    uint32_t width = (argc > 1) ? atoi(argv[1]) : 2048;
+    uint32_t height = (argc > 2) ? atoi(argv[2]) : 1536;
+    int runs = (argc > 3) ? atoi(argv[3]) : 50;
+
+    // Leaf in the middle, dark background around it
+    std::vector<uint16_t> f0(width * height), fm(width * height);
+    srand(1);
+    for (uint32_t y = 0; y < height; y++)
+    {
+        for (uint32_t x = 0; x < width; x++)
+        {
+            bool leaf = x > width / 4 && x < width * 3 / 4 && y > height / 4 && y < height * 3 / 4;
+            uint16_t base = leaf ? 600 + rand() % 200 : rand() % 40;
+            f0[y * width + x] = base;
+            fm[y * width + x] = leaf ? base * 5 : base;
+        }
+    }
+
+    ImageView f0_view, fm_view;
+    f0_view.data = reinterpret_cast<const uint8_t*>(f0.data());
+    fm_view.data = reinterpret_cast<const uint8_t*>(fm.data());
+    f0_view.width = fm_view.width = width;
+    f0_view.height = fm_view.height = height;
+    f0_view.stride = fm_view.stride = width * 2;
+    f0_view.bits = fm_view.bits = 12;
+
+    std::vector<float> map(width * height);
+    std::vector<uint8_t> rgba(width * height * 4);
+    double mpix = width * height / 1e6;
+
+    std::cout << std::fixed << std::setprecision(2) << width << "x" << height << ", median of " << runs << " runs" << std::endl;
+    double ms = medianMs(runs, [&]() { Fluorescence::fvfm(f0_view, fm_view, map.data()); });
+    std::cout << "  fvfm            " << ms << " ms  (" << mpix / ms * 1e3 << " Mpix/s)" << std::endl;
+
+    for (int p = 0; p < ColorMap::PALETTE_COUNT; p++)
+    {
+        ColorMap colormap(p, 0.0f, 0.85f);
+        ms = medianMs(runs, [&]() { colormap.render(map.data(), width, height, width, rgba.data(), width * 4); });
+        std::cout << "  float " << std::left << std::setw(9) << ColorMap::getPaletteName(p) << " " << ms << " ms  (" << mpix / ms * 1e3 << " Mpix/s)" << std::endl;
+    }
+
+    ColorMap raw(ColorMap::PALETTE_GRAY, 0.0f, 4095.0f);
+    ms = medianMs(runs, [&]() { raw.render(fm.data(), width, height, width, rgba.data(), width * 4); });
+    std::cout << "  uint16 Gray      " << ms << " ms  (" << mpix / ms * 1e3 << " Mpix/s)" << std::endl;
+
+    // Keep the output alive
+    uint64_t sum = 0;
+    for (size_t i = 0; i < rgba.size(); i += 4096)
+    {
+        sum += rgba[i];
+    }
+    return sum == 1 ? 1 : 0;
+}
@@ -0,0 +1,139 @@
+// GVSP stream receiver on loopback. GvspSender streams frames with a known
+// pattern to GvspReceiver and answers its resend requests. Each case is run
+// with the packet size, injected loss and reordering shown. It reports the
+// packet and byte rates, how many frames came out complete and intact, and
+// how many packets were asked for again and recovered.
+//
+// ./build/gvspbench.out [frames] [fps] [width] [height]   (default 300 30 2048 1536, Mono8)
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "gvspreceiver.h"
+#include "gvspsender.h"
+
+struct Case
+{
+    const char* name;
+    uint32_t packet_size;
+    double drop;
+    double reorder;
+    bool resend;
+};
+
+static uint8_t pattern(uint64_t block_id, size_t i)
+{
+    return static_cast<uint8_t>(block_id * 7 + i * 13 + (i >> 11));
+}
+
+int main(int argc, char* argv[])
+{
+    int frames = (argc > 1) ? atoi(argv[1]) : 300;
+    double fps = (argc > 2) ? atof(argv[2]) : 30.0;
+    uint32_t width = (argc > 3) ? atoi(argv[3]) : 2048;
+    uint32_t height = (argc > 4) ? atoi(argv[4]) : 1536;
+    size_t bytes = Gvsp::imageBytes(GVSP_PIX_MONO8, width, height);
+
+    const Case cases[] =
+    {
+        {"1500", 1500, 0.0, 0.0, true},
+        {"9000 jumbo", 9000, 0.0, 0.0, true},
+        {"1500 1% loss", 1500, 0.01, 0.0, true},
+        {"1500 1% loss no resend", 1500, 0.01, 0.0, false},
+        {"1500 1% loss 5% reorder", 1500, 0.01, 0.05, true},
+        {"9000 5% loss", 9000, 0.05, 0.0, true},
+    };
+
+    // One image per block id mod 8, the sender copies from these
+    std::vector<std::vector<uint8_t>> images(8, std::vector<uint8_t>(bytes));
+    for (size_t k = 0; k < images.size(); k++)
+    {
+        for (size_t i = 0; i < bytes; i++)
+        {
+            images[k][i] = pattern(k, i);
+        }
+    }
+
+    bool ok = true;
+    std::cout << std::fixed << std::setprecision(1);
+    for (const Case& c : cases)
+    {
+        GvspReceiver receiver;
+        GvspSender sender;
+        if (!receiver.open(0, bytes, DEFAULT_GVSP_BUFFERS, c.packet_size))
+        {
+            return 1;
+        }
+        uint16_t gvcp = sender.open("127.0.0.1", receiver.getPort(), c.packet_size) ? sender.serve(0) : 0;
+        if (gvcp == 0)
+        {
+            return 1;
+        }
+        sender.setLoss(c.drop, c.reorder, 42);
+        receiver.setDevice("127.0.0.1", gvcp);
+        receiver.setResend(c.resend);
+
+        std::atomic<int> intact(0);
+        std::atomic<int> corrupt(0);
+        std::atomic<int> handed(0);
+        std::vector<double> reassembly;
+        receiver.start([&](GvspFrame* f)
+        {
+            if (f->stats.complete)
+            {
+                const std::vector<uint8_t>& expected = images[f->block_id % images.size()];
+                bool same = f->size == bytes && std::equal(expected.begin(), expected.end(), f->data.begin());
+                (same ? intact : corrupt)++;
+            }
+            reassembly.push_back(f->stats.reassembly_us);
+            handed++;
+            receiver.release(f);
+        });
+
+        auto t0 = std::chrono::steady_clock::now();
+        auto next = t0;
+        for (int i = 0; i < frames; i++)
+        {
+            // The block id is known before sending, 16 bit ids skip 0
+            uint64_t id = (i + 1) % 0xffff;
+            id = (id == 0) ? 0xffff : id;
+            sender.sendFrame(images[id % images.size()].data(), width, height, GVSP_PIX_MONO8, i);
+            next += std::chrono::microseconds(static_cast<int64_t>(1e6 / fps));
+            std::this_thread::sleep_until(next);
+        }
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+        while (handed < frames && std::chrono::steady_clock::now() < deadline)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        receiver.stop();
+
+        GvspStats rs = receiver.getStats();
+        GvspSenderStats ss = sender.getStats();
+        std::sort(reassembly.begin(), reassembly.end());
+        double p50 = reassembly.empty() ? 0.0 : reassembly[reassembly.size() / 2] / 1e3;
+        double p99 = reassembly.empty() ? 0.0 : reassembly[std::min(reassembly.size() - 1, reassembly.size() * 99 / 100)] / 1e3;
+
+        // Without loss, or with resends, every frame has to come out intact
+        bool good = corrupt == 0 && (c.drop > 0.0 && !c.resend ? true : intact == frames);
+        ok = ok && good;
+        std::cout << std::setw(24) << c.name << "  " << std::setw(7) << rs.packets / seconds / 1e3 << " kpkt/s  "
+                  << std::setw(6) << rs.bytes / seconds / 1e6 << " MB/s  " << std::setw(5) << rs.packets / std::max<double>(rs.batches, 1) << " pkt/batch  "
+                  << "intact " << std::setw(5) << 100.0 * intact / frames << "%  dropped " << ss.dropped << " asked " << rs.resend_packets
+                  << " recovered " << rs.resent_received << "  kernel drops " << rs.socket_drops
+                  << "  reassembly p50 " << std::setprecision(2) << p50 << " ms p99 " << p99 << " ms  " << std::setprecision(1)
+                  << (good ? "ok" : "FAILED") << std::endl;
+
+        sender.close();
+        receiver.close();
+    }
+    std::cout << (ok ? "ok" : "FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,158 @@
+// LED controller transports compared. For each target, round trips of a
+// short command string (send until DONE, one at a time), then throughput
+// with long command strings sent back to back until the last DONE.
+//
+// "pty" is the tty transport on a pseudo terminal with MockController on the
+// other end: the real epoll and termios path, but without a baud rate.
+// "mock:9600" is the in process controller with 9600 baud wire times, what
+// /dev/ttyUSB0 costs, and "mock" has no wire at all, the floor a USB link
+// approaches. Real targets (/dev/ttyUSB0, usb:VID:PID) can be given too.
+//
+// ./build/ledbench.out [round-trips] [target ...]   (default 200 pty mock:9600 mock)
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <pty.h>
+#include <unistd.h>
+
+#include "ledtransport.h"
+#include "serialport.h"
+
+// MockController answering on the master side of a pty
+class PtyController
+{
+    public:
+        bool open()
+        {
+            char name[128];
+            if (openpty(&master, &slave, name, nullptr, nullptr) != 0)
+            {
+                return false;
+            }
+            path = name;
+            controller.reset(new MockController([this](const std::string& line)
+            {
+                std::string bytes = line + "\r\n";
+                if (write(master, bytes.data(), bytes.size()) < 0)
+                {
+                    std::cout << "pty: write failed" << std::endl;
+                }
+            }));
+            reader = std::thread([this]()
+            {
+                char buf[256];
+                ssize_t n;
+                while ((n = read(master, buf, sizeof(buf))) > 0)
+                {
+                    controller->receive(buf, n);
+                }
+            });
+            return true;
+        }
+
+        void close()
+        {
+            // Reads on the master fail once every slave fd is closed
+            ::close(slave);
+            SerialPort::instance().close();
+            reader.join();
+            controller.reset();
+            ::close(master);
+        }
+
+        std::string path;
+
+    private:
+        int master = -1;
+        int slave = -1;
+        std::thread reader;
+        std::unique_ptr<MockController> controller;
+};
+
+static double percentile(std::vector<double> v, double p)
+{
+    std::sort(v.begin(), v.end());
+    return v.empty() ? 0.0 : v[std::min(v.size() - 1, static_cast<size_t>(p * v.size()))];
+}
+
+int main(int argc, char* argv[])
+{
+    int trips = (argc > 1) ? atoi(argv[1]) : 200;
+    std::vector<std::string> targets;
+    for (int i = 2; i < argc; i++)
+    {
+        targets.push_back(argv[i]);
+    }
+    if (targets.empty())
+    {
+        targets = {"pty", "mock:9600", "mock"};
+    }
+
+    // Torch on, finishes at once. The long one is 60 triplets at time 0,
+    // about the length of an induction command string, and has no pulses so
+    // the controller is done as soon as it has read it.
+    const std::string shortcmd = "0 0 500";
+    std::string longcmd;
+    for (int i = 0; i < 20; i++)
+    {
+        longcmd += "1 0 800 5 0 0 0 0 0 ";
+    }
+    const int burst = 32;
+
+    bool ok = true;
+    std::cout << std::fixed << std::setprecision(3);
+    for (const std::string& target : targets)
+    {
+        PtyController pty;
+        SerialPort& port = SerialPort::instance();
+        if (target == "pty" ? !(pty.open() && port.open(pty.path)) : !port.open(target))
+        {
+            std::cout << target << ": unable to open" << std::endl;
+            ok = false;
+            continue;
+        }
+
+        std::vector<double> rtt_ms;
+        int failed = 0;
+        for (int i = 0; i < trips; i++)
+        {
+            auto t0 = std::chrono::steady_clock::now();
+            uint64_t id = port.send(shortcmd);
+            if (id == 0 || !port.waitDone(id, 2000))
+            {
+                failed++;
+                continue;
+            }
+            rtt_ms.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count());
+        }
+
+        auto t0 = std::chrono::steady_clock::now();
+        uint64_t last = 0;
+        for (int i = 0; i < burst; i++)
+        {
+            last = port.send(longcmd);
+        }
+        bool drained = last != 0 && port.waitDone(last, 60000);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+        bool good = failed == 0 && drained && port.hasReplies();
+        ok = ok && good;
+        std::cout << std::setw(10) << target << "  round trip p50 " << percentile(rtt_ms, 0.5) << " ms  p99 " << percentile(rtt_ms, 0.99) << " ms  "
+                  << std::setprecision(1) << burst / seconds << " cmd/s  " << burst * (longcmd.size() + 2) / seconds / 1024.0 << " KB/s  "
+                  << (good ? "ok" : "FAILED") << std::setprecision(3) << std::endl;
+
+        if (target == "pty")
+        {
+            pty.close();
+        }
+        port.close();
+    }
+    std::cout << (ok ? "ok" : "FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
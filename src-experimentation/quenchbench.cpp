@@ -0,0 +1,87 @@
+// Quenching analysis of an induction curve: builds the command string of
+// an Fv/Fm plus actinic sequence, takes the frame roles from it and feeds
+// synthetic frames (flat levels plus noise, 12 significant bits) through
+// Quenching one by one, as the display thread does while recording. Times
+// each frame and checks the means against the formulas on the flat levels.
+//
+// ./build/quenchbench.out [width] [height]
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+#include "quenching.h"
+#include "sequence.h"
+
+int main(int argc, char* argv[])
+{
+    uint32_t width = (argc > 1) ? atoi(argv[1]) : 2048;
+    uint32_t height = (argc > 2) ? atoi(argv[2]) : 1536;
+
+    PamSettings settings;
+    settings.phases.push_back({300000, 1000, 30000});   // 5 min actinic
+    settings.phases.push_back({120000, 0, 30000});      // 2 min recovery
+    std::vector<SerialCommand> cmds = Sequence::build(settings);
+    std::vector<int> roles = Sequence::frameRoles(cmds);
+    std::cout << roles.size() << " frames over " << Sequence::duration(cmds) / 1000.0 << " s" << std::endl;
+
+    // Levels after dark subtraction: F0 250, Fm 1450, F' 450, Fm' 850
+    const float dark = 50, f0 = 300, fm = 1500, fp = 500, fmp = 900;
+    float levels[] = {dark, f0, fm, fp, fmp, 400};
+    double phi = (fmp - fp) / (fmp - dark);
+    double npq = (fm - fmp) / (fmp - dark);
+    double f0p = (f0 - dark) / ((fm - f0) / (fm - dark) + (f0 - dark) / (fmp - dark));
+    double qp = (fmp - fp) / (fmp - dark - f0p);
+    double ql = qp * f0p / (fp - dark);
+
+    // One frame per role, leaves in the left three quarters
+    std::vector<std::vector<uint16_t>> frames(6, std::vector<uint16_t>(static_cast<size_t>(width) * height));
+    srand(1);
+    for (int r = 0; r < 6; r++)
+    {
+        for (size_t i = 0; i < frames[r].size(); i++)
+        {
+            bool leaf = (i % width) < width * 3 / 4;
+            frames[r][i] = leaf ? static_cast<uint16_t>(levels[r] + rand() % 3 - 1) : static_cast<uint16_t>(dark);
+        }
+    }
+
+    Quenching quenching;
+    quenching.begin(roles);
+    std::vector<double> pulse_ms, other_ms;
+    for (uint32_t i = 0; i < roles.size(); i++)
+    {
+        ImageView view;
+        view.data = reinterpret_cast<const uint8_t*>(frames[roles[i]].data());
+        view.width = width;
+        view.height = height;
+        view.stride = width * 2;
+        view.bits = 12;
+
+        auto t0 = std::chrono::steady_clock::now();
+        bool point = quenching.addFrame(i, view);
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+        (point ? pulse_ms : other_ms).push_back(ms);
+    }
+
+    bool ok = !quenching.getPoints().empty();
+    std::cout << std::fixed << std::setprecision(4) << "expected  PhiPSII " << phi << "  qP " << qp << "  qL " << ql << "  NPQ " << npq << std::endl;
+    for (const QuenchingPoint& p : quenching.getPoints())
+    {
+        std::cout << "frame " << std::setw(3) << p.frame << " PhiPSII " << p.phi_psii << "  qP " << p.qp << "  qL " << p.ql << "  NPQ " << p.npq
+                  << "  " << p.valid << " px" << std::endl;
+        ok = ok && std::fabs(p.phi_psii - phi) < 0.01 && std::fabs(p.qp - qp) < 0.01 && std::fabs(p.ql - ql) < 0.01 && std::fabs(p.npq - npq) < 0.01 &&
+             p.valid == static_cast<uint64_t>(width * 3 / 4) * height;
+    }
+
+    std::sort(pulse_ms.begin(), pulse_ms.end());
+    std::sort(other_ms.begin(), other_ms.end());
+    std::cout << std::setprecision(2) << width << "x" << height << ": Fm' frame " << pulse_ms[pulse_ms.size() / 2] << " ms, other frames "
+              << other_ms[other_ms.size() / 2] << " ms (median)" << std::endl;
+    std::cout << (ok ? "ok" : "MISMATCH") << std::endl;
+    return ok ? 0 : 1;
+}
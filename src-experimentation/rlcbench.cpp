@@ -0,0 +1,107 @@
+// Rapid light curve fit throughput: synthetic PhiPSII maps for each step of
+// a light curve, where every pixel follows ETRmax * tanh(alpha * PAR / ETRmax)
+// with its own parameters and a little noise, and a quarter of the image is
+// background. Fits every pixel with 1..N threads, reports pixels per second
+// and checks the recovered parameters, then fits per region.
+//
+// ./build/rlcbench.out [width] [height]
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <thread>
+#include <vector>
+
+#include "lightcurve.h"
+#include "tools.h"
+
+int main(int argc, char* argv[])
+{
+    uint32_t width = (argc > 1) ? atoi(argv[1]) : 2048;
+    uint32_t height = (argc > 2) ? atoi(argv[2]) : 1536;
+    const size_t pixels = static_cast<size_t>(width) * height;
+
+    // The DAC steps of the example in scheduler.h
+    std::vector<float> par;
+    for (float dac : {100.0f, 200.0f, 400.0f, 700.0f, 1000.0f, 1500.0f, 2000.0f})
+    {
+        par.push_back(Tools::dacIrradiance(dac));
+    }
+
+    // Parameters vary across the image, regions are vertical stripes
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    const float share = 0.5f * DEFAULT_ABSORPTANCE;
+    std::vector<float> alpha(pixels), etr_max(pixels);
+    std::vector<uint16_t> labels(pixels);
+    for (size_t i = 0; i < pixels; i++)
+    {
+        uint32_t x = i % width;
+        alpha[i] = 0.25f + 0.1f * x / width;
+        etr_max[i] = 150.0f + 100.0f * (i / width) / height;
+        labels[i] = (x < width * 3 / 4) ? 1 + x * 8 / width : 0;
+    }
+    std::vector<std::vector<float>> phi(par.size(), std::vector<float>(pixels));
+    srand(1);
+    for (size_t k = 0; k < par.size(); k++)
+    {
+        for (size_t i = 0; i < pixels; i++)
+        {
+            float etr = etr_max[i] * std::tanh(alpha[i] * par[k] / etr_max[i]) * (1.0f + 0.01f * (rand() % 200 - 100) / 100.0f);
+            phi[k][i] = (labels[i] != 0) ? etr / (par[k] * share) : nan;
+        }
+    }
+
+    std::cout << std::fixed << std::setprecision(2) << width << "x" << height << ", " << par.size() << " steps, PAR";
+    for (float p : par)
+    {
+        std::cout << " " << p;
+    }
+    std::cout << std::endl;
+
+    bool ok = true;
+    unsigned int cores = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned int threads = 1; threads <= cores; threads *= 2)
+    {
+        LightCurve curve;
+        curve.setThreads(threads);
+        curve.begin(par);
+        for (size_t k = 0; k < par.size(); k++)
+        {
+            curve.addStep(k, phi[k].data(), width, height);
+        }
+        uint64_t fitted = curve.fitPixels();
+
+        // Worst relative error of the fitted pixels
+        float worst_alpha = 0.0f, worst_etr = 0.0f;
+        const float* a = curve.getMap(LightCurve::PARAM_ALPHA);
+        const float* e = curve.getMap(LightCurve::PARAM_ETRMAX);
+        for (size_t i = 0; i < pixels; i++)
+        {
+            if (a[i] == a[i])
+            {
+                worst_alpha = std::max(worst_alpha, std::fabs(a[i] - alpha[i]) / alpha[i]);
+                worst_etr = std::max(worst_etr, std::fabs(e[i] - etr_max[i]) / etr_max[i]);
+            }
+        }
+        bool good = fitted == static_cast<uint64_t>(width * 3 / 4) * height && worst_alpha < 0.1 && worst_etr < 0.05;
+        ok = ok && good;
+        std::cout << "  " << threads << " threads  " << curve.getPixelsPerSecond() / 1e6 << " Mpx/s  " << fitted << " fitted, worst error alpha "
+                  << worst_alpha * 100 << "%, ETRmax " << worst_etr * 100 << "%  " << (good ? "ok" : "MISMATCH") << std::endl;
+
+        if (threads == 1)
+        {
+            std::vector<LightCurveFit> fits = curve.fitRegions(labels.data(), 6);
+            for (size_t l = 0; l < fits.size(); l++)
+            {
+                std::cout << "    region " << l + 1 << "  alpha " << std::setprecision(3) << fits[l].alpha << "  ETRmax " << std::setprecision(1)
+                          << fits[l].etr_max << "  Ik " << fits[l].ik << std::setprecision(2) << std::endl;
+                ok = ok && fits[l].ok;
+            }
+        }
+    }
+    std::cout << (ok ? "ok" : "MISMATCH") << std::endl;
+    return ok ? 0 : 1;
+}
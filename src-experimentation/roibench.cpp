@@ -0,0 +1,108 @@
+// Per region statistics of a full resolution map. Builds a mask with a grid
+// of rectangular and polygon "leaves", reduces a synthetic Fv/Fm map over it
+// with 1..N threads, and checks the counts and means against a plain loop.
+// Many regions (e.g. 60000) exercise the histogram memory cap.
+//
+// ./build/roibench.out [width] [height] [regions] [runs]
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "roi.h"
+
+int main(int argc, char* argv[])
+{
+    uint32_t width = (argc > 1) ? atoi(argv[1]) : 2048;
+    uint32_t height = (argc > 2) ? atoi(argv[2]) : 1536;
+    int regions = (argc > 3) ? atoi(argv[3]) : 48;
+    int runs = (argc > 4) ? atoi(argv[4]) : 20;
+
+    // Alternate rectangles and diamonds on an 8 wide grid
+    RoiMask mask;
+    int columns = 8;
+    int rows = (regions + columns - 1) / columns;
+    float cw = static_cast<float>(width) / columns, ch = static_cast<float>(height) / rows;
+    for (int i = 0; i < regions; i++)
+    {
+        float x = (i % columns) * cw, y = (i / columns) * ch;
+        if (i % 2 == 0)
+        {
+            mask.addRect(i + 1, x + cw * 0.1f, y + ch * 0.1f, cw * 0.8f, ch * 0.8f);
+        }
+        else
+        {
+            mask.addPolygon(i + 1, {x + cw / 2, y, x + cw, y + ch / 2, x + cw / 2, y + ch, x, y + ch / 2});
+        }
+    }
+    const uint16_t* labels = mask.getLabels(width, height);
+
+    // Fv/Fm around 0.8 with background NaN
+    std::vector<float> map(static_cast<size_t>(width) * height);
+    srand(1);
+    for (size_t i = 0; i < map.size(); i++)
+    {
+        map[i] = (rand() % 16 == 0) ? NAN : 0.6f + (rand() % 1000) / 4000.0f;
+    }
+
+    // Reference, with the exact median of region 1
+    std::vector<float> first;
+    for (size_t i = 0; i < map.size(); i++)
+    {
+        if (labels[i] == 1 && map[i] == map[i])
+        {
+            first.push_back(map[i]);
+        }
+    }
+    std::sort(first.begin(), first.end());
+    float median = first.empty() ? NAN : first[first.size() / 2];
+
+    std::vector<uint64_t> count(regions + 1, 0);
+    std::vector<double> sum(regions + 1, 0.0);
+    for (size_t i = 0; i < map.size(); i++)
+    {
+        if (labels[i] != 0 && map[i] == map[i])
+        {
+            count[labels[i]]++;
+            sum[labels[i]] += map[i];
+        }
+    }
+
+    std::cout << std::fixed << std::setprecision(2) << width << "x" << height << ", " << regions << " regions, median of " << runs << " runs" << std::endl;
+    unsigned int cores = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned int threads = 1; threads <= cores; threads *= 2)
+    {
+        RoiStats stats;
+        stats.setThreads(threads);
+        std::vector<RoiSummary> result;
+        std::vector<double> ms;
+        for (int r = 0; r < runs; r++)
+        {
+            auto t0 = std::chrono::steady_clock::now();
+            result = stats.reduce(map.data(), labels, width, height, width, mask.getMaxLabel());
+            ms.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count());
+        }
+        std::sort(ms.begin(), ms.end());
+
+        bool ok = result.size() == mask.getMaxLabel();   // Regions too small for a pixel are gone
+        for (size_t i = 0; ok && i < result.size(); i++)
+        {
+            uint32_t l = result[i].label;
+            ok = result[i].count == count[l] && (count[l] == 0 || std::fabs(result[i].mean - sum[l] / count[l]) < 1e-6);
+        }
+        std::cout << "  " << threads << " threads  " << ms[ms.size() / 2] << " ms  " << (ok ? "ok" : "MISMATCH") << std::endl;
+        if (threads == 1 && !result.empty())
+        {
+            const RoiSummary& s = result[0];
+            std::cout << "    region 1: n " << s.count << " mean " << std::setprecision(4) << s.mean << " std " << s.std << " min " << s.min
+                      << " max " << s.max << " p10/50/90 " << s.percentiles[0] << "/" << s.percentiles[1] << "/" << s.percentiles[2]
+                      << " (exact median " << median << ")" << std::setprecision(2) << std::endl;
+        }
+    }
+    return 0;
+}
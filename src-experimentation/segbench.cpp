@@ -0,0 +1,150 @@
+// Plant segmentation on a synthetic tray: a grid of seedlings (discs) over a
+// noisy background with salt specks, 16 bit with 12 significant bits. Times
+// Segmenter with 1..N threads and checks the labels against a flood fill of
+// the same opened mask.
+//
+// ./build/segbench.out [width] [height] [plants per row] [runs]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "segmentation.h"
+
+// Same components, possibly different numbering: each label maps to exactly one flood label
+static bool samePartition(const std::vector<uint16_t>& a, const std::vector<uint16_t>& b)
+{
+    std::vector<int> ab(65536, -1), ba(65536, -1);
+    for (size_t i = 0; i < a.size(); i++)
+    {
+        if ((a[i] == 0) != (b[i] == 0))
+        {
+            return false;
+        }
+        if (a[i] == 0)
+        {
+            continue;
+        }
+        if (ab[a[i]] < 0) ab[a[i]] = b[i];
+        if (ba[b[i]] < 0) ba[b[i]] = a[i];
+        if (ab[a[i]] != b[i] || ba[b[i]] != a[i])
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static uint32_t floodFill(const std::vector<uint16_t>& labels, uint32_t width, uint32_t height, std::vector<uint16_t>& out)
+{
+    out.assign(labels.size(), 0);
+    uint32_t n = 0;
+    std::vector<size_t> stack;
+    for (size_t start = 0; start < labels.size(); start++)
+    {
+        if (labels[start] == 0 || out[start] != 0)
+        {
+            continue;
+        }
+        out[start] = ++n;
+        stack.push_back(start);
+        while (!stack.empty())
+        {
+            size_t i = stack.back();
+            stack.pop_back();
+            int64_t x = i % width, y = i / width;
+            for (int64_t dy = -1; dy <= 1; dy++)
+            {
+                for (int64_t dx = -1; dx <= 1; dx++)
+                {
+                    int64_t nx = x + dx, ny = y + dy;
+                    if (nx < 0 || ny < 0 || nx >= width || ny >= height)
+                    {
+                        continue;
+                    }
+                    size_t j = ny * width + nx;
+                    if (labels[j] != 0 && out[j] == 0)
+                    {
+                        out[j] = n;
+                        stack.push_back(j);
+                    }
+                }
+            }
+        }
+    }
+    return n;
+}
+
+int main(int argc, char* argv[])
+{
+    uint32_t width = (argc > 1) ? atoi(argv[1]) : 2048;
+    uint32_t height = (argc > 2) ? atoi(argv[2]) : 1536;
+    uint32_t per_row = (argc > 3) ? atoi(argv[3]) : 12;
+    int runs = (argc > 4) ? atoi(argv[4]) : 10;
+
+    std::vector<uint16_t> frame(static_cast<size_t>(width) * height);
+    srand(1);
+    for (auto& v : frame)
+    {
+        v = 100 + rand() % 200;
+        if (rand() % 500 == 0)
+        {
+            v = 3000;   // Specks the opening removes
+        }
+    }
+    float pitch = static_cast<float>(width) / per_row;
+    uint32_t rows = static_cast<uint32_t>(height / pitch);
+    for (uint32_t r = 0; r < rows; r++)
+    {
+        for (uint32_t c = 0; c < per_row; c++)
+        {
+            float cx = (c + 0.5f) * pitch, cy = (r + 0.5f) * pitch, radius = pitch * (0.25f + 0.15f * ((r + c) % 3));
+            for (int64_t y = std::max<int64_t>(0, cy - radius); y < std::min<int64_t>(height, cy + radius); y++)
+            {
+                for (int64_t x = std::max<int64_t>(0, cx - radius); x < std::min<int64_t>(width, cx + radius); x++)
+                {
+                    if ((x - cx) * (x - cx) + (y - cy) * (y - cy) < radius * radius)
+                    {
+                        frame[y * width + x] = 2000 + rand() % 1000;
+                    }
+                }
+            }
+        }
+    }
+
+    ImageView fm;
+    fm.data = reinterpret_cast<const uint8_t*>(frame.data());
+    fm.width = width;
+    fm.height = height;
+    fm.stride = width * 2;
+    fm.bits = 12;
+
+    std::cout << std::fixed << std::setprecision(2) << width << "x" << height << ", " << per_row * rows << " plants, median of " << runs << " runs" << std::endl;
+    unsigned int cores = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned int threads = 1; threads <= cores; threads *= 2)
+    {
+        Segmenter segmenter;
+        segmenter.setThreads(threads);
+        std::vector<uint16_t> labels;
+        uint32_t found = 0;
+        std::vector<double> ms;
+        for (int r = 0; r < runs; r++)
+        {
+            auto t0 = std::chrono::steady_clock::now();
+            found = segmenter.segment(fm, labels);
+            ms.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count());
+        }
+        std::sort(ms.begin(), ms.end());
+
+        std::vector<uint16_t> flood;
+        uint32_t expected = floodFill(labels, width, height, flood);
+        bool ok = found == expected && samePartition(labels, flood);
+        std::cout << "  " << threads << " threads  " << ms[ms.size() / 2] << " ms  " << found << " plants, threshold "
+                  << segmenter.getLastThreshold() << "  " << (ok ? "ok" : "MISMATCH") << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,187 @@
+// Per region series store: appends a long experiment as it would arrive live
+// (one block per sequence), queries one region over the last week, compacts
+// the file and queries again. Queries are checked against a full scan, and a
+// torn block at the end is checked to be cut off on the next open.
+//
+// ./build/seriesbench.out [regions] [days] [minutes between sequences] [file]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+#include "roiseries.h"
+
+static double msSince(std::chrono::steady_clock::time_point t0)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+}
+
+static bool sameRows(std::vector<SeriesRow> a, std::vector<SeriesRow> b)
+{
+    auto less = [](const SeriesRow& x, const SeriesRow& y) { return (x.roi != y.roi) ? x.roi < y.roi : x.wall_us < y.wall_us; };
+    std::sort(a.begin(), a.end(), less);
+    std::sort(b.begin(), b.end(), less);
+    if (a.size() != b.size())
+    {
+        return false;
+    }
+    for (size_t i = 0; i < a.size(); i++)
+    {
+        if (a[i].roi != b[i].roi || a[i].wall_us != b[i].wall_us || a[i].mean != b[i].mean || a[i].fm != b[i].fm)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void runQuery(const char* name, const std::string& file, const SeriesQuery& q, std::vector<SeriesRow>& rows)
+{
+    SeriesReader reader;
+    auto t0 = std::chrono::steady_clock::now();
+    reader.open(file);
+    double open_ms = msSince(t0);
+
+    SeriesQueryStats stats;
+    rows.clear();
+    t0 = std::chrono::steady_clock::now();
+    reader.query(q, rows, &stats);
+    double query_ms = msSince(t0);
+    std::cout << "  " << std::left << std::setw(10) << name << std::right << " open " << open_ms << " ms, query " << query_ms << " ms  "
+              << stats.rows << " rows, blocks " << stats.blocks_skipped << " skipped / " << stats.blocks_scanned << " scanned / "
+              << stats.blocks_read << " read, " << stats.bytes_read / 1024 << " KB of " << reader.getBlocks() << " blocks" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+    uint32_t regions = (argc > 1) ? atoi(argv[1]) : 200;
+    uint32_t days = (argc > 2) ? atoi(argv[2]) : 30;
+    uint32_t minutes = (argc > 3) ? atoi(argv[3]) : 5;
+    std::string file = (argc > 4) ? argv[4] : "/tmp/seriesbench.series";
+
+    const int64_t minute_us = 60LL * 1000 * 1000;
+    const int64_t start_us = 1700000000LL * 1000 * 1000;
+    uint32_t sequences = days * 24 * 60 / minutes;
+    std::remove(file.c_str());
+
+    // Live appends, one block per sequence
+    srand(1);
+    SeriesWriter writer;
+    writer.open(file);
+    auto t0 = std::chrono::steady_clock::now();
+    for (uint32_t s = 0; s < sequences; s++)
+    {
+        for (uint32_t r = 1; r <= regions; r++)
+        {
+            SeriesRow row;
+            row.wall_us = start_us + s * minutes * minute_us;
+            row.roi = r;
+            row.recording = s;
+            row.count = 5000 + rand() % 1000;
+            row.mean = 0.78f + 0.0001f * (rand() % 400) - 0.0002f * (s % 288 > 200);
+            row.std = 0.03f;
+            row.min = row.mean - 0.1f;
+            row.max = row.mean + 0.05f;
+            row.p10 = row.mean - 0.03f;
+            row.p50 = row.mean;
+            row.p90 = row.mean + 0.03f;
+            row.f0 = 400.0f + rand() % 50;
+            row.fm = row.f0 / (1.0f - row.mean);
+            writer.append(row);
+        }
+        writer.flush(false);
+    }
+    writer.close();
+    double write_ms = msSince(t0);
+    uint64_t rows = static_cast<uint64_t>(sequences) * regions;
+    std::cout << std::fixed << std::setprecision(2) << rows << " rows (" << regions << " regions x " << sequences << " sequences), appended in "
+              << write_ms << " ms, " << write_ms * 1000.0 / sequences << " us per sequence" << std::endl;
+
+    // The same rows as roi.csv, for scale
+    {
+        std::ofstream csv(file + ".csv");
+        SeriesReader reader;
+        reader.open(file);
+        std::vector<SeriesRow> all;
+        for (size_t b = 0; b < reader.getBlocks(); b++)
+        {
+            reader.readBlock(b, all);
+        }
+        for (const SeriesRow& r : all)
+        {
+            csv << r.wall_us << "," << r.recording << "," << r.roi << "," << r.count << "," << r.mean << "," << r.std << "," << r.min << ","
+                << r.max << "," << r.p10 << "," << r.p50 << "," << r.p90 << "\n";
+        }
+    }
+    std::ifstream sizes(file, std::ios::ate), csv_size(file + ".csv", std::ios::ate);
+    std::cout << "  series " << sizes.tellg() / 1024 << " KB, csv " << csv_size.tellg() / 1024 << " KB" << std::endl;
+    std::remove((file + ".csv").c_str());
+
+    // Region 12 over the last week
+    SeriesQuery q;
+    q.roi_min = q.roi_max = std::min<uint32_t>(12, regions);
+    q.to_us = start_us + static_cast<int64_t>(sequences) * minutes * minute_us;
+    q.from_us = q.to_us - 7LL * 24 * 60 * minute_us;
+
+    std::vector<SeriesRow> expected;
+    {
+        SeriesReader reader;
+        reader.open(file);
+        std::vector<SeriesRow> all;
+        t0 = std::chrono::steady_clock::now();
+        for (size_t b = 0; b < reader.getBlocks(); b++)
+        {
+            reader.readBlock(b, all);
+        }
+        for (const SeriesRow& r : all)
+        {
+            if (r.roi >= q.roi_min && r.roi <= q.roi_max && r.wall_us >= q.from_us && r.wall_us <= q.to_us)
+            {
+                expected.push_back(r);
+            }
+        }
+        std::cout << "Region " << q.roi_min << ", last 7 days" << std::endl << "  full scan  " << msSince(t0) << " ms  " << expected.size() << " rows" << std::endl;
+    }
+
+    std::vector<SeriesRow> found;
+    runQuery("appended", file, q, found);
+    bool ok = sameRows(found, expected);
+
+    t0 = std::chrono::steady_clock::now();
+    SeriesWriter::compact(file);
+    std::cout << "  compact    " << msSince(t0) << " ms" << std::endl;
+    runQuery("compacted", file, q, found);
+    ok = ok && sameRows(found, expected);
+
+    // A region over the whole run, where sorted blocks help the most
+    SeriesQuery all_time;
+    all_time.roi_min = all_time.roi_max = q.roi_min;
+    runQuery("all time", file, all_time, found);
+    ok = ok && found.size() == sequences;
+
+    // Torn block: half a block of garbage at the end is dropped on open
+    {
+        std::ofstream tail(file, std::ios::app | std::ios::binary);
+        SeriesBlockHeader torn = {};
+        torn.magic = SERIES_BLOCK_MAGIC;
+        torn.rows = 100;
+        torn.payload_size = 100 * sizeof(SeriesRow);
+        tail.write(reinterpret_cast<const char*>(&torn), sizeof(torn));
+        tail << "partial";
+    }
+    SeriesWriter reopened;
+    reopened.open(file);
+    reopened.close();
+    SeriesReader check;
+    check.open(file);
+    ok = ok && check.getRows() == rows;
+
+    std::cout << (ok ? "ok" : "MISMATCH") << std::endl;
+    std::remove(file.c_str());
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,139 @@
+// Throughput and latency of the shared memory live feed. The parent process
+// publishes synthetic frames through ShmPublisher; a forked child maps the
+// feed with ShmReader, reads every pixel in place, and reports publish to
+// read latency, MB/s, and frames skipped or overwritten while it read them.
+//
+// ./build/shmbench.out [frames] [width] [height] [fps]   (fps 0 = flat out)
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "shmfeed.h"
+#include "shmpublisher.h"
+
+#define BENCH_SHM_NAME "/pam-feed-bench"
+
+static int runReader(int frames)
+{
+    ShmReader reader;
+    for (int i = 0; i < 1000 && !reader.open(BENCH_SHM_NAME); i++)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    if (!reader.isOpen())
+    {
+        std::cout << "reader: feed never appeared" << std::endl;
+        return 1;
+    }
+
+    std::vector<double> latency_us;
+    latency_us.reserve(frames);
+    uint64_t bytes = 0;
+    uint64_t torn = 0;
+    uint64_t checksum = 0;
+    int64_t first_ns = 0;
+    int64_t last_ns = 0;
+
+    ShmFrame frame;
+    while (reader.next(frame, 1000))
+    {
+        int64_t now = shmFeedNow();
+        latency_us.push_back((now - frame.slot->publish_ns) / 1000.0);
+
+        // Touch every byte, as an analysis pass would
+        const uint64_t* p = reinterpret_cast<const uint64_t*>(frame.data);
+        for (uint32_t i = 0; i < frame.slot->data_size / 8; i++)
+        {
+            checksum += p[i];
+        }
+        if (!reader.isValid(frame))
+        {
+            torn++;
+        }
+
+        bytes += frame.slot->data_size;
+        if (first_ns == 0)
+        {
+            first_ns = now;
+        }
+        last_ns = shmFeedNow();
+        if (frame.seq >= static_cast<uint64_t>(frames))
+        {
+            break;
+        }
+    }
+
+    if (latency_us.empty())
+    {
+        std::cout << "reader: no frames" << std::endl;
+        return 1;
+    }
+
+    std::sort(latency_us.begin(), latency_us.end());
+    auto pct = [&latency_us](double p) { return latency_us[std::min(latency_us.size() - 1, static_cast<size_t>(p * latency_us.size()))]; };
+    double seconds = std::max(1e-9, (last_ns - first_ns) / 1e9);
+
+    std::cout << std::fixed << std::setprecision(1)
+              << "reader: " << latency_us.size() << " frames, " << reader.getSkipped() << " skipped, " << torn << " overwritten while reading" << std::endl
+              << "reader: " << bytes / 1e6 / seconds << " MB/s read in place" << std::endl
+              << "reader: latency (us) p50 " << pct(0.5) << "  p99 " << pct(0.99) << "  max " << latency_us.back()
+              << "  (checksum " << std::hex << checksum << std::dec << ")" << std::endl;
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    int frames = (argc > 1) ? std::stoi(argv[1]) : 500;
+    uint32_t width = (argc > 2) ? std::stoul(argv[2]) : 2560;
+    uint32_t height = (argc > 3) ? std::stoul(argv[3]) : 2048;
+    double fps = (argc > 4) ? std::stod(argv[4]) : 0.0;
+
+    std::vector<uint8_t> pixels(static_cast<size_t>(width) * height);
+    for (size_t i = 0; i < pixels.size(); i++)
+    {
+        pixels[i] = static_cast<uint8_t>(i * 31);
+    }
+
+    FrameHeader header = {};
+    header.width = width;
+    header.height = height;
+    header.bits = 8;
+    header.stride = width;
+
+    // Create the feed before forking so the reader finds it straight away
+    ShmPublisher publisher(BENCH_SHM_NAME);
+    publisher.publish(header, pixels.data(), pixels.size());
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        _exit(runReader(frames));
+    }
+
+    std::cout << frames << " frames of " << width << "x" << height << (fps > 0 ? "" : ", unpaced") << std::endl;
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    auto t0 = std::chrono::steady_clock::now();
+    for (int i = 2; i <= frames; i++)
+    {
+        if (fps > 0)
+        {
+            std::this_thread::sleep_until(t0 + std::chrono::microseconds(static_cast<int64_t>(i * 1e6 / fps)));
+        }
+        header.block_id = i;
+        publisher.publish(header, pixels.data(), pixels.size());
+    }
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+    std::cout << std::fixed << std::setprecision(1) << "publisher: " << (frames - 1) * pixels.size() / 1e3 / ms << " MB/s" << std::endl;
+
+    int status = 0;
+    waitpid(pid, &status, 0);
+    publisher.close();
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
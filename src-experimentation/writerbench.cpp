@@ -0,0 +1,148 @@
+// Compares the session writer against one file per frame, the way frames are
+// stored with PvBufferWriter (minus the PNG encoding). Each is run flat out
+// for sustained MB/s, then paced at a camera-like frame rate for latency
+// percentiles.
+//
+// ./build/writerbench.out [dir] [frames] [width] [height] [fps]
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "sessionwriter.h"
+
+typedef std::chrono::steady_clock Clock;
+
+static double msSince(Clock::time_point t0)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+}
+
+static void report(const std::string& name, std::vector<double>& latency_us, uint64_t bytes, double total_ms)
+{
+    std::sort(latency_us.begin(), latency_us.end());
+    auto pct = [&latency_us](double p)
+    {
+        size_t i = std::min(latency_us.size() - 1, static_cast<size_t>(p * latency_us.size()));
+        return latency_us[i] / 1000.0;
+    };
+
+    std::cout << std::fixed << std::setprecision(2)
+              << std::setw(34) << std::left << name << std::right
+              << std::setw(10) << bytes / 1e6 / (total_ms / 1000.0) << " MB/s"
+              << "  p50 " << std::setw(8) << pct(0.5)
+              << "  p99 " << std::setw(8) << pct(0.99)
+              << "  p99.9 " << std::setw(8) << pct(0.999)
+              << "  max " << std::setw(8) << latency_us.back() / 1000.0 << std::endl;
+}
+
+static void pace(Clock::time_point t0, int i, double fps)
+{
+    if (fps > 0)
+    {
+        std::this_thread::sleep_until(t0 + std::chrono::microseconds(static_cast<int64_t>(i * 1e6 / fps)));
+    }
+}
+
+// One open/write/close per frame, then a sync of the lot at the end
+static void benchPerFile(const std::string& dir, const std::vector<uint8_t>& frame, int frames, double fps)
+{
+    std::vector<double> latency;
+    auto t0 = Clock::now();
+    for (int i = 0; i < frames; i++)
+    {
+        pace(t0, i, fps);
+
+        std::stringstream ss;
+        ss << dir << "/bench-" << i << ".raw";
+
+        auto t = Clock::now();
+        int fd = open(ss.str().c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0 || write(fd, frame.data(), frame.size()) != static_cast<ssize_t>(frame.size()))
+        {
+            std::cout << "write failed: " << strerror(errno) << std::endl;
+            return;
+        }
+        close(fd);
+        latency.push_back(msSince(t) * 1000.0);
+    }
+    sync();
+    double total = msSince(t0);
+    report(fps > 0 ? "file per frame, paced" : "file per frame", latency, static_cast<uint64_t>(frame.size()) * frames, total);
+
+    for (int i = 0; i < frames; i++)
+    {
+        std::stringstream ss;
+        ss << dir << "/bench-" << i << ".raw";
+        unlink(ss.str().c_str());
+    }
+}
+
+static void benchSession(const std::string& dir, const std::vector<uint8_t>& frame, int frames, uint32_t width, uint32_t height, double fps)
+{
+    std::vector<double> latency;
+    latency.reserve(frames);
+
+    std::string file = dir + "/bench-session.pam";
+    SessionWriter writer;
+    writer.setCompletionCallback([&latency](double us) { latency.push_back(us); });
+    if (!writer.open(file))
+    {
+        return;
+    }
+
+    FrameHeader header = {};
+    header.width = width;
+    header.height = height;
+    header.bits = 8;
+    header.stride = width;
+
+    auto t0 = Clock::now();
+    for (int i = 0; i < frames; i++)
+    {
+        pace(t0, i, fps);
+        header.frame = i + 1;
+        header.block_id = i + 1;
+        writer.write(header, frame.data(), frame.size(), true);
+    }
+    writer.flush();
+    double total = msSince(t0);
+    writer.close();
+
+    std::string name = std::string("session (") + writer.getBackend() + (writer.isDirect() ? ", direct" : "") + (fps > 0 ? ", paced)" : ")");
+    report(name, latency, writer.getBytesWritten(), total);
+    unlink(file.c_str());
+}
+
+int main(int argc, char* argv[])
+{
+    std::string dir = (argc > 1) ? argv[1] : ".";
+    int frames = (argc > 2) ? std::stoi(argv[2]) : 200;
+    uint32_t width = (argc > 3) ? std::stoul(argv[3]) : 2560;
+    uint32_t height = (argc > 4) ? std::stoul(argv[4]) : 2048;
+    double fps = (argc > 5) ? std::stod(argv[5]) : 10.0;
+
+    // Something that doesn't compress to nothing
+    std::vector<uint8_t> frame(static_cast<size_t>(width) * height);
+    uint32_t x = 1;
+    for (auto& p : frame)
+    {
+        x = x * 1664525 + 1013904223;
+        p = x >> 24;
+    }
+
+    std::cout << frames << " frames of " << width << "x" << height << " to " << dir << " (latency in ms)" << std::endl;
+    benchPerFile(dir, frame, frames, 0);
+    benchSession(dir, frame, frames, width, height, 0);
+    benchPerFile(dir, frame, frames, fps);
+    benchSession(dir, frame, frames, width, height, fps);
+
+    return 0;
+}
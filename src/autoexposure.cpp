@@ -0,0 +1,202 @@
+#include "autoexposure.h"
+#include "receiver.h"
+#include <cmath>
+#include <algorithm>
+#include <iostream>
+
+AutoExposure::AutoExposure(PvGenParameterArray* _params) :
+    params(_params),
+    enabled(false),
+    converged(false),
+    percentile(DEFAULT_AE_PERCENTILE),
+    level(DEFAULT_AE_LEVEL),
+    fm_headroom(DEFAULT_FM_HEADROOM),
+    settle(0),
+    seq_first(0.0f),
+    seq_peak(0.0f),
+    seq_saturation(0.0f),
+    seq_frames(0)
+{
+
+}
+
+void AutoExposure::setEnabled(bool _enabled)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    enabled = _enabled;
+    converged = false;
+    settle = 0;
+}
+
+void AutoExposure::setParameters(PvGenParameterArray* _params)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    params = _params;
+    converged = false;
+    settle = 0;
+}
+
+bool AutoExposure::isEnabled()
+{
+    return enabled;
+}
+
+bool AutoExposure::isConverged()
+{
+    return converged;
+}
+
+void AutoExposure::setTarget(float _percentile, float _level)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    percentile = std::max(0.0f, std::min(1.0f, _percentile));
+    level = std::max(0.01f, std::min(1.0f, _level));
+    converged = false;
+}
+
+void AutoExposure::setFmHeadroom(float _headroom)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    fm_headroom = std::max(1.0f, _headroom);
+    converged = false;
+}
+
+float AutoExposure::getFmHeadroom()
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    return fm_headroom;
+}
+
+void AutoExposure::update(const Histogram& hist)
+{
+    if (!enabled || hist.getCount() == 0)
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mtx);
+
+    // Let the last change reach the sensor before judging it
+    if (settle > 0)
+    {
+        settle--;
+        return;
+    }
+
+    float target = level * (HISTOGRAM_BINS - 1) / fm_headroom;
+    float current = hist.percentile(percentile);
+
+    // A clipped percentile says nothing about how far over we are, so back
+    // off hard instead of trusting the ratio.
+    float ratio;
+    if (hist.saturation() > AE_SATURATION_LIMIT)
+    {
+        ratio = 0.5f;
+    }
+    else
+    {
+        ratio = target / std::max(current, 1.0f);
+    }
+
+    // Within 5% is close enough, chasing noise just restarts settling
+    if (std::fabs(ratio - 1.0f) < 0.05f)
+    {
+        converged = true;
+        return;
+    }
+
+    // Damped step in the log domain, limited to x4 either way
+    double factor = std::pow(static_cast<double>(ratio), 0.7);
+    factor = std::max(0.25, std::min(4.0, factor));
+
+    converged = false;
+    apply(factor);
+    settle = AE_SETTLE_FRAMES;
+}
+
+void AutoExposure::apply(double factor)
+{
+    PvGenFloat* exposure_param = dynamic_cast<PvGenFloat *>(params->Get("ExposureTime"));
+    PvGenFloat* gain_param = dynamic_cast<PvGenFloat *>(params->Get("Gain"));
+    if (exposure_param == nullptr || gain_param == nullptr)
+    {
+        return;
+    }
+
+    double exposure, gain;
+    exposure_param->GetValue(exposure);
+    gain_param->GetValue(gain);
+
+    // Gain is treated as roughly linear in brightness. Exposure is preferred
+    // since it costs no noise: brighten with exposure first then gain, darken
+    // by taking gain off first.
+    double new_exposure = exposure * factor;
+    double new_gain = gain;
+    if (factor > 1.0)
+    {
+        if (new_exposure > MAX_EXPOSURE - 1)
+        {
+            new_gain = gain * new_exposure / (MAX_EXPOSURE - 1);
+            new_exposure = MAX_EXPOSURE - 1;
+        }
+    }
+    else if (gain > MIN_GAIN)
+    {
+        new_gain = std::max<double>(gain * factor, MIN_GAIN);
+        new_exposure = exposure * factor * gain / new_gain;
+    }
+
+    new_exposure = std::max<double>(MIN_EXPOSURE, std::min<double>(MAX_EXPOSURE - 1, new_exposure));
+    new_gain = std::max<double>(MIN_GAIN, std::min<double>(MAX_GAIN, new_gain));
+
+    if (new_exposure != exposure)
+    {
+        exposure_param->SetValue(std::round(new_exposure));
+    }
+    if (new_gain != gain)
+    {
+        gain_param->SetValue(std::round(new_gain));
+    }
+}
+
+void AutoExposure::observeSequenceFrame(const Histogram& hist)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+
+    float p = hist.percentile(percentile);
+    if (seq_frames == 0)
+    {
+        seq_first = p;
+    }
+
+    seq_peak = std::max(seq_peak, p);
+    seq_saturation = std::max(seq_saturation, hist.saturation());
+    seq_frames++;
+}
+
+void AutoExposure::endSequence()
+{
+    std::lock_guard<std::mutex> lock(mtx);
+
+    if (seq_frames > 1 && seq_first >= 1.0f)
+    {
+        float measured = seq_peak / seq_first;
+        if (seq_saturation > AE_SATURATION_LIMIT)
+        {
+            // Fm clipped, so the real ratio is larger than what we saw
+            fm_headroom = std::max(fm_headroom, measured) * 1.25f;
+            std::cout << "Fm frame saturated, headroom now " << fm_headroom << std::endl;
+        }
+        else
+        {
+            // Keep a 10% margin on the observed ratio
+            fm_headroom = std::max(1.0f, measured * 1.1f);
+        }
+        converged = false;
+    }
+
+    seq_first = 0.0f;
+    seq_peak = 0.0f;
+    seq_saturation = 0.0f;
+    seq_frames = 0;
+}
@@ -0,0 +1,84 @@
+// *****************************************************************************
+//
+// autoexposure.h
+// Closed loop exposure/gain control driven by the viewfinder histogram.
+//
+// The loop drives a chosen percentile of the viewfinder frame towards a
+// target level. The target is scaled down by the expected Fm/F ratio so that
+// the brighter saturating pulse frame of a PAM sequence still fits in range.
+// That ratio is learnt from the recorded sequences themselves.
+//
+// Parameters are written straight to the camera without restarting the stream.
+//
+// *****************************************************************************
+
+
+#ifndef __AUTOEXPOSURE_H__
+#define __AUTOEXPOSURE_H__
+
+#include <atomic>
+#include <mutex>
+#include <PvGenParameterArray.h>
+
+#include "histogram.h"
+
+// Percentile of the frame that is regulated, and the level (fraction of
+// full scale) it should sit at before the Fm headroom is applied.
+#define DEFAULT_AE_PERCENTILE 0.99f
+#define DEFAULT_AE_LEVEL 0.85f
+
+// Starting guess for Fm / measuring frame brightness
+#define DEFAULT_FM_HEADROOM 4.0f
+
+// Fraction of pixels in the top bin that counts as a saturated frame
+#define AE_SATURATION_LIMIT 0.001f
+
+// Frames to skip after a change so the new setting has reached the sensor
+#define AE_SETTLE_FRAMES 2
+
+class AutoExposure
+{
+    public:
+        AutoExposure(PvGenParameterArray* _params);
+
+        // After a reconnect the device has a new parameter array
+        void setParameters(PvGenParameterArray* _params);
+
+        void setEnabled(bool _enabled);
+        bool isEnabled();
+        void setTarget(float _percentile, float _level);
+        void setFmHeadroom(float _headroom);
+        float getFmHeadroom();
+        bool isConverged();
+
+        // Viewfinder frames
+        void update(const Histogram& hist);
+
+        // Frames recorded during a PAM sequence. The first frame is taken as
+        // the measuring (F0) frame, the brightest as Fm.
+        void observeSequenceFrame(const Histogram& hist);
+        void endSequence();
+
+    private:
+        void apply(double factor);
+
+    private:
+        PvGenParameterArray* params;
+        std::atomic<bool> enabled;
+        std::atomic<bool> converged;
+        std::mutex mtx;
+
+        float percentile;
+        float level;
+        float fm_headroom;
+        unsigned int settle;
+
+        // Sequence bookkeeping
+        float seq_first;
+        float seq_peak;
+        float seq_saturation;
+        unsigned int seq_frames;
+};
+
+
+#endif // __AUTOEXPOSURE_H__
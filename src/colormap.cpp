@@ -0,0 +1,166 @@
+#include "colormap.h"
+#include <algorithm>
+
+struct ColorStop
+{
+    float at;
+    uint8_t r, g, b;
+};
+
+// Palettes as a few stops, interpolated linearly into the table
+static const std::vector<ColorStop> PALETTE_STOPS[ColorMap::PALETTE_COUNT] =
+{
+    // Gray
+    {{0.0f, 0, 0, 0}, {1.0f, 255, 255, 255}},
+
+    // Viridis
+    {{0.0f, 68, 1, 84}, {0.125f, 71, 44, 122}, {0.25f, 59, 81, 139}, {0.375f, 44, 113, 142}, {0.5f, 33, 144, 141},
+     {0.625f, 39, 173, 129}, {0.75f, 92, 200, 99}, {0.875f, 170, 220, 50}, {1.0f, 253, 231, 37}},
+
+    // Jet
+    {{0.0f, 0, 0, 128}, {0.125f, 0, 0, 255}, {0.375f, 0, 255, 255}, {0.625f, 255, 255, 0}, {0.875f, 255, 0, 0}, {1.0f, 128, 0, 0}},
+
+    // PAM
+    {{0.0f, 0, 0, 0}, {0.14f, 230, 0, 0}, {0.29f, 255, 140, 0}, {0.43f, 255, 230, 0}, {0.57f, 0, 200, 0},
+     {0.71f, 0, 80, 255}, {0.86f, 150, 0, 220}, {1.0f, 255, 120, 220}}
+};
+
+static const char* PALETTE_NAMES[ColorMap::PALETTE_COUNT] = {"Gray", "Viridis", "Jet", "PAM"};
+
+static uint32_t pack(uint8_t r, uint8_t g, uint8_t b, uint8_t a)
+{
+    // RGBA in memory on a little endian host
+    return r | (g << 8) | (b << 16) | (static_cast<uint32_t>(a) << 24);
+}
+
+ColorMap::ColorMap(int _palette, float _min, float _max) :
+    palette(PALETTE_VIRIDIS), min(_min), max(_max), invalid(pack(0, 0, 0, 0))
+{
+    if (_palette >= 0 && _palette < PALETTE_COUNT)
+    {
+        palette = _palette;
+    }
+    build();
+}
+
+void ColorMap::setPalette(int _palette)
+{
+    if (_palette >= 0 && _palette < PALETTE_COUNT && _palette != palette)
+    {
+        palette = _palette;
+        build();
+    }
+}
+
+void ColorMap::setRange(float _min, float _max)
+{
+    if (_min != min || _max != max)
+    {
+        min = _min;
+        max = _max;
+        build();
+    }
+}
+
+void ColorMap::setInvalidColor(uint8_t r, uint8_t g, uint8_t b, uint8_t a)
+{
+    invalid = pack(r, g, b, a);
+    build();
+}
+
+int ColorMap::getPalette()
+{
+    return palette;
+}
+
+float ColorMap::getMin()
+{
+    return min;
+}
+
+float ColorMap::getMax()
+{
+    return max;
+}
+
+const char* ColorMap::getPaletteName(int _palette)
+{
+    return (_palette >= 0 && _palette < PALETTE_COUNT) ? PALETTE_NAMES[_palette] : "";
+}
+
+void ColorMap::build()
+{
+    const std::vector<ColorStop>& stops = PALETTE_STOPS[palette];
+    lut.resize(COLORMAP_SIZE + 1);
+    size_t s = 0;
+    for (uint32_t i = 0; i < COLORMAP_SIZE; i++)
+    {
+        float at = static_cast<float>(i) / (COLORMAP_SIZE - 1);
+        while (s + 2 < stops.size() && at > stops[s + 1].at)
+        {
+            s++;
+        }
+        const ColorStop& a = stops[s];
+        const ColorStop& b = stops[s + 1];
+        float t = std::min(1.0f, std::max(0.0f, (at - a.at) / (b.at - a.at)));
+        lut[i] = pack(static_cast<uint8_t>(a.r + t * (b.r - a.r) + 0.5f),
+                      static_cast<uint8_t>(a.g + t * (b.g - a.g) + 0.5f),
+                      static_cast<uint8_t>(a.b + t * (b.b - a.b) + 0.5f), 255);
+    }
+    lut[COLORMAP_SIZE] = invalid;
+
+    // Rebuilt for the new range when next needed
+    lut16.clear();
+}
+
+// Table index of a value. NaN maps to the invalid entry. Written with selects
+// rather than branches so the row loops vectorise.
+static inline uint32_t lutIndex(float v, float min, float scale)
+{
+    const float top = COLORMAP_SIZE - 1;
+    float t = (v - min) * scale;
+    t = (t > 0.0f) ? t : 0.0f;
+    t = (t < top) ? t : top;
+    uint32_t i = static_cast<uint32_t>(t + 0.5f);
+    return (v == v) ? i : COLORMAP_SIZE;
+}
+
+void ColorMap::render(const float* in, uint32_t width, uint32_t height, uint32_t in_stride, uint8_t* out, uint32_t out_stride)
+{
+    float scale = (max > min) ? (COLORMAP_SIZE - 1) / (max - min) : 0.0f;
+    const uint32_t* table = lut.data();
+    for (uint32_t y = 0; y < height; y++)
+    {
+        const float* row = in + static_cast<size_t>(y) * in_stride;
+        uint32_t* o = reinterpret_cast<uint32_t*>(out + static_cast<size_t>(y) * out_stride);
+        for (uint32_t x = 0; x < width; x++)
+        {
+            o[x] = table[lutIndex(row[x], min, scale)];
+        }
+    }
+}
+
+void ColorMap::render(const uint16_t* in, uint32_t width, uint32_t height, uint32_t in_stride, uint8_t* out, uint32_t out_stride)
+{
+    // Every raw value gets its own entry, so the loop is a single lookup
+    if (lut16.empty())
+    {
+        float scale = (max > min) ? (COLORMAP_SIZE - 1) / (max - min) : 0.0f;
+        lut16.resize(65536);
+        for (uint32_t v = 0; v < lut16.size(); v++)
+        {
+            lut16[v] = lut[lutIndex(static_cast<float>(v), min, scale)];
+        }
+    }
+
+    const uint32_t* table = lut16.data();
+    for (uint32_t y = 0; y < height; y++)
+    {
+        const uint16_t* row = in + static_cast<size_t>(y) * in_stride;
+        uint32_t* o = reinterpret_cast<uint32_t*>(out + static_cast<size_t>(y) * out_stride);
+        for (uint32_t x = 0; x < width; x++)
+        {
+            o[x] = table[row[x]];
+        }
+    }
+}
@@ -0,0 +1,63 @@
+// *****************************************************************************
+//
+// colormap.h
+// False colour rendering of float maps (Fv/Fm and friends) and 16 bit
+// frames. Values are scaled into a range and looked up in a palette table, so
+// each pixel costs one multiply, a clamp and a load. Output is RGBA, 4 bytes
+// per pixel in R, G, B, A memory order (PvPixelRGBa8).
+//
+// NaN, which the fluorescence kernels use for background, gets the invalid
+// colour. It is transparent black unless set otherwise.
+//
+// *****************************************************************************
+
+
+#ifndef __COLORMAP_H__
+#define __COLORMAP_H__
+
+#include <cstdint>
+#include <vector>
+
+#define COLORMAP_SIZE 1024      // Palette entries between min and max
+
+class ColorMap
+{
+    public:
+        enum PALETTES
+        {
+            PALETTE_GRAY,
+            PALETTE_VIRIDIS,
+            PALETTE_JET,
+            PALETTE_PAM,        // Black, red, yellow, green, blue, pink, as on imaging PAM software
+            PALETTE_COUNT
+        };
+
+        ColorMap(int _palette = PALETTE_VIRIDIS, float _min = 0.0f, float _max = 1.0f);
+
+        void setPalette(int _palette);
+        void setRange(float _min, float _max);
+        void setInvalidColor(uint8_t r, uint8_t g, uint8_t b, uint8_t a);
+        int getPalette();
+        float getMin();
+        float getMax();
+        static const char* getPaletteName(int _palette);
+
+        // in_stride is in elements, out_stride in bytes. 16 bit input is
+        // scaled with the same range, in raw pixel values.
+        void render(const float* in, uint32_t width, uint32_t height, uint32_t in_stride, uint8_t* out, uint32_t out_stride);
+        void render(const uint16_t* in, uint32_t width, uint32_t height, uint32_t in_stride, uint8_t* out, uint32_t out_stride);
+
+    private:
+        void build();
+
+    private:
+        int palette;
+        float min;
+        float max;
+        uint32_t invalid;
+        std::vector<uint32_t> lut;      // COLORMAP_SIZE entries, then the invalid colour
+        std::vector<uint32_t> lut16;    // One entry per 16 bit value, built on first use
+};
+
+
+#endif // __COLORMAP_H__
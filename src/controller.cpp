@@ -0,0 +1,114 @@
+#include "controller.h"
+#include "metrics.h"
+#include <algorithm>
+
+Controller::Controller(Receiver* _receiver) :
+    receiver(_receiver),
+    running(false)
+{
+
+}
+
+Controller::~Controller()
+{
+    stop();
+}
+
+void Controller::start()
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    if (running)
+    {
+        return;
+    }
+    running = true;
+    thread = std::thread(&Controller::run, this);
+}
+
+void Controller::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        running = false;
+        queue.clear();
+    }
+    cv.notify_all();
+    if (thread.joinable())
+    {
+        thread.join();
+    }
+}
+
+void Controller::post(const std::string& key, Command command)
+{
+    static Counter* coalesced = Metrics::instance().counter("pam_controller_coalesced_total", "Queued commands replaced by a newer one");
+
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto queued = std::chrono::steady_clock::now();
+        if (!key.empty())
+        {
+            // The newer command goes to the back, behind anything queued
+            // since the one it replaces. Its wait is counted from the first.
+            auto it = std::find_if(queue.begin(), queue.end(), [&key](const Entry& e) { return e.key == key; });
+            if (it != queue.end())
+            {
+                queued = it->queued;
+                queue.erase(it);
+                coalesced->inc();
+            }
+        }
+        queue.push_back({key, command, queued});
+    }
+    cv.notify_all();
+}
+
+void Controller::setResultCallback(ResultCallback cb)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    on_result = cb;
+}
+
+size_t Controller::getPending()
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    return queue.size();
+}
+
+void Controller::run()
+{
+    static Counter* commands = Metrics::instance().counter("pam_controller_commands_total", "Commands run on the controller thread");
+    static Gauge* pending = Metrics::instance().gauge("pam_controller_pending", "Commands waiting on the controller thread");
+    static MetricsHistogram* command_ms = Metrics::instance().histogram("pam_controller_command_ms", "Time from queueing a command until it finished",
+        {1.0, 5.0, 10.0, 50.0, 100.0, 250.0, 500.0, 1000.0, 5000.0});
+
+    std::unique_lock<std::mutex> lock(mtx);
+    while (true)
+    {
+        cv.wait(lock, [this]() { return !running || !queue.empty(); });
+        if (!running)
+        {
+            break;
+        }
+
+        Entry entry = queue.front();
+        queue.pop_front();
+        pending->set(static_cast<double>(queue.size()));
+        ResultCallback cb = on_result;
+        lock.unlock();
+
+        if (receiver->isConnected())
+        {
+            entry.command(receiver);
+        }
+        DeviceParams dp = receiver->getDeviceParams();
+        if (cb)
+        {
+            cb(dp);
+        }
+
+        commands->inc();
+        command_ms->observe(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - entry.queued).count());
+        lock.lock();
+    }
+}
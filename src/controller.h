@@ -0,0 +1,71 @@
+// *****************************************************************************
+//
+// controller.h
+// Runs camera commands on their own thread so the GUI never waits on the
+// Receiver. Changing gain, exposure or binning takes the receiver lock, may
+// restart the stream and goes out over GigE, which can take hundreds of ms.
+//
+// Commands are queued with a key. A queued command that hasn't started yet
+// is dropped when a newer one with the same key is queued, so a burst of
+// edits to one field only reaches the camera once, with the last value, and
+// still after every command queued before it. An empty key is
+// never coalesced (e.g. the start/stop toggle).
+//
+// After each command the device params are read back and passed to the
+// result callback, on the controller thread. The GUI posts them to its own
+// thread from there.
+//
+// *****************************************************************************
+
+
+#ifndef __CONTROLLER_H__
+#define __CONTROLLER_H__
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "receiver.h"
+
+class Controller
+{
+    public:
+        typedef std::function<void(Receiver*)> Command;
+        typedef std::function<void(const DeviceParams&)> ResultCallback;
+
+        Controller(Receiver* _receiver);
+        ~Controller();
+
+        void start();
+        void stop();    // Drops queued commands, waits for a running one
+
+        void post(const std::string& key, Command command);
+        void setResultCallback(ResultCallback cb);
+        size_t getPending();
+
+    private:
+        struct Entry
+        {
+            std::string key;
+            Command command;
+            std::chrono::steady_clock::time_point queued;
+        };
+
+        void run();
+
+    private:
+        Receiver* receiver;
+        std::deque<Entry> queue;
+        ResultCallback on_result;
+
+        std::thread thread;
+        std::mutex mtx;
+        std::condition_variable cv;
+        bool running;
+};
+
+
+#endif // __CONTROLLER_H__
@@ -0,0 +1,240 @@
+#include "correlator.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+#define DEFAULT_TICK_FREQUENCY 1e9  // (Hz)
+
+// GigE Vision 1.x block IDs are 16 bit, wrap to 1 and never use 0
+#define BLOCK_ID_WRAP 0xFFFF
+
+FrameCorrelator::FrameCorrelator() :
+    tick_frequency(DEFAULT_TICK_FREQUENCY),
+    tolerance(DEFAULT_TRIGGER_TOLERANCE),
+    active(false),
+    first(true),
+    first_timestamp(0),
+    last_block(0),
+    last_index(0),
+    handled(0)
+{
+    Metrics& m = Metrics::instance();
+    missing_total = m.counter("pam_frames_missing_total", "Triggered frames that never arrived");
+    duplicate_total = m.counter("pam_frames_duplicate_total", "Frames matched to a trigger that already had one");
+    late_total = m.counter("pam_frames_late_total", "Frames further than the tolerance from their trigger");
+    unexpected_total = m.counter("pam_frames_unexpected_total", "Frames after the last trigger or after the sequence closed");
+    valid_total = m.counter("pam_sequences_total{result=\"valid\"}", "Triggered sequences by correlation result");
+    invalid_total = m.counter("pam_sequences_total{result=\"invalid\"}", "Triggered sequences by correlation result");
+    error_ms = m.histogram("pam_trigger_error_ms", "Absolute frame to trigger timing error (ms)",
+        {0.01, 0.05, 0.1, 0.5, 1.0, 2.0, 5.0, 10.0, 50.0});
+}
+
+void FrameCorrelator::begin(const std::vector<double>& _triggers)
+{
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        triggers = _triggers;
+        std::sort(triggers.begin(), triggers.end());
+    }
+    reset();
+}
+
+void FrameCorrelator::reset()
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    seen.assign(triggers.size(), false);
+    active = !triggers.empty();
+    first = true;
+    first_timestamp = 0;
+    last_block = 0;
+    last_index = 0;
+    handled = 0;
+    report = SequenceReport();
+    report.expected = triggers.size();
+}
+
+void FrameCorrelator::setTickFrequency(double hz)
+{
+    if (hz > 0)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        tick_frequency = hz;
+    }
+}
+
+void FrameCorrelator::setTolerance(double ms)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    tolerance = ms;
+}
+
+bool FrameCorrelator::isActive()
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    return active;
+}
+
+void FrameCorrelator::flag(const char* what, size_t index, double error)
+{
+    std::cout << "Correlator: " << what << " frame at trigger " << index + 1 << "/" << triggers.size()
+              << " (" << error << " ms)" << std::endl;
+}
+
+uint64_t FrameCorrelator::blockStep(uint64_t block_id)
+{
+    if (block_id > last_block)
+    {
+        return block_id - last_block;
+    }
+
+    // Wrapped 16 bit ID, 0 is skipped
+    if (last_block <= BLOCK_ID_WRAP && block_id < last_block && block_id > 0)
+    {
+        return block_id + BLOCK_ID_WRAP - last_block;
+    }
+
+    return 0;
+}
+
+bool FrameCorrelator::onFrame(uint64_t block_id, uint64_t timestamp)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+
+    if (triggers.empty())
+    {
+        return true;
+    }
+
+    // A frame after end() belongs to no sequence, most likely the tail of
+    // the last one arriving after the unlock
+    if (!active)
+    {
+        report.unexpected++;
+        unexpected_total->inc();
+        std::cout << "Correlator: frame " << block_id << " after the sequence closed" << std::endl;
+        return false;
+    }
+
+    // The first frame defines where trigger 0 is on the device clock. If
+    // that frame is lost the rest read as one trigger early, which shows up
+    // as timing errors rather than as a missing frame.
+    if (first)
+    {
+        first = false;
+        first_timestamp = timestamp;
+        last_block = block_id;
+        last_index = 0;
+        seen[0] = true;
+        report.matched++;
+        error_ms->observe(0.0);
+        return true;
+    }
+
+    double rel = (timestamp >= first_timestamp) ? (timestamp - first_timestamp) * 1000.0 / tick_frequency : -1.0;
+    double t = triggers[0] + rel;
+
+    // Nearest expected trigger
+    size_t j = std::lower_bound(triggers.begin(), triggers.end(), t) - triggers.begin();
+    if (j == triggers.size() || (j > 0 && t - triggers[j - 1] < triggers[j] - t))
+    {
+        j--;
+    }
+    double error = t - triggers[j];
+
+    uint64_t step = blockStep(block_id);
+    bool ok = true;
+
+    if (step == 0 || seen[j])
+    {
+        if (step > 0 && j == triggers.size() - 1 && error > tolerance)
+        {
+            report.unexpected++;
+            unexpected_total->inc();
+            flag("unexpected", j, error);
+        }
+        else
+        {
+            report.duplicate++;
+            duplicate_total->inc();
+            flag("duplicate", j, error);
+        }
+        last_block = std::max(last_block, block_id);
+        return false;
+    }
+
+    // Frames lost in between, by trigger time or by block ID, whichever
+    // says more
+    uint64_t skipped = (j > last_index) ? j - last_index - 1 : 0;
+    uint64_t missing = std::max<uint64_t>(skipped, step - 1);
+    if (missing > 0)
+    {
+        report.missing += missing;
+        missing_total->inc(missing);
+        std::cout << "Correlator: " << missing << " frame(s) missing before trigger " << j + 1 << "/" << triggers.size() << std::endl;
+        ok = false;
+    }
+
+    seen[j] = true;
+    report.matched++;
+    report.max_error = std::max(report.max_error, std::fabs(error));
+    error_ms->observe(std::fabs(error));
+
+    if (std::fabs(error) > tolerance)
+    {
+        report.late++;
+        late_total->inc();
+        flag("late", j, error);
+        ok = false;
+    }
+
+    last_block = block_id;
+    last_index = std::max(last_index, j);
+    return ok;
+}
+
+SequenceReport FrameCorrelator::end()
+{
+    std::lock_guard<std::mutex> lock(mtx);
+
+    if (!active)
+    {
+        return report;
+    }
+    active = false;
+
+    // Triggers after the last frame never produced one. The first frame is
+    // always matched to trigger 0, so with no frames at all everything is
+    // missing.
+    unsigned int trailing = 0;
+    for (size_t i = first ? 0 : last_index + 1; i < triggers.size(); i++)
+    {
+        trailing += seen[i] ? 0 : 1;
+    }
+    if (trailing > 0)
+    {
+        report.missing += trailing;
+        missing_total->inc(trailing);
+        std::cout << "Correlator: " << trailing << " frame(s) missing at the end of the sequence" << std::endl;
+    }
+
+    report.valid = report.missing == 0 && report.duplicate == 0 && report.late == 0 &&
+                   report.unexpected == 0 && report.matched == report.expected;
+    (report.valid ? valid_total : invalid_total)->inc();
+
+    return report;
+}
+
+void FrameCorrelator::onHandled()
+{
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        handled++;
+    }
+    handled_cv.notify_all();
+}
+
+bool FrameCorrelator::waitHandled(unsigned int frames, unsigned int timeout_ms)
+{
+    std::unique_lock<std::mutex> lock(mtx);
+    return handled_cv.wait_for(lock, std::chrono::milliseconds(timeout_ms), [this, frames]() { return handled >= frames; });
+}
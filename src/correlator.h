@@ -0,0 +1,103 @@
+// *****************************************************************************
+//
+// correlator.h
+// Matches the frames of a triggered sequence against the camera triggers in
+// the LED command string, so a sequence with a missing, duplicated or late
+// frame is flagged as soon as it happens and marked invalid.
+//
+// The device timestamp of the first frame is aligned to the first trigger.
+// Each following frame is assigned to the nearest expected trigger and its
+// timing error is recorded. Skipped triggers and gaps in the block ID are
+// both counted as missing frames.
+//
+// *****************************************************************************
+
+
+#ifndef __CORRELATOR_H__
+#define __CORRELATOR_H__
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "metrics.h"
+
+// A frame further than this from its trigger is late (or early)
+#define DEFAULT_TRIGGER_TOLERANCE 5.0   // (ms)
+
+struct SequenceReport
+{
+    unsigned int expected = 0;
+    unsigned int matched = 0;
+    unsigned int missing = 0;
+    unsigned int duplicate = 0;
+    unsigned int late = 0;
+    unsigned int unexpected = 0;
+    double max_error = 0.0;     // (ms)
+    bool valid = false;
+};
+
+class FrameCorrelator
+{
+    public:
+        FrameCorrelator();
+
+        // Expected trigger times (ms from the start of the sequence), also
+        // resets. With no triggers frames aren't checked.
+        void begin(const std::vector<double>& _triggers);
+
+        // Start over for the next sequence with the same triggers
+        void reset();
+
+        // Device timestamp ticks per second (GevTimestampTickFrequency)
+        void setTickFrequency(double hz);
+        void setTolerance(double ms);
+
+        // Returns false if the frame breaks the sequence
+        bool onFrame(uint64_t block_id, uint64_t timestamp);
+
+        // Close the sequence; triggers without a frame count as missing
+        SequenceReport end();
+
+        // The consumer is done with a recorded frame (checked, previewed and
+        // saved). waitHandled() waits until that is true of frames frames
+        // since the last reset, so the sequence isn't closed while its last
+        // frame is still being worked on.
+        void onHandled();
+        bool waitHandled(unsigned int frames, unsigned int timeout_ms);
+
+        // Triggers are set and the sequence hasn't been closed
+        bool isActive();
+
+    private:
+        void flag(const char* what, size_t index, double error);
+        uint64_t blockStep(uint64_t block_id);
+
+    private:
+        std::mutex mtx;
+        std::condition_variable handled_cv;
+        std::vector<double> triggers;
+        std::vector<bool> seen;
+        double tick_frequency;
+        double tolerance;
+
+        bool active;
+        bool first;
+        uint64_t first_timestamp;   // Aligned to trigger 0
+        uint64_t last_block;
+        size_t last_index;
+        unsigned int handled;
+        SequenceReport report;
+
+        Counter* missing_total;
+        Counter* duplicate_total;
+        Counter* late_total;
+        Counter* unexpected_total;
+        Counter* valid_total;
+        Counter* invalid_total;
+        MetricsHistogram* error_ms;
+};
+
+
+#endif // __CORRELATOR_H__
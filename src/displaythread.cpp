@@ -1,10 +1,33 @@
 #include "displaythread.h"
+#include "metrics.h"
+#include <algorithm>
 #include <chrono>
 #include <sstream>
 #include <iostream>
 
+// Significant bits of the supported mono formats, 0 for anything else
+static uint32_t significantBits(PvPixelType type)
+{
+    switch (type)
+    {
+        case PvPixelMono8: return 8;
+        case PvPixelMono10: return 10;
+        case PvPixelMono12: return 12;
+        case PvPixelMono16: return 16;
+        default: return 0;
+    }
+}
+
 void DisplayThread::setSaving(const bool& _save)
 {
+    if (_save && !is_saving)
+    {
+        recording++;
+        if (fvfm_preview != nullptr)
+        {
+            fvfm_preview->begin();
+        }
+    }
     is_saving = _save;
     sequence = 1;
 }
@@ -26,31 +49,393 @@ void DisplayThread::setSavingPath(const std::string& _path)
     path = _path;
 }
 
+void DisplayThread::setAutoExposure(AutoExposure* _auto_exposure)
+{
+    auto_exposure = _auto_exposure;
+}
+
+void DisplayThread::setCorrelator(FrameCorrelator* _correlator)
+{
+    correlator = _correlator;
+}
+
+void DisplayThread::setSessionWriter(SessionWriter* _session_writer)
+{
+    session_writer = _session_writer;
+}
+
+void DisplayThread::setFrameRing(FrameRing* _frame_ring)
+{
+    frame_ring = _frame_ring;
+}
+
+void DisplayThread::setFvFmPreview(FvFmPreview* _fvfm_preview)
+{
+    fvfm_preview = _fvfm_preview;
+}
+
+void DisplayThread::setFrameStats(FrameStatsRing* _frame_stats)
+{
+    frame_stats = _frame_stats;
+}
+
+void DisplayThread::setPacketSize(uint32_t _packet_size)
+{
+    if (_packet_size > GVSP_IP_UDP_OVERHEAD + GVSP_HEADER_SIZE)
+    {
+        packet_size = _packet_size;
+    }
+}
+
+bool DisplayThread::showFvFm(bool display)
+{
+    static Gauge* fvfm_mean = Metrics::instance().gauge("pam_fvfm_mean", "Mean Fv/Fm of the last recorded sequence");
+    static MetricsHistogram* render_ms = Metrics::instance().histogram("pam_fvfm_render_ms", "Time to compute and false colour the Fv/Fm preview",
+        {1, 2, 5, 10, 20, 50, 100});
+
+    auto start = std::chrono::steady_clock::now();
+    if (fvfm_preview == nullptr || !fvfm_preview->compute())
+    {
+        return false;
+    }
+
+#ifndef PAM_HEADLESS
+    if (display && display_wnd != nullptr)
+    {
+        // RGBA buffer of the map's size, reallocated when the ROI changes
+        uint32_t width = fvfm_preview->getWidth();
+        uint32_t height = fvfm_preview->getHeight();
+        if (fvfm_buffer == nullptr || fvfm_buffer->GetImage()->GetWidth() != width || fvfm_buffer->GetImage()->GetHeight() != height)
+        {
+            delete fvfm_buffer;
+            fvfm_buffer = new PvBuffer();
+            fvfm_buffer->GetImage()->Alloc(width, height, PvPixelRGBa8);
+        }
+
+        PvImage* image = fvfm_buffer->GetImage();
+        fvfm_preview->render(image->GetDataPointer(), width * 4 + image->GetPaddingX());
+
+        // After a recording the stream is paused, so there is no frame
+        // callback to hand the map to; take the display thread's lock instead
+        std::lock_guard<std::mutex> lock(display_mtx);
+        display_wnd->Display(*fvfm_buffer, false);
+    }
+#endif
+
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    render_ms->observe(ms);
+    fvfm_mean->set(fvfm_preview->getMean());
+    std::cout << "Fv/Fm " << fvfm_preview->getMean() << " over " << fvfm_preview->getValid() << " pixels (" << ms << " ms)" << std::endl;
+    return true;
+}
+
+void DisplayThread::reportQuenching()
+{
+    static Gauge* phi_psii = Metrics::instance().gauge("pam_phipsii", "Mean PhiPSII of the last saturating pulse under actinic light");
+    static Gauge* npq = Metrics::instance().gauge("pam_npq", "Mean NPQ of the last saturating pulse under actinic light");
+    static Counter* points = Metrics::instance().counter("pam_quenching_points_total", "Saturating pulses analysed under actinic light");
+
+    QuenchingPoint point;
+    while (fvfm_preview->takePoint(point))
+    {
+        phi_psii->set(point.phi_psii);
+        npq->set(point.npq);
+        points->inc();
+        std::cout << "Pulse at frame " << point.frame + 1 << ": PhiPSII " << point.phi_psii << ", qP " << point.qp << ", qL " << point.ql
+                  << ", NPQ " << point.npq << " over " << point.valid << " pixels" << std::endl;
+    }
+}
+
+double DisplayThread::getHistogramUs()
+{
+    return histogram.getElapsedUs();
+}
+
+void DisplayThread::setStartTime(std::chrono::steady_clock::time_point _start_time)
+{
+    start_time = _start_time;
+}
+
+uint64_t DisplayThread::getFrameCount()
+{
+    return frame_count;
+}
+
+uint64_t DisplayThread::getFramesSaved()
+{
+    return saved_count;
+}
+
+bool DisplayThread::isIdle()
+{
+    uint64_t retrieved = frame_count;
+    return done_count == retrieved;
+}
+
+std::chrono::steady_clock::time_point DisplayThread::getFirstFrameTime()
+{
+    // Written once before frame_count leaves zero
+    return first_frame;
+}
+
 DisplayThread::DisplayThread(PvDisplayWnd* _display_wnd) :
-    display_wnd(_display_wnd), is_saving(false)
+    display_wnd(_display_wnd), is_saving(false), sequence(1), recording(0), auto_exposure(nullptr), correlator(nullptr),
+    session_writer(nullptr), frame_ring(nullptr), fvfm_preview(nullptr), frame_stats(nullptr),
+    packet_size(DEFAULT_GVSP_PACKET_SIZE), fvfm_buffer(nullptr), next_sink(0), frame_count(0), saved_count(0), done_count(0),
+    start_time(std::chrono::steady_clock::now())
 {
     buffer_writer = new PvBufferWriter();
 }
 
+void DisplayThread::updateHistogram(PvBuffer* _buffer)
+{
+    if (_buffer->GetPayloadType() != PvPayloadTypeImage)
+    {
+        return;
+    }
+
+    PvImage* image = _buffer->GetImage();
+    uint32_t bits = significantBits(image->GetPixelType());
+    if (bits == 0)
+    {
+        return;
+    }
+
+    uint32_t bytes = (bits > 8) ? 2 : 1;
+    uint32_t stride = image->GetWidth() * bytes + image->GetPaddingX();
+    histogram.compute(image->GetDataPointer(), image->GetWidth(), image->GetHeight(), stride, bits);
+
+    if (is_saving)
+    {
+        auto_exposure->observeSequenceFrame(histogram);
+    }
+    else
+    {
+        auto_exposure->update(histogram);
+    }
+}
+
+bool DisplayThread::fillHeader(PvBuffer* _buffer, FrameHeader& header)
+{
+    if (_buffer->GetPayloadType() != PvPayloadTypeImage)
+    {
+        return false;
+    }
+
+    PvImage* image = _buffer->GetImage();
+    header = FrameHeader();
+    header.width = image->GetWidth();
+    header.height = image->GetHeight();
+    header.pixel_type = image->GetPixelType();
+    header.bits = significantBits(image->GetPixelType());
+    header.stride = image->GetWidth() * image->GetBitsPerPixel() / 8 + image->GetPaddingX();
+    header.recording = recording;
+    header.frame = sequence;
+    header.block_id = _buffer->GetBlockID();
+    header.timestamp = _buffer->GetTimestamp();
+    header.wall_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    header.data_size = header.stride * header.height;
+    return true;
+}
+
+bool DisplayThread::storeSession(const FrameHandle& frame, uint32_t& written)
+{
+    if (frame.data() == nullptr)
+    {
+        return false;
+    }
+
+    // The writer needs aligned buffers for O_DIRECT, so this is a copy
+    written = frame.size();
+    frame.countCopy();
+    return session_writer->write(frame.header(), frame.data(), written);
+}
+
+int DisplayThread::addFrameSink(FrameSink sink)
+{
+    std::lock_guard<std::mutex> lock(sink_mtx);
+    int id = next_sink++;
+    sinks[id] = sink;
+    return id;
+}
+
+void DisplayThread::removeFrameSink(int id)
+{
+    std::lock_guard<std::mutex> lock(sink_mtx);
+    sinks.erase(id);
+}
+
+void DisplayThread::recordPackets(PvBuffer* _buffer)
+{
+    // eBUS counts what went wrong rather than what arrived, so the expected
+    // count comes from the size: leader, data packets and trailer
+    uint32_t bytes = (_buffer->GetPayloadType() == PvPayloadTypeImage) ? _buffer->GetImage()->GetImageSize() : _buffer->GetAcquiredSize();
+    uint32_t per_packet = packet_size - GVSP_IP_UDP_OVERHEAD - GVSP_HEADER_SIZE;
+
+    GvspFrameStats s;
+    s.block_id = _buffer->GetBlockID();
+    s.packets_expected = (bytes + per_packet - 1) / per_packet + 2;
+    s.missing = std::min(_buffer->GetLostPacketCount(), s.packets_expected);
+    s.packets_received = s.packets_expected - s.missing;
+    s.resend_requests = _buffer->GetResendGroupRequestedCount();
+    s.resend_packets = _buffer->GetResendPacketRequestedCount();
+    s.resent_received = _buffer->GetPacketsRecoveredCount();
+    s.duplicates = _buffer->GetRedundantPacketCount();
+    s.out_of_order = _buffer->GetPacketOutOfOrderCount();
+    s.complete = _buffer->GetOperationResult().IsOK();
+    frame_stats->push(s);
+}
+
 void DisplayThread::OnBufferRetrieved (PvBuffer *_buffer)
 {
+    static Counter* received = Metrics::instance().counter("pam_frames_received_total", "Buffers retrieved from the pipeline");
+    static Counter* incomplete = Metrics::instance().counter("pam_frames_incomplete_total", "Buffers retrieved with a failed operation result");
+    static Counter* saved = Metrics::instance().counter("pam_frames_saved_total", "Frames written to disk");
+    static Counter* save_errors = Metrics::instance().counter("pam_save_errors_total", "Frames that failed to write");
+    static Counter* bytes = Metrics::instance().counter("pam_bytes_written_total", "Bytes written to disk");
+    static Gauge* histogram_us = Metrics::instance().gauge("pam_histogram_us", "Time of the last auto exposure histogram pass");
+    static Gauge* first_frame_ms = Metrics::instance().gauge("pam_startup_first_frame_ms", "Time from start to the first frame");
+
+    if (frame_count == 0)
+    {
+        first_frame = std::chrono::steady_clock::now();
+        double ms = std::chrono::duration<double, std::milli>(first_frame - start_time).count();
+        first_frame_ms->set(ms);
+        std::cout << "First frame after " << ms << " ms" << std::endl;
+    }
+    frame_count++;
+    received->inc();
+    if (!_buffer->GetOperationResult().IsOK())
+    {
+        incomplete->inc();
+    }
+    if (frame_stats != nullptr)
+    {
+        recordPackets(_buffer);
+    }
+
+    // Auto exposure only needs a histogram while it is running
+    if (auto_exposure != nullptr && auto_exposure->isEnabled())
+    {
+        updateHistogram(_buffer);
+        histogram_us->set(histogram.getElapsedUs());
+    }
+
+    // One shared handle per frame. PvDisplayThread gives the buffer back to
+    // the pipeline after OnBufferDone, which copies the pixels out first for
+    // anyone still holding it.
+    FrameHeader header;
+    const uint8_t* data = nullptr;
+    if (fillHeader(_buffer, header))
+    {
+        data = _buffer->GetImage()->GetDataPointer();
+    }
+    current = FrameHandle(_buffer, header, data, nullptr);
+
     // If saving, do it here
     if (is_saving)
     {
-        buffer_writer->Store(_buffer, PvString(getFileName().c_str()), PvBufferFormatType::PvBufferFormatPNG, NULL);
+        // Check the frame against its trigger before the slow PNG write
+        if (correlator != nullptr)
+        {
+            correlator->onFrame(_buffer->GetBlockID(), _buffer->GetTimestamp());
+        }
+
+        if (fvfm_preview != nullptr && fvfm_preview->addFrame(current.header(), current.data()))
+        {
+            current.countCopy();
+            reportQuenching();
+        }
+
+        uint32_t written = 0;
+        bool ok;
+        if (session_writer != nullptr && session_writer->isOpen())
+        {
+            ok = storeSession(current, written);
+        }
+        else
+        {
+            ok = buffer_writer->Store(_buffer, PvString(getFileName().c_str()), PvBufferFormatType::PvBufferFormatPNG, &written).IsOK();
+        }
+
+        if (ok)
+        {
+            saved_count++;
+            saved->inc();
+            bytes->inc(written);
+        }
+        else
+        {
+            save_errors->inc();
+        }
         sequence++;
+
+        if (correlator != nullptr)
+        {
+            correlator->onHandled();
+        }
+    }
+    else if (frame_ring != nullptr && current.data() != nullptr && frame_ring->isAllocated())
+    {
+        current.countCopy();
+        frame_ring->push(current.header(), current.data(), current.size());
     }
+
+    // Sinks that keep the handle hold the buffer until they drop it
+    std::vector<FrameSink> fns;
+    {
+        std::lock_guard<std::mutex> lock(sink_mtx);
+        for (auto& it : sinks)
+        {
+            fns.push_back(it.second);
+        }
+    }
+    for (auto& fn : fns)
+    {
+        fn(current);
+    }
+    done_count++;
 }
 
 void DisplayThread::OnBufferDisplay (PvBuffer *_buffer)
 {
+#ifndef PAM_HEADLESS
     // Display
-    display_wnd->Display( *_buffer, false);
+    if (display_wnd != nullptr)
+    {
+        std::lock_guard<std::mutex> lock(display_mtx);
+        display_wnd->Display( *_buffer, false);
+    }
+#endif
+}
+
+void DisplayThread::setOverlay(const char* text, bool redraw)
+{
+#ifndef PAM_HEADLESS
+    if (display_wnd != nullptr)
+    {
+        std::lock_guard<std::mutex> lock(display_mtx);
+        display_wnd->SetTextOverlay(text);
+        if (redraw)
+        {
+            display_wnd->Display(display_wnd->GetInternalBuffer());
+        }
+    }
+#endif
 }
 
 void DisplayThread::OnBufferDone (PvBuffer *_buffer)
 {
+    static Counter* detached = Metrics::instance().counter("pam_frames_detached_total", "Frames copied out of their buffer because a sink kept them");
 
+    // Anyone still holding the frame gets its own copy, the buffer goes back
+    // to the stream now
+    FrameHandle frame = current;
+    current.reset();
+    if (frame.holders() > 1 && frame.detach())
+    {
+        detached->inc();
+    }
 }
 
 void DisplayThread::OnBufferLog (const PvString &_log)
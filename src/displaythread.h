@@ -5,6 +5,9 @@
 // display tasks. The PvDisplayThread doesn't know anything about the PvDisplay
 // adaptor. This is implemented purely in the overriden virtual functions.
 //
+// The display window may be null, and in a PAM_HEADLESS build the display
+// code is compiled out entirely so the binary doesn't link PvGUI/Qt.
+//
 // *****************************************************************************
 
 
@@ -12,8 +15,27 @@
 #define __DISPLAYTHREAD_H__
 
 #include <PvDisplayThread.h>
-#include <PvDisplayWnd.h>
 #include <PvBufferWriter.h>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <mutex>
+
+#ifndef PAM_HEADLESS
+#include <PvDisplayWnd.h>
+#else
+class PvDisplayWnd;
+#endif
+
+#include "histogram.h"
+#include "autoexposure.h"
+#include "correlator.h"
+#include "sessionwriter.h"
+#include "framering.h"
+#include "framehandle.h"
+#include "fvfmpreview.h"
+#include "framestats.h"
 
 class DisplayThread : public PvDisplayThread
 {
@@ -21,7 +43,52 @@ class DisplayThread : public PvDisplayThread
         DisplayThread(PvDisplayWnd* _display_wnd);
         void setSaving(const bool& save);
         void setSavingPath(const std::string& _path);
-        
+        void setAutoExposure(AutoExposure* _auto_exposure);
+        void setCorrelator(FrameCorrelator* _correlator);
+
+        // Frames go to the session file while it is open, PNGs otherwise
+        void setSessionWriter(SessionWriter* _session_writer);
+
+        // Viewfinder frames are pushed into the ring while it is allocated
+        void setFrameRing(FrameRing* _frame_ring);
+
+        // Recorded frames are offered to the preview. showFvFm() computes the
+        // map of the last sequence and, with display set, draws it in place
+        // of the live image. Quenching results of sequences with actinic
+        // light are logged and exported per pulse as they come in.
+        void setFvFmPreview(FvFmPreview* _fvfm_preview);
+        bool showFvFm(bool display = true);
+
+        // Text over the image, redrawn at once if asked. Every Display() on
+        // the window goes through the display thread's lock, so the map and
+        // overlays shown from other threads never race a live frame.
+        void setOverlay(const char* text, bool redraw = false);
+
+        // Packet counts of every retrieved buffer go to the ring. The
+        // expected count is worked out from the image size and the
+        // negotiated GevSCPSPacketSize.
+        void setFrameStats(FrameStatsRing* _frame_stats);
+        void setPacketSize(uint32_t _packet_size);
+
+        // Sinks get every retrieved frame on the display thread. They should
+        // return quickly; to work on a frame elsewhere, keep the handle and
+        // read it through pixels(). A kept frame is copied out of its buffer
+        // when the display thread is done with it (see framehandle.h).
+        typedef std::function<void(const FrameHandle&)> FrameSink;
+        int addFrameSink(FrameSink sink);
+        void removeFrameSink(int id);
+        double getHistogramUs();
+
+        // Frames retrieved since construction, and when the first one arrived
+        // (reported relative to the start time)
+        void setStartTime(std::chrono::steady_clock::time_point _start_time);
+        uint64_t getFrameCount();
+        uint64_t getFramesSaved();
+
+        // Every retrieved frame has been through OnBufferRetrieved
+        bool isIdle();
+        std::chrono::steady_clock::time_point getFirstFrameTime();
+
 
     protected:
         // Implement PvDisplayThread callbacks
@@ -32,6 +99,11 @@ class DisplayThread : public PvDisplayThread
 
     private:
         std::string getFileName();
+        void updateHistogram(PvBuffer* _buffer);
+        bool fillHeader(PvBuffer* _buffer, FrameHeader& header);
+        bool storeSession(const FrameHandle& frame, uint32_t& written);
+        void recordPackets(PvBuffer* _buffer);
+        void reportQuenching();
 
     private:
         PvDisplayWnd* display_wnd;
@@ -39,6 +111,26 @@ class DisplayThread : public PvDisplayThread
         std::string path;
         bool is_saving;
         unsigned int sequence;
+        unsigned int recording;
+        AutoExposure* auto_exposure;
+        FrameCorrelator* correlator;
+        SessionWriter* session_writer;
+        FrameRing* frame_ring;
+        FvFmPreview* fvfm_preview;
+        FrameStatsRing* frame_stats;
+        std::atomic<uint32_t> packet_size;
+        PvBuffer* fvfm_buffer;          // RGBA image of the last map
+        std::mutex display_mtx;         // Calls on display_wnd
+        std::map<int, FrameSink> sinks;
+        std::mutex sink_mtx;
+        int next_sink;
+        FrameHandle current;
+        Histogram histogram;
+        std::atomic<uint64_t> frame_count;
+        std::atomic<uint64_t> saved_count;
+        std::atomic<uint64_t> done_count;
+        std::chrono::steady_clock::time_point start_time;
+        std::chrono::steady_clock::time_point first_frame;
 };
 
 
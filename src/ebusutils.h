@@ -254,7 +254,9 @@ void acquireImages( PvDevice *aDevice, PvStream *aStream )
                     std::cout << " Payload type not supported by this sample";
                     break;
                 }
-                std::cout << "  " << lFrameRateVal << " FPS  " << ( lBandwidthVal / 1000000.0 ) << " Mb/s   \r";
+                std::cout << "  " << lFrameRateVal << " FPS  " << ( lBandwidthVal / 1000000.0 ) << " Mb/s";
+                std::cout << "  Lost: " << lBuffer->GetLostPacketCount() << " Resent: " << lBuffer->GetPacketsRecoveredCount()
+                          << "/" << lBuffer->GetResendPacketRequestedCount() << "   \r";
             }
             else
             {
@@ -0,0 +1,245 @@
+#include "fluorescence.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+// Plain loops over one row at a time, written so the compiler vectorises them
+template<typename T>
+static double sumPixels(const ImageView& image)
+{
+    double total = 0.0;
+    for (uint32_t y = 0; y < image.height; y++)
+    {
+        const T* row = reinterpret_cast<const T*>(image.data + static_cast<size_t>(y) * image.stride);
+        uint64_t row_sum = 0;
+        for (uint32_t x = 0; x < image.width; x++)
+        {
+            row_sum += row[x];
+        }
+        total += static_cast<double>(row_sum);
+    }
+    return total;
+}
+
+template<typename T>
+static void fvfmRows(const ImageView& f0, const ImageView& fm, float* out, float min_fm)
+{
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    for (uint32_t y = 0; y < f0.height; y++)
+    {
+        const T* a = reinterpret_cast<const T*>(f0.data + static_cast<size_t>(y) * f0.stride);
+        const T* b = reinterpret_cast<const T*>(fm.data + static_cast<size_t>(y) * fm.stride);
+        float* o = out + static_cast<size_t>(y) * f0.width;
+        for (uint32_t x = 0; x < f0.width; x++)
+        {
+            float m = b[x];
+            float v = (m - a[x]) / m;
+            o[x] = (m >= min_fm) ? v : nan;
+        }
+    }
+}
+
+template<typename T>
+static void levelRows(const ImageView& image, const ImageView* dark, float* out)
+{
+    for (uint32_t y = 0; y < image.height; y++)
+    {
+        const T* a = reinterpret_cast<const T*>(image.data + static_cast<size_t>(y) * image.stride);
+        float* o = out + static_cast<size_t>(y) * image.width;
+        if (dark == nullptr)
+        {
+            for (uint32_t x = 0; x < image.width; x++)
+            {
+                o[x] = a[x];
+            }
+            continue;
+        }
+        const T* d = reinterpret_cast<const T*>(dark->data + static_cast<size_t>(y) * dark->stride);
+        for (uint32_t x = 0; x < image.width; x++)
+        {
+            o[x] = std::max(0.0f, static_cast<float>(a[x]) - static_cast<float>(d[x]));
+        }
+    }
+}
+
+// Inputs and outputs as restrict parameters: with eight pointers the
+// compiler gives up on runtime alias checks and doesn't vectorise.
+static void quenchingPixels(const float* __restrict f0, const float* __restrict fm, const float* __restrict fp, const float* __restrict fmp,
+                            size_t pixels, float min_fm, float* __restrict phi_out, float* __restrict qp_out, float* __restrict ql_out,
+                            float* __restrict npq_out)
+{
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    for (size_t i = 0; i < pixels; i++)
+    {
+        float a = f0[i], m = fm[i], mp = fmp[i], f = fp[i];
+        float inv_mp = 1.0f / mp;
+        float phi = (mp - f) * inv_mp;
+        float npq = (m - mp) * inv_mp;
+        float f0p = a / ((m - a) / m + a * inv_mp);
+        float qp = (mp - f) / (mp - f0p);
+        float ql = qp * f0p / f;
+
+        // x - x is 0 only for finite x, so NaN and inf fail as well. The
+        // results get 0 or NaN added: selecting a division result makes the
+        // compiler move the division under a branch.
+        float mask = (m >= min_fm) ? 0.0f : nan;
+        mask = (mp > 0.0f) ? mask : nan;
+        mask = (f > 0.0f) ? mask : nan;
+        mask = (mp > f0p) ? mask : nan;
+        mask = ((ql - ql) == 0.0f) ? mask : nan;
+        phi_out[i] = phi + mask;
+        qp_out[i] = qp + mask;
+        ql_out[i] = ql + mask;
+        npq_out[i] = npq + mask;
+    }
+}
+
+template<typename T>
+static void labelSums(const ImageView& image, const uint16_t* labels, uint16_t max_label, std::vector<uint64_t>& sums, std::vector<uint64_t>& counts)
+{
+    for (uint32_t y = 0; y < image.height; y++)
+    {
+        const T* row = reinterpret_cast<const T*>(image.data + static_cast<size_t>(y) * image.stride);
+        const uint16_t* label_row = labels + static_cast<size_t>(y) * image.width;
+        for (uint32_t x = 0; x < image.width; x++)
+        {
+            uint16_t l = label_row[x];
+            if (l != 0 && l <= max_label)
+            {
+                sums[l] += row[x];
+                counts[l]++;
+            }
+        }
+    }
+}
+
+void Fluorescence::labelMeans(const ImageView& image, const uint16_t* labels, uint16_t max_label, std::vector<double>& means)
+{
+    means.assign(max_label + 1u, std::numeric_limits<double>::quiet_NaN());
+    if (image.data == nullptr || labels == nullptr)
+    {
+        return;
+    }
+
+    std::vector<uint64_t> sums(max_label + 1u, 0), counts(max_label + 1u, 0);
+    if (image.bytesPerPixel() == 2)
+    {
+        labelSums<uint16_t>(image, labels, max_label, sums, counts);
+    }
+    else
+    {
+        labelSums<uint8_t>(image, labels, max_label, sums, counts);
+    }
+    for (uint32_t l = 1; l <= max_label; l++)
+    {
+        if (counts[l] > 0)
+        {
+            means[l] = static_cast<double>(sums[l]) / counts[l];
+        }
+    }
+}
+
+bool Fluorescence::levels(const ImageView& image, const ImageView* dark, float* out)
+{
+    if (image.data == nullptr || out == nullptr)
+    {
+        return false;
+    }
+    if (dark != nullptr && (dark->data == nullptr || !sameShape(image, *dark)))
+    {
+        dark = nullptr;
+    }
+
+    if (image.bytesPerPixel() == 2)
+    {
+        levelRows<uint16_t>(image, dark, out);
+    }
+    else
+    {
+        levelRows<uint8_t>(image, dark, out);
+    }
+    return true;
+}
+
+void Fluorescence::quenching(const float* f0, const float* fm, const float* fp, const float* fmp, size_t pixels, float min_fm,
+                             const QuenchingMaps& out, QuenchingSums& sums)
+{
+    // Maps first in a loop that vectorises, then the sums over the pixels
+    // that came out valid
+    quenchingPixels(f0, fm, fp, fmp, pixels, min_fm, out.phi_psii, out.qp, out.ql, out.npq);
+
+    sums = QuenchingSums();
+    const size_t row = 4096;
+    for (size_t start = 0; start < pixels; start += row)
+    {
+        size_t end = std::min(pixels, start + row);
+        float phi_sum = 0.0f, qp_sum = 0.0f, ql_sum = 0.0f, npq_sum = 0.0f;
+        uint32_t valid = 0;
+        for (size_t i = start; i < end; i++)
+        {
+            bool ok = out.phi_psii[i] == out.phi_psii[i];
+            phi_sum += ok ? out.phi_psii[i] : 0.0f;
+            qp_sum += ok ? out.qp[i] : 0.0f;
+            ql_sum += ok ? out.ql[i] : 0.0f;
+            npq_sum += ok ? out.npq[i] : 0.0f;
+            valid += ok;
+        }
+        sums.phi_psii += phi_sum;
+        sums.qp += qp_sum;
+        sums.ql += ql_sum;
+        sums.npq += npq_sum;
+        sums.valid += valid;
+    }
+}
+
+bool Fluorescence::sameShape(const ImageView& a, const ImageView& b)
+{
+    return a.width == b.width && a.height == b.height && a.bytesPerPixel() == b.bytesPerPixel();
+}
+
+double Fluorescence::meanLevel(const ImageView& image)
+{
+    if (image.data == nullptr || image.pixels() == 0)
+    {
+        return 0.0;
+    }
+
+    double total = (image.bytesPerPixel() == 2) ? sumPixels<uint16_t>(image) : sumPixels<uint8_t>(image);
+    return total / image.pixels();
+}
+
+size_t Fluorescence::brightest(const std::vector<ImageView>& frames)
+{
+    size_t best = 0;
+    double best_level = -1.0;
+    for (size_t i = 0; i < frames.size(); i++)
+    {
+        double level = meanLevel(frames[i]);
+        if (level > best_level)
+        {
+            best_level = level;
+            best = i;
+        }
+    }
+    return best;
+}
+
+bool Fluorescence::fvfm(const ImageView& f0, const ImageView& fm, float* out, float threshold)
+{
+    if (f0.data == nullptr || fm.data == nullptr || out == nullptr || !sameShape(f0, fm))
+    {
+        return false;
+    }
+
+    // Never divide by a zero Fm, even with the threshold at 0
+    float min_fm = std::max(1.0f, threshold * fm.maxValue());
+    if (f0.bytesPerPixel() == 2)
+    {
+        fvfmRows<uint16_t>(f0, fm, out, min_fm);
+    }
+    else
+    {
+        fvfmRows<uint8_t>(f0, fm, out, min_fm);
+    }
+    return true;
+}
@@ -0,0 +1,90 @@
+// *****************************************************************************
+//
+// fluorescence.h
+// Per-pixel chlorophyll fluorescence parameters from recorded frames. These
+// kernels only need the standard library, so the Python module and offline
+// tools build them without eBUS or Qt.
+//
+// Frames are 8 bit, or up to 16 significant bits in a 16 bit container.
+// Results are float maps of width * height with no row padding. Pixels whose
+// Fm is below the threshold (a fraction of full scale) are NaN, so they drop
+// out of later statistics instead of showing up as 0.
+//
+// *****************************************************************************
+
+
+#ifndef __FLUORESCENCE_H__
+#define __FLUORESCENCE_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Fm below this fraction of full scale is background, not leaf
+#define DEFAULT_FM_THRESHOLD 0.02f
+
+// Light adapted parameters of one saturating pulse, each width * height
+struct QuenchingMaps
+{
+    float* phi_psii = nullptr;      // (Fm' - F') / Fm'
+    float* qp = nullptr;            // (Fm' - F') / (Fm' - F0')
+    float* ql = nullptr;            // qP * F0' / F'
+    float* npq = nullptr;           // (Fm - Fm') / Fm'
+};
+
+// Sums over the pixels where every parameter is defined
+struct QuenchingSums
+{
+    double phi_psii = 0.0;
+    double qp = 0.0;
+    double ql = 0.0;
+    double npq = 0.0;
+    uint64_t valid = 0;
+};
+
+struct ImageView
+{
+    const uint8_t* data = nullptr;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t stride = 0;            // Bytes per row
+    uint32_t bits = 8;              // Significant bits, more than 8 means 16 bit pixels
+
+    uint32_t bytesPerPixel() const { return (bits > 8) ? 2 : 1; }
+    uint32_t maxValue() const { return (1u << bits) - 1; }
+    size_t pixels() const { return static_cast<size_t>(width) * height; }
+};
+
+class Fluorescence
+{
+    public:
+        // Average pixel value, for picking out the saturating pulse frame
+        static double meanLevel(const ImageView& image);
+
+        // Index of the brightest of the frames (the Fm frame of a sequence)
+        static size_t brightest(const std::vector<ImageView>& frames);
+
+        // Fv/Fm = (Fm - F0) / Fm. out holds width * height floats.
+        static bool fvfm(const ImageView& f0, const ImageView& fm, float* out, float threshold = DEFAULT_FM_THRESHOLD);
+
+        // Frame as floats with the dark frame (if any) taken off, clamped at
+        // 0. The quenching kernels work on these, so each frame of a
+        // sequence is converted once.
+        static bool levels(const ImageView& image, const ImageView* dark, float* out);
+
+        // Quenching parameters of one Fm' frame from the dark adapted F0
+        // and Fm and the F' before it, all from levels(). F0' isn't
+        // measured but estimated as F0 / (Fv/Fm + F0/Fm') (Oxborough and
+        // Baker). Pixels with Fm below min_fm (raw counts) are NaN.
+        static void quenching(const float* f0, const float* fm, const float* fp, const float* fmp, size_t pixels, float min_fm,
+                              const QuenchingMaps& out, QuenchingSums& sums);
+
+        // Mean pixel value per label of a width * height label image.
+        // means[l] for l in 1..max_label, NaN where a label has no pixels.
+        static void labelMeans(const ImageView& image, const uint16_t* labels, uint16_t max_label, std::vector<double>& means);
+
+        static bool sameShape(const ImageView& a, const ImageView& b);
+};
+
+
+#endif // __FLUORESCENCE_H__
@@ -0,0 +1,136 @@
+#include "framehandle.h"
+#include "metrics.h"
+
+static const FrameHeader s_empty_header = {};
+
+FrameHandle::Shared::~Shared()
+{
+    static Counter* copies_total = Metrics::instance().counter("pam_frame_copies_total", "Pixel copies made from retrieved frames");
+    static Gauge* copies_last = Metrics::instance().gauge("pam_frame_copies_last", "Pixel copies made from the last released frame");
+    static MetricsHistogram* held_ms = Metrics::instance().histogram("pam_frame_held_ms", "Time from retrieval until the last holder released a frame",
+        {1.0, 2.0, 5.0, 10.0, 20.0, 50.0, 100.0, 500.0});
+
+    copies_total->inc(copies);
+    copies_last->set(copies);
+    held_ms->observe(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - retrieved).count());
+
+    if (on_release)
+    {
+        on_release();
+    }
+}
+
+FrameHandle::FrameHandle()
+{
+
+}
+
+FrameHandle::FrameHandle(PvBuffer* _buffer, const FrameHeader& _header, const uint8_t* _data, ReleaseCallback _on_release) :
+    shared(std::make_shared<Shared>())
+{
+    shared->buffer = _buffer;
+    shared->header = _header;
+    shared->data = _data;
+    shared->on_release = _on_release;
+    shared->copies = 0;
+    shared->retrieved = std::chrono::steady_clock::now();
+}
+
+bool FrameHandle::isValid() const
+{
+    return shared != nullptr;
+}
+
+PvBuffer* FrameHandle::buffer() const
+{
+    return shared ? shared->buffer.load() : nullptr;
+}
+
+const FrameHeader& FrameHandle::header() const
+{
+    return shared ? shared->header : s_empty_header;
+}
+
+const uint8_t* FrameHandle::data() const
+{
+    return shared ? shared->data.load() : nullptr;
+}
+
+uint32_t FrameHandle::size() const
+{
+    return (shared && shared->data != nullptr) ? shared->header.data_size : 0;
+}
+
+long FrameHandle::holders() const
+{
+    return shared.use_count();
+}
+
+void FrameHandle::countCopy() const
+{
+    if (shared)
+    {
+        shared->copies++;
+    }
+}
+
+void FrameHandle::reset()
+{
+    shared.reset();
+}
+
+FrameHandle::Pixels FrameHandle::pixels() const
+{
+    return Pixels(shared);
+}
+
+bool FrameHandle::detach()
+{
+    if (!shared || shared->data == nullptr || shared->buffer == nullptr)
+    {
+        return false;
+    }
+
+    std::unique_lock<std::mutex> lock(shared->mtx);
+    shared->cv.wait(lock, [this]() { return shared->readers == 0; });
+    shared->owned.assign(shared->data.load(), shared->data.load() + shared->header.data_size);
+    shared->data = shared->owned.data();
+    shared->buffer = nullptr;
+    shared->copies++;
+    return true;
+}
+
+FrameHandle::Pixels::Pixels(std::shared_ptr<Shared> _shared) :
+    shared(_shared)
+{
+    if (shared)
+    {
+        std::lock_guard<std::mutex> lock(shared->mtx);
+        shared->readers++;
+    }
+}
+
+FrameHandle::Pixels::Pixels(Pixels&& other) :
+    shared(std::move(other.shared))
+{
+}
+
+FrameHandle::Pixels::~Pixels()
+{
+    if (shared)
+    {
+        std::lock_guard<std::mutex> lock(shared->mtx);
+        shared->readers--;
+        shared->cv.notify_all();
+    }
+}
+
+const uint8_t* FrameHandle::Pixels::data() const
+{
+    return shared ? shared->data.load() : nullptr;
+}
+
+uint32_t FrameHandle::Pixels::size() const
+{
+    return (shared && shared->data != nullptr) ? shared->header.data_size : 0;
+}
@@ -0,0 +1,108 @@
+// *****************************************************************************
+//
+// framehandle.h
+// Shared reference to a frame retrieved from the pipeline. Copying a
+// FrameHandle adds a holder without copying pixels. The release callback runs
+// when the last holder is gone.
+//
+// Display, saving and analysis can all hold the same frame at once. Anything
+// that does copy the pixels calls countCopy(), and the total per frame is
+// exported when the frame is released. Holding a frame only to share it
+// should keep that count at zero.
+//
+// The buffer belongs to the stream again once the display thread is done
+// with it. If a holder keeps the handle past that, detach() copies the pixels
+// into memory the handle owns and the buffer goes back at once. data() is
+// only safe inside a sink call; to read the pixels later, pin them with
+// pixels(), which detach() waits for.
+//
+// *****************************************************************************
+
+
+#ifndef __FRAMEHANDLE_H__
+#define __FRAMEHANDLE_H__
+
+#include <PvBuffer.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "sessionwriter.h"
+
+class FrameHandle
+{
+    public:
+        typedef std::function<void()> ReleaseCallback;
+
+        FrameHandle();
+        FrameHandle(PvBuffer* _buffer, const FrameHeader& _header, const uint8_t* _data, ReleaseCallback _on_release);
+
+        bool isValid() const;
+        PvBuffer* buffer() const;
+        const FrameHeader& header() const;
+        const uint8_t* data() const;    // Null for non-image payloads
+        uint32_t size() const;
+        long holders() const;
+
+        // Call after copying the pixels out of the frame
+        void countCopy() const;
+
+        // Drops this holder
+        void reset();
+
+    private:
+        struct Shared;
+
+    public:
+        // Keeps the pixels where they are while it exists
+        class Pixels
+        {
+            public:
+                Pixels(std::shared_ptr<Shared> _shared);
+                Pixels(Pixels&& other);
+                ~Pixels();
+                const uint8_t* data() const;
+                uint32_t size() const;
+
+            private:
+                Pixels(const Pixels&) = delete;
+                Pixels& operator=(const Pixels&) = delete;
+
+                std::shared_ptr<Shared> shared;
+        };
+
+        Pixels pixels() const;
+
+        // Copies the pixels out of the buffer once nothing is reading them,
+        // after which buffer() is null. Returns false if there was nothing
+        // to copy.
+        bool detach();
+
+    private:
+        struct Shared
+        {
+            std::atomic<PvBuffer*> buffer;
+            FrameHeader header;
+            std::atomic<const uint8_t*> data;
+            std::vector<uint8_t> owned;     // Pixels after detach()
+            ReleaseCallback on_release;
+            std::atomic<uint32_t> copies;
+            std::chrono::steady_clock::time_point retrieved;
+
+            std::mutex mtx;
+            std::condition_variable cv;
+            unsigned int readers = 0;       // Pixels pins
+
+            ~Shared();
+        };
+
+        std::shared_ptr<Shared> shared;
+};
+
+
+#endif // __FRAMEHANDLE_H__
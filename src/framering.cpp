@@ -0,0 +1,255 @@
+#include "framering.h"
+#include "metrics.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+static int64_t wallMicros()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+FrameRing::FrameRing() :
+    arena(nullptr),
+    capacity(0),
+    slot_size(0),
+    slot_count(0),
+    head(0),
+    pre_seconds(DEFAULT_RING_PRE),
+    post_seconds(DEFAULT_RING_POST),
+    committing(false),
+    write_pos(0),
+    deadline_us(0),
+    running(false)
+{
+
+}
+
+FrameRing::~FrameRing()
+{
+    release();
+}
+
+bool FrameRing::allocate(size_t _capacity)
+{
+    static Gauge* ring_bytes = Metrics::instance().gauge("pam_ring_bytes", "Memory reserved for the pre-trigger ring");
+
+    release();
+
+    arena = static_cast<uint8_t*>(malloc(_capacity));
+    if (arena == nullptr)
+    {
+        std::cout << "FrameRing: unable to allocate " << _capacity / (1 << 20) << " MB" << std::endl;
+        return false;
+    }
+
+    // Touch every page now rather than on the first lap of the ring
+    memset(arena, 0, _capacity);
+
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        capacity = _capacity;
+        slot_size = 0;
+        slot_count = 0;
+        head = 0;
+        running = true;
+    }
+    thread = std::thread(&FrameRing::run, this);
+    ring_bytes->set(static_cast<double>(_capacity));
+
+    return true;
+}
+
+void FrameRing::release()
+{
+    static Gauge* ring_bytes = Metrics::instance().gauge("pam_ring_bytes", "Memory reserved for the pre-trigger ring");
+
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        running = false;
+    }
+    cv.notify_all();
+    if (thread.joinable())
+    {
+        thread.join();
+    }
+
+    std::lock_guard<std::mutex> lock(mtx);
+    free(arena);
+    arena = nullptr;
+    capacity = 0;
+    slot_count = 0;
+    headers.clear();
+    ring_bytes->set(0);
+}
+
+bool FrameRing::isAllocated()
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    return arena != nullptr;
+}
+
+void FrameRing::setWindow(double _pre_seconds, double _post_seconds)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    pre_seconds = std::max(0.0, _pre_seconds);
+    post_seconds = std::max(0.0, _post_seconds);
+}
+
+void FrameRing::setPath(const std::string& _path)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    path = _path;
+}
+
+bool FrameRing::isCommitting()
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    return committing;
+}
+
+bool FrameRing::push(const FrameHeader& header, const uint8_t* data, uint32_t size)
+{
+    static Counter* dropped = Metrics::instance().counter("pam_ring_dropped_total", "Frames the pre-trigger ring had no free slot for");
+
+    std::unique_lock<std::mutex> lock(mtx);
+    if (arena == nullptr)
+    {
+        return false;
+    }
+
+    // Lay the arena out for this frame size
+    if (size != slot_size)
+    {
+        if (committing)
+        {
+            dropped->inc();
+            return false;
+        }
+        slot_size = size;
+        slot_count = (size > 0) ? capacity / size : 0;
+        headers.assign(slot_count, FrameHeader());
+        head = 0;
+    }
+    if (slot_count == 0)
+    {
+        return false;
+    }
+
+    // The slot holds frame head - slot_count, which a commit may still need
+    if (committing && head >= slot_count && head - slot_count >= write_pos)
+    {
+        dropped->inc();
+        return false;
+    }
+
+    // Held across the copy so release() can't free the arena under it. The
+    // commit reads other slots without the lock.
+    uint64_t slot = head % slot_count;
+    headers[slot] = header;
+    memcpy(arena + slot * slot_size, data, size);
+    head++;
+    bool notify = committing;
+    lock.unlock();
+    if (notify)
+    {
+        cv.notify_all();
+    }
+
+    return true;
+}
+
+bool FrameRing::commit()
+{
+    static Counter* commits = Metrics::instance().counter("pam_ring_commits_total", "Pre-trigger ring commits");
+
+    std::unique_lock<std::mutex> lock(mtx);
+    if (arena == nullptr || committing || head == 0)
+    {
+        return false;
+    }
+
+    // Oldest frame still in the ring and inside the pre-trigger window
+    int64_t now_us = wallMicros();
+    int64_t oldest_us = now_us - static_cast<int64_t>(pre_seconds * 1e6);
+    uint64_t start = (head > slot_count) ? head - slot_count : 0;
+    while (start < head && headers[start % slot_count].wall_us < oldest_us)
+    {
+        start++;
+    }
+
+    std::string file = path + "pretrigger-" + std::to_string(now_us) + ".pam";
+    if (!writer.open(file))
+    {
+        return false;
+    }
+
+    write_pos = start;
+    deadline_us = now_us + static_cast<int64_t>(post_seconds * 1e6);
+    deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(deadline_us - now_us);
+    committing = true;
+    commits->inc();
+    std::cout << "FrameRing: committing " << head - start << " buffered frames to " << file << std::endl;
+
+    lock.unlock();
+    cv.notify_all();
+    return true;
+}
+
+void FrameRing::finishCommit(std::unique_lock<std::mutex>& lock)
+{
+    lock.unlock();
+    uint64_t bytes = writer.getBytesWritten();
+    writer.close();
+    lock.lock();
+
+    committing = false;
+    std::cout << "FrameRing: commit done, " << bytes / 1e6 << " MB written" << std::endl;
+}
+
+void FrameRing::run()
+{
+    std::unique_lock<std::mutex> lock(mtx);
+
+    while (running)
+    {
+        if (!committing)
+        {
+            cv.wait(lock);
+            continue;
+        }
+
+        if (write_pos < head)
+        {
+            FrameHeader header = headers[write_pos % slot_count];
+            if (header.wall_us > deadline_us)
+            {
+                finishCommit(lock);
+                continue;
+            }
+
+            // push() won't reuse this slot until write_pos moves past it
+            const uint8_t* data = arena + (write_pos % slot_count) * slot_size;
+            uint32_t size = slot_size;
+            lock.unlock();
+            writer.write(header, data, size, true);
+            lock.lock();
+            write_pos++;
+            continue;
+        }
+
+        // Caught up, wait for the following frames until the deadline
+        if (std::chrono::steady_clock::now() >= deadline)
+        {
+            finishCommit(lock);
+            continue;
+        }
+        cv.wait_until(lock, deadline);
+    }
+
+    if (committing)
+    {
+        finishCommit(lock);
+    }
+}
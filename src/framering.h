@@ -0,0 +1,89 @@
+// *****************************************************************************
+//
+// framering.h
+// Pre-trigger buffer for the viewfinder. The last few seconds of frames are
+// kept in a RAM ring allocated once up front. commit() writes the frames in
+// the ring, then the frames that follow for post_seconds, to a session file
+// (see sessionwriter.h) in the saving path.
+//
+// Memory use is the capacity given to allocate(), plus the commit's session
+// writer, which allocates DEFAULT_WRITER_DEPTH record buffers (one frame
+// each, about 40 MB at full resolution) on the first commit and keeps them
+// until the ring is destroyed. The number of frames that fit depends on the
+// frame size; if that changes (e.g. binning) the ring starts over. While a commit is writing, frames it hasn't
+// reached yet are never overwritten. If the disk can't keep up, new frames
+// are dropped instead.
+//
+// Besides an explicit commitPreTrigger(), the Receiver commits on every
+// EVENT line from the LED controller while the ring is allocated (see
+// serialport.h).
+//
+// *****************************************************************************
+
+
+#ifndef __FRAMERING_H__
+#define __FRAMERING_H__
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "sessionwriter.h"
+
+#define DEFAULT_RING_MB 256
+#define DEFAULT_RING_PRE 5.0    // (s) kept before a commit
+#define DEFAULT_RING_POST 2.0   // (s) written after a commit
+
+class FrameRing
+{
+    public:
+        FrameRing();
+        ~FrameRing();
+
+        bool allocate(size_t capacity);
+        void release();
+        bool isAllocated();
+        void setWindow(double _pre_seconds, double _post_seconds);
+        void setPath(const std::string& _path);
+
+        // Called for every viewfinder frame. Returns false if it was dropped.
+        bool push(const FrameHeader& header, const uint8_t* data, uint32_t size);
+
+        // Returns false if there is nothing to write or a commit is running
+        bool commit();
+        bool isCommitting();
+
+    private:
+        void run();
+        void finishCommit(std::unique_lock<std::mutex>& lock);
+
+    private:
+        uint8_t* arena;
+        size_t capacity;
+        uint32_t slot_size;
+        uint64_t slot_count;
+        std::vector<FrameHeader> headers;   // One per slot
+        uint64_t head;                      // Frames pushed since the layout was set
+
+        double pre_seconds;
+        double post_seconds;
+        std::string path;
+
+        bool committing;
+        uint64_t write_pos;                 // Next frame the commit writes
+        int64_t deadline_us;                // Frames after this aren't part of it
+        std::chrono::steady_clock::time_point deadline;
+        SessionWriter writer;
+
+        std::thread thread;
+        std::mutex mtx;
+        std::condition_variable cv;
+        bool running;
+};
+
+
+#endif // __FRAMERING_H__
@@ -0,0 +1,119 @@
+#include "framestats.h"
+
+#include <algorithm>
+#include <sstream>
+
+#include "metrics.h"
+
+double FrameStatsSummary::lossRate() const
+{
+    return (packets_expected > 0) ? static_cast<double>(missing) / packets_expected : 0.0;
+}
+
+std::string FrameStatsSummary::describe() const
+{
+    std::stringstream ss;
+    ss << frames - incomplete << "/" << frames << " frames, "
+       << missing << " of " << packets_expected << " packets lost, "
+       << resend_requests << " resends";
+    if (reassembly_max_us > 0.0)
+    {
+        ss << ", " << static_cast<int>(reassembly_max_us / 1000.0 + 0.5) << " ms max";
+    }
+    return ss.str();
+}
+
+FrameStatsRing::FrameStatsRing(size_t _capacity) :
+    ring(std::max<size_t>(_capacity, 1)),
+    next(0),
+    count(0)
+{
+}
+
+void FrameStatsRing::push(const GvspFrameStats& s)
+{
+    static Counter* expected = Metrics::instance().counter("pam_stream_packets_expected_total", "Packets the frames handed on should have had");
+    static Counter* received = Metrics::instance().counter("pam_stream_packets_received_total", "Packets received of the frames handed on");
+    static Counter* missing = Metrics::instance().counter("pam_stream_packets_missing_total", "Packets still missing when a frame was handed on");
+    static Counter* resend_requests = Metrics::instance().counter("pam_stream_resend_requests_total", "Packet resend requests sent to the camera");
+    static Counter* resent = Metrics::instance().counter("pam_stream_packets_resent_total", "Packets recovered by a resend");
+    static MetricsHistogram* missing_per_frame = Metrics::instance().histogram("pam_stream_frame_missing_packets", "Packets missing per frame",
+        {0.0, 1.0, 2.0, 5.0, 10.0, 50.0, 100.0, 1000.0});
+    static MetricsHistogram* reassembly_ms = Metrics::instance().histogram("pam_stream_frame_reassembly_ms", "Time from the first packet of a frame until it was handed on",
+        {1.0, 2.0, 5.0, 10.0, 20.0, 50.0, 100.0, 250.0});
+
+    expected->inc(s.packets_expected);
+    received->inc(s.packets_received);
+    missing->inc(s.missing);
+    resend_requests->inc(s.resend_requests);
+    resent->inc(s.resent_received);
+    missing_per_frame->observe(s.missing);
+    if (s.reassembly_us > 0.0)
+    {
+        reassembly_ms->observe(s.reassembly_us / 1000.0);
+    }
+
+    std::lock_guard<std::mutex> lock(mtx);
+    ring[next] = s;
+    next = (next + 1) % ring.size();
+    count++;
+}
+
+void FrameStatsRing::clear()
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    next = 0;
+    count = 0;
+}
+
+std::vector<GvspFrameStats> FrameStatsRing::recent(size_t n)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    n = std::min<uint64_t>(std::min(n, ring.size()), count);
+
+    std::vector<GvspFrameStats> out;
+    out.reserve(n);
+    size_t i = (next + ring.size() - n) % ring.size();
+    for (size_t k = 0; k < n; k++)
+    {
+        out.push_back(ring[i]);
+        i = (i + 1) % ring.size();
+    }
+    return out;
+}
+
+FrameStatsSummary FrameStatsRing::summary(size_t n)
+{
+    FrameStatsSummary sum;
+    unsigned int timed = 0;
+    for (const GvspFrameStats& s : recent(n))
+    {
+        sum.frames++;
+        sum.incomplete += s.complete ? 0 : 1;
+        sum.packets_expected += s.packets_expected;
+        sum.packets_received += s.packets_received;
+        sum.missing += s.missing;
+        sum.resend_requests += s.resend_requests;
+        sum.resend_packets += s.resend_packets;
+        sum.resent_received += s.resent_received;
+        sum.duplicates += s.duplicates;
+        sum.out_of_order += s.out_of_order;
+        if (s.reassembly_us > 0.0)
+        {
+            sum.reassembly_mean_us += s.reassembly_us;
+            sum.reassembly_max_us = std::max(sum.reassembly_max_us, s.reassembly_us);
+            timed++;
+        }
+    }
+    if (timed > 0)
+    {
+        sum.reassembly_mean_us /= timed;
+    }
+    return sum;
+}
+
+uint64_t FrameStatsRing::getCount()
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    return count;
+}
@@ -0,0 +1,74 @@
+// *****************************************************************************
+//
+// framestats.h
+// Packet level statistics of the last few thousand frames, for telling
+// packet loss, resends and a host that can't keep up apart when frames go
+// missing, and for tuning the packet size and socket buffers with data.
+//
+// The stream layer pushes one GvspFrameStats per frame: the display thread
+// from the counters eBUS keeps on each PvBuffer, GvspReceiver (with
+// setFrameStats()) from its own reassembly. Every push also updates the
+// pam_stream_frame_* and pam_stream_packets_* metrics. eBUS doesn't report
+// reassembly time per buffer, so it is only known for the in tree receiver.
+//
+// *****************************************************************************
+
+
+#ifndef __FRAMESTATS_H__
+#define __FRAMESTATS_H__
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "gvspreceiver.h"
+
+#define DEFAULT_FRAME_STATS 4096        // Frames kept
+#define DEFAULT_FRAME_STATS_WINDOW 100  // Frames summarised for display
+
+// Totals over the last frames
+struct FrameStatsSummary
+{
+    uint32_t frames = 0;
+    uint32_t incomplete = 0;
+    uint64_t packets_expected = 0;
+    uint64_t packets_received = 0;
+    uint64_t missing = 0;
+    uint64_t resend_requests = 0;
+    uint64_t resend_packets = 0;
+    uint64_t resent_received = 0;
+    uint64_t duplicates = 0;
+    uint64_t out_of_order = 0;
+    double reassembly_mean_us = 0.0;    // Over frames where it is known
+    double reassembly_max_us = 0.0;
+
+    // Fraction of expected packets that never arrived
+    double lossRate() const;
+
+    // One line, e.g. "100/100 frames, 0 of 158300 packets lost, 12 resends"
+    std::string describe() const;
+};
+
+class FrameStatsRing
+{
+    public:
+        FrameStatsRing(size_t _capacity = DEFAULT_FRAME_STATS);
+
+        void push(const GvspFrameStats& s);
+        void clear();
+
+        // The last n frames, oldest first
+        std::vector<GvspFrameStats> recent(size_t n = DEFAULT_FRAME_STATS);
+        FrameStatsSummary summary(size_t n = DEFAULT_FRAME_STATS_WINDOW);
+        uint64_t getCount();
+
+    private:
+        std::mutex mtx;
+        std::vector<GvspFrameStats> ring;
+        size_t next;
+        uint64_t count;
+};
+
+
+#endif // __FRAMESTATS_H__
@@ -0,0 +1,316 @@
+#include "fvfmpreview.h"
+#include "sequence.h"
+#include <algorithm>
+#include <iostream>
+
+FvFmPreview::FvFmPreview() :
+    enabled(false), light_adapted(false), threshold(DEFAULT_FM_THRESHOLD), colormap(ColorMap::PALETTE_PAM, DEFAULT_FVFM_MIN, DEFAULT_FVFM_MAX),
+    fm_level(-1.0), width(0), height(0), mean(0.0), valid(0), points_taken(0)
+{
+
+}
+
+void FvFmPreview::setEnabled(bool _enabled)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    enabled = _enabled;
+    release();
+}
+
+bool FvFmPreview::isEnabled()
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    return enabled;
+}
+
+bool FvFmPreview::isActive()
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    return active();
+}
+
+bool FvFmPreview::active()
+{
+    return enabled || light_adapted;
+}
+
+void FvFmPreview::release()
+{
+    // Don't hold on to two frames and a map nobody will look at
+    if (!active())
+    {
+        std::vector<uint8_t>().swap(f0);
+        std::vector<uint8_t>().swap(fm);
+        std::vector<float>().swap(map);
+        width = height = 0;
+    }
+}
+
+void FvFmPreview::setColorMap(int palette, float min, float max)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    colormap.setPalette(palette);
+    colormap.setRange(min, max);
+}
+
+void FvFmPreview::setThreshold(float _threshold)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    threshold = _threshold;
+    quenching.setThreshold(_threshold);
+}
+
+void FvFmPreview::setRoles(const std::vector<int>& _roles, const std::vector<float>& _par)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    roles = _roles;
+    par = _par;
+    light_adapted = std::find(roles.begin(), roles.end(), FRAME_FMP) != roles.end();
+    release();
+}
+
+void FvFmPreview::begin()
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    f0.clear();
+    fm.clear();
+    fm_level = -1.0;
+    quenching.begin(active() ? roles : std::vector<int>());
+    points_taken = 0;
+
+    // One light curve step per Fm' frame
+    std::vector<float> steps;
+    for (size_t i = 0; active() && i < roles.size() && i < par.size(); i++)
+    {
+        if (roles[i] == FRAME_FMP)
+        {
+            steps.push_back(par[i]);
+        }
+    }
+    light_curve.begin(steps);
+}
+
+static ImageView view(const FrameHeader& header, const uint8_t* data)
+{
+    ImageView image;
+    image.data = data;
+    image.width = header.width;
+    image.height = header.height;
+    image.stride = header.stride;
+    image.bits = (header.bits != 0) ? header.bits : 8;
+    return image;
+}
+
+bool FvFmPreview::addFrame(const FrameHeader& header, const uint8_t* data)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    if (!active() || data == nullptr || header.data_size == 0)
+    {
+        return false;
+    }
+
+    // Frames are numbered from 1 within a recording
+    uint32_t index = header.frame - 1;
+    if (index < roles.size())
+    {
+        // The quenching analysis keeps its frames as float levels
+        if (quenching.addFrame(index, view(header, data), header.wall_us) && light_curve.isActive())
+        {
+            light_curve.addStep(quenching.getPoints().size() - 1, quenching.getMap(Quenching::PARAM_PHIPSII),
+                                quenching.getWidth(), quenching.getHeight());
+        }
+        bool converted = quenching.isActive() && roles[index] != FRAME_ACTINIC;
+        if (roles[index] == FRAME_F0 && f0.empty())
+        {
+            f0.assign(data, data + header.data_size);
+            f0_header = header;
+            return true;
+        }
+        if (roles[index] == FRAME_FM && fm.empty())
+        {
+            fm.assign(data, data + header.data_size);
+            fm_header = header;
+            return true;
+        }
+        return converted;
+    }
+
+    if (f0.empty())
+    {
+        f0.assign(data, data + header.data_size);
+        f0_header = header;
+        return true;
+    }
+
+    // Only the brightest frame is kept, so measure before copying
+    double level = Fluorescence::meanLevel(view(header, data));
+    if (level <= fm_level)
+    {
+        return false;
+    }
+
+    fm_level = level;
+    fm.assign(data, data + header.data_size);
+    fm_header = header;
+    return true;
+}
+
+bool FvFmPreview::compute()
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    ImageView f0_view = view(f0_header, f0.empty() ? nullptr : f0.data());
+    ImageView fm_view = view(fm_header, fm.empty() ? nullptr : fm.data());
+    if (!active() || f0_view.data == nullptr || fm_view.data == nullptr || !Fluorescence::sameShape(f0_view, fm_view))
+    {
+        return false;
+    }
+
+    width = f0_view.width;
+    height = f0_view.height;
+    map.resize(f0_view.pixels());
+    Fluorescence::fvfm(f0_view, fm_view, map.data(), threshold);
+
+    double total = 0.0;
+    valid = 0;
+    for (float v : map)
+    {
+        if (v == v)
+        {
+            total += v;
+            valid++;
+        }
+    }
+    mean = (valid > 0) ? total / valid : 0.0;
+    return true;
+}
+
+bool FvFmPreview::render(uint8_t* rgba, uint32_t stride)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    if (rgba == nullptr || map.empty())
+    {
+        return false;
+    }
+
+    colormap.render(map.data(), width, height, width, rgba, stride);
+    return true;
+}
+
+bool FvFmPreview::takeMaps(FvFmMaps& maps)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    if (map.empty() || f0.empty() || fm.empty())
+    {
+        return false;
+    }
+
+    maps.recording = f0_header.recording;
+    maps.width = width;
+    maps.height = height;
+    maps.mean = mean;
+    maps.map = map;
+    maps.f0_header = f0_header;
+    maps.fm_header = fm_header;
+    maps.f0.swap(f0);
+    maps.fm.swap(fm);
+    f0.clear();
+    fm.clear();
+    return true;
+}
+
+bool FvFmPreview::takePoint(QuenchingPoint& point)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    const std::vector<QuenchingPoint>& points = quenching.getPoints();
+    if (points_taken >= points.size())
+    {
+        return false;
+    }
+    point = points[points_taken++];
+    return true;
+}
+
+std::vector<QuenchingPoint> FvFmPreview::getPoints()
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    return quenching.getPoints();
+}
+
+bool FvFmPreview::takeLightCurve(LightCurve& curve)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    if (!light_curve.isComplete())
+    {
+        return false;
+    }
+    std::swap(curve, light_curve);
+    light_curve.begin(std::vector<float>());
+    return true;
+}
+
+uint32_t FvFmPreview::getRecording()
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    return f0_header.recording;
+}
+
+uint32_t FvFmPreview::getWidth()
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    return width;
+}
+
+uint32_t FvFmPreview::getHeight()
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    return height;
+}
+
+double FvFmPreview::getMean()
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    return mean;
+}
+
+uint64_t FvFmPreview::getValid()
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    return valid;
+}
+
+std::vector<RoiSummary> FvFmMaps::reduce(RoiMask& mask, RoiStats& stats) const
+{
+    if (map.empty())
+    {
+        return std::vector<RoiSummary>();
+    }
+
+    const uint16_t* labels = mask.getLabels(width, height);
+    if (labels == nullptr)
+    {
+        std::cout << "ROI label image doesn't match the " << width << "x" << height << " map" << std::endl;
+        return std::vector<RoiSummary>();
+    }
+    std::vector<RoiSummary> summaries = stats.reduce(map.data(), labels, width, height, width, mask.getMaxLabel());
+
+    // Raw levels of the same regions, for whoever wants more than the ratio
+    std::vector<double> f0_means, fm_means;
+    Fluorescence::labelMeans(view(f0_header, f0.data()), labels, mask.getMaxLabel(), f0_means);
+    Fluorescence::labelMeans(view(fm_header, fm.data()), labels, mask.getMaxLabel(), fm_means);
+    for (RoiSummary& s : summaries)
+    {
+        s.f0 = f0_means[s.label];
+        s.fm = fm_means[s.label];
+    }
+    return summaries;
+}
+
+uint32_t FvFmMaps::segment(Segmenter& segmenter, std::vector<uint16_t>& labels) const
+{
+    if (fm.empty())
+    {
+        labels.clear();
+        return 0;
+    }
+    return segmenter.segment(view(fm_header, fm.data()), labels);
+}
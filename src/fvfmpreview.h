@@ -0,0 +1,134 @@
+// *****************************************************************************
+//
+// fvfmpreview.h
+// Fv/Fm of the sequence just recorded, for showing on the display once it
+// ends. Frames are offered one by one while recording: the first is kept as
+// F0, and a frame replaces Fm whenever it is brighter than the last. Only
+// two frames are held per sequence, whatever its length, but each brighter
+// frame is copied as it replaces Fm.
+//
+// When the roles of the frames are known (setRoles, from the command string)
+// F0 and Fm are picked by role instead, and a sequence with actinic phases
+// also runs a Quenching analysis as its pulses arrive. When the pulses come
+// at three or more light levels (given as PAR per frame) each one's PhiPSII
+// map goes into a LightCurve as well. Roles with Fm' frames turn the
+// analysis on by themselves, so a scheduled induction or light curve step
+// is analysed whether or not the map is shown.
+//
+// compute() builds the map and its statistics, and render() false colours
+// it into an RGBA image with the preview's ColorMap. takeMaps() hands the map
+// and its two frames over as FvFmMaps, which the per region and segmentation
+// analysis runs on while the next sequence records.
+//
+// *****************************************************************************
+
+
+#ifndef __FVFMPREVIEW_H__
+#define __FVFMPREVIEW_H__
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "sessionwriter.h"
+#include "fluorescence.h"
+#include "colormap.h"
+#include "roi.h"
+#include "segmentation.h"
+#include "quenching.h"
+#include "lightcurve.h"
+
+// Colour scale of the preview. Healthy leaves sit around 0.8.
+#define DEFAULT_FVFM_MIN 0.0f
+#define DEFAULT_FVFM_MAX 0.85f
+
+// The map of a finished sequence and the frames it came from
+struct FvFmMaps
+{
+    uint32_t recording = 0;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    double mean = 0.0;
+    std::vector<float> map;
+    FrameHeader f0_header = {};
+    FrameHeader fm_header = {};
+    std::vector<uint8_t> f0;
+    std::vector<uint8_t> fm;
+
+    // Per region statistics of the map, with the raw F0 and Fm levels
+    std::vector<RoiSummary> reduce(RoiMask& mask, RoiStats& stats) const;
+
+    // Label image of the plants in the Fm frame
+    uint32_t segment(Segmenter& segmenter, std::vector<uint16_t>& labels) const;
+};
+
+class FvFmPreview
+{
+    public:
+        FvFmPreview();
+
+        void setEnabled(bool _enabled);
+        bool isEnabled();
+        bool isActive();    // Enabled, or the roles have Fm' frames
+        void setColorMap(int palette, float min = DEFAULT_FVFM_MIN, float max = DEFAULT_FVFM_MAX);
+        void setThreshold(float _threshold);
+
+        // FrameRole and actinic PAR of each frame of the coming sequences,
+        // empty if unknown
+        void setRoles(const std::vector<int>& _roles, const std::vector<float>& _par = std::vector<float>());
+
+        // Starts a new sequence. addFrame() returns true if it copied the frame.
+        void begin();
+        bool addFrame(const FrameHeader& header, const uint8_t* data);
+
+        // False until a sequence has both an F0 and a brighter Fm frame
+        bool compute();
+        bool render(uint8_t* rgba, uint32_t stride);
+
+        // Hands over the last map and its frames. The preview keeps a copy
+        // of the map for render(), but not the frames.
+        bool takeMaps(FvFmMaps& maps);
+
+        // Quenching point completed since the last call, if any
+        bool takePoint(QuenchingPoint& point);
+        std::vector<QuenchingPoint> getPoints();    // Of the last sequence
+
+        // Hands over the light curve of the last sequence, if it has every
+        // step, so the fit runs without holding up the next sequence
+        bool takeLightCurve(LightCurve& curve);
+
+        uint32_t getRecording();    // Of the last map
+        uint32_t getWidth();
+        uint32_t getHeight();
+        double getMean();           // Over the pixels above the threshold
+        uint64_t getValid();
+
+    private:
+        bool active();
+        void release();
+
+    private:
+        std::mutex mtx;
+        bool enabled;
+        bool light_adapted;     // The roles have Fm' frames
+        float threshold;
+        ColorMap colormap;
+        FrameHeader f0_header;
+        FrameHeader fm_header;
+        std::vector<uint8_t> f0;
+        std::vector<uint8_t> fm;
+        double fm_level;
+        std::vector<float> map;
+        uint32_t width;
+        uint32_t height;
+        double mean;
+        uint64_t valid;
+        std::vector<int> roles;
+        std::vector<float> par;
+        Quenching quenching;
+        LightCurve light_curve;
+        size_t points_taken;
+};
+
+
+#endif // __FVFMPREVIEW_H__
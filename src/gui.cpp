@@ -2,11 +2,13 @@
 #include <QLabel>
 #include <QSizePolicy>
 #include <QCloseEvent>
+#include <QMetaObject>
 #include "tools.h"
+#include "metrics.h"
 
 
 Gui::Gui(QWidget *parent)
-    : QWidget(parent), display_wnd(nullptr), display_widget(nullptr), SignalHandler(SignalHandler::SIG_INT)
+    : QWidget(parent), display_wnd(nullptr), display_widget(nullptr), SignalHandler(SignalHandler::SIG_INT | SignalHandler::SIG_TERM)
 {
     // Create display adapter
     display_wnd = new PvDisplayWnd;
@@ -17,13 +19,42 @@ Gui::Gui(QWidget *parent)
     // Create the window layout
     createLayout();
 
-    setFixedSize(760, 420);
+    setFixedSize(760, 500);
 
     receiver = new Receiver(display_wnd);
+    scheduler = new Scheduler(receiver);
+    scheduler->setFinishedCallback([this]()
+    {
+        QMetaObject::invokeMethod(this, "onProtocolFinished", Qt::QueuedConnection);
+    });
+
+    // Camera commands run on the controller thread, results come back here
+    controller = new Controller(receiver);
+    controller->setResultCallback([this](const DeviceParams& dp)
+    {
+        QMetaObject::invokeMethod(this, [this, dp]() { showParameters(dp); }, Qt::QueuedConnection);
+    });
+    controller->start();
     if(receiver->isConnected())
     {
         updateParameters();
     }
+
+    // The stream statistics are local, no need to go through the controller
+    stats_timer = new QTimer(this);
+    connect(stats_timer, SIGNAL(timeout()), this, SLOT(onStatsTimer()));
+    stats_timer->start(UI_STATS_INTERVAL);
+
+    // Measures how late the event loop gets round to a short timer
+    last_tick = std::chrono::steady_clock::now();
+    stall_timer = new QTimer(this);
+    stall_timer->setTimerType(Qt::PreciseTimer);
+    connect(stall_timer, SIGNAL(timeout()), this, SLOT(onStallTimer()));
+    stall_timer->start(UI_STALL_INTERVAL);
+
+    // Signals arrive through the handler's pipe and are dealt with here
+    signal_notifier = new QSocketNotifier(getSignalFd(), QSocketNotifier::Read, this);
+    connect(signal_notifier, SIGNAL(activated(int)), this, SLOT(onSignal()));
 }
 
 void Gui::closeEvent(QCloseEvent *event)
@@ -38,13 +69,34 @@ bool Gui::isInitialised()
 
 bool Gui::handleSignal(int signal)
 {
-    quit();
-    
+    // Runs from the event loop, so closing goes through the normal path
+    close();
+
     return true;
 }
 
+void Gui::onSignal()
+{
+    dispatchSignals();
+}
+
 void Gui::quit()
 {
+    if (quitting)
+    {
+        return;
+    }
+    quitting = true;
+
+    signal_notifier->setEnabled(false);
+    stall_timer->stop();
+    stats_timer->stop();
+    controller->stop();
+    delete controller;
+
+    scheduler->stop();
+    delete scheduler;
+
     receiver->quit();
     delete receiver;
     display_widget->close();
@@ -53,6 +105,7 @@ void Gui::quit()
 
 void Gui::setImagePath(const std::string& path)
 {
+    image_path = path;
     receiver->setSavingPath(path);
 }
 
@@ -87,7 +140,12 @@ void Gui::createDisplay()
 
 void Gui::updateParameters()
 {
-    DeviceParams dp = receiver->getDeviceParams();
+    // Reading them back goes over GigE too, the result arrives in showParameters
+    controller->post("params", [](Receiver*) {});
+}
+
+void Gui::showParameters(const DeviceParams& dp)
+{
     // When updating the display fields, if any edits were made
     name_field->setText(QString::fromStdString(dp.name));
     ip_field->setText(QString::fromStdString(dp.ip));
@@ -126,6 +184,11 @@ QVBoxLayout* Gui::createMenu()
     mac_field->setReadOnly( true );
     mac_field->setEnabled( false );
 
+    // Packet statistics of the last frames
+    QLabel* net_label = new QLabel(tr( "Network" ));
+    net_field = new QLineEdit;
+    net_field->setReadOnly( true );
+
     // Parameter field gain
     QLabel* gain_label = new QLabel(tr( "Gain" ));
     gain_field = new QLineEdit;
@@ -142,6 +205,37 @@ QVBoxLayout* Gui::createMenu()
     bin_field = new QRadioButton;
     bin_field->setEnabled( true );
 
+    QLabel* auto_exp_label = new QLabel(tr( "Auto Exposure" ));
+    auto_exp_field = new QCheckBox;
+    auto_exp_field->setEnabled( true );
+
+    QLabel* pretrigger_label = new QLabel(tr( "Pre-trigger (C)" ));
+    pretrigger_field = new QCheckBox;
+    pretrigger_field->setEnabled( true );
+
+    QLabel* feed_label = new QLabel(tr( "Live Feed (shm)" ));
+    feed_field = new QCheckBox;
+    feed_field->setEnabled( true );
+
+    QLabel* fvfm_label = new QLabel(tr( "Fv/Fm Map" ));
+    fvfm_field = new QCheckBox;
+    fvfm_field->setEnabled( true );
+    palette_field = new QComboBox;
+    for (int i = 0; i < ColorMap::PALETTE_COUNT; i++)
+    {
+        palette_field->addItem(tr(ColorMap::getPaletteName(i)));
+    }
+    palette_field->setCurrentIndex(ColorMap::PALETTE_PAM);
+
+    QLabel* roi_label = new QLabel(tr( "ROI File" ));
+    roi_field = new QLineEdit;
+    roi_field->setReadOnly( false );
+    roi_field->setEnabled( true );
+
+    QLabel* segment_label = new QLabel(tr( "Auto ROI" ));
+    segment_field = new QCheckBox;
+    segment_field->setEnabled( true );
+
     QLabel* width_label = new QLabel(tr( "Width" ));
     width_field = new QLineEdit;
     width_field->setReadOnly( true );
@@ -166,6 +260,13 @@ QVBoxLayout* Gui::createMenu()
     command_button = new QToolButton();
     command_button->setText(tr("Send->"));
 
+    QLabel* protocol_label = new QLabel(tr( "Protocol" ));
+    protocol_field = new QLineEdit;
+    protocol_field->setText(tr("protocol.pam"));
+    protocol_button = new QToolButton();
+    protocol_button->setCheckable(true);
+    protocol_button->setText(tr("Run/Stop"));
+
     // Add fields to grid
     int row = 0;
     QGridLayout* grid_layout = new QGridLayout;
@@ -175,12 +276,27 @@ QVBoxLayout* Gui::createMenu()
     grid_layout->addWidget(ip_field, row, 1); row++;
     grid_layout->addWidget(mac_label, row, 0); 
     grid_layout->addWidget(mac_field, row, 1); row++;
+    grid_layout->addWidget(net_label, row, 0);
+    grid_layout->addWidget(net_field, row, 1); row++;
     grid_layout->addWidget(gain_label, row, 0); 
     grid_layout->addWidget(gain_field, row, 1); row++;
     grid_layout->addWidget(m_exp_label, row, 0); 
     grid_layout->addWidget(m_exp_field, row, 1); row++;
     grid_layout->addWidget(bin_label, row, 0); ;
     grid_layout->addWidget(bin_field, row, 1); row++;
+    grid_layout->addWidget(auto_exp_label, row, 0);
+    grid_layout->addWidget(auto_exp_field, row, 1); row++;
+    grid_layout->addWidget(pretrigger_label, row, 0);
+    grid_layout->addWidget(pretrigger_field, row, 1); row++;
+    grid_layout->addWidget(feed_label, row, 0);
+    grid_layout->addWidget(feed_field, row, 1); row++;
+    grid_layout->addWidget(fvfm_label, row, 0);
+    grid_layout->addWidget(fvfm_field, row, 1); row++;
+    grid_layout->addWidget(palette_field, row, 1); row++;
+    grid_layout->addWidget(roi_label, row, 0);
+    grid_layout->addWidget(roi_field, row, 1); row++;
+    grid_layout->addWidget(segment_label, row, 0);
+    grid_layout->addWidget(segment_field, row, 1); row++;
     grid_layout->addWidget(width_label, row, 0); 
     grid_layout->addWidget(width_field, row, 1); row++;
     grid_layout->addWidget(height_label, row, 0);
@@ -190,7 +306,10 @@ QVBoxLayout* Gui::createMenu()
     grid_layout->addWidget(torch_button, row, 1); row++;
     grid_layout->addWidget(command_label, row, 0);
     grid_layout->addWidget(command_field, row, 1); row++;
-    grid_layout->addWidget(command_button, row, 1);
+    grid_layout->addWidget(command_button, row, 1); row++;
+    grid_layout->addWidget(protocol_label, row, 0);
+    grid_layout->addWidget(protocol_field, row, 1); row++;
+    grid_layout->addWidget(protocol_button, row, 1);
 
     QVBoxLayout* menu_layout = new QVBoxLayout;
     menu_layout->addLayout(grid_layout);
@@ -201,10 +320,21 @@ QVBoxLayout* Gui::createMenu()
     connect(m_exp_field, SIGNAL(editingFinished()), this, SLOT(onExposureEdit()));
     connect(bin_field, SIGNAL(clicked()), this, SLOT(onBinningEdit()));
     connect(gain_field, SIGNAL(editingFinished()), this, SLOT(onGainEdit()));
+    connect(auto_exp_field, SIGNAL(clicked()), this, SLOT(onAutoExposureEdit()));
+    connect(pretrigger_field, SIGNAL(clicked()), this, SLOT(onPreTriggerEdit()));
+    connect(feed_field, SIGNAL(clicked()), this, SLOT(onLiveFeedEdit()));
+    connect(fvfm_field, SIGNAL(clicked()), this, SLOT(onFvFmEdit()));
+    connect(palette_field, SIGNAL(currentIndexChanged(int)), this, SLOT(onFvFmEdit()));
+    connect(roi_field, SIGNAL(editingFinished()), this, SLOT(onRoiEdit()));
+    connect(segment_field, SIGNAL(clicked()), this, SLOT(onSegmentEdit()));
     connect(command_field, SIGNAL(editingFinished()), this, SLOT(onCommandEdit()));
     connect(torch_button, SIGNAL(released()), this, SLOT(onTorchClick()));
     connect(command_button, SIGNAL(released()), this, SLOT(onCommandClick()));
+    connect(protocol_button, SIGNAL(released()), this, SLOT(onProtocolClick()));
+
 
+    param_timer = new QTimer(this);
+    connect(param_timer, SIGNAL(timeout()), this, SLOT(onParamTimer()));
 
     return menu_layout;
 }
@@ -217,67 +347,199 @@ void Gui::onCommandEdit()
 void Gui::onCommandClick()
 {
     QString str = command_field->text();
-    Tools::sendSerialString(str.toStdString());
+
+    // A command with camera triggers is what the next recording is checked against
+    std::vector<SerialCommand> cmds;
+    bool has_triggers = Sequence::parse(str.toStdString(), cmds) && Sequence::triggerCount(cmds) > 0;
+    std::string command = str.toStdString();
+    controller->post("", [has_triggers, command](Receiver* r)
+    {
+        if (has_triggers)
+        {
+            r->setSequence(command);
+        }
+        Tools::sendSerialString(command);
+    });
+    setFocus(Qt::OtherFocusReason);
+}
+
+void Gui::onProtocolClick()
+{
+    if (protocol_button->isChecked())
+    {
+        // Load and run, leave the button up if either fails
+        std::string file = protocol_field->text().toStdString();
+        bool ok = receiver->isConnected() && scheduler->load(file) && scheduler->start(image_path + "schedule.csv");
+        protocol_button->setChecked(ok);
+    }
+    else
+    {
+        scheduler->stop();
+    }
     setFocus(Qt::OtherFocusReason);
 }
 
+void Gui::onProtocolFinished()
+{
+    // Joins the wheel thread and pops the button back up, unless the
+    // protocol was started again in the meantime
+    if (!quitting && !scheduler->isRunning())
+    {
+        scheduler->stop();
+        protocol_button->setChecked(false);
+    }
+}
+
 void Gui::onTorchClick()
 {
+    std::string command = "0 0 0";
     if (torch_button->isChecked())
     {
         int val = torch_slider->value() * 100;
         std::stringstream ss;
         ss << "0 0 " << val;
-        Tools::sendSerialString(ss.str());
-    }
-    else
-    {
-        Tools::sendSerialString("0 0 0");
+        command = ss.str();
     }
+    controller->post("torch", [command](Receiver*) { Tools::sendSerialString(command); });
     setFocus(Qt::OtherFocusReason);
 }
 
 void Gui::onExposureEdit()
 {
-    if (receiver->isConnected())
-    {
-        QString str = m_exp_field->text();
-        receiver->setExposure(str.toInt());
-    }
-    updateParameters();
+    int exposure = m_exp_field->text().toInt();
+    controller->post("exposure", [exposure](Receiver* r) { r->setExposure(exposure); });
     setFocus(Qt::OtherFocusReason);
 }
 
 void Gui::onBinningEdit()
 {
-    if (receiver->isConnected())
-    {
-        receiver->setBinning(bin_field->isChecked());
-    }
-    updateParameters();
+    bool binning = bin_field->isChecked();
+    controller->post("binning", [binning](Receiver* r) { r->setBinning(binning); });
     setFocus(Qt::OtherFocusReason);
 }
 
 void Gui::onGainEdit()
 {
-    if (receiver->isConnected())
+    int gain = gain_field->text().toInt();
+    controller->post("gain", [gain](Receiver* r) { r->setGain(gain); });
+    setFocus(Qt::OtherFocusReason);
+}
+
+void Gui::onPreTriggerEdit()
+{
+    bool enabled = pretrigger_field->isChecked();
+    controller->post("pretrigger", [enabled](Receiver* r) { r->setPreTrigger(enabled); });
+    setFocus(Qt::OtherFocusReason);
+}
+
+void Gui::onLiveFeedEdit()
+{
+    bool enabled = feed_field->isChecked();
+    controller->post("live_feed", [enabled](Receiver* r) { r->setLiveFeed(enabled); });
+    setFocus(Qt::OtherFocusReason);
+}
+
+void Gui::onFvFmEdit()
+{
+    bool enabled = fvfm_field->isChecked();
+    int palette = palette_field->currentIndex();
+    controller->post("fvfm", [enabled, palette](Receiver* r) { r->setFvFmPreview(enabled, palette); });
+    setFocus(Qt::OtherFocusReason);
+}
+
+void Gui::onRoiEdit()
+{
+    std::string file = roi_field->text().toStdString();
+    controller->post("roi", [file](Receiver* r) { r->setRoiMask(file); });
+    setFocus(Qt::OtherFocusReason);
+}
+
+void Gui::onSegmentEdit()
+{
+    bool enabled = segment_field->isChecked();
+    controller->post("segment", [enabled](Receiver* r) { r->setSegmentation(enabled); });
+    setFocus(Qt::OtherFocusReason);
+}
+
+void Gui::onAutoExposureEdit()
+{
+    bool enabled = auto_exp_field->isChecked();
+    controller->post("auto_exposure", [enabled](Receiver* r) { r->setAutoExposure(enabled); });
+
+    // The loop owns gain and exposure while it runs
+    gain_field->setReadOnly(enabled);
+    m_exp_field->setReadOnly(enabled);
+    if (enabled)
     {
-        QString str = gain_field->text();
-        receiver->setGain(str.toInt());
+        param_timer->start(500);
     }
+    else
+    {
+        param_timer->stop();
+    }
+
     setFocus(Qt::OtherFocusReason);
+}
+
+void Gui::onParamTimer()
+{
     updateParameters();
 }
 
+void Gui::onStatsTimer()
+{
+    FrameStatsSummary s = receiver->getFrameStats();
+    if (s.frames == 0)
+    {
+        return;
+    }
+
+    std::stringstream ss;
+    ss << std::fixed << std::setprecision(2);
+    ss << "Last " << s.frames << " frames at " << receiver->getPacketSize() << " byte packets" << std::endl
+       << s.packets_received << " of " << s.packets_expected << " packets, " << s.lossRate() * 100.0 << "% lost" << std::endl
+       << s.resend_requests << " resend requests for " << s.resend_packets << " packets, " << s.resent_received << " recovered" << std::endl
+       << s.duplicates << " duplicates, " << s.out_of_order << " out of order";
+    if (s.reassembly_max_us > 0.0)
+    {
+        ss << std::endl << "Reassembly " << s.reassembly_mean_us / 1000.0 << " ms mean, " << s.reassembly_max_us / 1000.0 << " ms max";
+    }
+
+    net_field->setText(QString::fromStdString(s.describe()));
+    net_field->setToolTip(QString::fromStdString(ss.str()));
+}
+
+void Gui::onStallTimer()
+{
+    static MetricsHistogram* stall_ms = Metrics::instance().histogram("pam_ui_stall_ms", "How late the UI event loop ran its stall timer",
+        {1.0, 5.0, 10.0, 20.0, 50.0, 100.0, 250.0, 500.0, 1000.0});
+    static Gauge* stall_max_ms = Metrics::instance().gauge("pam_ui_stall_max_ms", "Longest UI event loop stall so far");
+    static double longest = 0.0;
+
+    auto now = std::chrono::steady_clock::now();
+    double late = std::chrono::duration<double, std::milli>(now - last_tick).count() - UI_STALL_INTERVAL;
+    last_tick = now;
+
+    late = std::max(0.0, late);
+    stall_ms->observe(late);
+    if (late > longest)
+    {
+        longest = late;
+        stall_max_ms->set(longest);
+    }
+}
+
 // Keypress event
 void Gui::keyPressEvent(QKeyEvent* event)
 {
     if (event->key() == Qt::Key_Space)
     {
-        // start/stop stream
-            if (receiver->isConnected())
-            {
-                receiver->setState();
-            }
+        // start/stop stream, every press counts
+        controller->post("", [](Receiver* r) { r->setState(); });
+    }
+    else if (event->key() == Qt::Key_C)
+    {
+        // Write out the pre-trigger ring and the next few seconds
+        controller->post("", [](Receiver* r) { r->commitPreTrigger(); });
     }
 }
\ No newline at end of file
@@ -16,14 +16,26 @@
 #include <QKeyEvent>
 #include <QToolButton>
 #include <QSlider>
+#include <QCheckBox>
+#include <QComboBox>
+#include <QTimer>
+#include <QSocketNotifier>
 
 // eBUS SDK
 #include <PvDisplayWnd.h>
 
 // project
 #include "receiver.h"
+#include "scheduler.h"
+#include "controller.h"
 #include "signalhandler.h"
 
+// Period of the timer used to measure UI event loop stalls
+#define UI_STALL_INTERVAL 20    // (ms)
+
+// How often the network statistics field is refreshed
+#define UI_STATS_INTERVAL 1000  // (ms)
+
 static const std::string SEND_STR = "1 0 800    5 0 0   2 100 512 5 100 0      1 199 2500    2 200 400000 5 500 0   5 750 0 5 850 0";
 
 class Gui : public QWidget, public SignalHandler
@@ -47,29 +59,62 @@ class Gui : public QWidget, public SignalHandler
         QVBoxLayout* createMenu();
         void createDisplay();
         void updateParameters();
+        void showParameters(const DeviceParams& dp);
 
     public slots:
         void onExposureEdit();
         void onBinningEdit();
         void onGainEdit();
+        void onAutoExposureEdit();
+        void onPreTriggerEdit();
+        void onLiveFeedEdit();
+        void onFvFmEdit();
+        void onRoiEdit();
+        void onSegmentEdit();
+        void onParamTimer();
+        void onStallTimer();
+        void onStatsTimer();
+        void onSignal();
         void onTorchClick();
         void onCommandClick();
         void onCommandEdit();
+        void onProtocolClick();
+        void onProtocolFinished();
 
     private:
         // Ui element variables
         QLineEdit* name_field;
         QLineEdit* ip_field;
         QLineEdit* mac_field;
+        QLineEdit* net_field;
         QLineEdit* gain_field;
         QLineEdit* m_exp_field;
         QRadioButton* bin_field;
+        QCheckBox* auto_exp_field;
+        QCheckBox* pretrigger_field;
+        QCheckBox* feed_field;
+        QCheckBox* fvfm_field;
+        QComboBox* palette_field;
+        QLineEdit* roi_field;
+        QCheckBox* segment_field;
         QLineEdit* width_field;
         QLineEdit* height_field;
         QLineEdit* command_field;
         QSlider* torch_slider;
         QToolButton* torch_button;
         QToolButton* command_button;
+        QLineEdit* protocol_field;
+        QToolButton* protocol_button;
+
+        // Refreshes the parameter fields while auto exposure is adjusting them
+        QTimer* param_timer;
+
+        // Fires every UI_STALL_INTERVAL, any lateness is time the loop was blocked
+        QTimer* stall_timer;
+        std::chrono::steady_clock::time_point last_tick;
+
+        // Refreshes the network field from the receiver's frame statistics
+        QTimer* stats_timer;
 
         // The display widget is the container widget of the image display
         QWidget* display_widget;
@@ -79,8 +124,14 @@ class Gui : public QWidget, public SignalHandler
 
         // RECIEVER CLASS
         Receiver* receiver;
+        Scheduler* scheduler;
+        Controller* controller;
+        std::string image_path;
         
+        QSocketNotifier* signal_notifier;
+
         bool init = false;
+        bool quitting = false;
 
 };
 
@@ -0,0 +1,272 @@
+// *****************************************************************************
+//
+// gvsp.h
+// GigE Vision stream protocol (GVSP) and the parts of the control protocol
+// (GVCP) the stream side needs, as plain byte layouts so the in tree
+// receiver and sender don't depend on eBUS.
+//
+// A frame is a block of UDP packets: a leader (packet 0) with the image
+// size and pixel format, data packets 1..N of packet_size bytes less the
+// IP, UDP and GVSP headers (the last one shorter), and a trailer (N + 1).
+// Every packet starts with
+//
+//     status (16) | block id (16) | format (8) | packet id (24)
+//
+// or, with the extended ID flag (GigE Vision 2.0), with a 20 byte header
+// holding a 64 bit block id and a 32 bit packet id. All fields are big
+// endian.
+//
+// Missing packets are asked for again with PACKETRESEND_CMD on the device's
+// GVCP port. Devices send resent packets with GVSP_STATUS_RESEND.
+//
+// *****************************************************************************
+
+
+#ifndef __GVSP_H__
+#define __GVSP_H__
+
+#include <cstddef>
+#include <cstdint>
+
+#define GVCP_PORT 3956
+#define GVCP_KEY 0x42
+#define GVCP_HEADER_SIZE 8
+#define GVCP_FLAG_ACK 0x01              // Acknowledge requested
+#define GVCP_FLAG_EXTENDED_ID 0x10      // PACKETRESEND_CMD with 64 bit block ids
+#define GVCP_PACKETRESEND_CMD 0x0040
+
+#define GVSP_HEADER_SIZE 8
+#define GVSP_EXT_HEADER_SIZE 20
+#define GVSP_EI_FLAG 0x80               // Extended ID, in the format byte
+#define GVSP_IP_UDP_OVERHEAD 28         // IPv4 and UDP headers, counted in the packet size
+#define GVSP_LEADER_SIZE 36             // Image leader after the GVSP header
+#define GVSP_TRAILER_SIZE 8
+#define GVSP_MAX_PACKET 9216            // Largest datagram taken, jumbo frames included
+#define DEFAULT_GVSP_PACKET_SIZE 1500   // GevSCPSPacketSize, 8192 or so with jumbo frames
+
+#define GVSP_STATUS_SUCCESS 0x0000
+#define GVSP_STATUS_RESEND 0x0100       // Packet is a resend
+
+#define GVSP_PAYLOAD_IMAGE 0x0001
+
+// Pixel formats (PFNC). Bits 16-23 are the bits per pixel.
+#define GVSP_PIX_MONO8 0x01080001
+#define GVSP_PIX_MONO12 0x01100005
+#define GVSP_PIX_MONO16 0x01100007
+
+enum GvspFormat
+{
+    GVSP_LEADER = 1,
+    GVSP_TRAILER = 2,
+    GVSP_PAYLOAD = 3
+};
+
+struct GvspPacket
+{
+    uint16_t status;
+    uint64_t block_id;
+    int format;
+    uint32_t packet_id;
+    bool extended;
+    const uint8_t* data;    // After the header
+    size_t size;
+};
+
+struct GvspImageLeader
+{
+    uint64_t timestamp;     // Device ticks
+    uint32_t pixel_format;
+    uint32_t width;
+    uint32_t height;
+    uint32_t offset_x;
+    uint32_t offset_y;
+    uint16_t padding_x;
+    uint16_t padding_y;
+};
+
+struct GvspResend
+{
+    uint16_t req_id;
+    uint16_t channel;
+    uint64_t block_id;
+    uint32_t first;         // Packet ids, inclusive
+    uint32_t last;
+    bool extended;
+};
+
+namespace Gvsp
+{
+    inline void put16(uint8_t* p, uint16_t v) { p[0] = v >> 8; p[1] = v; }
+    inline void put32(uint8_t* p, uint32_t v) { put16(p, v >> 16); put16(p + 2, v); }
+    inline void put64(uint8_t* p, uint64_t v) { put32(p, v >> 32); put32(p + 4, v); }
+    inline uint16_t get16(const uint8_t* p) { return static_cast<uint16_t>(p[0] << 8 | p[1]); }
+    inline uint32_t get32(const uint8_t* p) { return static_cast<uint32_t>(get16(p)) << 16 | get16(p + 2); }
+    inline uint64_t get64(const uint8_t* p) { return static_cast<uint64_t>(get32(p)) << 32 | get32(p + 4); }
+
+    inline uint32_t bitsPerPixel(uint32_t pixel_format)
+    {
+        return (pixel_format >> 16) & 0xff;
+    }
+
+    inline size_t imageBytes(uint32_t pixel_format, uint32_t width, uint32_t height)
+    {
+        return (static_cast<size_t>(width) * height * bitsPerPixel(pixel_format) + 7) / 8;
+    }
+
+    // Image bytes in each data packet
+    inline size_t payloadSize(uint32_t packet_size, bool extended)
+    {
+        size_t header = GVSP_IP_UDP_OVERHEAD + (extended ? GVSP_EXT_HEADER_SIZE : GVSP_HEADER_SIZE);
+        return (packet_size > header) ? packet_size - header : 0;
+    }
+
+    inline bool parse(const uint8_t* p, size_t n, GvspPacket& out)
+    {
+        if (n < GVSP_HEADER_SIZE)
+        {
+            return false;
+        }
+        out.status = get16(p);
+        out.extended = (p[4] & GVSP_EI_FLAG) != 0;
+        out.format = p[4] & 0x0f;
+        if (out.extended)
+        {
+            if (n < GVSP_EXT_HEADER_SIZE)
+            {
+                return false;
+            }
+            out.block_id = get64(p + 8);
+            out.packet_id = get32(p + 16);
+            out.data = p + GVSP_EXT_HEADER_SIZE;
+            out.size = n - GVSP_EXT_HEADER_SIZE;
+        }
+        else
+        {
+            out.block_id = get16(p + 2);
+            out.packet_id = get32(p + 4) & 0xffffff;
+            out.data = p + GVSP_HEADER_SIZE;
+            out.size = n - GVSP_HEADER_SIZE;
+        }
+        return out.format >= GVSP_LEADER && out.format <= GVSP_PAYLOAD;
+    }
+
+    // Returns the header length
+    inline size_t writeHeader(uint8_t* p, uint16_t status, uint64_t block_id, int format, uint32_t packet_id, bool extended)
+    {
+        put16(p, status);
+        if (extended)
+        {
+            put16(p + 2, 0);
+            put32(p + 4, 0);
+            p[4] = GVSP_EI_FLAG | format;
+            put64(p + 8, block_id);
+            put32(p + 16, packet_id);
+            return GVSP_EXT_HEADER_SIZE;
+        }
+        put16(p + 2, static_cast<uint16_t>(block_id));
+        put32(p + 4, packet_id & 0xffffff);
+        p[4] = format;
+        return GVSP_HEADER_SIZE;
+    }
+
+    inline size_t writeLeader(uint8_t* p, const GvspImageLeader& l)
+    {
+        put16(p, 0);
+        put16(p + 2, GVSP_PAYLOAD_IMAGE);
+        put64(p + 4, l.timestamp);
+        put32(p + 12, l.pixel_format);
+        put32(p + 16, l.width);
+        put32(p + 20, l.height);
+        put32(p + 24, l.offset_x);
+        put32(p + 28, l.offset_y);
+        put16(p + 32, l.padding_x);
+        put16(p + 34, l.padding_y);
+        return GVSP_LEADER_SIZE;
+    }
+
+    inline bool parseLeader(const uint8_t* p, size_t n, GvspImageLeader& l)
+    {
+        if (n < GVSP_LEADER_SIZE || get16(p + 2) != GVSP_PAYLOAD_IMAGE)
+        {
+            return false;
+        }
+        l.timestamp = get64(p + 4);
+        l.pixel_format = get32(p + 12);
+        l.width = get32(p + 16);
+        l.height = get32(p + 20);
+        l.offset_x = get32(p + 24);
+        l.offset_y = get32(p + 28);
+        l.padding_x = get16(p + 32);
+        l.padding_y = get16(p + 34);
+        return true;
+    }
+
+    inline size_t writeTrailer(uint8_t* p, uint32_t height)
+    {
+        put16(p, 0);
+        put16(p + 2, GVSP_PAYLOAD_IMAGE);
+        put32(p + 4, height);
+        return GVSP_TRAILER_SIZE;
+    }
+
+    // GVCP command header: key, flags, command, payload length, request id
+    inline size_t writeCommand(uint8_t* p, uint8_t flags, uint16_t command, uint16_t length, uint16_t req_id)
+    {
+        p[0] = GVCP_KEY;
+        p[1] = flags;
+        put16(p + 2, command);
+        put16(p + 4, length);
+        put16(p + 6, req_id);
+        return GVCP_HEADER_SIZE;
+    }
+
+    inline size_t writeResend(uint8_t* p, const GvspResend& r)
+    {
+        if (r.extended)
+        {
+            writeCommand(p, GVCP_FLAG_EXTENDED_ID, GVCP_PACKETRESEND_CMD, 20, r.req_id);
+            put16(p + 8, r.channel);
+            put16(p + 10, 0);
+            put32(p + 12, r.first);
+            put32(p + 16, r.last);
+            put64(p + 20, r.block_id);
+            return GVCP_HEADER_SIZE + 20;
+        }
+        writeCommand(p, 0, GVCP_PACKETRESEND_CMD, 12, r.req_id);
+        put16(p + 8, r.channel);
+        put16(p + 10, static_cast<uint16_t>(r.block_id));
+        put32(p + 12, r.first & 0xffffff);
+        put32(p + 16, r.last & 0xffffff);
+        return GVCP_HEADER_SIZE + 12;
+    }
+
+    inline bool parseResend(const uint8_t* p, size_t n, GvspResend& r)
+    {
+        if (n < GVCP_HEADER_SIZE + 12 || p[0] != GVCP_KEY || get16(p + 2) != GVCP_PACKETRESEND_CMD)
+        {
+            return false;
+        }
+        r.extended = (p[1] & GVCP_FLAG_EXTENDED_ID) != 0;
+        r.req_id = get16(p + 6);
+        r.channel = get16(p + 8);
+        if (r.extended)
+        {
+            if (n < GVCP_HEADER_SIZE + 20)
+            {
+                return false;
+            }
+            r.first = get32(p + 12);
+            r.last = get32(p + 16);
+            r.block_id = get64(p + 20);
+        }
+        else
+        {
+            r.block_id = get16(p + 10);
+            r.first = get32(p + 12) & 0xffffff;
+            r.last = get32(p + 16) & 0xffffff;
+        }
+        return r.first <= r.last;
+    }
+}
+
+#endif // __GVSP_H__
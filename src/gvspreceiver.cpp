@@ -0,0 +1,575 @@
+#include "gvspreceiver.h"
+#include "framestats.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define GVSP_MAX_RESEND_RANGES 32   // Resend commands per frame per round
+
+GvspReceiver::GvspReceiver() :
+    fd(-1), wake_fd(-1), port(0), socket_buffer(0), packet_size(DEFAULT_GVSP_PACKET_SIZE), max_bytes(0),
+    device_port(GVCP_PORT), resend(true), resend_delay_us(DEFAULT_GVSP_RESEND_DELAY), max_resends(DEFAULT_GVSP_MAX_RESENDS),
+    frame_timeout_ms(DEFAULT_GVSP_FRAME_TIMEOUT), req_id(0), recent_next(0), payload(0), extended(false),
+    frame_stats(nullptr), running(false)
+{
+    std::fill(recent, recent + GVSP_RECENT_BLOCKS, UINT64_MAX);
+}
+
+GvspReceiver::~GvspReceiver()
+{
+    close();
+}
+
+int64_t GvspReceiver::now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool GvspReceiver::open(uint16_t _port, size_t _max_bytes, unsigned int buffers, uint32_t _packet_size, int _socket_buffer)
+{
+    close();
+
+    fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (fd < 0)
+    {
+        std::cout << "Gvsp: socket failed: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    // FORCE goes past rmem_max but needs CAP_NET_ADMIN
+    if (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &_socket_buffer, sizeof(_socket_buffer)) != 0)
+    {
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &_socket_buffer, sizeof(_socket_buffer));
+    }
+    socklen_t len = sizeof(socket_buffer);
+    getsockopt(fd, SOL_SOCKET, SO_RCVBUF, &socket_buffer, &len);
+    if (socket_buffer < _socket_buffer)
+    {
+        std::cout << "Gvsp: socket buffer " << (socket_buffer >> 10) << " KB of " << (_socket_buffer >> 10)
+                  << " KB asked for, raise net.core.rmem_max" << std::endl;
+    }
+
+    // Datagrams dropped on a full buffer come back with each read
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_RXQ_OVFL, &one, sizeof(one));
+
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(_port);
+    if (bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0)
+    {
+        std::cout << "Gvsp: bind to port " << _port << " failed: " << strerror(errno) << std::endl;
+        ::close(fd);
+        fd = -1;
+        return false;
+    }
+    len = sizeof(addr);
+    getsockname(fd, reinterpret_cast<struct sockaddr*>(&addr), &len);
+    port = ntohs(addr.sin_port);
+
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    packet_size = _packet_size;
+    max_bytes = _max_bytes;
+    payload = 0;
+
+    pool.clear();
+    pool.resize(buffers);
+    free_frames.clear();
+    for (GvspFrame& f : pool)
+    {
+        f.data.resize(max_bytes);
+        free_frames.push_back(&f);
+    }
+    for (Active& a : active)
+    {
+        a = Active();
+    }
+    std::fill(recent, recent + GVSP_RECENT_BLOCKS, UINT64_MAX);
+    stats = GvspStats();
+    snapshot = GvspStats();
+    return true;
+}
+
+void GvspReceiver::close()
+{
+    stop();
+    if (wake_fd >= 0)
+    {
+        ::close(wake_fd);
+        wake_fd = -1;
+    }
+    if (fd >= 0)
+    {
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+uint16_t GvspReceiver::getPort()
+{
+    return port;
+}
+
+int GvspReceiver::getSocketBuffer()
+{
+    return socket_buffer;
+}
+
+void GvspReceiver::setDevice(const std::string& ip, uint16_t gvcp_port)
+{
+    device_ip = ip;
+    device_port = gvcp_port;
+}
+
+void GvspReceiver::setResend(bool enabled, uint32_t delay_us, unsigned int max_asks)
+{
+    resend = enabled;
+    resend_delay_us = delay_us;
+    max_resends = max_asks;
+}
+
+void GvspReceiver::setFrameTimeout(uint32_t ms)
+{
+    frame_timeout_ms = ms;
+}
+
+void GvspReceiver::setFrameStats(FrameStatsRing* _frame_stats)
+{
+    frame_stats = _frame_stats;
+}
+
+bool GvspReceiver::start(FrameCallback _callback)
+{
+    if (fd < 0 || running)
+    {
+        return false;
+    }
+
+    uint64_t v;
+    while (read(wake_fd, &v, sizeof(v)) > 0)
+    {
+    }
+    callback = _callback;
+    running = true;
+    thread = std::thread(&GvspReceiver::run, this);
+    return true;
+}
+
+void GvspReceiver::stop()
+{
+    if (!thread.joinable())
+    {
+        return;
+    }
+
+    running = false;
+    uint64_t one = 1;
+    if (write(wake_fd, &one, sizeof(one)) < 0)
+    {
+        std::cout << "Gvsp: unable to wake the receiver: " << strerror(errno) << std::endl;
+    }
+    thread.join();
+
+    // Frames being assembled go back without being handed on
+    for (Active& a : active)
+    {
+        if (a.frame != nullptr)
+        {
+            release(a.frame);
+            a.frame = nullptr;
+        }
+    }
+}
+
+void GvspReceiver::release(GvspFrame* frame)
+{
+    std::lock_guard<std::mutex> lock(pool_mtx);
+    free_frames.push_back(frame);
+}
+
+GvspFrame* GvspReceiver::takeBuffer()
+{
+    std::lock_guard<std::mutex> lock(pool_mtx);
+    if (free_frames.empty())
+    {
+        return nullptr;
+    }
+    GvspFrame* f = free_frames.back();
+    free_frames.pop_back();
+    return f;
+}
+
+GvspStats GvspReceiver::getStats()
+{
+    std::lock_guard<std::mutex> lock(stats_mtx);
+    return snapshot;
+}
+
+GvspReceiver::Active* GvspReceiver::activeFor(uint64_t block_id, int64_t t)
+{
+    Active* slot = nullptr;
+    for (Active& a : active)
+    {
+        if (a.frame != nullptr && a.frame->block_id == block_id)
+        {
+            return &a;
+        }
+        if (a.frame == nullptr && slot == nullptr)
+        {
+            slot = &a;
+        }
+    }
+
+    // All slots busy, the oldest frame won't be finished
+    if (slot == nullptr)
+    {
+        slot = &active[0];
+        for (Active& a : active)
+        {
+            slot = (a.first_ns < slot->first_ns) ? &a : slot;
+        }
+        finish(*slot, t);
+    }
+
+    GvspFrame* frame = takeBuffer();
+    if (frame == nullptr)
+    {
+        // Remembered, so the rest of its packets are dropped quietly
+        stats.no_buffer++;
+        recent[recent_next] = block_id;
+        recent_next = (recent_next + 1) % GVSP_RECENT_BLOCKS;
+        return nullptr;
+    }
+
+    frame->block_id = block_id;
+    frame->size = 0;
+    frame->timestamp = 0;
+    frame->pixel_format = 0;
+    frame->width = frame->height = 0;
+    frame->stats = GvspFrameStats();
+    frame->stats.block_id = block_id;
+
+    size_t ids = max_bytes / payload + 3;
+    Active& a = *slot;
+    a.frame = frame;
+    a.got.assign(ids, 0);
+    a.asked.assign(ids, 0);
+    a.last_id = 0;
+    a.highest = 0;
+    a.received = 0;
+    a.leader = a.trailer = false;
+    a.first_ns = a.last_ns = t;
+    a.gap_ns = 0;
+    a.rounds = 0;
+    return slot;
+}
+
+bool GvspReceiver::isComplete(const Active& a)
+{
+    // The trailer isn't needed
+    return a.leader && a.last_id > 0 && a.received - (a.trailer ? 1 : 0) == a.last_id;
+}
+
+void GvspReceiver::handlePacket(const uint8_t* p, size_t n, int64_t t)
+{
+    GvspPacket pk;
+    if (!Gvsp::parse(p, n, pk))
+    {
+        stats.malformed++;
+        return;
+    }
+    stats.packets++;
+    stats.bytes += n;
+    if (payload == 0)
+    {
+        payload = Gvsp::payloadSize(packet_size, pk.extended);
+        extended = pk.extended;
+        if (payload == 0)
+        {
+            return;
+        }
+    }
+
+    if (std::find(recent, recent + GVSP_RECENT_BLOCKS, pk.block_id) != recent + GVSP_RECENT_BLOCKS)
+    {
+        stats.stale++;
+        return;
+    }
+
+    Active* a = activeFor(pk.block_id, t);
+    if (a == nullptr)
+    {
+        return;
+    }
+    GvspFrame* f = a->frame;
+    uint32_t id = pk.packet_id;
+    if (id >= a->got.size() || (a->last_id > 0 && id > a->last_id))
+    {
+        stats.malformed++;
+        return;
+    }
+    if (a->got[id])
+    {
+        f->stats.duplicates++;
+        return;
+    }
+
+    // A jump past the next id leaves a gap, an id below the highest fills one
+    if (a->received > 0 && id < a->highest)
+    {
+        f->stats.out_of_order++;
+    }
+    else if ((a->received == 0 && id > 0) || id > a->highest + 1)
+    {
+        a->gap_ns = (a->gap_ns != 0) ? a->gap_ns : t;
+    }
+    a->got[id] = 1;
+    a->received++;
+    a->highest = std::max(a->highest, id);
+    a->last_ns = t;
+    if (a->asked[id])
+    {
+        f->stats.resent_received++;
+        stats.resent_received++;
+    }
+
+    switch (pk.format)
+    {
+        case GVSP_LEADER:
+        {
+            GvspImageLeader l;
+            if (!Gvsp::parseLeader(pk.data, pk.size, l) || Gvsp::imageBytes(l.pixel_format, l.width, l.height) > max_bytes)
+            {
+                stats.malformed++;
+                break;
+            }
+            f->timestamp = l.timestamp;
+            f->pixel_format = l.pixel_format;
+            f->width = l.width;
+            f->height = l.height;
+            f->size = Gvsp::imageBytes(l.pixel_format, l.width, l.height);
+            a->last_id = static_cast<uint32_t>((f->size + payload - 1) / payload) + 1;
+            a->leader = true;
+            break;
+        }
+
+        case GVSP_PAYLOAD:
+        {
+            size_t offset = static_cast<size_t>(id - 1) * payload;
+            if (id == 0 || offset + pk.size > max_bytes)
+            {
+                stats.malformed++;
+                break;
+            }
+            memcpy(f->data.data() + offset, pk.data, pk.size);
+            break;
+        }
+
+        case GVSP_TRAILER:
+            a->trailer = true;
+            a->last_id = (a->last_id > 0) ? a->last_id : id;
+            break;
+    }
+
+    if (isComplete(*a))
+    {
+        finish(*a, t);
+    }
+    else if (a->trailer && a->gap_ns == 0)
+    {
+        a->gap_ns = t;
+    }
+}
+
+void GvspReceiver::requestResends(Active& a, int64_t t)
+{
+    a.rounds++;
+    a.gap_ns = t;
+    if (device_ip.empty())
+    {
+        return;
+    }
+
+    // Packets past the highest id seen may still be on their way, unless the
+    // trailer is in or the stream has stopped
+    bool tail = a.trailer || t - a.last_ns >= static_cast<int64_t>(resend_delay_us) * 1000;
+    uint32_t limit = (tail && a.last_id > 0) ? a.last_id - 1 : a.highest;
+    struct sockaddr_in dev = {};
+    dev.sin_family = AF_INET;
+    dev.sin_port = htons(device_port);
+    inet_pton(AF_INET, device_ip.c_str(), &dev.sin_addr);
+
+    GvspFrame* f = a.frame;
+    unsigned int ranges = 0;
+    uint32_t id = 0;
+    while (id <= limit && ranges < GVSP_MAX_RESEND_RANGES)
+    {
+        if (a.got[id] || a.asked[id] >= max_resends)
+        {
+            id++;
+            continue;
+        }
+        uint32_t first = id;
+        while (id <= limit && !a.got[id] && a.asked[id] < max_resends)
+        {
+            a.asked[id]++;
+            id++;
+        }
+
+        // Request ids skip 0
+        req_id = (req_id == 0xffff) ? 1 : req_id + 1;
+        GvspResend r = {req_id, 0, f->block_id, first, id - 1, extended};
+        uint8_t cmd[GVCP_HEADER_SIZE + 20];
+        size_t len = Gvsp::writeResend(cmd, r);
+        sendto(fd, cmd, len, 0, reinterpret_cast<struct sockaddr*>(&dev), sizeof(dev));
+
+        ranges++;
+        f->stats.resend_requests++;
+        f->stats.resend_packets += id - first;
+        stats.resend_requests++;
+        stats.resend_packets += id - first;
+    }
+}
+
+void GvspReceiver::checkFrames(int64_t t)
+{
+    for (Active& a : active)
+    {
+        if (a.frame == nullptr)
+        {
+            continue;
+        }
+        if (t - a.last_ns > static_cast<int64_t>(frame_timeout_ms) * 1000000)
+        {
+            finish(a, t);
+            continue;
+        }
+
+        // A stream that stops short has lost its tail
+        int64_t delay = static_cast<int64_t>(resend_delay_us) * 1000;
+        if (a.gap_ns == 0 && t - a.last_ns >= delay)
+        {
+            a.gap_ns = a.last_ns;
+        }
+        // Each round waits twice as long as the last (up to 8 times), resent
+        // packets queue behind the rest of the stream
+        if (resend && a.gap_ns != 0 && t - a.gap_ns >= (delay << std::min(a.rounds, 3u)))
+        {
+            requestResends(a, t);
+        }
+    }
+}
+
+void GvspReceiver::finish(Active& a, int64_t t)
+{
+    GvspFrame* f = a.frame;
+    a.frame = nullptr;
+
+    uint32_t limit = (a.last_id > 0) ? a.last_id : a.highest + 1;
+    uint32_t missing = 0;
+    for (uint32_t id = 0; id < limit; id++)
+    {
+        missing += !a.got[id];
+    }
+    f->stats.packets_expected = limit + 1;
+    f->stats.packets_received = a.received;
+    f->stats.missing = missing;
+    f->stats.reassembly_us = (t - a.first_ns) / 1e3;
+    f->stats.complete = isComplete(a);
+
+    stats.frames++;
+    (f->stats.complete ? stats.complete : stats.incomplete)++;
+    recent[recent_next] = f->block_id;
+    recent_next = (recent_next + 1) % GVSP_RECENT_BLOCKS;
+    if (frame_stats != nullptr)
+    {
+        frame_stats->push(f->stats);
+    }
+
+    if (callback)
+    {
+        callback(f);
+    }
+    else
+    {
+        release(f);
+    }
+}
+
+void GvspReceiver::run()
+{
+    std::vector<uint8_t> buf(static_cast<size_t>(GVSP_BATCH) * GVSP_MAX_PACKET);
+    struct mmsghdr msgs[GVSP_BATCH];
+    struct iovec iov[GVSP_BATCH];
+    static const size_t ctrl_size = CMSG_SPACE(sizeof(uint32_t));
+    std::vector<uint8_t> ctrl(GVSP_BATCH * ctrl_size);
+
+    struct pollfd fds[2] = {{fd, POLLIN, 0}, {wake_fd, POLLIN, 0}};
+    while (running)
+    {
+        // Woken at least every ms for the resend and timeout checks
+        if (poll(fds, 2, 1) < 0 && errno != EINTR)
+        {
+            std::cout << "Gvsp: poll failed: " << strerror(errno) << std::endl;
+            break;
+        }
+        if (fds[1].revents & POLLIN)
+        {
+            break;
+        }
+
+        while (true)
+        {
+            for (int i = 0; i < GVSP_BATCH; i++)
+            {
+                iov[i].iov_base = buf.data() + static_cast<size_t>(i) * GVSP_MAX_PACKET;
+                iov[i].iov_len = GVSP_MAX_PACKET;
+                memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+                msgs[i].msg_hdr.msg_iov = &iov[i];
+                msgs[i].msg_hdr.msg_iovlen = 1;
+                msgs[i].msg_hdr.msg_control = ctrl.data() + i * ctrl_size;
+                msgs[i].msg_hdr.msg_controllen = ctrl_size;
+            }
+
+            int n = recvmmsg(fd, msgs, GVSP_BATCH, MSG_DONTWAIT, nullptr);
+            if (n <= 0)
+            {
+                break;
+            }
+
+            int64_t t = now();
+            stats.batches++;
+            for (int i = 0; i < n; i++)
+            {
+                handlePacket(static_cast<const uint8_t*>(iov[i].iov_base), msgs[i].msg_len, t);
+                for (struct cmsghdr* c = CMSG_FIRSTHDR(&msgs[i].msg_hdr); c != nullptr; c = CMSG_NXTHDR(&msgs[i].msg_hdr, c))
+                {
+                    if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SO_RXQ_OVFL)
+                    {
+                        uint32_t drops;
+                        memcpy(&drops, CMSG_DATA(c), sizeof(drops));
+                        stats.socket_drops = std::max<uint64_t>(stats.socket_drops, drops);
+                    }
+                }
+            }
+            if (n < GVSP_BATCH)
+            {
+                break;
+            }
+        }
+
+        checkFrames(now());
+
+        std::lock_guard<std::mutex> lock(stats_mtx);
+        snapshot = stats;
+    }
+}
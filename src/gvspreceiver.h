@@ -0,0 +1,190 @@
+// *****************************************************************************
+//
+// gvspreceiver.h
+// GVSP stream receiver on a plain UDP socket, as an alternative to eBUS's
+// PvStream and its driver. The device is still configured elsewhere, this
+// only takes the stream: point the device's stream channel (GevSCDA and
+// GevSCPHostPort) at getPort().
+//
+// One thread takes packets in batches with recvmmsg from a socket with a
+// large receive buffer, and copies each payload straight to its place in a
+// frame from a fixed pool. Packets are placed by id, so order doesn't
+// matter. A packet id past a gap, or the trailer with packets still
+// missing, starts the resend timer for that frame. If the gap is still
+// there resend_delay later, the missing ranges are asked for with
+// PACKETRESEND_CMD. Later rounds each wait twice as long as the one before,
+// and a packet is asked for at most max_resends times. A frame is handed on
+// once the leader and every data packet are in. If nothing arrives for
+// frame_timeout it is handed on incomplete.
+//
+// Frames go to the callback on the receiver thread and come back to the
+// pool with release(). While the pool is empty new frames are dropped.
+//
+// *****************************************************************************
+
+
+#ifndef __GVSPRECEIVER_H__
+#define __GVSPRECEIVER_H__
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gvsp.h"
+
+#define DEFAULT_GVSP_BUFFERS 8              // Frames in the pool
+#define DEFAULT_GVSP_SOCKET_BUFFER (64 << 20)   // (bytes) asked for, the kernel may cap it at rmem_max
+#define DEFAULT_GVSP_RESEND_DELAY 2000      // (us) a gap may stay open before it's asked for
+#define DEFAULT_GVSP_MAX_RESENDS 3          // Times a packet is asked for
+#define DEFAULT_GVSP_FRAME_TIMEOUT 100      // (ms) without a packet before a frame is given up
+#define GVSP_BATCH 64                       // Datagrams per recvmmsg
+#define GVSP_ACTIVE_FRAMES 4                // Frames being assembled at once
+#define GVSP_RECENT_BLOCKS 16               // Finished block ids remembered, late resends are ignored
+
+class FrameStatsRing;
+
+struct GvspFrameStats
+{
+    uint64_t block_id = 0;
+    uint32_t packets_expected = 0;  // Leader, data and trailer
+    uint32_t packets_received = 0;
+    uint32_t missing = 0;           // Still missing when handed on
+    uint32_t resend_requests = 0;   // Resend commands sent
+    uint32_t resend_packets = 0;    // Packets asked for
+    uint32_t resent_received = 0;   // Asked for and arrived
+    uint32_t duplicates = 0;
+    uint32_t out_of_order = 0;      // Arrived after a higher id
+    double reassembly_us = 0.0;     // First packet to handed on
+    bool complete = false;
+};
+
+struct GvspFrame
+{
+    std::vector<uint8_t> data;      // max_bytes, size bytes used
+    size_t size = 0;
+    uint64_t block_id = 0;
+    uint64_t timestamp = 0;         // Device ticks, from the leader
+    uint32_t pixel_format = 0;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    GvspFrameStats stats;
+};
+
+struct GvspStats
+{
+    uint64_t packets = 0;
+    uint64_t bytes = 0;             // Datagram bytes
+    uint64_t batches = 0;           // recvmmsg calls that returned packets
+    uint64_t frames = 0;
+    uint64_t complete = 0;
+    uint64_t incomplete = 0;
+    uint64_t no_buffer = 0;         // Frames dropped, the pool was empty
+    uint64_t stale = 0;             // Packets of frames already handed on
+    uint64_t malformed = 0;
+    uint64_t resend_requests = 0;
+    uint64_t resend_packets = 0;
+    uint64_t resent_received = 0;
+    uint64_t socket_drops = 0;      // Datagrams the kernel dropped, socket buffer full
+};
+
+class GvspReceiver
+{
+    public:
+        typedef std::function<void(GvspFrame* frame)> FrameCallback;
+
+        GvspReceiver();
+        ~GvspReceiver();
+
+        // Port 0 picks a free one. max_bytes is the largest image expected.
+        bool open(uint16_t port, size_t max_bytes, unsigned int buffers = DEFAULT_GVSP_BUFFERS,
+                  uint32_t _packet_size = DEFAULT_GVSP_PACKET_SIZE, int socket_buffer = DEFAULT_GVSP_SOCKET_BUFFER);
+        void close();
+        uint16_t getPort();
+        int getSocketBuffer();      // What the kernel granted (bytes)
+
+        // Where resend requests go, the device's GVCP address
+        void setDevice(const std::string& ip, uint16_t gvcp_port = GVCP_PORT);
+        void setResend(bool enabled, uint32_t delay_us = DEFAULT_GVSP_RESEND_DELAY, unsigned int max_asks = DEFAULT_GVSP_MAX_RESENDS);
+        void setFrameTimeout(uint32_t ms);
+
+        // Each frame's statistics are also pushed here as it is handed on
+        // (see framestats.h). Set before start().
+        void setFrameStats(FrameStatsRing* _frame_stats);
+
+        bool start(FrameCallback _callback);
+        void stop();
+
+        // Hands a frame back to the pool
+        void release(GvspFrame* frame);
+        GvspStats getStats();
+
+    private:
+        struct Active
+        {
+            GvspFrame* frame = nullptr;
+            std::vector<uint8_t> got;       // Per packet id
+            std::vector<uint8_t> asked;     // Times asked for, per packet id
+            uint32_t last_id = 0;           // Trailer id once known (data packets + 1)
+            uint32_t highest = 0;
+            uint32_t received = 0;
+            bool leader = false;
+            bool trailer = false;
+            int64_t first_ns = 0;
+            int64_t last_ns = 0;
+            int64_t gap_ns = 0;             // A gap was first seen, 0 if none
+            unsigned int rounds = 0;
+        };
+
+        void run();
+        void handlePacket(const uint8_t* p, size_t n, int64_t now);
+        Active* activeFor(uint64_t block_id, int64_t now);
+        bool isComplete(const Active& a);
+        void checkFrames(int64_t now);
+        void requestResends(Active& a, int64_t now);
+        void finish(Active& a, int64_t now);
+        GvspFrame* takeBuffer();
+
+        static int64_t now();
+
+    private:
+        int fd;
+        int wake_fd;
+        uint16_t port;
+        int socket_buffer;
+        uint32_t packet_size;
+        size_t max_bytes;
+
+        std::string device_ip;
+        uint16_t device_port;
+        bool resend;
+        uint32_t resend_delay_us;
+        unsigned int max_resends;
+        uint32_t frame_timeout_ms;
+        uint16_t req_id;
+
+        std::vector<GvspFrame> pool;
+        std::vector<GvspFrame*> free_frames;
+        std::mutex pool_mtx;
+
+        Active active[GVSP_ACTIVE_FRAMES];
+        uint64_t recent[GVSP_RECENT_BLOCKS];
+        size_t recent_next;
+        size_t payload;             // Bytes per data packet, set by the first packet
+        bool extended;              // The stream uses extended ids, so do resend requests
+
+        FrameStatsRing* frame_stats;
+        FrameCallback callback;
+        std::thread thread;
+        std::atomic<bool> running;
+
+        GvspStats stats;            // Receiver thread only
+        GvspStats snapshot;         // Copied after each batch, under stats_mtx
+        std::mutex stats_mtx;
+};
+
+
+#endif // __GVSPRECEIVER_H__
@@ -0,0 +1,307 @@
+#include "gvspsender.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define GVSP_SEND_BATCH 64          // Datagrams per sendmmsg
+#define GVSP_SEND_BUFFER (8 << 20)  // (bytes) socket send buffer
+
+GvspSender::GvspSender() :
+    fd(-1), ctrl_fd(-1), wake_fd(-1), dest_port(0), packet_size(DEFAULT_GVSP_PACKET_SIZE), extended(false), block_id(0),
+    drop(0.0), reorder(0.0), rng(1), running(false)
+{
+}
+
+GvspSender::~GvspSender()
+{
+    close();
+}
+
+bool GvspSender::open(const std::string& ip, uint16_t port, uint32_t _packet_size, bool _extended)
+{
+    // The control port, if served, stays open
+    if (fd >= 0)
+    {
+        ::close(fd);
+    }
+
+    fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        std::cout << "Gvsp: socket failed: " << strerror(errno) << std::endl;
+        return false;
+    }
+    int size = GVSP_SEND_BUFFER;
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+
+    extended = _extended;
+    block_id = 0;
+    stats = GvspSenderStats();
+    history.clear();
+    setPacketSize(_packet_size);
+    return setDestination(ip, port);
+}
+
+void GvspSender::close()
+{
+    if (control.joinable())
+    {
+        running = false;
+        uint64_t one = 1;
+        if (write(wake_fd, &one, sizeof(one)) < 0)
+        {
+            std::cout << "Gvsp: unable to wake the control thread: " << strerror(errno) << std::endl;
+        }
+        control.join();
+    }
+    for (int* f : {&fd, &ctrl_fd, &wake_fd})
+    {
+        if (*f >= 0)
+        {
+            ::close(*f);
+            *f = -1;
+        }
+    }
+}
+
+bool GvspSender::setDestination(const std::string& ip, uint16_t port)
+{
+    struct in_addr a;
+    if (inet_pton(AF_INET, ip.c_str(), &a) != 1)
+    {
+        std::cout << "Gvsp: bad destination address " << ip << std::endl;
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(mtx);
+    dest_ip = ip;
+    dest_port = port;
+    return true;
+}
+
+void GvspSender::setPacketSize(uint32_t _packet_size)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    packet_size = std::min<uint32_t>(std::max<uint32_t>(_packet_size, GVSP_IP_UDP_OVERHEAD + GVSP_EXT_HEADER_SIZE + GVSP_LEADER_SIZE),
+                                     GVSP_MAX_PACKET + GVSP_IP_UDP_OVERHEAD);
+    history.clear();
+}
+
+void GvspSender::setLoss(double _drop, double _reorder, uint32_t seed)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    drop = _drop;
+    reorder = _reorder;
+    rng.seed(seed);
+}
+
+uint16_t GvspSender::serve(uint16_t gvcp_port)
+{
+    if (control.joinable())
+    {
+        return 0;
+    }
+
+    ctrl_fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(gvcp_port);
+    socklen_t len = sizeof(addr);
+    if (ctrl_fd < 0 || bind(ctrl_fd, reinterpret_cast<struct sockaddr*>(&addr), len) != 0)
+    {
+        std::cout << "Gvsp: unable to serve resends on port " << gvcp_port << ": " << strerror(errno) << std::endl;
+        return 0;
+    }
+    getsockname(ctrl_fd, reinterpret_cast<struct sockaddr*>(&addr), &len);
+
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    running = true;
+    control = std::thread(&GvspSender::runControl, this);
+    return ntohs(addr.sin_port);
+}
+
+uint64_t GvspSender::sendFrame(const uint8_t* data, uint32_t width, uint32_t height, uint32_t pixel_format, uint64_t timestamp)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+
+    // Block id 0 is reserved, 16 bit ids wrap to 1
+    block_id++;
+    if (!extended && (block_id & 0xffff) == 0)
+    {
+        block_id++;
+    }
+    uint64_t id = extended ? block_id : (block_id & 0xffff);
+
+    size_t bytes = Gvsp::imageBytes(pixel_format, width, height);
+    size_t payload = Gvsp::payloadSize(packet_size, extended);
+    size_t stride = packet_size - GVSP_IP_UDP_OVERHEAD;
+    uint32_t data_packets = static_cast<uint32_t>((bytes + payload - 1) / payload);
+    uint32_t total = data_packets + 2;
+
+    // The oldest frame's buffers are reused
+    Sent s;
+    if (history.size() >= GVSP_SENDER_HISTORY)
+    {
+        s = std::move(history.front());
+        history.pop_front();
+    }
+    s.block_id = id;
+    s.packets.resize(static_cast<size_t>(total) * stride);
+    s.lengths.resize(total);
+
+    uint8_t* p = s.packets.data();
+    GvspImageLeader l = {timestamp, pixel_format, width, height, 0, 0, 0, 0};
+    size_t h = Gvsp::writeHeader(p, GVSP_STATUS_SUCCESS, id, GVSP_LEADER, 0, extended);
+    s.lengths[0] = h + Gvsp::writeLeader(p + h, l);
+    for (uint32_t i = 0; i < data_packets; i++)
+    {
+        p = s.packets.data() + static_cast<size_t>(i + 1) * stride;
+        size_t offset = static_cast<size_t>(i) * payload;
+        size_t n = std::min(payload, bytes - offset);
+        h = Gvsp::writeHeader(p, GVSP_STATUS_SUCCESS, id, GVSP_PAYLOAD, i + 1, extended);
+        memcpy(p + h, data + offset, n);
+        s.lengths[i + 1] = h + n;
+    }
+    p = s.packets.data() + static_cast<size_t>(total - 1) * stride;
+    h = Gvsp::writeHeader(p, GVSP_STATUS_SUCCESS, id, GVSP_TRAILER, total - 1, extended);
+    s.lengths[total - 1] = h + Gvsp::writeTrailer(p + h, height);
+
+    std::vector<uint32_t> ids(total);
+    for (uint32_t i = 0; i < total; i++)
+    {
+        ids[i] = i;
+    }
+    sendPackets(s, ids, GVSP_STATUS_SUCCESS);
+    history.push_back(std::move(s));
+    stats.frames++;
+    return id;
+}
+
+void GvspSender::resend(const GvspResend& r)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    stats.resend_requests++;
+    auto it = std::find_if(history.begin(), history.end(), [&r](const Sent& s) { return s.block_id == r.block_id; });
+    if (it == history.end())
+    {
+        stats.resend_missed++;
+        return;
+    }
+
+    std::vector<uint32_t> ids;
+    for (uint32_t id = r.first; id <= r.last && id < it->lengths.size(); id++)
+    {
+        ids.push_back(id);
+    }
+    stats.resent += ids.size();
+    sendPackets(*it, ids, GVSP_STATUS_RESEND);
+}
+
+void GvspSender::sendPackets(Sent& s, const std::vector<uint32_t>& ids, uint16_t status)
+{
+    struct sockaddr_in dest = {};
+    dest.sin_family = AF_INET;
+    dest.sin_port = htons(dest_port);
+    inet_pton(AF_INET, dest_ip.c_str(), &dest.sin_addr);
+    size_t stride = packet_size - GVSP_IP_UDP_OVERHEAD;
+
+    // Loss and reordering are decided up front
+    std::vector<uint32_t> order;
+    order.reserve(ids.size());
+    std::uniform_real_distribution<double> u(0.0, 1.0);
+    for (uint32_t id : ids)
+    {
+        if (drop > 0.0 && u(rng) < drop)
+        {
+            stats.dropped++;
+            continue;
+        }
+        order.push_back(id);
+    }
+    for (size_t i = 0; reorder > 0.0 && i + 1 < order.size(); i++)
+    {
+        if (u(rng) < reorder)
+        {
+            std::swap(order[i], order[i + 1]);
+            stats.reordered++;
+            i++;
+        }
+    }
+
+    struct mmsghdr msgs[GVSP_SEND_BATCH];
+    struct iovec iov[GVSP_SEND_BATCH];
+    size_t i = 0;
+    while (i < order.size())
+    {
+        int n = static_cast<int>(std::min<size_t>(GVSP_SEND_BATCH, order.size() - i));
+        for (int k = 0; k < n; k++)
+        {
+            uint8_t* p = s.packets.data() + static_cast<size_t>(order[i + k]) * stride;
+            Gvsp::put16(p, status);
+            iov[k].iov_base = p;
+            iov[k].iov_len = s.lengths[order[i + k]];
+            memset(&msgs[k].msg_hdr, 0, sizeof(msgs[k].msg_hdr));
+            msgs[k].msg_hdr.msg_name = &dest;
+            msgs[k].msg_hdr.msg_namelen = sizeof(dest);
+            msgs[k].msg_hdr.msg_iov = &iov[k];
+            msgs[k].msg_hdr.msg_iovlen = 1;
+        }
+
+        int sent = sendmmsg(fd, msgs, n, 0);
+        if (sent < 0)
+        {
+            if (errno == EINTR || errno == ENOBUFS)
+            {
+                continue;
+            }
+            std::cout << "Gvsp: send failed: " << strerror(errno) << std::endl;
+            return;
+        }
+        for (int k = 0; k < sent; k++)
+        {
+            stats.bytes += iov[k].iov_len;
+        }
+        stats.packets += sent;
+        i += sent;
+    }
+}
+
+GvspSenderStats GvspSender::getStats()
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    return stats;
+}
+
+void GvspSender::runControl()
+{
+    uint8_t buf[GVSP_MAX_PACKET];
+    struct pollfd fds[2] = {{ctrl_fd, POLLIN, 0}, {wake_fd, POLLIN, 0}};
+    while (running)
+    {
+        if (poll(fds, 2, -1) < 0 && errno != EINTR)
+        {
+            std::cout << "Gvsp: poll failed: " << strerror(errno) << std::endl;
+            break;
+        }
+        if (fds[1].revents & POLLIN)
+        {
+            break;
+        }
+        if (fds[0].revents & POLLIN)
+        {
+            ssize_t n = recv(ctrl_fd, buf, sizeof(buf), 0);
+            GvspResend r;
+            if (n > 0 && Gvsp::parseResend(buf, n, r))
+            {
+                resend(r);
+            }
+        }
+    }
+}
@@ -0,0 +1,103 @@
+// *****************************************************************************
+//
+// gvspsender.h
+// Sending side of a GVSP stream, what a camera's stream channel does: each
+// frame goes out as leader, data packets and trailer with sendmmsg. The
+// last GVSP_SENDER_HISTORY frames are kept so resend requests can be
+// answered. Used by the stream bench and the device emulator.
+//
+// Packet loss and reordering can be injected: each packet is dropped with
+// probability drop, and swapped with the next one with probability reorder.
+// Dropped packets are still answered on resend, like a switch dropping them
+// rather than the device.
+//
+// serve() answers PACKETRESEND_CMD on its own GVCP port. A device that
+// already has a GVCP socket passes the commands to resend() instead.
+//
+// *****************************************************************************
+
+
+#ifndef __GVSPSENDER_H__
+#define __GVSPSENDER_H__
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gvsp.h"
+
+#define GVSP_SENDER_HISTORY 8       // Frames kept for resends
+
+struct GvspSenderStats
+{
+    uint64_t frames = 0;
+    uint64_t packets = 0;
+    uint64_t bytes = 0;
+    uint64_t dropped = 0;           // Injected loss
+    uint64_t reordered = 0;         // Injected swaps
+    uint64_t resend_requests = 0;
+    uint64_t resent = 0;            // Packets sent again
+    uint64_t resend_missed = 0;     // Asked for frames no longer kept
+};
+
+class GvspSender
+{
+    public:
+        GvspSender();
+        ~GvspSender();
+
+        bool open(const std::string& ip, uint16_t port, uint32_t _packet_size = DEFAULT_GVSP_PACKET_SIZE, bool _extended = false);
+        void close();
+        bool setDestination(const std::string& ip, uint16_t port);
+        void setPacketSize(uint32_t _packet_size);
+        void setLoss(double _drop, double _reorder, uint32_t seed = 1);
+
+        // Answers resend requests on this port (0 picks a free one), returns the port or 0
+        uint16_t serve(uint16_t gvcp_port);
+
+        // Returns the block id
+        uint64_t sendFrame(const uint8_t* data, uint32_t width, uint32_t height, uint32_t pixel_format, uint64_t timestamp);
+        void resend(const GvspResend& r);
+
+        GvspSenderStats getStats();
+
+    private:
+        struct Sent
+        {
+            uint64_t block_id;
+            std::vector<uint8_t> packets;   // Packed, packet_size bytes apart
+            std::vector<uint16_t> lengths;
+        };
+
+        void sendPackets(Sent& s, const std::vector<uint32_t>& ids, uint16_t status);
+        void runControl();
+
+    private:
+        int fd;
+        int ctrl_fd;
+        int wake_fd;
+        std::string dest_ip;
+        uint16_t dest_port;
+        uint32_t packet_size;
+        bool extended;
+        uint64_t block_id;
+
+        double drop;
+        double reorder;
+        std::mt19937 rng;
+
+        std::deque<Sent> history;
+        std::mutex mtx;             // history, rng, stats and the socket
+
+        std::thread control;
+        std::atomic<bool> running;
+        GvspSenderStats stats;
+};
+
+
+#endif // __GVSPSENDER_H__
@@ -0,0 +1,360 @@
+// *****************************************************************************
+//
+// headless.cpp
+// Command line acquisition without Qt or a display window, for unattended
+// rigs. Connects, applies the camera settings, runs N PAM sequences and exits.
+// With --pretrigger it stays in the viewfinder instead and writes the ring
+// out on every SIGUSR1 until interrupted.
+//
+// Built as build/pam-headless with PAM_HEADLESS defined (see Makefile).
+//
+// *****************************************************************************
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "receiver.h"
+#include "scheduler.h"
+#include "serialport.h"
+#include "signalhandler.h"
+#include "metrics.h"
+#include "tools.h"
+
+#define DEFAULT_SEQUENCE_TIMEOUT 10000  // (ms)
+#define FIRST_FRAME_TIMEOUT 5000        // (ms)
+
+static std::atomic<bool> s_stop(false);
+static std::atomic<bool> s_commit(false);
+
+class HeadlessSignals : public SignalHandler
+{
+    public:
+        HeadlessSignals() : SignalHandler(SignalHandler::SIG_INT | SignalHandler::SIG_TERM | SignalHandler::SIG_USER) {}
+
+        bool handleSignal(int signal)
+        {
+            if (signal == SignalHandler::SIG_USER)
+            {
+                s_commit = true;
+            }
+            else
+            {
+                s_stop = true;
+            }
+            return true;
+        }
+};
+
+// Calls handleSignal() from a thread of its own rather than in signal context
+class SignalThread
+{
+    public:
+        SignalThread(SignalHandler* _handler) : handler(_handler), done(false), thread(&SignalThread::run, this) {}
+
+        ~SignalThread()
+        {
+            done = true;
+            thread.join();
+        }
+
+    private:
+        void run()
+        {
+            while (!done)
+            {
+                handler->waitForSignals(100);
+            }
+        }
+
+        SignalHandler* handler;
+        std::atomic<bool> done;
+        std::thread thread;
+};
+
+struct Options
+{
+    int gain = -1;
+    int exposure = -1;
+    int binning = -1;
+    int frames = DEFAULT_FRAME_COUNT;
+    int count = 1;
+    unsigned int interval = 0;      // (s) between sequence starts
+    unsigned int timeout = DEFAULT_SEQUENCE_TIMEOUT;
+    std::string sequence;
+    std::string protocol;
+    std::string output = "images/";
+    std::string format = "png";
+    int pretrigger = 0;             // (MB) ring size, 0 for none
+    double pre = DEFAULT_RING_PRE;
+    double post = DEFAULT_RING_POST;
+    std::string feed;               // Shared memory name, empty for none
+    int fvfm = 0;
+    std::string roi;                // Mask file, empty for none
+    int segment = 0;
+    std::string compact;            // Series file to compact, then exit
+    std::string led;                // LED controller target, empty for the default
+};
+
+static void usage(const char* name)
+{
+    std::cout << "Usage: " << name << " [options]" << std::endl
+              << "  --gain N            Camera gain" << std::endl
+              << "  --exposure N        Exposure time (us)" << std::endl
+              << "  --binning 0|1       2x2 pixel binning" << std::endl
+              << "  --sequence STR      LED controller command string" << std::endl
+              << "  --sequence-file F   Read the command string from the first line of F" << std::endl
+              << "  --frames N          Frames per sequence (default " << DEFAULT_FRAME_COUNT << ")" << std::endl
+              << "  --count N           Number of sequences to run (default 1)" << std::endl
+              << "  --interval S        Seconds between sequence starts (default 0)" << std::endl
+              << "  --timeout MS        Per sequence timeout (default " << DEFAULT_SEQUENCE_TIMEOUT << ")" << std::endl
+              << "  --protocol F        Run a protocol file instead of a fixed sequence" << std::endl
+              << "  --output PATH       Output directory (default images/)" << std::endl
+              << "  --format png|session  One PNG per frame, or one preallocated session file (default png)" << std::endl
+              << "  --pretrigger MB     Keep viewfinder frames in a RAM ring and write them out on SIGUSR1" << std::endl
+              << "  --pre S             Seconds kept before SIGUSR1 (default " << DEFAULT_RING_PRE << ")" << std::endl
+              << "  --post S            Seconds written after SIGUSR1 (default " << DEFAULT_RING_POST << ")" << std::endl
+              << "  --feed NAME         Publish live frames to shared memory (e.g. " << DEFAULT_SHM_NAME << ")" << std::endl
+              << "  --fvfm 0|1          Print the mean Fv/Fm of each sequence" << std::endl
+              << "  --roi FILE          Append per region Fv/Fm of each sequence to roi.csv (format in src/roi.h)" << std::endl
+              << "  --segment 0|1       Find the plants in each Fm frame and use them as the regions" << std::endl
+              << "  --compact FILE      Sort a roi.series file into large blocks and exit (see src/roiseries.h)" << std::endl
+              << "  --led TARGET        LED controller link: tty path, usb:VID:PID or mock (default $PAM_LED or " << DEFAULT_LED_TARGET << ")" << std::endl;
+}
+
+static bool readSequenceFile(const std::string& file, std::string& sequence)
+{
+    std::ifstream in(file);
+    std::string line;
+    while (std::getline(in, line))
+    {
+        if (line.find_first_not_of(" \t\r") != std::string::npos)
+        {
+            sequence = line;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool parseArgs(int argc, char* argv[], Options& opt)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--help" || arg == "-h" || i + 1 >= argc)
+        {
+            return false;
+        }
+
+        std::string val = argv[++i];
+        try
+        {
+            if (arg == "--gain") opt.gain = std::stoi(val);
+            else if (arg == "--exposure") opt.exposure = std::stoi(val);
+            else if (arg == "--binning") opt.binning = std::stoi(val);
+            else if (arg == "--frames") opt.frames = std::stoi(val);
+            else if (arg == "--count") opt.count = std::stoi(val);
+            else if (arg == "--interval") opt.interval = std::stoul(val);
+            else if (arg == "--timeout") opt.timeout = std::stoul(val);
+            else if (arg == "--sequence") opt.sequence = val;
+            else if (arg == "--output") opt.output = val;
+            else if (arg == "--protocol") opt.protocol = val;
+            else if (arg == "--format" && (val == "png" || val == "session")) opt.format = val;
+            else if (arg == "--pretrigger") opt.pretrigger = std::stoi(val);
+            else if (arg == "--pre") opt.pre = std::stod(val);
+            else if (arg == "--post") opt.post = std::stod(val);
+            else if (arg == "--feed") opt.feed = val;
+            else if (arg == "--fvfm") opt.fvfm = std::stoi(val);
+            else if (arg == "--roi") opt.roi = val;
+            else if (arg == "--segment") opt.segment = std::stoi(val);
+            else if (arg == "--compact") opt.compact = val;
+            else if (arg == "--led") opt.led = val;
+            else if (arg == "--sequence-file")
+            {
+                if (!readSequenceFile(val, opt.sequence))
+                {
+                    std::cout << "Unable to read a sequence from " << val << std::endl;
+                    return false;
+                }
+            }
+            else
+            {
+                std::cout << "Unknown option " << arg << std::endl;
+                return false;
+            }
+        }
+        catch (const std::exception&)
+        {
+            std::cout << "Bad value for " << arg << ": " << val << std::endl;
+            return false;
+        }
+    }
+
+    if (opt.sequence.empty() && opt.protocol.empty() && opt.pretrigger <= 0 && opt.compact.empty())
+    {
+        std::cout << "A sequence, protocol or pre-trigger ring is required" << std::endl;
+        return false;
+    }
+
+    if (opt.output.back() != '/')
+    {
+        opt.output += '/';
+    }
+
+    return true;
+}
+
+static double msSince(std::chrono::steady_clock::time_point t0, std::chrono::steady_clock::time_point t1)
+{
+    return std::chrono::duration<double, std::milli>(t1 - t0).count();
+}
+
+int main(int argc, char* argv[])
+{
+    auto t_start = std::chrono::steady_clock::now();
+
+    Options opt;
+    if (!parseArgs(argc, argv, opt))
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // Offline maintenance, no camera needed
+    if (!opt.compact.empty())
+    {
+        return SeriesWriter::compact(opt.compact) ? 0 : 1;
+    }
+
+    HeadlessSignals signals;
+    SignalThread signal_thread(&signals);
+
+    if (!opt.led.empty() && !SerialPort::instance().open(opt.led))
+    {
+        return 1;
+    }
+
+    Receiver receiver(nullptr);
+    if (!receiver.isConnected())
+    {
+        std::cout << "Failed to initialise receiver" << std::endl;
+        return 1;
+    }
+    auto t_connected = std::chrono::steady_clock::now();
+
+    // Each of these restarts the stream, so only touch what was asked for
+    if (opt.gain >= 0) receiver.setGain(opt.gain);
+    if (opt.exposure >= 0) receiver.setExposure(opt.exposure);
+    if (opt.binning >= 0) receiver.setBinning(opt.binning != 0);
+
+    receiver.setSavingPath(opt.output);
+    if (opt.format == "session" && !receiver.setRecordingFormat(Receiver::FORMAT_SESSION))
+    {
+        receiver.quit();
+        return 1;
+    }
+    receiver.setFrameCount(opt.frames);
+    if (!opt.feed.empty())
+    {
+        receiver.setLiveFeed(true, opt.feed);
+    }
+    receiver.setFvFmPreview(opt.fvfm != 0);
+    receiver.setSegmentation(opt.segment != 0);
+    if (!opt.roi.empty() && !receiver.setRoiMask(opt.roi))
+    {
+        receiver.quit();
+        return 1;
+    }
+
+    // The receiver starts in viewfinder mode, so the first frame arrives
+    // without a trigger.
+    while (receiver.getFramesReceived() == 0 && !s_stop && msSince(t_start, std::chrono::steady_clock::now()) < FIRST_FRAME_TIMEOUT)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "Startup to connect: " << msSince(t_start, t_connected) << " ms" << std::endl;
+    if (receiver.getFramesReceived() > 0)
+    {
+        std::cout << "Startup to first frame: " << msSince(t_start, receiver.getFirstFrameTime()) << " ms" << std::endl;
+    }
+    else
+    {
+        std::cout << "No frame within " << FIRST_FRAME_TIMEOUT << " ms" << std::endl;
+    }
+
+    if (opt.pretrigger > 0)
+    {
+        bool ok = receiver.setPreTrigger(true, opt.pretrigger, opt.pre, opt.post);
+        if (ok)
+        {
+            std::cout << "Pre-trigger ring running, send SIGUSR1 to write it out" << std::endl;
+        }
+        while (ok && !s_stop)
+        {
+            if (s_commit.exchange(false))
+            {
+                receiver.commitPreTrigger();
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+
+        receiver.quit();
+        Metrics::instance().stop();
+        return ok ? 0 : 1;
+    }
+
+    if (!opt.protocol.empty())
+    {
+        Scheduler scheduler(&receiver);
+        bool ok = scheduler.load(opt.protocol) && scheduler.start(opt.output + "schedule.csv");
+        while (ok && scheduler.isRunning() && !s_stop)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+        scheduler.stop();
+
+        receiver.quit();
+        Metrics::instance().stop();
+        return ok ? 0 : 1;
+    }
+
+    int completed = 0;
+    auto next = std::chrono::steady_clock::now();
+    for (int i = 0; i < opt.count && !s_stop; i++)
+    {
+        std::this_thread::sleep_until(next);
+        next += std::chrono::seconds(opt.interval);
+
+        auto t_seq = std::chrono::steady_clock::now();
+        receiver.setSequence(opt.sequence);
+        receiver.startRecording();
+        Tools::sendSerialString(opt.sequence);
+
+        // The receiver drops back to paused when the multiframe acquisition unlocks
+        if (receiver.waitForState(Receiver::PAUSED, opt.timeout))
+        {
+            completed++;
+            std::cout << "Sequence " << i + 1 << "/" << opt.count << " done in "
+                      << msSince(t_seq, std::chrono::steady_clock::now()) << " ms"
+                      << (receiver.getLastReport().valid ? "" : " (invalid)") << std::endl;
+        }
+        else
+        {
+            std::cout << "Sequence " << i + 1 << "/" << opt.count << " timed out" << std::endl;
+            receiver.stopAcquisition();
+        }
+    }
+
+    std::cout << "Network: " << receiver.getFrameStats(DEFAULT_FRAME_STATS).describe() << std::endl;
+    receiver.quit();
+    std::cout << completed << " of " << opt.count << " sequences completed" << std::endl;
+
+    Metrics::instance().stop();
+    return (completed == opt.count) ? 0 : 2;
+}
@@ -0,0 +1,127 @@
+#include "histogram.h"
+#include <chrono>
+#include <cstring>
+#include <algorithm>
+
+Histogram::Histogram() :
+    count(0),
+    step(DEFAULT_HISTOGRAM_STEP),
+    elapsed_us(0.0)
+{
+    memset(bins, 0, sizeof(bins));
+}
+
+void Histogram::setStep(uint32_t _step)
+{
+    step = (_step > 0) ? _step : 1;
+}
+
+void Histogram::compute(const uint8_t* data, uint32_t width, uint32_t height, uint32_t stride, uint32_t bits)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    // Partial histograms, merged at the end
+    uint32_t lanes[HISTOGRAM_LANES][HISTOGRAM_BINS];
+    memset(lanes, 0, sizeof(lanes));
+
+    // Samples handled per unrolled iteration and the x span they cover
+    const uint32_t span = step * HISTOGRAM_LANES;
+    const uint32_t unrolled = (width >= span) ? width - span + 1 : 0;
+
+    for (uint32_t y = 0; y < height; y += step)
+    {
+        const uint8_t* row = data + static_cast<size_t>(y) * stride;
+        uint32_t x = 0;
+
+        if (bits <= 8)
+        {
+            for (; x < unrolled; x += span)
+            {
+                lanes[0][row[x]]++;
+                lanes[1][row[x + step]]++;
+                lanes[2][row[x + 2 * step]]++;
+                lanes[3][row[x + 3 * step]]++;
+            }
+            for (; x < width; x += step)
+            {
+                lanes[0][row[x]]++;
+            }
+        }
+        else
+        {
+            // Drop the low bits so the top of the range lands in the top bin.
+            // Anything above the nominal range is clamped rather than wrapped.
+            const uint16_t* row16 = reinterpret_cast<const uint16_t*>(row);
+            const uint32_t shift = bits - 8;
+            for (; x < unrolled; x += span)
+            {
+                lanes[0][std::min<uint32_t>(row16[x] >> shift, HISTOGRAM_BINS - 1)]++;
+                lanes[1][std::min<uint32_t>(row16[x + step] >> shift, HISTOGRAM_BINS - 1)]++;
+                lanes[2][std::min<uint32_t>(row16[x + 2 * step] >> shift, HISTOGRAM_BINS - 1)]++;
+                lanes[3][std::min<uint32_t>(row16[x + 3 * step] >> shift, HISTOGRAM_BINS - 1)]++;
+            }
+            for (; x < width; x += step)
+            {
+                lanes[0][std::min<uint32_t>(row16[x] >> shift, HISTOGRAM_BINS - 1)]++;
+            }
+        }
+    }
+
+    // Merge the lanes. Plain element-wise adds, which the compiler vectorises.
+    count = 0;
+    for (uint32_t b = 0; b < HISTOGRAM_BINS; b++)
+    {
+        bins[b] = lanes[0][b] + lanes[1][b] + lanes[2][b] + lanes[3][b];
+        count += bins[b];
+    }
+
+    auto end = std::chrono::steady_clock::now();
+    elapsed_us = std::chrono::duration<double, std::micro>(end - start).count();
+}
+
+float Histogram::percentile(float p) const
+{
+    if (count == 0)
+    {
+        return 0.0f;
+    }
+
+    p = std::max(0.0f, std::min(1.0f, p));
+    uint64_t threshold = static_cast<uint64_t>(p * count);
+    uint64_t sum = 0;
+    for (uint32_t b = 0; b < HISTOGRAM_BINS; b++)
+    {
+        sum += bins[b];
+        if (sum > threshold)
+        {
+            return static_cast<float>(b);
+        }
+    }
+
+    return static_cast<float>(HISTOGRAM_BINS - 1);
+}
+
+float Histogram::saturation() const
+{
+    if (count == 0)
+    {
+        return 0.0f;
+    }
+
+    return static_cast<float>(bins[HISTOGRAM_BINS - 1]) / count;
+}
+
+const uint32_t* Histogram::getBins() const
+{
+    return bins;
+}
+
+uint32_t Histogram::getCount() const
+{
+    return count;
+}
+
+double Histogram::getElapsedUs() const
+{
+    return elapsed_us;
+}
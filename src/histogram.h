@@ -0,0 +1,55 @@
+// *****************************************************************************
+//
+// histogram.h
+// Intensity histogram over a decimated subset of a mono frame. Used by the
+// auto-exposure loop so it has to be cheap enough to run on every viewfinder
+// frame.
+//
+// *****************************************************************************
+
+
+#ifndef __HISTOGRAM_H__
+#define __HISTOGRAM_H__
+
+#include <cstdint>
+
+// Number of bins. Frames deeper than 8 bits are shifted down to fit.
+#define HISTOGRAM_BINS 256
+
+// Only every n'th pixel of every n'th row is sampled
+#define DEFAULT_HISTOGRAM_STEP 4
+
+// Number of interleaved partial histograms. Consecutive samples go to
+// different tables so that runs of equal pixel values don't stall on the
+// same counter.
+#define HISTOGRAM_LANES 4
+
+class Histogram
+{
+    public:
+        Histogram();
+
+        // Compute from a mono frame. Pixels with more than 8 significant bits
+        // are expected in 16-bit little endian containers.
+        void compute(const uint8_t* data, uint32_t width, uint32_t height, uint32_t stride, uint32_t bits);
+        void setStep(uint32_t _step);
+
+        // Level (0 - 255) below which fraction p (0 - 1) of the samples fall
+        float percentile(float p) const;
+
+        // Fraction of samples in the top bin
+        float saturation() const;
+
+        const uint32_t* getBins() const;
+        uint32_t getCount() const;
+        double getElapsedUs() const;
+
+    private:
+        uint32_t bins[HISTOGRAM_BINS];
+        uint32_t count;
+        uint32_t step;
+        double elapsed_us;
+};
+
+
+#endif // __HISTOGRAM_H__
@@ -0,0 +1,697 @@
+#include "ledtransport.h"
+#include "sequence.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <termios.h>
+#include <unistd.h>
+
+#ifdef PAM_HAVE_LIBUSB
+#include <libusb-1.0/libusb.h>
+#endif
+
+static int64_t steadyNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+std::unique_ptr<LedTransport> LedTransport::create(const std::string& target, std::string& error)
+{
+    if (target.compare(0, 4, "mock") == 0)
+    {
+        uint32_t baud = (target.size() > 5 && target[4] == ':') ? std::strtoul(target.c_str() + 5, nullptr, 10) : 0;
+        return std::unique_ptr<LedTransport>(new MockTransport(baud));
+    }
+
+    if (target.compare(0, 4, "usb:") == 0)
+    {
+#ifdef PAM_HAVE_LIBUSB
+        unsigned int vendor, product;
+        char sep;
+        std::stringstream ss(target.substr(4));
+        if (!(ss >> std::hex >> vendor >> sep >> product) || sep != ':' || vendor > 0xffff || product > 0xffff)
+        {
+            error = "expected usb:VID:PID in hex, got " + target;
+            return nullptr;
+        }
+        return std::unique_ptr<LedTransport>(new UsbTransport(vendor, product));
+#else
+        error = "built without libusb, " + target + " is not available";
+        return nullptr;
+#endif
+    }
+
+    if (!target.empty() && target[0] == '/')
+    {
+        return std::unique_ptr<LedTransport>(new TtyTransport(target));
+    }
+
+    error = "unknown LED controller target '" + target + "'";
+    return nullptr;
+}
+
+// *****************************************************************************
+// tty
+
+TtyTransport::TtyTransport(const std::string& _device) :
+    device(_device), fd(-1), wake_fd(-1), broken(false)
+{
+
+}
+
+TtyTransport::~TtyTransport()
+{
+    close();
+}
+
+const char* TtyTransport::name()
+{
+    return "tty";
+}
+
+bool TtyTransport::isBroken()
+{
+    return broken;
+}
+
+bool TtyTransport::open(Receive _receive)
+{
+    close();
+    receive = _receive;
+
+    fd = ::open(device.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (fd < 0)
+    {
+        std::cout << "Serial: unable to open " << device << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    struct termios tty;
+    if (tcgetattr(fd, &tty) != 0)
+    {
+        std::cout << "Serial: error " << errno << " from tcgetattr: " << strerror(errno) << std::endl;
+        ::close(fd);
+        fd = -1;
+        return false;
+    }
+
+    tty.c_cflag &= ~PARENB; // Clear parity bit, disabling parity (most common)
+    tty.c_cflag &= ~CSTOPB; // Clear stop field, only one stop bit used in communication (most common)
+    tty.c_cflag &= ~CSIZE; // Clear all bits that set the data size
+    tty.c_cflag |= CS8; // 8 bits per byte (most common)
+    tty.c_cflag &= ~CRTSCTS; // Disable RTS/CTS hardware flow control (most common)
+    tty.c_cflag |= CREAD | CLOCAL; // Turn on READ & ignore ctrl lines (CLOCAL = 1)
+    tty.c_lflag &= ~(ICANON | ECHO | ECHOE | ECHONL | ISIG); // Raw input, lines are split by the caller
+    tty.c_iflag &= ~(IXON | IXOFF | IXANY | IGNBRK | BRKINT | PARMRK | ISTRIP | INLCR | IGNCR | ICRNL);
+    tty.c_oflag &= ~OPOST; // Prevent special interpretation of output bytes (e.g. newline chars)
+    tty.c_oflag &= ~ONLCR; // Prevent conversion of newline to carriage return/line feed
+
+    cfsetispeed(&tty, B9600);
+    cfsetospeed(&tty, B9600);
+
+    if (tcsetattr(fd, TCSANOW, &tty) != 0)
+    {
+        std::cout << "Serial: error " << errno << " from tcsetattr: " << strerror(errno) << std::endl;
+        ::close(fd);
+        fd = -1;
+        return false;
+    }
+
+    // Occasionally there is some garbage left in the buffers which tends to
+    // throw off the MCU. The port stays open, so this is only needed once.
+    tcflush(fd, TCIOFLUSH);
+
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    broken = false;
+    reader = std::thread(&TtyTransport::run, this);
+    return true;
+}
+
+void TtyTransport::close()
+{
+    if (reader.joinable())
+    {
+        uint64_t one = 1;
+        if (::write(wake_fd, &one, sizeof(one)) < 0)
+        {
+            std::cout << "Serial: unable to wake the reader: " << strerror(errno) << std::endl;
+        }
+        reader.join();
+    }
+    if (wake_fd >= 0)
+    {
+        ::close(wake_fd);
+        wake_fd = -1;
+    }
+    if (fd >= 0)
+    {
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+bool TtyTransport::write(const std::string& bytes)
+{
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    size_t done = 0;
+    while (done < bytes.size())
+    {
+        ssize_t n = ::write(fd, bytes.data() + done, bytes.size() - done);
+        if (n > 0)
+        {
+            done += n;
+            continue;
+        }
+        if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        {
+            return false;
+        }
+
+        // 9600 baud drains about 1 byte/ms, long sequences fill the buffer
+        struct pollfd p = {fd, POLLOUT, 0};
+        if (poll(&p, 1, LED_WRITE_TIMEOUT) <= 0 || (p.revents & (POLLERR | POLLHUP)))
+        {
+            return false;
+        }
+    }
+
+    // Until the last byte is on the wire, so round trips don't include the
+    // transmission of long strings
+    return tcdrain(fd) == 0;
+}
+
+void TtyTransport::run()
+{
+    int ep = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev);
+    ev.data.fd = wake_fd;
+    epoll_ctl(ep, EPOLL_CTL_ADD, wake_fd, &ev);
+
+    char buf[256];
+    bool stop = false;
+    while (!stop)
+    {
+        struct epoll_event events[2];
+        int n = epoll_wait(ep, events, 2, -1);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            std::cout << "Serial: epoll_wait failed: " << strerror(errno) << std::endl;
+            broken = true;
+            break;
+        }
+
+        for (int i = 0; i < n; i++)
+        {
+            if (events[i].data.fd == wake_fd)
+            {
+                stop = true;
+                continue;
+            }
+
+            // Drain everything there is, replies can come back to back
+            ssize_t got;
+            while ((got = read(fd, buf, sizeof(buf))) > 0)
+            {
+                receive(buf, got);
+            }
+
+            // Unplugged adapters read 0 or report a hang up
+            bool gone = (got == 0) || (got < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR);
+            if (gone || (events[i].events & (EPOLLHUP | EPOLLERR)))
+            {
+                std::cout << "Serial: " << device << " went away" << std::endl;
+                broken = true;
+                stop = true;
+            }
+        }
+    }
+
+    ::close(ep);
+    if (broken)
+    {
+        receive(nullptr, 0);
+    }
+}
+
+// *****************************************************************************
+// usb
+
+#ifdef PAM_HAVE_LIBUSB
+namespace
+{
+    struct OutWrite
+    {
+        std::mutex* mtx;
+        std::condition_variable* cv;
+        bool done;
+        int status;
+        int length;
+    };
+}
+
+UsbTransport::UsbTransport(uint16_t _vendor, uint16_t _product) :
+    vendor(_vendor), product(_product), ctx(nullptr), handle(nullptr), interface(-1), ep_in(0), ep_out(0),
+    in_flight(0), running(false), broken(false)
+{
+    for (auto& t : in)
+    {
+        t = nullptr;
+    }
+}
+
+UsbTransport::~UsbTransport()
+{
+    close();
+}
+
+const char* UsbTransport::name()
+{
+    return "usb";
+}
+
+bool UsbTransport::isBroken()
+{
+    return broken;
+}
+
+bool UsbTransport::findEndpoints()
+{
+    libusb_config_descriptor* config;
+    if (libusb_get_active_config_descriptor(libusb_get_device(handle), &config) != 0)
+    {
+        return false;
+    }
+
+    // A CDC data interface if there is one, else the first with a bulk pair
+    interface = -1;
+    for (int pass = 0; pass < 2 && interface < 0; pass++)
+    {
+        for (int i = 0; i < config->bNumInterfaces && interface < 0; i++)
+        {
+            if (config->interface[i].num_altsetting < 1)
+            {
+                continue;
+            }
+            const libusb_interface_descriptor& alt = config->interface[i].altsetting[0];
+            if (pass == 0 && alt.bInterfaceClass != LIBUSB_CLASS_DATA)
+            {
+                continue;
+            }
+
+            unsigned char found_in = 0, found_out = 0;
+            for (int k = 0; k < alt.bNumEndpoints; k++)
+            {
+                const libusb_endpoint_descriptor& ep = alt.endpoint[k];
+                if ((ep.bmAttributes & LIBUSB_TRANSFER_TYPE_MASK) != LIBUSB_TRANSFER_TYPE_BULK)
+                {
+                    continue;
+                }
+                unsigned char& slot = ((ep.bEndpointAddress & LIBUSB_ENDPOINT_DIR_MASK) == LIBUSB_ENDPOINT_IN) ? found_in : found_out;
+                slot = (slot != 0) ? slot : ep.bEndpointAddress;
+            }
+            if (found_in != 0 && found_out != 0)
+            {
+                interface = alt.bInterfaceNumber;
+                ep_in = found_in;
+                ep_out = found_out;
+            }
+        }
+    }
+
+    libusb_free_config_descriptor(config);
+    return interface >= 0;
+}
+
+bool UsbTransport::open(Receive _receive)
+{
+    close();
+    receive = _receive;
+
+    int r = libusb_init(&ctx);
+    if (r < 0)
+    {
+        std::cout << "Usb: libusb_init failed: " << libusb_error_name(r) << std::endl;
+        ctx = nullptr;
+        return false;
+    }
+
+    handle = libusb_open_device_with_vid_pid(ctx, vendor, product);
+    if (handle == nullptr)
+    {
+        std::cout << "Usb: no device " << std::hex << vendor << ":" << product << std::dec << std::endl;
+        close();
+        return false;
+    }
+    libusb_set_auto_detach_kernel_driver(handle, 1);
+
+    if (!findEndpoints())
+    {
+        std::cout << "Usb: device has no interface with bulk IN and OUT endpoints" << std::endl;
+        close();
+        return false;
+    }
+    if ((r = libusb_claim_interface(handle, interface)) != 0)
+    {
+        std::cout << "Usb: unable to claim interface " << interface << ": " << libusb_error_name(r) << std::endl;
+        interface = -1;
+        close();
+        return false;
+    }
+
+    broken = false;
+    running = true;
+    for (int i = 0; i < USB_IN_TRANSFERS; i++)
+    {
+        in[i] = libusb_alloc_transfer(0);
+        libusb_fill_bulk_transfer(in[i], handle, ep_in, in_buf[i], USB_IN_SIZE, &UsbTransport::inDone, this, 0);
+        if ((r = libusb_submit_transfer(in[i])) != 0)
+        {
+            std::cout << "Usb: unable to queue a read: " << libusb_error_name(r) << std::endl;
+            close();
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(mtx);
+        in_flight++;
+    }
+
+    events = std::thread(&UsbTransport::run, this);
+    std::cout << "Usb: " << std::hex << vendor << ":" << product << std::dec << " interface " << interface
+              << ", endpoints " << std::hex << +ep_out << "/" << +ep_in << std::dec << std::endl;
+    return true;
+}
+
+void UsbTransport::close()
+{
+    running = false;
+    if (handle != nullptr)
+    {
+        // Reads still queued come back cancelled
+        for (libusb_transfer* t : in)
+        {
+            if (t != nullptr)
+            {
+                libusb_cancel_transfer(t);
+            }
+        }
+    }
+    if (events.joinable())
+    {
+        events.join();
+    }
+    else if (ctx != nullptr)
+    {
+        // No event thread yet, collect the cancellations here
+        struct timeval tv = {0, 100000};
+        for (int i = 0; i < 10 && in_flight > 0; i++)
+        {
+            libusb_handle_events_timeout_completed(ctx, &tv, nullptr);
+        }
+    }
+
+    for (libusb_transfer*& t : in)
+    {
+        if (t != nullptr)
+        {
+            libusb_free_transfer(t);
+            t = nullptr;
+        }
+    }
+    in_flight = 0;
+
+    if (handle != nullptr)
+    {
+        if (interface >= 0)
+        {
+            libusb_release_interface(handle, interface);
+            interface = -1;
+        }
+        libusb_close(handle);
+        handle = nullptr;
+    }
+    if (ctx != nullptr)
+    {
+        libusb_exit(ctx);
+        ctx = nullptr;
+    }
+}
+
+void UsbTransport::run()
+{
+    // Runs until the reads have come back after close()
+    struct timeval tv = {0, 100000};
+    while (true)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            if (!running && in_flight == 0)
+            {
+                break;
+            }
+        }
+        libusb_handle_events_timeout_completed(ctx, &tv, nullptr);
+    }
+}
+
+void UsbTransport::inDone(libusb_transfer* transfer)
+{
+    UsbTransport* self = static_cast<UsbTransport*>(transfer->user_data);
+
+    if (transfer->status == LIBUSB_TRANSFER_COMPLETED && transfer->actual_length > 0)
+    {
+        self->receive(reinterpret_cast<const char*>(transfer->buffer), transfer->actual_length);
+    }
+
+    bool again = self->running && (transfer->status == LIBUSB_TRANSFER_COMPLETED || transfer->status == LIBUSB_TRANSFER_TIMED_OUT);
+    if (again && libusb_submit_transfer(transfer) == 0)
+    {
+        return;
+    }
+
+    if (self->running && !self->broken.exchange(true))
+    {
+        std::cout << "Usb: read failed (status " << transfer->status << "), device went away" << std::endl;
+        self->receive(nullptr, 0);
+    }
+    std::lock_guard<std::mutex> lock(self->mtx);
+    self->in_flight--;
+    self->cv.notify_all();
+}
+
+void UsbTransport::outDone(libusb_transfer* transfer)
+{
+    OutWrite* w = static_cast<OutWrite*>(transfer->user_data);
+    std::lock_guard<std::mutex> lock(*w->mtx);
+    w->done = true;
+    w->status = transfer->status;
+    w->length = transfer->actual_length;
+    w->cv->notify_all();
+}
+
+bool UsbTransport::write(const std::string& bytes)
+{
+    if (handle == nullptr || broken)
+    {
+        return false;
+    }
+
+    std::vector<unsigned char> buf(bytes.begin(), bytes.end());
+    OutWrite w = {&mtx, &cv, false, 0, 0};
+    libusb_transfer* t = libusb_alloc_transfer(0);
+    libusb_fill_bulk_transfer(t, handle, ep_out, buf.data(), static_cast<int>(buf.size()), &UsbTransport::outDone, &w, LED_WRITE_TIMEOUT);
+    int r = libusb_submit_transfer(t);
+    if (r != 0)
+    {
+        std::cout << "Usb: write failed: " << libusb_error_name(r) << std::endl;
+        libusb_free_transfer(t);
+        if (r == LIBUSB_ERROR_NO_DEVICE)
+        {
+            broken = true;
+        }
+        return false;
+    }
+
+    // The transfer has its own timeout, so it always comes back
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        cv.wait(lock, [&w]() { return w.done; });
+    }
+    libusb_free_transfer(t);
+
+    if (w.status == LIBUSB_TRANSFER_NO_DEVICE)
+    {
+        broken = true;
+    }
+    return w.status == LIBUSB_TRANSFER_COMPLETED && w.length == static_cast<int>(buf.size());
+}
+#endif
+
+// *****************************************************************************
+// mock
+
+MockController::MockController(Reply _reply, uint32_t _baud) :
+    reply(_reply), baud(_baud), busy_until(0), running(true)
+{
+    thread = std::thread(&MockController::run, this);
+}
+
+MockController::~MockController()
+{
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        running = false;
+        cv.notify_all();
+    }
+    thread.join();
+}
+
+int64_t MockController::wireTime(size_t n, uint32_t baud)
+{
+    // Start, 8 data and stop bit per byte
+    return (baud > 0) ? static_cast<int64_t>(n) * 10 * 1000000000LL / baud : 0;
+}
+
+void MockController::receive(const char* data, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        if (data[i] == '\n' || data[i] == '\r')
+        {
+            if (!line.empty())
+            {
+                handleLine(line);
+                line.clear();
+            }
+        }
+        else
+        {
+            line.push_back(data[i]);
+        }
+    }
+}
+
+void MockController::handleLine(const std::string& command)
+{
+    int64_t now = steadyNs();
+    std::vector<SerialCommand> cmds;
+    std::lock_guard<std::mutex> lock(mtx);
+    if (!Sequence::parse(command, cmds) || cmds.empty())
+    {
+        outbox.emplace(now, "ERR parse");
+    }
+    else
+    {
+        outbox.emplace(now, "OK " + std::to_string(cmds.size()));
+
+        // Sequences run one after the other
+        busy_until = std::max(busy_until, now) + static_cast<int64_t>(Sequence::duration(cmds)) * 1000000;
+        outbox.emplace(busy_until, "DONE");
+    }
+    cv.notify_all();
+}
+
+void MockController::run()
+{
+    std::unique_lock<std::mutex> lock(mtx);
+    while (running)
+    {
+        if (outbox.empty())
+        {
+            cv.wait(lock);
+            continue;
+        }
+
+        auto first = outbox.begin();
+        int64_t wait = first->first - steadyNs();
+        if (wait > 0)
+        {
+            cv.wait_for(lock, std::chrono::nanoseconds(wait));
+            continue;
+        }
+
+        // One reply on the wire at a time
+        std::string out = first->second;
+        outbox.erase(first);
+        lock.unlock();
+        int64_t wire = wireTime(out.size() + 2, baud);
+        if (wire > 0)
+        {
+            std::this_thread::sleep_for(std::chrono::nanoseconds(wire));
+        }
+        reply(out);
+        lock.lock();
+    }
+}
+
+MockTransport::MockTransport(uint32_t _baud) :
+    baud(_baud)
+{
+
+}
+
+MockTransport::~MockTransport()
+{
+    close();
+}
+
+const char* MockTransport::name()
+{
+    return "mock";
+}
+
+bool MockTransport::isBroken()
+{
+    return false;
+}
+
+bool MockTransport::open(Receive _receive)
+{
+    close();
+    controller.reset(new MockController([_receive](const std::string& line)
+    {
+        std::string bytes = line + "\r\n";
+        _receive(bytes.data(), bytes.size());
+    }, baud));
+    return true;
+}
+
+void MockTransport::close()
+{
+    controller.reset();
+}
+
+bool MockTransport::write(const std::string& bytes)
+{
+    if (!controller)
+    {
+        return false;
+    }
+
+    // Returns once the last byte would be on the wire, as tcdrain does
+    int64_t wire = MockController::wireTime(bytes.size(), baud);
+    if (wire > 0)
+    {
+        std::this_thread::sleep_for(std::chrono::nanoseconds(wire));
+    }
+    controller->receive(bytes.data(), bytes.size());
+    return true;
+}
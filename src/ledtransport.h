@@ -0,0 +1,189 @@
+// *****************************************************************************
+//
+// ledtransport.h
+// Byte links to the LED controller, picked at runtime from a target string:
+//
+//     /dev/ttyUSB0        tty at 9600 baud, read with epoll
+//     usb:16c0:05dc       libusb, bulk endpoints of the device with this
+//                         vendor:product id (PAM_HAVE_LIBUSB builds only)
+//     mock                in process controller, no wire delay
+//     mock:9600           the same, with the time a 9600 baud wire takes
+//
+// The usb transport claims the first interface with a bulk IN and a bulk OUT
+// endpoint, preferring a CDC data interface, and carries the same text as
+// the tty. Writes are async bulk transfers and the caller waits for their
+// completion. USB_IN_TRANSFERS reads are kept queued, so replies are picked
+// up as soon as the controller sends them. A libusb event thread handles
+// both.
+//
+// MockController acts like the firmware: it checks each command string,
+// answers "OK n" or "ERR ...", and "DONE" once the sequence would have run.
+// Sequences queue behind each other. MockTransport wires it up in process.
+// The benches also put it behind a pty to test the tty path.
+//
+// Received bytes go to the Receive callback on the transport's own thread.
+// It is called with (nullptr, 0) once if the link goes away.
+//
+// *****************************************************************************
+
+
+#ifndef __LEDTRANSPORT_H__
+#define __LEDTRANSPORT_H__
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#define DEFAULT_LED_TARGET "/dev/ttyUSB0"
+#define LED_WRITE_TIMEOUT 2000      // (ms) without progress before a write gives up
+#define USB_IN_TRANSFERS 2          // Reads kept queued
+#define USB_IN_SIZE 512             // (bytes) per read
+
+class LedTransport
+{
+    public:
+        typedef std::function<void(const char* data, size_t n)> Receive;
+
+        virtual ~LedTransport() {}
+
+        // Chosen from the target string, nullptr and error set if it's unknown
+        static std::unique_ptr<LedTransport> create(const std::string& target, std::string& error);
+
+        virtual bool open(Receive _receive) = 0;
+        virtual void close() = 0;
+
+        // Blocks until the bytes have left the host
+        virtual bool write(const std::string& bytes) = 0;
+
+        // The link went away, it has to be closed and opened again
+        virtual bool isBroken() = 0;
+        virtual const char* name() = 0;
+};
+
+class TtyTransport : public LedTransport
+{
+    public:
+        TtyTransport(const std::string& _device);
+        ~TtyTransport();
+
+        bool open(Receive _receive) override;
+        void close() override;
+        bool write(const std::string& bytes) override;
+        bool isBroken() override;
+        const char* name() override;
+
+    private:
+        void run();
+
+    private:
+        std::string device;
+        int fd;
+        int wake_fd;            // eventfd that stops the reader
+        std::thread reader;
+        std::atomic<bool> broken;
+        Receive receive;
+};
+
+#ifdef PAM_HAVE_LIBUSB
+struct libusb_context;
+struct libusb_device_handle;
+struct libusb_transfer;
+
+class UsbTransport : public LedTransport
+{
+    public:
+        UsbTransport(uint16_t _vendor, uint16_t _product);
+        ~UsbTransport();
+
+        bool open(Receive _receive) override;
+        void close() override;
+        bool write(const std::string& bytes) override;
+        bool isBroken() override;
+        const char* name() override;
+
+    private:
+        bool findEndpoints();
+        void run();
+        static void inDone(libusb_transfer* transfer);
+        static void outDone(libusb_transfer* transfer);
+
+    private:
+        uint16_t vendor;
+        uint16_t product;
+        libusb_context* ctx;
+        libusb_device_handle* handle;
+        int interface;
+        unsigned char ep_in;
+        unsigned char ep_out;
+
+        libusb_transfer* in[USB_IN_TRANSFERS];
+        unsigned char in_buf[USB_IN_TRANSFERS][USB_IN_SIZE];
+        int in_flight;          // Reads queued, under mtx
+
+        std::thread events;
+        std::atomic<bool> running;
+        std::atomic<bool> broken;
+        std::mutex mtx;
+        std::condition_variable cv;
+        Receive receive;
+};
+#endif
+
+class MockController
+{
+    public:
+        typedef std::function<void(const std::string& line)> Reply;
+
+        // baud 0 answers straight away, otherwise replies take as long as
+        // they would on the wire
+        MockController(Reply _reply, uint32_t _baud = 0);
+        ~MockController();
+
+        // Bytes from the host, any split
+        void receive(const char* data, size_t n);
+
+        // Time the wire takes for n bytes at this baud rate (8N1)
+        static int64_t wireTime(size_t n, uint32_t baud);
+
+    private:
+        void handleLine(const std::string& line);
+        void run();
+
+    private:
+        Reply reply;
+        uint32_t baud;
+        std::string line;
+        int64_t busy_until;     // The last queued sequence ends (steady_clock ns)
+
+        std::multimap<int64_t, std::string> outbox;     // Replies by the time they're sent
+        std::thread thread;
+        std::mutex mtx;
+        std::condition_variable cv;
+        bool running;
+};
+
+class MockTransport : public LedTransport
+{
+    public:
+        MockTransport(uint32_t _baud = 0);
+        ~MockTransport();
+
+        bool open(Receive _receive) override;
+        void close() override;
+        bool write(const std::string& bytes) override;
+        bool isBroken() override;
+        const char* name() override;
+
+    private:
+        uint32_t baud;
+        std::unique_ptr<MockController> controller;
+};
+
+
+#endif // __LEDTRANSPORT_H__
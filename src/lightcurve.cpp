@@ -0,0 +1,349 @@
+#include "lightcurve.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <thread>
+
+LightCurve::LightCurve(float _absorptance) :
+    absorptance(_absorptance), threads(0), active(false), width(0), height(0), pixels_per_second(0.0)
+{
+
+}
+
+void LightCurve::setThreads(unsigned int _threads)
+{
+    threads = _threads;
+}
+
+bool LightCurve::begin(const std::vector<float>& _par)
+{
+    par = _par;
+    std::vector<float> levels = par;
+    std::sort(levels.begin(), levels.end());
+    levels.erase(std::unique(levels.begin(), levels.end()), levels.end());
+    active = levels.size() >= LIGHTCURVE_MIN_STEPS;
+
+    added.assign(par.size(), false);
+    width = height = 0;
+    mean_fit = LightCurveFit();
+    if (!active)
+    {
+        std::vector<float>().swap(etr);
+        for (auto& map : maps)
+        {
+            std::vector<float>().swap(map);
+        }
+    }
+    return active;
+}
+
+bool LightCurve::isActive()
+{
+    return active;
+}
+
+bool LightCurve::addStep(size_t step, const float* phi_psii, uint32_t _width, uint32_t _height)
+{
+    if (!active || step >= par.size() || phi_psii == nullptr)
+    {
+        return false;
+    }
+    if (width == 0)
+    {
+        width = _width;
+        height = _height;
+        etr.resize(static_cast<size_t>(width) * height * par.size());
+    }
+    else if (_width != width || _height != height)
+    {
+        return false;
+    }
+
+    // Strided store, so each pixel's steps end up side by side for the fit
+    const size_t steps = par.size();
+    const size_t pixels = static_cast<size_t>(width) * height;
+    const float scale = par[step] * 0.5f * absorptance;
+    float* out = etr.data() + step;
+    for (size_t i = 0; i < pixels; i++)
+    {
+        out[i * steps] = phi_psii[i] * scale;
+    }
+    added[step] = true;
+    return true;
+}
+
+bool LightCurve::isComplete()
+{
+    return active && width > 0 && std::find(added.begin(), added.end(), false) == added.end();
+}
+
+LightCurveFit LightCurve::fit(const float* par, const float* etr, size_t n, unsigned int iterations)
+{
+    LightCurveFit result;
+    if (n < 2)
+    {
+        return result;
+    }
+
+    // Plateau from the highest point, slope from the lowest light level
+    float e = 0.0f, low_par = std::numeric_limits<float>::infinity(), low_etr = 0.0f;
+    for (size_t k = 0; k < n; k++)
+    {
+        if (!(etr[k] == etr[k]))
+        {
+            return result;
+        }
+        e = std::max(e, etr[k]);
+        if (par[k] > 0.0f && par[k] < low_par)
+        {
+            low_par = par[k];
+            low_etr = etr[k];
+        }
+    }
+    if (e <= 0.0f || low_par == std::numeric_limits<float>::infinity())
+    {
+        return result;
+    }
+    e *= 1.1f;
+    float a = (low_etr > 0.0f) ? low_etr / low_par : e / low_par;
+
+    auto cost = [&](float a_, float e_)
+    {
+        float c = 0.0f;
+        for (size_t k = 0; k < n; k++)
+        {
+            float r = etr[k] - e_ * std::tanh(a_ * par[k] / e_);
+            c += r * r;
+        }
+        return c;
+    };
+
+    float c = cost(a, e);
+    float lambda = 1e-3f;
+    for (unsigned int it = 0; it < iterations; it++)
+    {
+        // Normal equations. d/da = p (1 - t^2), d/dE = t - u (1 - t^2)
+        float jaa = 0.0f, jae = 0.0f, jee = 0.0f, ga = 0.0f, ge = 0.0f;
+        for (size_t k = 0; k < n; k++)
+        {
+            float u = a * par[k] / e;
+            float t = std::tanh(u);
+            float s = 1.0f - t * t;
+            float da = par[k] * s;
+            float de = t - u * s;
+            float r = etr[k] - e * t;
+            jaa += da * da;
+            jae += da * de;
+            jee += de * de;
+            ga += da * r;
+            ge += de * r;
+        }
+
+        // Damp until a step lowers the cost
+        bool stepped = false;
+        float step_a = 0.0f, step_e = 0.0f;
+        while (lambda < 1e6f)
+        {
+            float maa = jaa * (1.0f + lambda), mee = jee * (1.0f + lambda);
+            float det = maa * mee - jae * jae;
+            if (det != 0.0f)
+            {
+                step_a = (mee * ga - jae * ge) / det;
+                step_e = (maa * ge - jae * ga) / det;
+                float na = a + step_a, ne = e + step_e;
+                if (na > 0.0f && ne > 0.0f)
+                {
+                    float nc = cost(na, ne);
+                    if (nc <= c)
+                    {
+                        a = na;
+                        e = ne;
+                        c = nc;
+                        lambda = std::max(1e-7f, lambda * 0.3f);
+                        stepped = true;
+                        break;
+                    }
+                }
+            }
+            lambda *= 10.0f;
+        }
+        if (!stepped || (std::fabs(step_a) <= 1e-5f * a && std::fabs(step_e) <= 1e-5f * e))
+        {
+            break;
+        }
+    }
+
+    result.alpha = a;
+    result.etr_max = e;
+    result.ik = e / a;
+    result.rmse = std::sqrt(c / n);
+    result.ok = std::isfinite(result.ik) && a > 0.0f && e > 0.0f;
+    return result;
+}
+
+void LightCurve::fitRange(size_t first, size_t last, uint64_t& fitted)
+{
+    const size_t steps = par.size();
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    for (size_t i = first; i < last; i++)
+    {
+        LightCurveFit f = fit(par.data(), etr.data() + i * steps, steps);
+        maps[PARAM_ALPHA][i] = f.ok ? f.alpha : nan;
+        maps[PARAM_ETRMAX][i] = f.ok ? f.etr_max : nan;
+        maps[PARAM_IK][i] = f.ok ? f.ik : nan;
+        fitted += f.ok;
+    }
+}
+
+uint64_t LightCurve::fitPixels()
+{
+    if (!isComplete())
+    {
+        return 0;
+    }
+
+    auto t0 = std::chrono::steady_clock::now();
+    const size_t pixels = static_cast<size_t>(width) * height;
+    for (auto& map : maps)
+    {
+        map.resize(pixels);
+    }
+
+    size_t chunks = (pixels + LIGHTCURVE_CHUNK - 1) / LIGHTCURVE_CHUNK;
+    unsigned int workers = (threads > 0) ? threads : std::max(1u, std::thread::hardware_concurrency());
+    workers = static_cast<unsigned int>(std::max<size_t>(1, std::min<size_t>(workers, chunks)));
+
+    // Background pixels fail fast, so chunks are handed out as workers free up
+    std::atomic<size_t> next(0);
+    std::vector<uint64_t> fitted(workers, 0);
+    auto work = [&](unsigned int w)
+    {
+        size_t chunk;
+        while ((chunk = next++) < chunks)
+        {
+            size_t first = chunk * LIGHTCURVE_CHUNK;
+            fitRange(first, std::min(pixels, first + LIGHTCURVE_CHUNK), fitted[w]);
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (unsigned int w = 1; w < workers; w++)
+    {
+        pool.emplace_back(work, w);
+    }
+    work(0);
+    for (std::thread& t : pool)
+    {
+        t.join();
+    }
+
+    uint64_t total = 0;
+    for (uint64_t f : fitted)
+    {
+        total += f;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    pixels_per_second = (seconds > 0.0) ? pixels / seconds : 0.0;
+
+    // Means of the fitted pixels
+    double sums[PARAM_COUNT] = {0.0, 0.0, 0.0};
+    for (size_t i = 0; i < pixels; i++)
+    {
+        if (maps[PARAM_ALPHA][i] == maps[PARAM_ALPHA][i])
+        {
+            for (int p = 0; p < PARAM_COUNT; p++)
+            {
+                sums[p] += maps[p][i];
+            }
+        }
+    }
+    mean_fit = LightCurveFit();
+    if (total > 0)
+    {
+        mean_fit.alpha = static_cast<float>(sums[PARAM_ALPHA] / total);
+        mean_fit.etr_max = static_cast<float>(sums[PARAM_ETRMAX] / total);
+        mean_fit.ik = static_cast<float>(sums[PARAM_IK] / total);
+        mean_fit.ok = true;
+    }
+    return total;
+}
+
+double LightCurve::getPixelsPerSecond()
+{
+    return pixels_per_second;
+}
+
+const float* LightCurve::getMap(int parameter)
+{
+    if (parameter < 0 || parameter >= PARAM_COUNT || maps[parameter].empty())
+    {
+        return nullptr;
+    }
+    return maps[parameter].data();
+}
+
+std::vector<LightCurveFit> LightCurve::fitRegions(const uint16_t* labels, uint16_t max_label)
+{
+    std::vector<LightCurveFit> fits;
+    if (!isComplete() || labels == nullptr || max_label == 0)
+    {
+        return fits;
+    }
+
+    // Mean ETR per label and step, each step over its own valid pixels
+    const size_t steps = par.size();
+    const size_t pixels = static_cast<size_t>(width) * height;
+    std::vector<double> sums((max_label + 1u) * steps, 0.0);
+    std::vector<uint64_t> counts((max_label + 1u) * steps, 0);
+    for (size_t i = 0; i < pixels; i++)
+    {
+        uint16_t l = labels[i];
+        if (l == 0 || l > max_label)
+        {
+            continue;
+        }
+        const float* e = etr.data() + i * steps;
+        for (size_t k = 0; k < steps; k++)
+        {
+            if (e[k] == e[k])
+            {
+                sums[l * steps + k] += e[k];
+                counts[l * steps + k]++;
+            }
+        }
+    }
+
+    std::vector<float> curve(steps);
+    for (uint32_t l = 1; l <= max_label; l++)
+    {
+        for (size_t k = 0; k < steps; k++)
+        {
+            uint64_t c = counts[l * steps + k];
+            curve[k] = (c > 0) ? static_cast<float>(sums[l * steps + k] / c) : std::numeric_limits<float>::quiet_NaN();
+        }
+        fits.push_back(fit(par.data(), curve.data(), steps));
+    }
+    return fits;
+}
+
+LightCurveFit LightCurve::getMeanFit()
+{
+    return mean_fit;
+}
+
+const std::vector<float>& LightCurve::getPar()
+{
+    return par;
+}
+
+uint32_t LightCurve::getWidth()
+{
+    return width;
+}
+
+uint32_t LightCurve::getHeight()
+{
+    return height;
+}
@@ -0,0 +1,103 @@
+// *****************************************************************************
+//
+// lightcurve.h
+// Rapid light curves: ETR against PAR over a few steps of actinic light with
+// a saturating pulse at the end of each, fitted per pixel and per region.
+//
+// ETR = PhiPSII * PAR * 0.5 * absorptance, the 0.5 being the share of light
+// going to PSII. Each step's PhiPSII map is taken as its pulse arrives and
+// kept per pixel (all steps of a pixel side by side), so the fit reads one
+// short row per pixel. The model is Jassby and Platt's
+//
+//     ETR = ETRmax * tanh(alpha * PAR / ETRmax),   Ik = ETRmax / alpha
+//
+// fitted with a few Levenberg-Marquardt iterations from an initial slope and
+// plateau read off the points. Pixels are shared out to worker threads in
+// chunks. Pixels with a NaN step, or whose fit doesn't converge to positive
+// values, are NaN.
+//
+// *****************************************************************************
+
+
+#ifndef __LIGHTCURVE_H__
+#define __LIGHTCURVE_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#define DEFAULT_ABSORPTANCE 0.84f           // Leaf absorptance
+#define DEFAULT_LIGHTCURVE_ITERATIONS 20    // Levenberg-Marquardt iteration cap
+#define LIGHTCURVE_MIN_STEPS 3              // Distinct light levels needed for a fit
+#define LIGHTCURVE_CHUNK 4096               // Pixels per unit of work
+
+struct LightCurveFit
+{
+    float alpha = 0.0f;     // Initial slope (electrons / photon)
+    float etr_max = 0.0f;   // (umol electrons m-2 s-1)
+    float ik = 0.0f;        // Light saturation point (umol photons m-2 s-1)
+    float rmse = 0.0f;
+    bool ok = false;
+};
+
+class LightCurve
+{
+    public:
+        enum PARAMETERS
+        {
+            PARAM_ALPHA,
+            PARAM_ETRMAX,
+            PARAM_IK,
+            PARAM_COUNT
+        };
+
+        LightCurve(float _absorptance = DEFAULT_ABSORPTANCE);
+
+        void setThreads(unsigned int _threads);     // 0 uses every core
+
+        // PAR of each step in order. Returns false, and the curve stays
+        // inactive, with fewer than LIGHTCURVE_MIN_STEPS distinct levels.
+        bool begin(const std::vector<float>& _par);
+        bool isActive();
+
+        // PhiPSII map of a step, width * height
+        bool addStep(size_t step, const float* phi_psii, uint32_t _width, uint32_t _height);
+        bool isComplete();          // Every step added
+
+        // Fits every pixel. Returns the number fitted.
+        uint64_t fitPixels();
+        double getPixelsPerSecond();    // Of the last fitPixels()
+        const float* getMap(int parameter);
+
+        // Mean ETR of each label at each step, fitted per label. One fit per
+        // label from 1 to max_label.
+        std::vector<LightCurveFit> fitRegions(const uint16_t* labels, uint16_t max_label);
+
+        // Mean of the per pixel fits
+        LightCurveFit getMeanFit();
+
+        const std::vector<float>& getPar();
+        uint32_t getWidth();
+        uint32_t getHeight();
+
+        static LightCurveFit fit(const float* par, const float* etr, size_t n, unsigned int iterations = DEFAULT_LIGHTCURVE_ITERATIONS);
+
+    private:
+        void fitRange(size_t first, size_t last, uint64_t& fitted);
+
+    private:
+        float absorptance;
+        unsigned int threads;
+        std::vector<float> par;
+        std::vector<float> etr;     // steps per pixel, pixel major
+        std::vector<bool> added;
+        bool active;
+        uint32_t width;
+        uint32_t height;
+        std::vector<float> maps[PARAM_COUNT];
+        LightCurveFit mean_fit;
+        double pixels_per_second;
+};
+
+
+#endif // __LIGHTCURVE_H__
@@ -1,8 +1,10 @@
 #include <QApplication>
 
 #include "gui.h"
+#include "metrics.h"
 
 const std::string saving_path = "images/";
+const std::string metrics_path = "metrics.prom";
 
 int main( int argc, char *argv[] )
 {
@@ -23,6 +25,13 @@ int main( int argc, char *argv[] )
     gui.setImagePath(saving_path);
     gui.show();
 
-    return app.exec();
+    // Export runtime stats for long runs
+    Metrics::instance().serve(DEFAULT_METRICS_PORT);
+    Metrics::instance().dumpTo(metrics_path, DEFAULT_METRICS_INTERVAL);
+
+    int ret = app.exec();
+    Metrics::instance().stop();
+
+    return ret;
 }
 
@@ -0,0 +1,430 @@
+#include "metrics.h"
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <set>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+// Atomic add for doubles (no fetch_add before C++20)
+static void atomicAdd(std::atomic<double>& a, double v)
+{
+    double old = a.load(std::memory_order_relaxed);
+    while (!a.compare_exchange_weak(old, old + v, std::memory_order_relaxed))
+    {
+    }
+}
+
+static std::string baseName(const std::string& name)
+{
+    return name.substr(0, name.find('{'));
+}
+
+// Bounds are written as given, without the full precision of values
+static std::string formatBound(double v)
+{
+    std::stringstream ss;
+    ss << v;
+    return ss.str();
+}
+
+Counter::Counter() : value(0)
+{
+
+}
+
+void Counter::inc(uint64_t n)
+{
+    value.fetch_add(n, std::memory_order_relaxed);
+}
+
+void Counter::set(uint64_t v)
+{
+    value.store(v, std::memory_order_relaxed);
+}
+
+uint64_t Counter::get() const
+{
+    return value.load(std::memory_order_relaxed);
+}
+
+Gauge::Gauge() : value(0.0)
+{
+
+}
+
+void Gauge::set(double v)
+{
+    value.store(v, std::memory_order_relaxed);
+}
+
+void Gauge::add(double v)
+{
+    atomicAdd(value, v);
+}
+
+double Gauge::get() const
+{
+    return value.load(std::memory_order_relaxed);
+}
+
+MetricsHistogram::MetricsHistogram(const std::vector<double>& _bounds) :
+    bounds(_bounds),
+    buckets(new std::atomic<uint64_t>[_bounds.size() + 1]),
+    count(0),
+    sum(0.0)
+{
+    for (size_t i = 0; i <= bounds.size(); i++)
+    {
+        buckets[i] = 0;
+    }
+}
+
+void MetricsHistogram::observe(double v)
+{
+    // Few buckets, a linear scan beats a binary search here
+    size_t i = 0;
+    while (i < bounds.size() && v > bounds[i])
+    {
+        i++;
+    }
+
+    buckets[i].fetch_add(1, std::memory_order_relaxed);
+    count.fetch_add(1, std::memory_order_relaxed);
+    atomicAdd(sum, v);
+}
+
+const std::vector<double>& MetricsHistogram::getBounds() const
+{
+    return bounds;
+}
+
+uint64_t MetricsHistogram::getBucket(size_t i) const
+{
+    return buckets[i].load(std::memory_order_relaxed);
+}
+
+uint64_t MetricsHistogram::getCount() const
+{
+    return count.load(std::memory_order_relaxed);
+}
+
+double MetricsHistogram::getSum() const
+{
+    return sum.load(std::memory_order_relaxed);
+}
+
+Metrics& Metrics::instance()
+{
+    static Metrics metrics;
+    return metrics;
+}
+
+Metrics::Metrics() : next_collector(0), running(false)
+{
+
+}
+
+Metrics::~Metrics()
+{
+    stop();
+
+    for (auto& it : entries)
+    {
+        destroy(it.second);
+    }
+    for (auto& e : rejected)
+    {
+        destroy(e);
+    }
+}
+
+void Metrics::destroy(const Entry& e)
+{
+    switch (e.type)
+    {
+        case COUNTER: delete static_cast<Counter*>(e.metric); break;
+        case GAUGE: delete static_cast<Gauge*>(e.metric); break;
+        case HISTOGRAM: delete static_cast<MetricsHistogram*>(e.metric); break;
+    }
+}
+
+// The metric already registered as name, if any. Called with mtx held.
+void* Metrics::find(const std::string& name, TYPE type)
+{
+    auto it = entries.find(name);
+    return (it != entries.end() && it->second.type == type) ? it->second.metric : nullptr;
+}
+
+// Registers metric as name unless the name, or another series of its family,
+// has a different type. Called with mtx held.
+void* Metrics::add(const std::string& name, TYPE type, const std::string& help, void* metric)
+{
+    std::string base = baseName(name);
+    for (auto& it : entries)
+    {
+        if (it.second.type != type && (it.first == name || baseName(it.first) == base))
+        {
+            std::cout << "Metrics: " << name << " is already registered with another type, not exporting it" << std::endl;
+            rejected.push_back({type, help, metric});
+            return metric;
+        }
+    }
+
+    entries[name] = {type, help, metric};
+    return metric;
+}
+
+Counter* Metrics::counter(const std::string& name, const std::string& help)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    void* m = find(name, COUNTER);
+    return static_cast<Counter*>(m != nullptr ? m : add(name, COUNTER, help, new Counter));
+}
+
+Gauge* Metrics::gauge(const std::string& name, const std::string& help)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    void* m = find(name, GAUGE);
+    return static_cast<Gauge*>(m != nullptr ? m : add(name, GAUGE, help, new Gauge));
+}
+
+MetricsHistogram* Metrics::histogram(const std::string& name, const std::string& help, const std::vector<double>& bounds)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    void* m = find(name, HISTOGRAM);
+    return static_cast<MetricsHistogram*>(m != nullptr ? m : add(name, HISTOGRAM, help, new MetricsHistogram(bounds)));
+}
+
+int Metrics::addCollector(std::function<void()> fn)
+{
+    std::lock_guard<std::mutex> lock(collector_mtx);
+    int id = next_collector++;
+    collectors[id] = fn;
+    return id;
+}
+
+void Metrics::removeCollector(int id)
+{
+    // Waits for a render that is running collectors
+    std::lock_guard<std::mutex> lock(collector_mtx);
+    collectors.erase(id);
+}
+
+std::string Metrics::render()
+{
+    // Collectors run outside mtx so they are free to look up metrics
+    {
+        std::lock_guard<std::mutex> lock(collector_mtx);
+        for (auto& it : collectors)
+        {
+            it.second();
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mtx);
+
+    // Totals past a million would lose digits at the default precision
+    std::stringstream ss;
+    ss << std::setprecision(std::numeric_limits<double>::max_digits10);
+    std::set<std::string> described;
+    for (auto& it : entries)
+    {
+        const std::string& name = it.first;
+        const Entry& e = it.second;
+
+        // HELP/TYPE once per metric family, labelled series share them
+        std::string base = baseName(name);
+        if (described.insert(base).second)
+        {
+            const char* type = (e.type == COUNTER) ? "counter" : (e.type == GAUGE) ? "gauge" : "histogram";
+            ss << "# HELP " << base << " " << e.help << "\n";
+            ss << "# TYPE " << base << " " << type << "\n";
+        }
+
+        switch (e.type)
+        {
+            case COUNTER:
+                ss << name << " " << static_cast<Counter*>(e.metric)->get() << "\n";
+                break;
+
+            case GAUGE:
+                ss << name << " " << static_cast<Gauge*>(e.metric)->get() << "\n";
+                break;
+
+            case HISTOGRAM:
+            {
+                // Labels go after the suffix, with le added to them
+                std::string labels = (base.size() < name.size()) ? name.substr(base.size() + 1, name.size() - base.size() - 2) : "";
+                std::string sep = labels.empty() ? "" : ",";
+                std::string plain = labels.empty() ? "" : "{" + labels + "}";
+                MetricsHistogram* h = static_cast<MetricsHistogram*>(e.metric);
+                const std::vector<double>& bounds = h->getBounds();
+                uint64_t cumulative = 0;
+                for (size_t i = 0; i < bounds.size(); i++)
+                {
+                    cumulative += h->getBucket(i);
+                    ss << base << "_bucket{" << labels << sep << "le=\"" << formatBound(bounds[i]) << "\"} " << cumulative << "\n";
+                }
+                cumulative += h->getBucket(bounds.size());
+                ss << base << "_bucket{" << labels << sep << "le=\"+Inf\"} " << cumulative << "\n";
+                ss << base << "_sum" << plain << " " << h->getSum() << "\n";
+                ss << base << "_count" << plain << " " << h->getCount() << "\n";
+                break;
+            }
+        }
+    }
+
+    return ss.str();
+}
+
+bool Metrics::serve(uint16_t port)
+{
+    if (server_thread.joinable())
+    {
+        return true;
+    }
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    // Loopback only, this is not meant to be reachable from the network
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(fd, 4) != 0)
+    {
+        std::cout << "Metrics: unable to listen on port " << port << std::endl;
+        close(fd);
+        return false;
+    }
+
+    running = true;
+    server_thread = std::thread(&Metrics::serverLoop, this, fd);
+    std::cout << "Metrics: serving on 127.0.0.1:" << port << std::endl;
+    return true;
+}
+
+void Metrics::serverLoop(int fd)
+{
+    while (running)
+    {
+        // Poll with a timeout so stop() is noticed
+        pollfd pfd = {fd, POLLIN, 0};
+        if (poll(&pfd, 1, 200) <= 0)
+        {
+            continue;
+        }
+
+        int client = accept(fd, nullptr, nullptr);
+        if (client < 0)
+        {
+            continue;
+        }
+
+        // We answer every request with the metrics page, so the request
+        // itself only needs draining.
+        char request[1024];
+        pollfd cfd = {client, POLLIN, 0};
+        if (poll(&cfd, 1, 200) > 0)
+        {
+            recv(client, request, sizeof(request), 0);
+        }
+
+        std::string body = render();
+        std::stringstream ss;
+        ss << "HTTP/1.0 200 OK\r\n"
+           << "Content-Type: text/plain; version=0.0.4\r\n"
+           << "Content-Length: " << body.size() << "\r\n\r\n"
+           << body;
+
+        std::string response = ss.str();
+        size_t sent = 0;
+        while (sent < response.size())
+        {
+            ssize_t n = send(client, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+            if (n <= 0)
+            {
+                break;
+            }
+            sent += n;
+        }
+
+        close(client);
+    }
+
+    close(fd);
+}
+
+bool Metrics::dump(const std::string& path)
+{
+    std::string tmp = path + ".tmp";
+    std::ofstream file(tmp, std::ios::trunc);
+    if (!file)
+    {
+        return false;
+    }
+
+    file << render();
+    file.close();
+
+    return std::rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+void Metrics::dumpTo(const std::string& path, unsigned int interval)
+{
+    if (dump_thread.joinable())
+    {
+        return;
+    }
+
+    running = true;
+    dump_thread = std::thread(&Metrics::dumpLoop, this, path, interval);
+}
+
+void Metrics::dumpLoop(std::string path, unsigned int interval)
+{
+    auto next = std::chrono::steady_clock::now();
+    while (running)
+    {
+        if (std::chrono::steady_clock::now() >= next)
+        {
+            dump(path);
+            next += std::chrono::seconds(interval);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+
+    // Final state on the way out
+    dump(path);
+}
+
+void Metrics::stop()
+{
+    running = false;
+
+    if (server_thread.joinable())
+    {
+        server_thread.join();
+    }
+
+    if (dump_thread.joinable())
+    {
+        dump_thread.join();
+    }
+}
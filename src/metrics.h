@@ -0,0 +1,158 @@
+// *****************************************************************************
+//
+// metrics.h
+// Process wide registry of counters, gauges and histograms for watching long
+// acquisitions. The registry renders the Prometheus text format, which is
+// served over HTTP on a loopback port and periodically dumped to a file.
+//
+// Metrics are created on first use and live for the lifetime of the process,
+// so call sites can keep a static pointer:
+//
+//     static Counter* frames = Metrics::instance().counter("pam_frames_total", "Frames");
+//     frames->inc();
+//
+// Labels are part of the name, e.g. pam_state_transitions_total{to="paused"}.
+//
+// *****************************************************************************
+
+
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define DEFAULT_METRICS_PORT 9464
+#define DEFAULT_METRICS_INTERVAL 10 // (s)
+
+class Counter
+{
+    public:
+        Counter();
+        void inc(uint64_t n = 1);
+
+        // For totals kept elsewhere (e.g. eBUS stream statistics) and copied
+        // in by a collector. Going down is read as a reset.
+        void set(uint64_t v);
+        uint64_t get() const;
+
+    private:
+        std::atomic<uint64_t> value;
+};
+
+class Gauge
+{
+    public:
+        Gauge();
+        void set(double v);
+        void add(double v);
+        double get() const;
+
+    private:
+        std::atomic<double> value;
+};
+
+// Fixed bucket histogram. Bounds are upper bounds in ascending order; an
+// implicit +Inf bucket catches the rest.
+class MetricsHistogram
+{
+    public:
+        MetricsHistogram(const std::vector<double>& _bounds);
+        void observe(double v);
+
+        const std::vector<double>& getBounds() const;
+        uint64_t getBucket(size_t i) const;  // Non-cumulative
+        uint64_t getCount() const;
+        double getSum() const;
+
+    private:
+        std::vector<double> bounds;
+        std::unique_ptr<std::atomic<uint64_t>[]> buckets;
+        std::atomic<uint64_t> count;
+        std::atomic<double> sum;
+};
+
+class Metrics
+{
+    public:
+        static Metrics& instance();
+
+        // A name whose family is already registered as another type is
+        // refused with a log line; the caller still gets a metric, but it is
+        // never rendered.
+        Counter* counter(const std::string& name, const std::string& help);
+        Gauge* gauge(const std::string& name, const std::string& help);
+        MetricsHistogram* histogram(const std::string& name, const std::string& help, const std::vector<double>& bounds);
+
+        // Collectors run before each render, for values that are polled
+        // (queue depths, stream statistics) rather than pushed. Once
+        // removeCollector() returns the collector is not running and won't
+        // run again, so what it reads can be freed. Collectors must not add
+        // or remove collectors themselves.
+        int addCollector(std::function<void()> fn);
+        void removeCollector(int id);
+
+        std::string render();
+
+        // Serve GET requests on 127.0.0.1:port. Returns false if the port
+        // could not be bound.
+        bool serve(uint16_t port = DEFAULT_METRICS_PORT);
+
+        // Rewrite path every interval seconds (via rename, so readers never
+        // see a partial file)
+        void dumpTo(const std::string& path, unsigned int interval = DEFAULT_METRICS_INTERVAL);
+        bool dump(const std::string& path);
+
+        void stop();
+
+    private:
+        Metrics();
+        ~Metrics();
+        Metrics(const Metrics&) = delete;
+        Metrics& operator=(const Metrics&) = delete;
+
+        void serverLoop(int fd);
+        void dumpLoop(std::string path, unsigned int interval);
+
+    private:
+        enum TYPE
+        {
+            COUNTER,
+            GAUGE,
+            HISTOGRAM
+        };
+
+        struct Entry
+        {
+            TYPE type;
+            std::string help;
+            void* metric;
+        };
+
+        void* find(const std::string& name, TYPE type);
+        void* add(const std::string& name, TYPE type, const std::string& help, void* metric);
+        static void destroy(const Entry& e);
+
+        std::mutex mtx;
+        std::map<std::string, Entry> entries;
+        std::vector<Entry> rejected;        // Type clashes, owned but not rendered
+
+        // Held while collectors run, so removing one waits for a render
+        std::mutex collector_mtx;
+        std::map<int, std::function<void()>> collectors;
+        int next_collector;
+
+        std::atomic<bool> running;
+        std::thread server_thread;
+        std::thread dump_thread;
+};
+
+
+#endif // __METRICS_H__
@@ -0,0 +1,171 @@
+#include "quenching.h"
+#include "sequence.h"
+#include <algorithm>
+
+Quenching::Quenching(float _threshold) :
+    threshold(_threshold), active(false), width(0), height(0), bits(8), have_f0(false), have_fm(false), have_fp(false)
+{
+
+}
+
+void Quenching::setThreshold(float _threshold)
+{
+    threshold = _threshold;
+}
+
+void Quenching::begin(const std::vector<int>& _roles)
+{
+    roles = _roles;
+    active = std::find(roles.begin(), roles.end(), FRAME_FMP) != roles.end();
+    width = height = 0;
+    dark = ImageView();
+    have_f0 = have_fm = have_fp = false;
+    points.clear();
+    if (!active)
+    {
+        // Plain Fv/Fm sequences don't need the buffers
+        for (auto* v : {&f0, &fm, &fp, &fmp})
+        {
+            std::vector<float>().swap(*v);
+        }
+        for (auto& map : maps)
+        {
+            std::vector<float>().swap(map);
+        }
+        std::vector<uint8_t>().swap(dark_data);
+    }
+}
+
+bool Quenching::isActive()
+{
+    return active;
+}
+
+bool Quenching::sameShape(const ImageView& image)
+{
+    if (width == 0)
+    {
+        width = image.width;
+        height = image.height;
+        bits = image.bits;
+        return true;
+    }
+    return image.width == width && image.height == height && image.bits == bits;
+}
+
+bool Quenching::addFrame(uint32_t index, const ImageView& image, int64_t wall_us)
+{
+    if (!active || index >= roles.size() || image.data == nullptr || !sameShape(image))
+    {
+        return false;
+    }
+
+    const ImageView* background = (dark.data != nullptr) ? &dark : nullptr;
+    switch (roles[index])
+    {
+        case FRAME_DARK:
+            if (dark.data == nullptr && !have_f0)
+            {
+                dark_data.assign(image.data, image.data + static_cast<size_t>(image.stride) * image.height);
+                dark = image;
+                dark.data = dark_data.data();
+            }
+            return false;
+
+        case FRAME_F0:
+            f0.resize(image.pixels());
+            have_f0 = Fluorescence::levels(image, background, f0.data());
+            return false;
+
+        case FRAME_FM:
+            fm.resize(image.pixels());
+            have_fm = Fluorescence::levels(image, background, fm.data());
+            return false;
+
+        case FRAME_FP:
+            fp.resize(image.pixels());
+            have_fp = Fluorescence::levels(image, background, fp.data());
+            return false;
+
+        case FRAME_FMP:
+            break;
+
+        default:
+            return false;
+    }
+
+    // An Fm' without the dark adapted pair or its F' has nothing to go by
+    if (!have_f0 || !have_fm || !have_fp)
+    {
+        return false;
+    }
+
+    size_t pixels = image.pixels();
+    fmp.resize(pixels);
+    Fluorescence::levels(image, background, fmp.data());
+    QuenchingMaps out;
+    float* ptrs[PARAM_COUNT];
+    for (int p = 0; p < PARAM_COUNT; p++)
+    {
+        maps[p].resize(pixels);
+        ptrs[p] = maps[p].data();
+    }
+    out.phi_psii = ptrs[PARAM_PHIPSII];
+    out.qp = ptrs[PARAM_QP];
+    out.ql = ptrs[PARAM_QL];
+    out.npq = ptrs[PARAM_NPQ];
+
+    QuenchingSums sums;
+    Fluorescence::quenching(f0.data(), fm.data(), fp.data(), fmp.data(), pixels, threshold * image.maxValue(), out, sums);
+    have_fp = false;
+
+    QuenchingPoint point;
+    point.frame = index;
+    point.wall_us = wall_us;
+    point.valid = sums.valid;
+    if (sums.valid > 0)
+    {
+        point.phi_psii = sums.phi_psii / sums.valid;
+        point.qp = sums.qp / sums.valid;
+        point.ql = sums.ql / sums.valid;
+        point.npq = sums.npq / sums.valid;
+    }
+    points.push_back(point);
+    return true;
+}
+
+const std::vector<QuenchingPoint>& Quenching::getPoints()
+{
+    return points;
+}
+
+const float* Quenching::getMap(int parameter)
+{
+    if (parameter < 0 || parameter >= PARAM_COUNT || maps[parameter].empty())
+    {
+        return nullptr;
+    }
+    return maps[parameter].data();
+}
+
+uint32_t Quenching::getWidth()
+{
+    return width;
+}
+
+uint32_t Quenching::getHeight()
+{
+    return height;
+}
+
+const char* Quenching::getParameterName(int parameter)
+{
+    switch (parameter)
+    {
+        case PARAM_PHIPSII: return "phi_psii";
+        case PARAM_QP: return "qp";
+        case PARAM_QL: return "ql";
+        case PARAM_NPQ: return "npq";
+        default: return "";
+    }
+}
@@ -0,0 +1,94 @@
+// *****************************************************************************
+//
+// quenching.h
+// Light adapted parameters (PhiPSII, qP, qL, NPQ) of an induction curve,
+// worked out frame by frame while the sequence is recorded.
+//
+// begin() takes the FrameRole of every frame (Sequence::frameRoles). The
+// first dark frame is subtracted from all the others. F0 and Fm are turned
+// into float levels once, then every F' is converted when it arrives and
+// every Fm' runs the kernels against it, so the work is spread over the
+// sequence and nothing is left for its end. Only the maps of the latest
+// pulse are kept, together with the mean of every pulse so far.
+//
+// *****************************************************************************
+
+
+#ifndef __QUENCHING_H__
+#define __QUENCHING_H__
+
+#include <cstdint>
+#include <vector>
+
+#include "fluorescence.h"
+
+struct QuenchingPoint
+{
+    uint32_t frame = 0;         // Index of the Fm' frame in the sequence
+    int64_t wall_us = 0;
+    double phi_psii = 0.0;      // Means over valid pixels
+    double qp = 0.0;
+    double ql = 0.0;
+    double npq = 0.0;
+    uint64_t valid = 0;
+};
+
+class Quenching
+{
+    public:
+        enum PARAMETERS
+        {
+            PARAM_PHIPSII,
+            PARAM_QP,
+            PARAM_QL,
+            PARAM_NPQ,
+            PARAM_COUNT
+        };
+
+        Quenching(float _threshold = DEFAULT_FM_THRESHOLD);
+
+        void setThreshold(float _threshold);
+
+        // Starts a sequence. Without an Fm' frame in roles addFrame() does
+        // nothing.
+        void begin(const std::vector<int>& _roles);
+        bool isActive();
+
+        // index is the frame's position in the sequence, from 0. Returns true
+        // when the frame completed a point.
+        bool addFrame(uint32_t index, const ImageView& image, int64_t wall_us = 0);
+
+        const std::vector<QuenchingPoint>& getPoints();
+
+        // Map of the last point, width * height, NaN off the leaves
+        const float* getMap(int parameter);
+        uint32_t getWidth();
+        uint32_t getHeight();
+
+        static const char* getParameterName(int parameter);
+
+    private:
+        bool sameShape(const ImageView& image);
+
+    private:
+        float threshold;
+        std::vector<int> roles;
+        bool active;
+        uint32_t width;
+        uint32_t height;
+        uint32_t bits;
+        ImageView dark;
+        std::vector<uint8_t> dark_data;
+        std::vector<float> f0;
+        std::vector<float> fm;
+        std::vector<float> fp;
+        std::vector<float> fmp;
+        bool have_f0;
+        bool have_fm;
+        bool have_fp;
+        std::vector<float> maps[PARAM_COUNT];
+        std::vector<QuenchingPoint> points;
+};
+
+
+#endif // __QUENCHING_H__
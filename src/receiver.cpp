@@ -2,19 +2,56 @@
 #include <PvDecompressionFilter.h>
 
 Receiver::Receiver(PvDisplayWnd* _display_wnd) :
+    from_cache(false),
     display_wnd(_display_wnd),
     device(nullptr),
     stream(nullptr),
     pipeline(nullptr),
     display_thread(nullptr),
     params(nullptr),
-    state(PAUSED)
+    auto_exposure(nullptr),
+    correlator(nullptr),
+    watchdog(nullptr),
+    session_writer(nullptr),
+    frame_ring(nullptr),
+    packet_size(DEFAULT_GVSP_PACKET_SIZE),
+    fvfm_preview(nullptr),
+    fvfm_display(false),
+    segment_rois(false),
+    analysis_stop(false),
+    sequence_ended(false),
+    sequence_busy(false),
+    sequence_stop(false),
+    live_feed_sink(-1),
+    link_lost(false),
+    recovering(false),
+    state(PAUSED),
+    frame_count(DEFAULT_FRAME_COUNT),
+    start_time(std::chrono::steady_clock::now()),
+    metrics_collector(-1)
 {
+    static Gauge* connect_ms = Metrics::instance().gauge("pam_startup_connect_ms", "Time from start to device connected");
+
     if (selectDevice() )
     {
-        connectToDevice();
+        // A stale cache entry can still be found but refuse the connection
+        if (!connectToDevice() && from_cache)
+        {
+            if (discoverDevice())
+            {
+                from_cache = false;
+                connectToDevice();
+            }
+        }
+
         if (device != NULL)
         {
+            saveDeviceCache();
+
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_time).count();
+            connect_ms->set(ms);
+            std::cout << "Connected in " << ms << " ms (" << (from_cache ? "cached" : "discovery") << ")" << std::endl;
+
             params = device->GetParameters();
             openStream();
             if (stream != NULL)
@@ -28,6 +65,29 @@ Receiver::Receiver(PvDisplayWnd* _display_wnd) :
 
                 // Start the display thread/pipeline to put images on the screen
                 display_thread = new DisplayThread(display_wnd);
+                display_thread->setStartTime(start_time);
+                auto_exposure = new AutoExposure(params);
+                display_thread->setAutoExposure(auto_exposure);
+
+                // Frames are matched to triggers on the device clock
+                correlator = new FrameCorrelator();
+                int64_t tick_frequency;
+                PvGenInteger* tick_param = dynamic_cast<PvGenInteger *>(params->Get("GevTimestampTickFrequency"));
+                if (tick_param != nullptr && tick_param->GetValue(tick_frequency).IsOK())
+                {
+                    correlator->setTickFrequency(static_cast<double>(tick_frequency));
+                }
+                display_thread->setCorrelator(correlator);
+                session_writer = new SessionWriter();
+                display_thread->setSessionWriter(session_writer);
+                frame_ring = new FrameRing();
+                display_thread->setFrameRing(frame_ring);
+                display_thread->setFrameStats(&frame_stats);
+                display_thread->setPacketSize(packet_size);
+                fvfm_preview = new FvFmPreview();
+                display_thread->setFvFmPreview(fvfm_preview);
+                analysis_thread = std::thread(&Receiver::runAnalysis, this);
+                sequence_thread = std::thread(&Receiver::runSequenceThread, this);
                 pipeline = new PvPipeline(stream);
 
                 display_thread->Start(pipeline, params);
@@ -36,33 +96,198 @@ Receiver::Receiver(PvDisplayWnd* _display_wnd) :
                 // Docs said to do this....I assume so that the thread gets time from OS?
                 display_thread->SetPriority(50);
 
+                registerMetrics();
+
                 // Start image acquisition (continuous)
                 setState();
+
+                // Watch the link from here on
+                device->RegisterEventSink(this);
+                watchdog = new Watchdog(this);
+                watchdog->start();
             }
         }
     }
 }
 
-void Receiver::quit()
+void Receiver::quit(unsigned int drain_timeout_ms)
 {
-    stopAcquisition();
+    auto quit_start = std::chrono::steady_clock::now();
+    if (watchdog != nullptr)
+    {
+        watchdog->stop();
+        delete watchdog;
+        watchdog = nullptr;
+    }
+    device->UnregisterEventSink(this);
+
+    drain(drain_timeout_ms);
+    setLiveFeed(false);
+
+    if (metrics_collector >= 0)
+    {
+        Metrics::instance().removeCollector(metrics_collector);
+        metrics_collector = -1;
+    }
 
-    display_thread->Stop(false);
+    // Wait for the display thread to leave its callbacks, they use
+    // everything deleted below
+    display_thread->Stop(true);
     pipeline->Stop();
+
+    // Sequences already recorded are still analysed and written, in what is
+    // left of the drain time
+    stopSequenceThread();
+    auto drained = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - quit_start).count();
+    stopAnalysis(static_cast<unsigned int>(std::max<int64_t>(0, static_cast<int64_t>(drain_timeout_ms) - drained)));
     
     stream->Close();
     PvStream::Free(stream);
 
     device->Disconnect();
     PvDevice::Free(device);
-    
-    display_wnd->Close();
+
+#ifndef PAM_HEADLESS
+    if (display_wnd != nullptr)
+    {
+        display_wnd->Close();
+    }
+#endif
 
     delete pipeline;
+    delete auto_exposure;
+    delete correlator;
+
+    // No more events into the ring
+    SerialPort::instance().setEventCallback(nullptr);
+
+    // Trims and syncs the session file
+    delete session_writer;
+
+    // Finishes a running commit first
+    delete frame_ring;
+    delete fvfm_preview;
+}
+
+DrainReport Receiver::drain(unsigned int timeout_ms)
+{
+    static Counter* drained = Metrics::instance().counter("pam_shutdown_frames_flushed_total", "Frames saved while draining at shutdown");
+    static Gauge* drain_ms = Metrics::instance().gauge("pam_shutdown_drain_ms", "Time the last shutdown drain took");
+
+    DrainReport report;
+    auto t0 = std::chrono::steady_clock::now();
+    auto deadline = t0 + std::chrono::milliseconds(timeout_ms);
+    auto remaining = [&deadline]()
+    {
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+        return static_cast<unsigned int>(std::max<int64_t>(1, left));
+    };
+
+    // No more triggers or frames. An unlocked sequence is closed by the
+    // acquisition state callback.
+    uint64_t saved_before = display_thread->getFramesSaved();
+    stopAcquisition();
+
+    // Frames already in the pipeline still go through the display thread,
+    // and a frame it has taken off the queue isn't saved until it is idle.
+    // A recording that was running is closed with its last frames.
+    waitForSequenceEnd(remaining());
+    while ((pipeline->GetOutputQueueSize() > 0 || !display_thread->isIdle()) && std::chrono::steady_clock::now() < deadline)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    report.pending = pipeline->GetOutputQueueSize() + (display_thread->isIdle() ? 0 : 1);
+
+    // Then out of the writer and onto disk
+    if (session_writer->isOpen() && !session_writer->flush(remaining()))
+    {
+        report.pending += session_writer->getPending();
+    }
+
+    // A pre-trigger commit writes its post window as well
+    while (frame_ring->isCommitting() && std::chrono::steady_clock::now() < deadline)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    report.flushed = display_thread->getFramesSaved() - saved_before;
+    report.timed_out = report.pending > 0 || frame_ring->isCommitting();
+    report.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+
+    drained->inc(report.flushed);
+    drain_ms->set(report.ms);
+    std::cout << "Shutdown drain: " << report.flushed << " frames flushed in " << report.ms << " ms";
+    if (report.timed_out)
+    {
+        std::cout << ", timed out with " << report.pending << " frames pending" << (frame_ring->isCommitting() ? " and a pre-trigger commit running" : "");
+    }
+    std::cout << std::endl;
+
+    return report;
+}
+
+void Receiver::registerMetrics()
+{
+    Metrics& m = Metrics::instance();
+    Gauge* output_queue = m.gauge("pam_pipeline_output_queue", "Buffers waiting in the pipeline output queue");
+    Gauge* queued = m.gauge("pam_stream_queued_buffers", "Buffers queued in the stream for acquisition");
+    Gauge* rate = m.gauge("pam_stream_acquisition_rate", "Frame rate measured by the stream (fps)");
+    Gauge* bandwidth = m.gauge("pam_stream_bandwidth", "Bandwidth measured by the stream (bits/s)");
+    Gauge* recent_loss = m.gauge("pam_stream_recent_packet_loss", "Fraction of packets lost over the last frames");
+    Gauge* packet_size_gauge = m.gauge("pam_stream_packet_size", "Negotiated stream packet size (bytes)");
+
+    // Stream statistics are running totals, exported as counters
+    const char* stream_counters[][2] =
+    {
+        {"BlocksDropped", "pam_stream_blocks_dropped_total"},
+        {"BlockIDsMissing", "pam_stream_block_ids_missing_total"},
+        {"LostPacket", "pam_stream_lost_packets_total"},
+        {"ResendPacketRequested", "pam_stream_resend_packets_requested_total"}
+    };
+    std::vector<std::pair<PvGenInteger*, Counter*>> counters;
+    PvGenParameterArray* stream_params = stream->GetParameters();
+    for (auto& c : stream_counters)
+    {
+        PvGenInteger* p = dynamic_cast<PvGenInteger *>(stream_params->Get(c[0]));
+        if (p != nullptr)
+        {
+            counters.push_back(std::make_pair(p, m.counter(c[1], std::string("Stream statistic ") + c[0])));
+        }
+    }
+    PvGenFloat* rate_param = dynamic_cast<PvGenFloat *>(stream_params->Get("AcquisitionRate"));
+    PvGenFloat* bandwidth_param = dynamic_cast<PvGenFloat *>(stream_params->Get("Bandwidth"));
+
+    metrics_collector = m.addCollector([this, output_queue, queued, rate, bandwidth, recent_loss, packet_size_gauge, counters, rate_param, bandwidth_param]()
+    {
+        output_queue->set(pipeline->GetOutputQueueSize());
+        queued->set(stream->GetQueuedBufferCount());
+        recent_loss->set(frame_stats.summary().lossRate());
+        packet_size_gauge->set(packet_size);
+
+        double val_float;
+        int64_t val_int;
+        if (rate_param != nullptr && rate_param->GetValue(val_float).IsOK())
+        {
+            rate->set(val_float);
+        }
+        if (bandwidth_param != nullptr && bandwidth_param->GetValue(val_float).IsOK())
+        {
+            bandwidth->set(val_float);
+        }
+        for (auto& c : counters)
+        {
+            if (c.first->GetValue(val_int).IsOK() && val_int >= 0)
+            {
+                c.second->set(static_cast<uint64_t>(val_int));
+            }
+        }
+    });
 }
 
 DeviceParams Receiver::getDeviceParams()
 {
+    std::lock_guard<std::recursive_mutex> lock(control_mtx);
+
     // If the camera is connected
     if(isConnected())
     {
@@ -105,40 +330,94 @@ DeviceParams Receiver::getDeviceParams()
 
 bool Receiver::isConnected()
 {
-    return device->IsConnected();
+    return device != nullptr && !recovering && device->IsConnected();
 }
 
 bool Receiver::selectDevice()
+{
+    // Try the camera we used last time first, a full discovery waits out
+    // the detection timeout on every interface
+    if (loadDeviceCache() && findCachedDevice())
+    {
+        from_cache = true;
+        return true;
+    }
+
+    from_cache = false;
+    return discoverDevice();
+}
+
+bool Receiver::findCachedDevice()
+{
+    PvSystem system;
+    const PvDeviceInfo *device_info = nullptr;
+
+    system.SetDetectionTimeout(CACHED_DETECTION_TIMEOUT);
+    PvResult result = system.FindDevice(PvString(cached_id.c_str()), &device_info);
+    if (!result.IsOK() || device_info == nullptr || device_info->GetType() != PvDeviceInfoTypeGEV)
+    {
+        std::cout << "Cached device " << cached_id << " not found, discovering" << std::endl;
+        return false;
+    }
+
+    if (!device_info->IsConfigurationValid())
+    {
+        return false;
+    }
+
+    std::cout << "\t" << device_info->GetDisplayID().GetAscii() << " (cached)" << std::endl;
+    connection_id = device_info->GetConnectionID();
+    return true;
+}
+
+bool Receiver::discoverDevice()
 {
     PvResult result;
     PvSystem system;
     const PvDeviceInfo *device_info = nullptr;
+    int best = 0;
 
     system.Find();
 
-    // Detect, select device.
+    // Detect, select device. Prefer the cached device, then a device on the
+    // cached interface, then the first GigE device.
     for (int i = 0; i < system.GetInterfaceCount(); i++)
     {
         // For each detected interface
         const PvInterface* interface = dynamic_cast<const PvInterface *>(system.GetInterface(i));
         if (interface != nullptr)
         {
+            std::string interface_id = interface->GetUniqueID().GetAscii();
+
             // For each detected device
             for (int j = 0; j < interface->GetDeviceCount(); j++)
             {
                 const PvDeviceInfo *di = dynamic_cast<const PvDeviceInfo *>(interface->GetDeviceInfo(j));
                 if (di != nullptr)
                 {
-                    // If the device is GigE compliant, use it
+                    // If the device is GigE compliant, it is a candidate
                     if (di->GetType() == PvDeviceInfoTypeGEV)
                     {
-                        device_info = di;
-                        std::cout << interface->GetDisplayID().GetAscii() << std::endl;
-                        std::cout << "\t" << di->GetDisplayID().GetAscii() << std::endl;
-                        break;
+                        int score = 1;
+                        if (!cached_id.empty() && cached_id == di->GetConnectionID().GetAscii())
+                        {
+                            score = 3;
+                        }
+                        else if (!cached_interface.empty() && cached_interface == interface_id)
+                        {
+                            score = 2;
+                        }
+
+                        if (score > best)
+                        {
+                            best = score;
+                            device_info = di;
+                            device_interface = interface_id;
+                            std::cout << interface->GetDisplayID().GetAscii() << std::endl;
+                            std::cout << "\t" << di->GetDisplayID().GetAscii() << std::endl;
+                        }
                     }
-                
-                }					
+                }
             }
         }
     }
@@ -160,6 +439,42 @@ bool Receiver::selectDevice()
     return false;
 }
 
+bool Receiver::loadDeviceCache()
+{
+    std::ifstream in(DEFAULT_DEVICE_CACHE);
+    std::string line;
+    while (std::getline(in, line))
+    {
+        size_t eq = line.find('=');
+        if (eq == std::string::npos)
+        {
+            continue;
+        }
+
+        std::string key = line.substr(0, eq);
+        if (key == "connection_id")
+        {
+            cached_id = line.substr(eq + 1);
+        }
+        else if (key == "interface")
+        {
+            cached_interface = line.substr(eq + 1);
+        }
+    }
+
+    return !cached_id.empty();
+}
+
+void Receiver::saveDeviceCache()
+{
+    // A cache hit doesn't tell us the interface, keep the one we had
+    std::string interface_id = from_cache ? cached_interface : device_interface;
+
+    std::ofstream out(DEFAULT_DEVICE_CACHE, std::ios::trunc);
+    out << "connection_id=" << connection_id.GetAscii() << std::endl;
+    out << "interface=" << interface_id << std::endl;
+}
+
 bool Receiver::connectToDevice()
 {
     PvResult result;
@@ -171,6 +486,7 @@ bool Receiver::connectToDevice()
     if (!result.IsOK())
     {
         PvDevice::Free(device);
+        device = nullptr;
         return false;
     }
     return true;
@@ -202,6 +518,19 @@ void Receiver::configureStream()
         // Negotiate packet size. Alternatively we could manually set packet size.
        device_gev->NegotiatePacketSize();
 
+        // Needed to count the packets each frame should have had
+        int64_t val;
+        PvGenInteger* size_param = dynamic_cast<PvGenInteger *>(device->GetParameters()->Get("GevSCPSPacketSize"));
+        if (size_param != nullptr && size_param->GetValue(val).IsOK())
+        {
+            packet_size = static_cast<uint32_t>(val);
+            std::cout << "PACKET SIZE: " << packet_size << std::endl;
+            if (display_thread != nullptr)
+            {
+                display_thread->setPacketSize(packet_size);
+            }
+        }
+
         // The streaming destination IP should be the ip of the network adapter on the up-board that the camera is conencted to.
         device_gev->SetStreamDestination(stream_gev->GetLocalIPAddress(), stream_gev->GetLocalPort() );
     }
@@ -319,6 +648,12 @@ void Receiver::startViewFinderMode()
 
 void Receiver::setBinning(bool binning)
 {
+    std::lock_guard<std::recursive_mutex> lock(control_mtx);
+    if (recovering)
+    {
+        return;
+    }
+
     stopAcquisition();
     device->StreamDisable();
     // Read current binning param
@@ -341,6 +676,12 @@ void Receiver::setBinning(bool binning)
 
 void Receiver::setGain(int gain)
 {
+    std::lock_guard<std::recursive_mutex> lock(control_mtx);
+    if (recovering)
+    {
+        return;
+    }
+
     stopAcquisition();
     device->StreamDisable();
     // Read current binning param
@@ -357,6 +698,12 @@ void Receiver::setGain(int gain)
 
 void Receiver::setExposure(int exposure)
 {
+    std::lock_guard<std::recursive_mutex> lock(control_mtx);
+    if (recovering)
+    {
+        return;
+    }
+
     stopAcquisition();
     device->StreamDisable();
     // Read current binning param
@@ -371,6 +718,246 @@ void Receiver::setExposure(int exposure)
     startAcquisition();
 }
 
+void Receiver::setAutoExposure(bool enabled)
+{
+    if (auto_exposure != nullptr)
+    {
+        auto_exposure->setEnabled(enabled);
+    }
+}
+
+bool Receiver::isAutoExposure()
+{
+    return auto_exposure != nullptr && auto_exposure->isEnabled();
+}
+
+void Receiver::OnLinkDisconnected(PvDevice* _device)
+{
+    // Runs on an eBUS thread, the watchdog does the actual recovery
+    std::cout << "Link to device lost" << std::endl;
+    link_lost = true;
+}
+
+bool Receiver::isLinkLost()
+{
+    return link_lost || (device != nullptr && !recovering && !device->IsConnected());
+}
+
+bool Receiver::isRecovering()
+{
+    return recovering;
+}
+
+void Receiver::snapshotSettings()
+{
+    if (!isConnected())
+    {
+        return;
+    }
+
+    CameraSettings current;
+    PvGenFloat* gain_param = dynamic_cast<PvGenFloat *>(params->Get("Gain"));
+    PvGenFloat* exposure_param = dynamic_cast<PvGenFloat *>(params->Get("ExposureTime"));
+    PvGenInteger* bin_param = dynamic_cast<PvGenInteger *>(params->Get("BinningHorizontal"));
+    current.valid = gain_param != nullptr && gain_param->GetValue(current.gain).IsOK() &&
+                    exposure_param != nullptr && exposure_param->GetValue(current.exposure).IsOK() &&
+                    bin_param != nullptr && bin_param->GetValue(current.binning).IsOK();
+
+    if (current.valid)
+    {
+        std::lock_guard<std::mutex> lock(settings_mtx);
+        settings = current;
+    }
+}
+
+void Receiver::restoreSettings()
+{
+    CameraSettings last;
+    {
+        std::lock_guard<std::mutex> lock(settings_mtx);
+        last = settings;
+    }
+    if (!last.valid)
+    {
+        return;
+    }
+
+    // Binning changes the payload size, so it has to go in before the
+    // pipeline is resized
+    PvGenInteger* bin_h = dynamic_cast<PvGenInteger *>(params->Get("BinningHorizontal"));
+    PvGenInteger* bin_v = dynamic_cast<PvGenInteger *>(params->Get("BinningVertical"));
+    PvGenFloat* gain_param = dynamic_cast<PvGenFloat *>(params->Get("Gain"));
+    PvGenFloat* exposure_param = dynamic_cast<PvGenFloat *>(params->Get("ExposureTime"));
+    if (bin_h != nullptr && bin_v != nullptr)
+    {
+        bin_h->SetValue(last.binning);
+        bin_v->SetValue(last.binning);
+    }
+    if (gain_param != nullptr)
+    {
+        gain_param->SetValue(last.gain);
+    }
+    if (exposure_param != nullptr)
+    {
+        exposure_param->SetValue(last.exposure);
+    }
+}
+
+bool Receiver::reconnect()
+{
+    PvDeviceGEV* device_gev = dynamic_cast<PvDeviceGEV *>(device);
+    PvStreamGEV* stream_gev = dynamic_cast<PvStreamGEV *>(stream);
+    if (device_gev == nullptr || stream_gev == nullptr)
+    {
+        return false;
+    }
+
+    // Same objects as before, so the acquisition manager, pipeline and
+    // display thread all stay valid. The camera may have come back on
+    // another address, in which case look it up again.
+    if (!device_gev->Connect(connection_id).IsOK())
+    {
+        if (!selectDevice() || !device_gev->Connect(connection_id).IsOK())
+        {
+            return false;
+        }
+    }
+
+    if (!stream_gev->Open(connection_id).IsOK())
+    {
+        device_gev->Disconnect();
+        return false;
+    }
+
+    return true;
+}
+
+bool Receiver::recover(std::function<bool()> cancelled)
+{
+    static Counter* outages = Metrics::instance().counter("pam_link_outages_total", "Link losses recovered by the watchdog");
+    static Counter* attempts = Metrics::instance().counter("pam_reconnect_attempts_total", "Failed reconnect attempts");
+    static Counter* lost_frames = Metrics::instance().counter("pam_outage_lost_frames_total", "Frames lost to link outages (estimated in viewfinder mode)");
+    static Gauge* last_outage = Metrics::instance().gauge("pam_last_outage_seconds", "Length of the last link outage");
+    static MetricsHistogram* outage_seconds = Metrics::instance().histogram("pam_outage_seconds", "Link outage length",
+        {1.0, 5.0, 10.0, 30.0, 60.0, 300.0, 1800.0});
+
+    auto t_lost = std::chrono::steady_clock::now();
+    std::unique_lock<std::recursive_mutex> control(control_mtx);
+    recovering = true;
+    int resume = getState();
+    setOverlay("Reconnecting", true);
+
+    // Viewfinder rate before the drop, to estimate what was lost
+    double rate = 0.0;
+    PvGenFloat* rate_param = dynamic_cast<PvGenFloat *>(stream->GetParameters()->Get("AcquisitionRate"));
+    if (rate_param != nullptr)
+    {
+        rate_param->GetValue(rate);
+    }
+
+    // Take the link down but keep the pipeline, its buffers stay allocated
+    // and are requeued when it starts again
+    display_thread->Stop(true);
+    pipeline->Stop();
+    stopAcquisition();
+    stream->Close();
+    device->Disconnect();
+
+    // The setters are no-ops meanwhile, so commands don't have to wait out
+    // the outage
+    control.unlock();
+
+    unsigned int tries = 1;
+    while (!reconnect())
+    {
+        attempts->inc();
+        for (int waited = 0; waited < RECONNECT_INTERVAL; waited += 100)
+        {
+            if (cancelled())
+            {
+                // Stay down, but as a plain disconnected receiver: a
+                // recording that was cut off is closed and the state paused
+                control.lock();
+                if (resume == MULTIFRAME)
+                {
+                    auto_exposure->endSequence();
+                    finishSequence();
+                }
+                {
+                    std::lock_guard<std::mutex> lock(state_mtx);
+                    state = PAUSED;
+                }
+                state_cv.notify_all();
+                recovering = false;
+                setOverlay("Disconnected", true);
+                std::cout << "Reconnect cancelled after " << tries << " attempts" << std::endl;
+                return false;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+        tries++;
+    }
+
+    control.lock();
+
+    params = device->GetParameters();
+    auto_exposure->setParameters(params);
+    configureStream();
+    restoreSettings();
+    device->StreamEnable();
+    resetStream();
+    pipeline->Start();
+    display_thread->Start(pipeline, params);
+    display_thread->SetPriority(50);
+
+    link_lost = false;
+    recovering = false;
+
+    // Back to the previous mode. A recording that was cut off can't be
+    // finished, so close it (its missing frames are counted) and pause
+    // until the next one is started.
+    uint64_t lost = 0;
+    if (resume == MULTIFRAME)
+    {
+        auto_exposure->endSequence();
+        if (correlator->isActive())
+        {
+            finishSequence();
+            lost = getLastReport().missing;
+        }
+        {
+            std::lock_guard<std::mutex> lock(state_mtx);
+            state = PAUSED;
+        }
+        state_cv.notify_all();
+        stopAcquisition();
+        setOverlay("Paused", true);
+    }
+    else if (resume == CONTINIOUS)
+    {
+        startViewFinderMode();
+        setOverlay("Viewfinder");
+    }
+    else
+    {
+        setOverlay("Paused", true);
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t_lost).count();
+    if (resume == CONTINIOUS)
+    {
+        lost = static_cast<uint64_t>(rate * seconds + 0.5);
+    }
+
+    outages->inc();
+    lost_frames->inc(lost);
+    last_outage->set(seconds);
+    outage_seconds->observe(seconds);
+    std::cout << "Reconnected after " << seconds << " s (" << tries << " attempts), " << lost << " frames lost" << std::endl;
+
+    return true;
+}
+
 void Receiver::resetStream()
 {
     display_thread->ResetStatistics();
@@ -391,7 +978,11 @@ void Receiver::OnAcquisitionStateChanged(PvDevice* _device, PvStream* _stream, u
         {
             if(state == MULTIFRAME)
             {
-                setState();
+                {
+                    std::lock_guard<std::mutex> lock(sequence_mtx);
+                    sequence_ended = true;
+                }
+                sequence_cv.notify_all();
             }
         }
     }
@@ -399,40 +990,690 @@ void Receiver::OnAcquisitionStateChanged(PvDevice* _device, PvStream* _stream, u
 
 void Receiver::setSavingPath(const std::string& _path)
 {
+    saving_path = _path;
     display_thread->setSavingPath(_path);
+    frame_ring->setPath(_path);
 }
 
-void Receiver::setState()
-{    
-    if(state == PAUSED)
+bool Receiver::setRecordingFormat(int format)
+{
+    if (format == FORMAT_PNG)
     {
-        display_thread->setSaving(false);
-        display_thread->ResetStatistics();
-        pipeline->Reset();
-        startViewFinderMode();
-        state = CONTINIOUS;
-        display_wnd->SetTextOverlay("Viewfinder");
+        session_writer->close();
+        return true;
     }
-    else if (state == MULTIFRAME)
+
+    if (session_writer->isOpen())
     {
-        stopAcquisition();
-        state = PAUSED;
-        display_wnd->SetTextOverlay("Paused");
-        
+        return true;
     }
-    else
-    {
-        startTriggeredMultiFrameMode(5);
-        display_thread->ResetStatistics();
-        pipeline->Reset();
-        display_thread->setSaving(true);
-        
-        state = MULTIFRAME;
-        
-        display_wnd->SetTextOverlay("Recording");
 
-        // Redraw the display to apply the text overlay. This is only necessary 
-        // for multiframe mode where we are waiting for trigger acquisition.
-        display_wnd->Display(display_wnd->GetInternalBuffer());
+    auto micros = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    return session_writer->open(saving_path + "session-" + std::to_string(micros) + ".pam");
+}
+
+bool Receiver::setPreTrigger(bool enabled, size_t megabytes, double pre_seconds, double post_seconds)
+{
+    if (!enabled)
+    {
+        SerialPort::instance().setEventCallback(nullptr);
+        frame_ring->release();
+        return true;
     }
-}
\ No newline at end of file
+
+    // An event at the LED controller (e.g. its trigger input) commits the
+    // ring like the C key does
+    SerialPort::instance().setEventCallback([this](const SerialEvent& e)
+    {
+        std::cout << "Pre-trigger event: " << e.text << std::endl;
+        commitPreTrigger();
+    });
+
+    frame_ring->setWindow(pre_seconds, post_seconds);
+    if (frame_ring->isAllocated())
+    {
+        return true;
+    }
+    std::cout << "Pre-trigger ring of " << megabytes << " MB, " << pre_seconds << " s before and " << post_seconds << " s after" << std::endl;
+    return frame_ring->allocate(megabytes << 20);
+}
+
+bool Receiver::isPreTrigger()
+{
+    return frame_ring->isAllocated();
+}
+
+bool Receiver::commitPreTrigger()
+{
+    if (!frame_ring->commit())
+    {
+        std::cout << "Pre-trigger commit ignored (ring empty, disabled or already committing)" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void Receiver::setFvFmPreview(bool enabled, int palette, float min, float max)
+{
+    std::lock_guard<std::mutex> lock(roi_mtx);
+    fvfm_display = enabled;
+    fvfm_preview->setColorMap(palette, min, max);
+    fvfm_preview->setEnabled(fvfm_display || segment_rois || !roi_mask.isEmpty());
+}
+
+bool Receiver::isFvFmPreview()
+{
+    std::lock_guard<std::mutex> lock(roi_mtx);
+    return fvfm_display;
+}
+
+bool Receiver::setRoiMask(const std::string& file)
+{
+    std::lock_guard<std::mutex> lock(roi_mtx);
+    bool ok = true;
+    if (file.empty())
+    {
+        roi_mask.clear();
+    }
+    else
+    {
+        ok = roi_mask.load(file);
+    }
+
+    // ROIs need the maps even with the preview off
+    fvfm_preview->setEnabled(fvfm_display || segment_rois || !roi_mask.isEmpty());
+    return ok;
+}
+
+void Receiver::setSegmentation(bool enabled)
+{
+    std::lock_guard<std::mutex> lock(roi_mtx);
+    segment_rois = enabled;
+    fvfm_preview->setEnabled(fvfm_display || segment_rois || !roi_mask.isEmpty());
+}
+
+bool Receiver::isSegmentation()
+{
+    std::lock_guard<std::mutex> lock(roi_mtx);
+    return segment_rois;
+}
+
+void Receiver::finishFvFm()
+{
+    static Gauge* queued = Metrics::instance().gauge("pam_analysis_queue", "Recorded sequences waiting for analysis");
+    static Counter* dropped = Metrics::instance().counter("pam_analysis_dropped_total", "Recorded sequences dropped unanalysed because the analysis fell behind");
+
+    bool display;
+    {
+        std::lock_guard<std::mutex> lock(roi_mtx);
+        display = fvfm_display;
+    }
+
+    // The map stays up while paused, the viewfinder draws over it. Induction
+    // and light curve sequences are analysed with the map hidden too.
+    if (!fvfm_preview->isActive() || !display_thread->showFvFm(display))
+    {
+        return;
+    }
+
+    // Everything else runs on the analysis thread, on maps of its own, so the
+    // next sequence can start recording into the preview
+    std::unique_ptr<SequenceAnalysis> job(new SequenceAnalysis());
+    job->points = fvfm_preview->getPoints();
+    job->has_curve = fvfm_preview->takeLightCurve(job->curve);
+    job->saving_path = saving_path;
+    if (!fvfm_preview->takeMaps(job->maps))
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(analysis_mtx);
+    while (analysis_queue.size() >= DEFAULT_ANALYSIS_QUEUE)
+    {
+        std::cout << "Analysis is falling behind, dropped recording " << analysis_queue.front()->maps.recording << std::endl;
+        analysis_queue.pop_front();
+        dropped->inc();
+    }
+    analysis_queue.push_back(std::move(job));
+    queued->set(analysis_queue.size());
+    analysis_cv.notify_all();
+}
+
+void Receiver::runAnalysis()
+{
+    static Gauge* queued = Metrics::instance().gauge("pam_analysis_queue", "Recorded sequences waiting for analysis");
+
+    while (true)
+    {
+        std::unique_ptr<SequenceAnalysis> job;
+        {
+            std::unique_lock<std::mutex> lock(analysis_mtx);
+            analysis_cv.wait(lock, [this]() { return analysis_stop || !analysis_queue.empty(); });
+            if (analysis_queue.empty())
+            {
+                return;
+            }
+            job = std::move(analysis_queue.front());
+            analysis_queue.pop_front();
+            queued->set(analysis_queue.size());
+        }
+        analysis_cv.notify_all();
+        analyse(*job);
+    }
+}
+
+void Receiver::stopAnalysis(unsigned int timeout_ms)
+{
+    static Gauge* queued = Metrics::instance().gauge("pam_analysis_queue", "Recorded sequences waiting for analysis");
+    static Counter* dropped = Metrics::instance().counter("pam_analysis_dropped_total", "Recorded sequences dropped unanalysed because the analysis fell behind");
+
+    if (!analysis_thread.joinable())
+    {
+        return;
+    }
+
+    // Whatever hasn't started by the deadline is dropped, so only the
+    // sequence being analysed holds up the join
+    {
+        std::unique_lock<std::mutex> lock(analysis_mtx);
+        analysis_stop = true;
+        analysis_cv.notify_all();
+        if (!analysis_cv.wait_for(lock, std::chrono::milliseconds(timeout_ms), [this]() { return analysis_queue.empty(); }))
+        {
+            std::cout << "Analysis timed out, " << analysis_queue.size() << " recorded sequences not analysed" << std::endl;
+            dropped->inc(analysis_queue.size());
+            analysis_queue.clear();
+            queued->set(0);
+        }
+    }
+    analysis_thread.join();
+}
+
+void Receiver::analyse(SequenceAnalysis& job)
+{
+    static MetricsHistogram* reduce_ms = Metrics::instance().histogram("pam_roi_reduce_ms", "Time to summarise an Fv/Fm map per region of interest",
+        {1, 2, 5, 10, 20, 50, 100});
+
+    static MetricsHistogram* segment_ms = Metrics::instance().histogram("pam_segment_ms", "Time to segment the Fm frame into plants",
+        {5, 10, 20, 50, 100, 200, 500});
+    static Gauge* segment_regions = Metrics::instance().gauge("pam_segment_regions", "Plants found in the last Fm frame");
+
+    // Only held to copy the settings, so commands aren't kept waiting
+    RoiMask roi_copy;
+    bool segment;
+    {
+        std::lock_guard<std::mutex> lock(roi_mtx);
+        roi_copy = roi_mask;
+        segment = segment_rois;
+    }
+
+    // Induction curves, one line per saturating pulse under actinic light
+    if (!job.points.empty())
+    {
+        std::ofstream out;
+        Tools::appendCsv(out, job.saving_path + "quenching.csv", "wall_time_us,recording,frame,fvfm,phi_psii,qp,ql,npq,valid");
+        for (const QuenchingPoint& p : job.points)
+        {
+            out << p.wall_us << "," << job.maps.recording << "," << p.frame + 1 << "," << job.maps.mean << ","
+                << p.phi_psii << "," << p.qp << "," << p.ql << "," << p.npq << "," << p.valid << "\n";
+        }
+        out.flush();
+    }
+
+    // Rapid light curves, fitted per pixel; label 0 is the mean of those fits
+    if (job.has_curve)
+    {
+        static MetricsHistogram* fit_ms = Metrics::instance().histogram("pam_rlc_fit_ms", "Time to fit a rapid light curve to every pixel",
+            {100, 200, 500, 1000, 2000, 5000, 10000});
+        static Gauge* fit_rate = Metrics::instance().gauge("pam_rlc_pixels_per_second", "Pixels per second of the last light curve fit");
+
+        auto t_fit = std::chrono::steady_clock::now();
+        uint64_t fitted = job.curve.fitPixels();
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t_fit).count();
+        fit_ms->observe(ms);
+        fit_rate->set(job.curve.getPixelsPerSecond());
+
+        LightCurveFit mean_fit = job.curve.getMeanFit();
+        std::cout << "Light curve: alpha " << mean_fit.alpha << ", ETRmax " << mean_fit.etr_max << ", Ik " << mean_fit.ik << " over " << fitted
+                  << " pixels (" << ms << " ms, " << static_cast<uint64_t>(job.curve.getPixelsPerSecond()) << " px/s)" << std::endl;
+        writeLightCurve(job, std::vector<LightCurveFit>(1, mean_fit), 0);
+    }
+
+    if (roi_copy.isEmpty() && !segment)
+    {
+        return;
+    }
+
+    // Plants found in this sequence stand in for the mask file
+    RoiMask* mask = &roi_copy;
+    auto t0 = std::chrono::steady_clock::now();
+    if (segment)
+    {
+        uint32_t regions = job.maps.segment(segmenter, segment_labels);
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+        segment_ms->observe(ms);
+        segment_regions->set(regions);
+        std::cout << "Segmentation: " << regions << " plants above " << segmenter.getLastThreshold() << " in " << ms << " ms" << std::endl;
+        if (regions == 0)
+        {
+            return;
+        }
+
+        uint32_t width = job.maps.width;
+        uint32_t height = job.maps.height;
+        segment_mask.setLabels(segment_labels.data(), width, height);
+        RoiMask::savePgm(job.saving_path + "labels-" + std::to_string(job.maps.recording) + ".pgm", segment_labels.data(), width, height);
+        mask = &segment_mask;
+        t0 = std::chrono::steady_clock::now();
+    }
+
+    std::vector<RoiSummary> rois = job.maps.reduce(*mask, roi_stats);
+    reduce_ms->observe(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count());
+    if (job.has_curve)
+    {
+        const uint16_t* labels = mask->getLabels(job.curve.getWidth(), job.curve.getHeight());
+        writeLightCurve(job, job.curve.fitRegions(labels, mask->getMaxLabel()), 1);
+    }
+    if (rois.empty())
+    {
+        return;
+    }
+
+    // One line per region and sequence, written as each sequence ends
+    const std::vector<float>& percentiles = roi_stats.getPercentiles();
+    std::ostringstream header;
+    header << "wall_time_us,recording,label,count,mean,std,min,max";
+    for (float p : percentiles)
+    {
+        header << ",p" << p;
+    }
+    std::ofstream out;
+    Tools::appendCsv(out, job.saving_path + "roi.csv", header.str());
+
+    auto wall = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    uint32_t recording = job.maps.recording;
+    for (const RoiSummary& roi : rois)
+    {
+        out << wall << "," << recording << "," << roi.label << "," << roi.count << "," << roi.mean << "," << roi.std << ","
+            << roi.min << "," << roi.max;
+        for (float v : roi.percentiles)
+        {
+            out << "," << v;
+        }
+        out << "\n";
+    }
+    out.flush();
+
+    // The same rows in the columnar store for queries over long runs
+    std::string series_file = job.saving_path + "roi.series";
+    if (roi_series.getFile() != series_file)
+    {
+        roi_series.open(series_file);
+    }
+    for (const RoiSummary& roi : rois)
+    {
+        SeriesRow row;
+        row.wall_us = wall;
+        row.roi = roi.label;
+        row.recording = recording;
+        row.count = static_cast<uint32_t>(roi.count);
+        row.mean = static_cast<float>(roi.mean);
+        row.std = static_cast<float>(roi.std);
+        row.min = roi.min;
+        row.max = roi.max;
+        float* p[] = {&row.p10, &row.p50, &row.p90};
+        for (size_t i = 0; i < 3; i++)
+        {
+            *p[i] = (i < roi.percentiles.size()) ? roi.percentiles[i] : std::numeric_limits<float>::quiet_NaN();
+        }
+        row.f0 = static_cast<float>(roi.f0);
+        row.fm = static_cast<float>(roi.fm);
+        roi_series.append(row);
+    }
+    roi_series.flush();
+}
+
+void Receiver::writeLightCurve(const SequenceAnalysis& job, const std::vector<LightCurveFit>& fits, uint32_t first_label)
+{
+    if (fits.empty())
+    {
+        return;
+    }
+
+    std::ofstream out;
+    if (!Tools::appendCsv(out, job.saving_path + "rlc.csv", "wall_time_us,recording,label,alpha,etr_max,ik,rmse"))
+    {
+        return;
+    }
+
+    auto wall = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    for (size_t i = 0; i < fits.size(); i++)
+    {
+        const LightCurveFit& f = fits[i];
+        out << wall << "," << job.maps.recording << "," << first_label + i << ",";
+        if (f.ok)
+        {
+            out << f.alpha << "," << f.etr_max << "," << f.ik << "," << f.rmse << "\n";
+        }
+        else
+        {
+            out << "nan,nan,nan,nan\n";
+        }
+    }
+    out.flush();
+}
+
+int Receiver::addFrameSink(DisplayThread::FrameSink sink)
+{
+    return display_thread->addFrameSink(sink);
+}
+
+void Receiver::removeFrameSink(int id)
+{
+    display_thread->removeFrameSink(id);
+}
+
+bool Receiver::setLiveFeed(bool enabled, const std::string& name)
+{
+    if (live_feed_sink >= 0)
+    {
+        removeFrameSink(live_feed_sink);
+        live_feed_sink = -1;
+    }
+
+    // The display thread may still be in the old sink, which keeps its own
+    // reference to the publisher
+    live_feed.reset();
+    if (!enabled)
+    {
+        return true;
+    }
+
+    std::shared_ptr<ShmPublisher> publisher = std::make_shared<ShmPublisher>(name);
+    live_feed = publisher;
+    live_feed_sink = addFrameSink([publisher](const FrameHandle& frame)
+    {
+        if (frame.data() != nullptr)
+        {
+            frame.countCopy();
+            publisher->publish(frame.header(), frame.data(), frame.size());
+        }
+    });
+    std::cout << "Live feed on " << name << std::endl;
+    return true;
+}
+
+void Receiver::setSequence(const std::string& command)
+{
+    std::vector<SerialCommand> cmds;
+    std::vector<double> triggers;
+    if (Sequence::parse(command, cmds))
+    {
+        triggers = Sequence::triggerTimes(cmds);
+    }
+    std::vector<float> par;
+    for (uint32_t dac : Sequence::actinicLevels(cmds))
+    {
+        par.push_back(Tools::dacIrradiance(dac));
+    }
+    fvfm_preview->setRoles(Sequence::frameRoles(cmds), par);
+
+    if (!triggers.empty() && static_cast<int>(triggers.size()) != frame_count)
+    {
+        std::cout << "Sequence has " << triggers.size() << " triggers but " << frame_count << " frames are expected" << std::endl;
+    }
+
+    correlator->begin(triggers);
+}
+
+SequenceReport Receiver::getLastReport()
+{
+    std::lock_guard<std::mutex> lock(state_mtx);
+    return last_report;
+}
+
+void Receiver::finishSequence()
+{
+    if (!correlator->isActive())
+    {
+        return;
+    }
+
+    // The unlock can overtake the last frames, wait for the display thread
+    // to be through them. A frame that never comes counts as missing.
+    correlator->waitHandled(frame_count, SEQUENCE_DRAIN_TIMEOUT);
+
+    SequenceReport report = correlator->end();
+    {
+        std::lock_guard<std::mutex> lock(state_mtx);
+        last_report = report;
+    }
+
+    std::cout << "Sequence " << (report.valid ? "valid" : "INVALID") << ": " << report.matched << "/" << report.expected
+              << " frames, " << report.missing << " missing, " << report.duplicate << " duplicate, " << report.late
+              << " late, max error " << report.max_error << " ms" << std::endl;
+
+    // One line per sequence next to the images, so invalid ones can be
+    // dropped from analysis
+    std::ofstream out;
+    if (!Tools::appendCsv(out, saving_path + "sequences.csv", "wall_time_us,expected,matched,missing,duplicate,late,unexpected,max_error_ms,valid"))
+    {
+        return;
+    }
+    auto wall = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    out << wall << "," << report.expected << "," << report.matched << "," << report.missing << "," << report.duplicate << ","
+        << report.late << "," << report.unexpected << "," << report.max_error << "," << (report.valid ? 1 : 0) << std::endl;
+}
+
+void Receiver::endSequence()
+{
+    // Recovery closes a sequence it cut off itself
+    std::lock_guard<std::recursive_mutex> lock(control_mtx);
+    if (recovering || getState() != MULTIFRAME)
+    {
+        return;
+    }
+
+    auto_exposure->endSequence();
+    finishSequence();
+    setState();
+
+    // finishSequence() waited for the last frame, so the preview has it
+    finishFvFm();
+
+    // Batched syncs leave the tail of the sequence in flight
+    if (session_writer->isOpen())
+    {
+        session_writer->flush();
+    }
+}
+
+void Receiver::runSequenceThread()
+{
+    std::unique_lock<std::mutex> lock(sequence_mtx);
+    while (true)
+    {
+        sequence_cv.wait(lock, [this]() { return sequence_stop || sequence_ended; });
+        if (!sequence_ended)
+        {
+            return;
+        }
+
+        sequence_ended = false;
+        sequence_busy = true;
+        lock.unlock();
+        endSequence();
+        lock.lock();
+        sequence_busy = false;
+        sequence_cv.notify_all();
+    }
+}
+
+void Receiver::stopSequenceThread()
+{
+    if (!sequence_thread.joinable())
+    {
+        return;
+    }
+
+    // A sequence that just ended is still closed first
+    {
+        std::lock_guard<std::mutex> lock(sequence_mtx);
+        sequence_stop = true;
+    }
+    sequence_cv.notify_all();
+    sequence_thread.join();
+}
+
+bool Receiver::waitForSequenceEnd(unsigned int timeout_ms)
+{
+    std::unique_lock<std::mutex> lock(sequence_mtx);
+    return sequence_cv.wait_for(lock, std::chrono::milliseconds(timeout_ms), [this]() { return !sequence_ended && !sequence_busy; });
+}
+
+void Receiver::setOverlay(const char* text, bool redraw)
+{
+    if (display_thread != nullptr)
+    {
+        display_thread->setOverlay(text, redraw);
+        return;
+    }
+
+#ifndef PAM_HEADLESS
+    if (display_wnd != nullptr)
+    {
+        display_wnd->SetTextOverlay(text);
+        if (redraw)
+        {
+            display_wnd->Display(display_wnd->GetInternalBuffer());
+        }
+    }
+#endif
+}
+
+int Receiver::getState()
+{
+    std::lock_guard<std::mutex> lock(state_mtx);
+    return state;
+}
+
+void Receiver::setFrameCount(int n)
+{
+    if (n > 0)
+    {
+        frame_count = n;
+    }
+}
+
+int Receiver::getFrameCount()
+{
+    return frame_count;
+}
+
+bool Receiver::waitForState(int _state, unsigned int timeout_ms)
+{
+    std::unique_lock<std::mutex> lock(state_mtx);
+    return state_cv.wait_for(lock, std::chrono::milliseconds(timeout_ms), [this, _state]() { return state == _state; });
+}
+
+uint64_t Receiver::getFramesReceived()
+{
+    return (display_thread != nullptr) ? display_thread->getFrameCount() : 0;
+}
+
+std::chrono::steady_clock::time_point Receiver::getStartTime()
+{
+    return start_time;
+}
+
+std::chrono::steady_clock::time_point Receiver::getFirstFrameTime()
+{
+    return display_thread->getFirstFrameTime();
+}
+
+FrameStatsSummary Receiver::getFrameStats(size_t frames)
+{
+    return frame_stats.summary(frames);
+}
+
+std::vector<GvspFrameStats> Receiver::getRecentFrameStats(size_t frames)
+{
+    return frame_stats.recent(frames);
+}
+
+uint32_t Receiver::getPacketSize()
+{
+    return packet_size;
+}
+
+void Receiver::startRecording()
+{
+    static Counter* to_recording = Metrics::instance().counter("pam_state_transitions_total{to=\"recording\"}", "Acquisition state transitions");
+
+    std::lock_guard<std::recursive_mutex> lock(control_mtx);
+    if (recovering)
+    {
+        return;
+    }
+
+    correlator->reset();
+    startTriggeredMultiFrameMode(frame_count);
+    display_thread->ResetStatistics();
+    pipeline->Reset();
+    display_thread->setSaving(true);
+
+    {
+        std::lock_guard<std::mutex> lock(state_mtx);
+        state = MULTIFRAME;
+    }
+    state_cv.notify_all();
+    to_recording->inc();
+
+    // Redraw the display to apply the text overlay. This is only necessary
+    // for multiframe mode where we are waiting for trigger acquisition.
+    setOverlay("Recording", true);
+}
+
+void Receiver::setState()
+{
+    static Counter* to_viewfinder = Metrics::instance().counter("pam_state_transitions_total{to=\"viewfinder\"}", "Acquisition state transitions");
+    static Counter* to_paused = Metrics::instance().counter("pam_state_transitions_total{to=\"paused\"}", "Acquisition state transitions");
+    static Gauge* current = Metrics::instance().gauge("pam_acquisition_state", "Current state (0 viewfinder, 1 recording, 2 paused)");
+
+    std::lock_guard<std::recursive_mutex> control(control_mtx);
+    if (recovering)
+    {
+        return;
+    }
+
+    int next;
+    if(state == PAUSED)
+    {
+        display_thread->setSaving(false);
+        display_thread->ResetStatistics();
+        pipeline->Reset();
+        startViewFinderMode();
+        next = CONTINIOUS;
+        to_viewfinder->inc();
+        setOverlay("Viewfinder");
+    }
+    else if (state == MULTIFRAME)
+    {
+        stopAcquisition();
+        next = PAUSED;
+        to_paused->inc();
+        setOverlay("Paused");
+    }
+    else
+    {
+        startRecording();
+        next = MULTIFRAME;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(state_mtx);
+        state = next;
+    }
+    state_cv.notify_all();
+    current->set(next);
+}
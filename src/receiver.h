@@ -24,6 +24,15 @@
 #include <list>
 #include <iomanip>
 #include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <fstream>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <algorithm>
+#include <deque>
+#include <memory>
 
 // eBUS SDK
 #include <PvSystem.h>
@@ -33,15 +42,42 @@
 #include <PvStreamGEV.h>
 #include <PvBuffer.h>
 #include <PvPipeline.h>
-#include <PvDisplayWnd.h>
 #include <PvAcquisitionStateManager.h>
 
 // project
 #include "displaythread.h"
+#include "autoexposure.h"
+#include "correlator.h"
+#include "sequence.h"
+#include "watchdog.h"
+#include "sessionwriter.h"
+#include "framering.h"
+#include "framestats.h"
+#include "shmpublisher.h"
+#include "roi.h"
+#include "roiseries.h"
+#include "segmentation.h"
+#include "metrics.h"
 #include "tools.h"
 
 // Default software-side params
 #define DEFAULT_BUFFER_COUNT 4
+#define DEFAULT_FRAME_COUNT 5   // Frames per triggered sequence
+#define SEQUENCE_DRAIN_TIMEOUT 200  // (ms) for the display thread to finish the last frames
+
+// Connection ID of the last camera used, tried before a full discovery
+#define DEFAULT_DEVICE_CACHE "device.cache"
+#define CACHED_DETECTION_TIMEOUT 300    // (ms)
+
+// Longest quit() waits for frames still on their way to disk
+#define DEFAULT_DRAIN_TIMEOUT 5000  // (ms)
+
+// Recorded sequences waiting for the analysis thread. When it falls further
+// behind, the oldest is dropped.
+#define DEFAULT_ANALYSIS_QUEUE 4
+
+// Delay between reconnect attempts after the link is lost
+#define RECONNECT_INTERVAL 1000     // (ms)
 
 // Default camera-side params
 #define MIN_GAIN 1
@@ -64,14 +100,46 @@ struct DeviceParams
     std::string height;
 };
 
+// What quit() managed to save before disconnecting
+struct DrainReport
+{
+    uint64_t flushed = 0;   // Frames saved during the drain
+    uint64_t pending = 0;   // Frames still queued when it timed out
+    bool timed_out = false;
+    double ms = 0.0;
+};
+
+// What a finished sequence leaves for the analysis thread: the Fv/Fm map
+// and its frames, the quenching points and the light curve, if complete
+struct SequenceAnalysis
+{
+    FvFmMaps maps;
+    std::vector<QuenchingPoint> points;
+    bool has_curve = false;
+    LightCurve curve;
+    std::string saving_path;
+};
+
+// Last good camera settings, restored after a reconnect
+struct CameraSettings
+{
+    bool valid = false;
+    double gain = 0.0;
+    double exposure = 0.0;
+    int64_t binning = 1;
+};
+
 // Receiver
-class Receiver : public PvAcquisitionStateEventSink
+class Receiver : public PvAcquisitionStateEventSink, public PvDeviceEventSink
 {
     public:
+        // _display_wnd may be null for headless use
         Receiver(PvDisplayWnd* _display_wnd);
         
         // Pulic functions
-        void quit();
+        // Stops acquisition, saves the frames already received and finalizes
+        // the files before disconnecting, giving up after drain_timeout_ms
+        void quit(unsigned int drain_timeout_ms = DEFAULT_DRAIN_TIMEOUT);
         bool isConnected();
         bool selectDevice();
         bool openStream();
@@ -90,13 +158,90 @@ class Receiver : public PvAcquisitionStateEventSink
         void setExposure(int);
         void setBinning(bool);
         void setGain(int);
+        void setAutoExposure(bool);
+        bool isAutoExposure();
         
         void resetStream();
         bool isMultiFrame();
         void startViewFinderMode();
         void setSavingPath(const std::string& _path);
+
+        // PNG per frame, or all frames in one session file in the saving path
+        bool setRecordingFormat(int format);
+
+        // Keeps the last pre_seconds of viewfinder frames in a RAM ring of
+        // megabytes. commitPreTrigger() writes them, plus the next
+        // post_seconds, to a session file in the saving path.
+        bool setPreTrigger(bool enabled, size_t megabytes = DEFAULT_RING_MB, double pre_seconds = DEFAULT_RING_PRE, double post_seconds = DEFAULT_RING_POST);
+        bool isPreTrigger();
+        bool commitPreTrigger();
+
+        // Every retrieved frame, shared with display and saving without a
+        // copy. See framehandle.h.
+        int addFrameSink(DisplayThread::FrameSink sink);
+        void removeFrameSink(int id);
+
+        // False colour Fv/Fm map of each sequence, shown on the display when
+        // it ends (see fvfmpreview.h). Palettes are ColorMap::PALETTES.
+        void setFvFmPreview(bool enabled, int palette = ColorMap::PALETTE_PAM, float min = DEFAULT_FVFM_MIN, float max = DEFAULT_FVFM_MAX);
+        bool isFvFmPreview();
+
+        // Per region Fv/Fm of each sequence, appended to roi.csv and
+        // roi.series (see roiseries.h) in the saving path (mask file format
+        // in roi.h). An empty file clears it.
+        bool setRoiMask(const std::string& file);
+
+        // Finds the plants in each sequence's Fm frame and uses them as the
+        // ROIs instead of the mask file. The label image is saved next to
+        // roi.csv as labels-<recording>.pgm (see segmentation.h).
+        void setSegmentation(bool enabled);
+        bool isSegmentation();
+
+        // Publishes every frame to a shared memory ring for local readers
+        // (see shmfeed.h)
+        bool setLiveFeed(bool enabled, const std::string& name = DEFAULT_SHM_NAME);
         DeviceParams getDeviceParams();
         void setState();    // Cycles between Paused, viewfinder and multi
+        void startRecording();
+        int getState();
+        void setFrameCount(int n);
+        int getFrameCount();
+
+        // LED command string of the next triggered sequence. Its camera
+        // triggers are what the recorded frames are checked against, and
+        // its LED states tell the Fv/Fm preview which frame is which.
+        void setSequence(const std::string& command);
+        SequenceReport getLastReport();
+
+        // Link recovery, driven by the watchdog. recover() blocks until the
+        // device is back or cancelled() returns true, in which case the
+        // receiver is left disconnected and paused. Taking the link down and
+        // bringing it back up hold the control lock, and the state machine
+        // and camera setters do nothing while it is down.
+        bool isLinkLost();
+        bool isRecovering();
+        void snapshotSettings();
+        bool recover(std::function<bool()> cancelled);
+
+        // Blocks until the state machine reaches _state. Returns false on timeout.
+        bool waitForState(int _state, unsigned int timeout_ms);
+
+        // Frames retrieved so far, and startup/first frame timing
+        uint64_t getFramesReceived();
+        std::chrono::steady_clock::time_point getStartTime();
+        std::chrono::steady_clock::time_point getFirstFrameTime();
+
+        // Packet statistics of the last frames (see framestats.h), and the
+        // packet size negotiated with the camera
+        FrameStatsSummary getFrameStats(size_t frames = DEFAULT_FRAME_STATS_WINDOW);
+        std::vector<GvspFrameStats> getRecentFrameStats(size_t frames = DEFAULT_FRAME_STATS);
+        uint32_t getPacketSize();
+
+        enum FORMATS
+        {
+            FORMAT_PNG,
+            FORMAT_SESSION
+        };
 
         // States
         enum STATES
@@ -106,13 +251,41 @@ class Receiver : public PvAcquisitionStateEventSink
             PAUSED            
         };
 
+    private:
+        void registerMetrics();
+        void setOverlay(const char* text, bool redraw = false);
+        void finishSequence();
+        void endSequence();
+        void runSequenceThread();
+        void stopSequenceThread();
+        bool waitForSequenceEnd(unsigned int timeout_ms);
+        void finishFvFm();
+        void runAnalysis();
+        void analyse(SequenceAnalysis& job);
+        void stopAnalysis(unsigned int timeout_ms);
+        void writeLightCurve(const SequenceAnalysis& job, const std::vector<LightCurveFit>& fits, uint32_t first_label);
+        DrainReport drain(unsigned int timeout_ms);
+        bool findCachedDevice();
+        bool discoverDevice();
+        bool loadDeviceCache();
+        void saveDeviceCache();
+        bool reconnect();
+        void restoreSettings();
+
     protected:
         // Callback when acquisition state has changed. This function in inherited from PvAcquisitionStateEventSink.
         void OnAcquisitionStateChanged(PvDevice* _device, PvStream* _stream, uint32_t _source, PvAcquisitionState _state );
 
+        // Called by eBUS when the control channel heartbeat fails. Inherited from PvDeviceEventSink.
+        void OnLinkDisconnected(PvDevice* _device);
+
     private:
         // Reciever will own a device, connection, stream and pipeline
         PvString connection_id;
+        std::string cached_id;
+        std::string cached_interface;
+        std::string device_interface;
+        bool from_cache;
         PvDevice* device;
         PvStream* stream;
         PvPipeline* pipeline;
@@ -122,9 +295,62 @@ class Receiver : public PvAcquisitionStateEventSink
         PvGenParameterArray* params;    // Actual device params
         DeviceParams device_params;     // Struct with some params for populating gui
         PvAcquisitionStateManager* acquisition_manager;
+        AutoExposure* auto_exposure;
+        FrameCorrelator* correlator;
+        SequenceReport last_report;
+        std::string saving_path;
+        Watchdog* watchdog;
+        SessionWriter* session_writer;
+        FrameRing* frame_ring;
+        FrameStatsRing frame_stats;
+        std::atomic<uint32_t> packet_size;
+        FvFmPreview* fvfm_preview;
+        bool fvfm_display;
+        RoiMask roi_mask;
+        RoiStats roi_stats;
+        bool segment_rois;
+        Segmenter segmenter;
+        RoiMask segment_mask;
+        std::vector<uint16_t> segment_labels;
+        SeriesWriter roi_series;
+        std::mutex roi_mtx;
+
+        // The per region, segmentation and light curve work of each sequence
+        // runs here, off the acquisition state callback. The segmenter, ROI
+        // statistics and series writer belong to this thread.
+        std::thread analysis_thread;
+        std::mutex analysis_mtx;
+        std::condition_variable analysis_cv;
+        std::deque<std::unique_ptr<SequenceAnalysis>> analysis_queue;
+        bool analysis_stop;
+
+        // Closes a sequence once the camera unlocks, so the eBUS callback
+        // isn't kept waiting for the display thread to finish its last frames
+        std::thread sequence_thread;
+        std::mutex sequence_mtx;
+        std::condition_variable sequence_cv;
+        bool sequence_ended;    // Unlocked and not closed yet
+        bool sequence_busy;
+        bool sequence_stop;
+        std::shared_ptr<ShmPublisher> live_feed;
+        int live_feed_sink;
+        CameraSettings settings;
+        std::mutex settings_mtx;
+        std::atomic<bool> link_lost;
+        std::atomic<bool> recovering;
+
+        // Held by whatever reconfigures the camera, stream or display: the
+        // state machine, the camera setters and link recovery, which run on
+        // the GUI, controller, scheduler and watchdog threads
+        std::recursive_mutex control_mtx;
 
         std::mutex mtx;
+        std::mutex state_mtx;
+        std::condition_variable state_cv;
         int state;
+        int frame_count;
+        std::chrono::steady_clock::time_point start_time;
+        int metrics_collector;
     };
 
 
@@ -0,0 +1,201 @@
+#include "recording.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+RecordingReader::RecordingReader() :
+    fd(-1),
+    base(nullptr),
+    length(0),
+    created_us(0)
+{
+
+}
+
+RecordingReader::~RecordingReader()
+{
+    close();
+}
+
+bool RecordingReader::open(const std::string& file)
+{
+    close();
+
+    fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(SessionHeader))
+    {
+        std::cout << "RecordingReader: unable to open " << file << std::endl;
+        close();
+        return false;
+    }
+
+    length = st.st_size;
+    void* p = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED)
+    {
+        std::cout << "RecordingReader: unable to map " << file << ": " << strerror(errno) << std::endl;
+        length = 0;
+        close();
+        return false;
+    }
+    base = static_cast<uint8_t*>(p);
+
+    // Read ahead aggressively, the whole file is usually wanted
+    madvise(base, length, MADV_SEQUENTIAL);
+    madvise(base, length, MADV_WILLNEED);
+
+    const SessionHeader* header = reinterpret_cast<const SessionHeader*>(base);
+    if (header->magic != SESSION_MAGIC || header->version != SESSION_VERSION || header->header_size > length)
+    {
+        std::cout << "RecordingReader: " << file << " is not a session file" << std::endl;
+        close();
+        return false;
+    }
+    created_us = header->created_us;
+
+    // Records run back to back until the zeros left by a crash, or the end
+    uint64_t offset = header->header_size;
+    while (offset + sizeof(FrameHeader) <= length)
+    {
+        const FrameHeader* frame = reinterpret_cast<const FrameHeader*>(base + offset);
+        if (frame->magic != FRAME_MAGIC || frame->record_size < sizeof(FrameHeader) + frame->data_size ||
+            offset + frame->record_size > length)
+        {
+            break;
+        }
+        offsets.push_back(offset);
+        offset += frame->record_size;
+    }
+
+    return true;
+}
+
+void RecordingReader::close()
+{
+    if (base != nullptr)
+    {
+        munmap(base, length);
+    }
+    if (fd >= 0)
+    {
+        ::close(fd);
+    }
+    base = nullptr;
+    length = 0;
+    fd = -1;
+    created_us = 0;
+    offsets.clear();
+}
+
+bool RecordingReader::isOpen()
+{
+    return base != nullptr;
+}
+
+int64_t RecordingReader::getCreated()
+{
+    return created_us;
+}
+
+size_t RecordingReader::getFrameCount()
+{
+    return offsets.size();
+}
+
+const FrameHeader* RecordingReader::getHeader(size_t i)
+{
+    if (i >= offsets.size())
+    {
+        return nullptr;
+    }
+    return reinterpret_cast<const FrameHeader*>(base + offsets[i]);
+}
+
+const uint8_t* RecordingReader::getData(size_t i)
+{
+    if (i >= offsets.size())
+    {
+        return nullptr;
+    }
+    return base + offsets[i] + sizeof(FrameHeader);
+}
+
+ImageView RecordingReader::getImage(size_t i)
+{
+    ImageView image;
+    const FrameHeader* header = getHeader(i);
+    if (header == nullptr)
+    {
+        return image;
+    }
+
+    image.data = getData(i);
+    image.width = header->width;
+    image.height = header->height;
+    image.stride = header->stride;
+
+    // Unknown formats are guessed from the row size
+    image.bits = header->bits;
+    if (image.bits == 0)
+    {
+        image.bits = (header->stride >= header->width * 2) ? 16 : 8;
+    }
+
+    // Don't let a bad header point past the record
+    if (static_cast<uint64_t>(image.stride) * image.height > header->data_size ||
+        image.stride < image.width * image.bytesPerPixel())
+    {
+        image.data = nullptr;
+    }
+    return image;
+}
+
+std::vector<uint32_t> RecordingReader::getRecordings()
+{
+    std::vector<uint32_t> recordings;
+    for (size_t i = 0; i < offsets.size(); i++)
+    {
+        uint32_t recording = getHeader(i)->recording;
+        if (std::find(recordings.begin(), recordings.end(), recording) == recordings.end())
+        {
+            recordings.push_back(recording);
+        }
+    }
+    return recordings;
+}
+
+std::vector<size_t> RecordingReader::getFrames(uint32_t recording)
+{
+    std::vector<size_t> frames;
+    for (size_t i = 0; i < offsets.size(); i++)
+    {
+        if (getHeader(i)->recording == recording)
+        {
+            frames.push_back(i);
+        }
+    }
+    return frames;
+}
+
+bool RecordingReader::getPamFrames(uint32_t recording, size_t& f0, size_t& fm)
+{
+    std::vector<size_t> frames = getFrames(recording);
+    if (frames.size() < 2)
+    {
+        return false;
+    }
+
+    std::vector<ImageView> images;
+    for (size_t i : frames)
+    {
+        images.push_back(getImage(i));
+    }
+    f0 = frames[0];
+    fm = frames[Fluorescence::brightest(images)];
+    return fm != f0;
+}
@@ -0,0 +1,56 @@
+// *****************************************************************************
+//
+// recording.h
+// Reads session files written by SessionWriter. The file is memory mapped and
+// only the record headers are read up front. Frame data is handed out as
+// pointers into the mapping, so nothing is decoded or copied.
+//
+// Frames are grouped by their recording number. One recording is one PAM
+// sequence: the first frame is F0 and the brightest is Fm.
+//
+// *****************************************************************************
+
+
+#ifndef __RECORDING_H__
+#define __RECORDING_H__
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "sessionwriter.h"
+#include "fluorescence.h"
+
+class RecordingReader
+{
+    public:
+        RecordingReader();
+        ~RecordingReader();
+
+        bool open(const std::string& file);
+        void close();
+        bool isOpen();
+
+        int64_t getCreated();
+        size_t getFrameCount();
+        const FrameHeader* getHeader(size_t i);
+        const uint8_t* getData(size_t i);
+        ImageView getImage(size_t i);
+
+        // Recording numbers in file order, and the frames of one of them
+        std::vector<uint32_t> getRecordings();
+        std::vector<size_t> getFrames(uint32_t recording);
+
+        // F0 and Fm frames of a recording. False if it has fewer than two.
+        bool getPamFrames(uint32_t recording, size_t& f0, size_t& fm);
+
+    private:
+        int fd;
+        uint8_t* base;
+        size_t length;
+        int64_t created_us;
+        std::vector<uint64_t> offsets;  // Record offsets in the file
+};
+
+
+#endif // __RECORDING_H__
@@ -0,0 +1,529 @@
+#include "roi.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <thread>
+
+RoiMask::RoiMask() :
+    fixed_width(0), fixed_height(0), width(0), height(0), dirty(true), max_label(0)
+{
+
+}
+
+bool RoiMask::load(const std::string& file)
+{
+    std::ifstream in(file);
+    if (!in.good())
+    {
+        std::cout << "RoiMask: unable to open " << file << std::endl;
+        return false;
+    }
+
+    clear();
+    std::string line;
+    int line_number = 0;
+    while (std::getline(in, line))
+    {
+        line_number++;
+        std::istringstream ss(line);
+        std::string kind;
+        if (!(ss >> kind) || kind[0] == '#')
+        {
+            continue;
+        }
+
+        bool ok = false;
+        if (kind == "labels")
+        {
+            // Relative to the mask file
+            std::string path;
+            ss >> path;
+            size_t slash = file.find_last_of('/');
+            if (!path.empty() && path[0] != '/' && slash != std::string::npos)
+            {
+                path = file.substr(0, slash + 1) + path;
+            }
+            ok = !path.empty() && loadPgm(path);
+        }
+        else
+        {
+            int label = 0;
+            std::vector<float> xy;
+            float v;
+            ss >> label;
+            while (ss >> v)
+            {
+                xy.push_back(v);
+            }
+
+            if (label > 0 && label <= std::numeric_limits<uint16_t>::max())
+            {
+                if (kind == "rect" && xy.size() == 4)
+                {
+                    addRect(label, xy[0], xy[1], xy[2], xy[3]);
+                    ok = true;
+                }
+                else if (kind == "poly" && xy.size() >= 6 && xy.size() % 2 == 0)
+                {
+                    addPolygon(label, xy);
+                    ok = true;
+                }
+            }
+        }
+
+        if (!ok)
+        {
+            std::cout << "RoiMask: bad line " << line_number << " in " << file << ": " << line << std::endl;
+            clear();
+            return false;
+        }
+    }
+
+    std::cout << "RoiMask: " << shapes.size() << " shapes" << (fixed.empty() ? "" : " and a label image") << " from " << file << std::endl;
+    return true;
+}
+
+bool RoiMask::loadPgm(const std::string& file)
+{
+    std::ifstream in(file, std::ios::binary);
+    std::string magic;
+    uint32_t w = 0, h = 0, maxval = 0;
+    in >> magic;
+
+    // Header fields may be separated by comments
+    auto field = [&in](uint32_t& value)
+    {
+        in >> std::ws;
+        while (in.peek() == '#')
+        {
+            std::string comment;
+            std::getline(in, comment);
+            in >> std::ws;
+        }
+        in >> value;
+    };
+    field(w);
+    field(h);
+    field(maxval);
+    in.get();
+
+    if (!in.good() || magic != "P5" || w == 0 || h == 0 || maxval == 0 || maxval > 65535)
+    {
+        std::cout << "RoiMask: " << file << " is not a binary PGM" << std::endl;
+        return false;
+    }
+
+    size_t pixels = static_cast<size_t>(w) * h;
+    size_t bytes = (maxval > 255) ? 2 : 1;
+    std::vector<uint8_t> raw(pixels * bytes);
+    if (!in.read(reinterpret_cast<char*>(raw.data()), raw.size()))
+    {
+        std::cout << "RoiMask: " << file << " is truncated" << std::endl;
+        return false;
+    }
+
+    // 16 bit PGM is big endian
+    fixed.resize(pixels);
+    for (size_t i = 0; i < pixels; i++)
+    {
+        fixed[i] = (bytes == 2) ? (raw[2 * i] << 8 | raw[2 * i + 1]) : raw[i];
+    }
+    fixed_width = w;
+    fixed_height = h;
+    dirty = true;
+    return true;
+}
+
+bool RoiMask::savePgm(const std::string& file, const uint16_t* labels, uint32_t width, uint32_t height)
+{
+    std::ofstream out(file, std::ios::binary);
+    out << "P5\n" << width << " " << height << "\n65535\n";
+
+    std::vector<uint8_t> raw(static_cast<size_t>(width) * height * 2);
+    for (size_t i = 0; i < raw.size() / 2; i++)
+    {
+        raw[2 * i] = labels[i] >> 8;
+        raw[2 * i + 1] = labels[i] & 0xff;
+    }
+    out.write(reinterpret_cast<const char*>(raw.data()), raw.size());
+    if (!out.good())
+    {
+        std::cout << "RoiMask: unable to write " << file << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void RoiMask::clear()
+{
+    shapes.clear();
+    fixed.clear();
+    fixed_width = fixed_height = 0;
+    labels.clear();
+    max_label = 0;
+    dirty = true;
+}
+
+bool RoiMask::isEmpty()
+{
+    return shapes.empty() && fixed.empty();
+}
+
+void RoiMask::addRect(uint16_t label, int32_t x, int32_t y, int32_t _width, int32_t _height)
+{
+    Shape shape;
+    shape.label = label;
+    shape.rect = true;
+    shape.xy = {static_cast<float>(x), static_cast<float>(y), static_cast<float>(_width), static_cast<float>(_height)};
+    shapes.push_back(shape);
+    dirty = true;
+}
+
+void RoiMask::addPolygon(uint16_t label, const std::vector<float>& xy)
+{
+    Shape shape;
+    shape.label = label;
+    shape.rect = false;
+    shape.xy = xy;
+    shapes.push_back(shape);
+    dirty = true;
+}
+
+void RoiMask::setLabels(const uint16_t* _labels, uint32_t _width, uint32_t _height)
+{
+    clear();
+    fixed.assign(_labels, _labels + static_cast<size_t>(_width) * _height);
+    fixed_width = _width;
+    fixed_height = _height;
+}
+
+const uint16_t* RoiMask::getLabels(uint32_t _width, uint32_t _height)
+{
+    if (!fixed.empty() && (fixed_width != _width || fixed_height != _height))
+    {
+        return nullptr;
+    }
+
+    if (dirty || width != _width || height != _height)
+    {
+        rasterize(_width, _height);
+    }
+    return labels.data();
+}
+
+uint16_t RoiMask::getMaxLabel()
+{
+    return max_label;
+}
+
+void RoiMask::rasterize(uint32_t _width, uint32_t _height)
+{
+    width = _width;
+    height = _height;
+    if (fixed.empty())
+    {
+        labels.assign(static_cast<size_t>(width) * height, 0);
+    }
+    else
+    {
+        labels = fixed;
+    }
+
+    for (const Shape& shape : shapes)
+    {
+        if (!shape.rect)
+        {
+            fillPolygon(shape);
+            continue;
+        }
+
+        int64_t x0 = std::max<int64_t>(0, shape.xy[0]);
+        int64_t y0 = std::max<int64_t>(0, shape.xy[1]);
+        int64_t x1 = std::min<int64_t>(width, static_cast<int64_t>(shape.xy[0]) + static_cast<int64_t>(shape.xy[2]));
+        int64_t y1 = std::min<int64_t>(height, static_cast<int64_t>(shape.xy[1]) + static_cast<int64_t>(shape.xy[3]));
+        for (int64_t y = y0; y < y1; y++)
+        {
+            std::fill(labels.begin() + y * width + x0, labels.begin() + y * width + std::max(x0, x1), shape.label);
+        }
+    }
+
+    max_label = labels.empty() ? 0 : *std::max_element(labels.begin(), labels.end());
+    dirty = false;
+}
+
+void RoiMask::fillPolygon(const Shape& shape)
+{
+    // Even-odd fill of the pixels whose centres are inside
+    const std::vector<float>& xy = shape.xy;
+    size_t n = xy.size() / 2;
+    float min_y = xy[1], max_y = xy[1];
+    for (size_t i = 1; i < n; i++)
+    {
+        min_y = std::min(min_y, xy[2 * i + 1]);
+        max_y = std::max(max_y, xy[2 * i + 1]);
+    }
+
+    int64_t y0 = std::max<int64_t>(0, static_cast<int64_t>(std::floor(min_y)));
+    int64_t y1 = std::min<int64_t>(height, static_cast<int64_t>(std::ceil(max_y)) + 1);
+    std::vector<float> crossings;
+    for (int64_t y = y0; y < y1; y++)
+    {
+        float yc = y + 0.5f;
+        crossings.clear();
+        for (size_t i = 0, j = n - 1; i < n; j = i++)
+        {
+            float xi = xy[2 * i], yi = xy[2 * i + 1];
+            float xj = xy[2 * j], yj = xy[2 * j + 1];
+            if ((yi <= yc) != (yj <= yc))
+            {
+                crossings.push_back(xi + (yc - yi) * (xj - xi) / (yj - yi));
+            }
+        }
+        std::sort(crossings.begin(), crossings.end());
+
+        for (size_t k = 0; k + 1 < crossings.size(); k += 2)
+        {
+            int64_t x0 = std::max<int64_t>(0, static_cast<int64_t>(std::ceil(crossings[k] - 0.5f)));
+            int64_t x1 = std::min<int64_t>(width, static_cast<int64_t>(std::ceil(crossings[k + 1] - 0.5f)));
+            for (int64_t x = x0; x < x1; x++)
+            {
+                labels[y * width + x] = shape.label;
+            }
+        }
+    }
+}
+
+RoiStats::RoiStats(uint32_t _bins) :
+    min(0.0f), max(0.0f), bins(std::max<uint32_t>(1, _bins)), hist_bins(bins), threads(0), percentiles({10.0f, 50.0f, 90.0f})
+{
+
+}
+
+void RoiStats::setPercentiles(const std::vector<float>& _percentiles)
+{
+    percentiles = _percentiles;
+}
+
+const std::vector<float>& RoiStats::getPercentiles()
+{
+    return percentiles;
+}
+
+void RoiStats::setThreads(unsigned int _threads)
+{
+    threads = _threads;
+}
+
+void RoiStats::range(const float* map, const uint16_t* labels, uint32_t width, uint32_t height, uint32_t stride, uint16_t max_label)
+{
+    float lo = std::numeric_limits<float>::infinity();
+    float hi = -std::numeric_limits<float>::infinity();
+    for (uint32_t y = 0; y < height; y++)
+    {
+        const float* row = map + static_cast<size_t>(y) * stride;
+        const uint16_t* label_row = labels + static_cast<size_t>(y) * width;
+        for (uint32_t x = 0; x < width; x++)
+        {
+            float v = row[x];
+            if (label_row[x] != 0 && label_row[x] <= max_label && v == v)
+            {
+                lo = (v < lo) ? v : lo;
+                hi = (v > hi) ? v : hi;
+            }
+        }
+    }
+
+    // Nothing labelled leaves every count at 0, the range doesn't matter
+    min = (lo <= hi) ? lo : 0.0f;
+    max = (lo <= hi) ? hi : 0.0f;
+}
+
+void RoiStats::reduceRows(const float* map, const uint16_t* labels, uint32_t width, uint32_t stride, uint32_t y0, uint32_t y1, Accumulator& acc)
+{
+    const uint32_t labels_n = acc.count.size();
+    const float scale = (max > min) ? hist_bins / (max - min) : 0.0f;
+    const float top = static_cast<float>(hist_bins - 1);
+
+    // Raw pointers, or the compiler reloads every vector after each store
+    uint64_t* count = acc.count.data();
+    double* sum = acc.sum.data();
+    double* sum_sq = acc.sum_sq.data();
+    float* lo = acc.min.data();
+    float* hi = acc.max.data();
+    uint32_t* hist = acc.hist.data();
+
+    // Labels come in runs along a row. Each run is summed in registers, so
+    // the per label totals are only touched once per run.
+    uint32_t* run_hist = nullptr;
+    for (uint32_t y = y0; y < y1; y++)
+    {
+        const float* row = map + static_cast<size_t>(y) * stride;
+        const uint16_t* label_row = labels + static_cast<size_t>(y) * width;
+        uint32_t x = 0;
+        while (x < width)
+        {
+            uint32_t l = label_row[x];
+            uint32_t end = x + 1;
+            while (end < width && label_row[end] == l)
+            {
+                end++;
+            }
+            if (l == 0 || l >= labels_n)
+            {
+                x = end;
+                continue;
+            }
+
+            run_hist = hist + static_cast<size_t>(l) * hist_bins;
+            uint64_t n = 0;
+            double s = 0.0, s2 = 0.0;
+            float run_lo = lo[l], run_hi = hi[l];
+            for (; x < end; x++)
+            {
+                float v = row[x];
+                if (v != v)
+                {
+                    continue;
+                }
+
+                n++;
+                s += v;
+                s2 += static_cast<double>(v) * v;
+                run_lo = (v < run_lo) ? v : run_lo;
+                run_hi = (v > run_hi) ? v : run_hi;
+
+                float b = (v - min) * scale;
+                b = (b > 0.0f) ? b : 0.0f;
+                b = (b < top) ? b : top;
+                run_hist[static_cast<uint32_t>(b)]++;
+            }
+            count[l] += n;
+            sum[l] += s;
+            sum_sq[l] += s2;
+            lo[l] = run_lo;
+            hi[l] = run_hi;
+        }
+    }
+}
+
+float RoiStats::percentile(const uint32_t* hist, uint64_t count, float p, float lo, float hi)
+{
+    // Linear within the bin that holds the rank
+    double rank = std::min(1.0, std::max(0.0, p / 100.0)) * count;
+    double width = (max - min) / hist_bins;
+    uint64_t below = 0;
+    for (uint32_t b = 0; b < hist_bins; b++)
+    {
+        if (hist[b] > 0 && below + hist[b] >= rank)
+        {
+            double v = min + (b + (rank - below) / hist[b]) * width;
+            return std::min(hi, std::max(lo, static_cast<float>(v)));
+        }
+        below += hist[b];
+    }
+    return hi;
+}
+
+std::vector<RoiSummary> RoiStats::reduce(const float* map, const uint16_t* labels, uint32_t width, uint32_t height, uint32_t stride, uint16_t max_label)
+{
+    std::vector<RoiSummary> summaries;
+    if (map == nullptr || labels == nullptr || max_label == 0)
+    {
+        return summaries;
+    }
+
+    uint32_t tiles = (height + DEFAULT_ROI_TILE_ROWS - 1) / DEFAULT_ROI_TILE_ROWS;
+    unsigned int workers = (threads > 0) ? threads : std::max(1u, std::thread::hardware_concurrency());
+    workers = std::max(1u, std::min(workers, tiles));
+
+    const uint32_t labels_n = max_label + 1u;
+
+    // Full resolution with fewer workers first, then fewer bins
+    const size_t budget = (static_cast<size_t>(DEFAULT_ROI_HIST_MB) << 20) / sizeof(uint32_t);
+    size_t per_worker = std::max<size_t>(1, budget / (static_cast<size_t>(labels_n) * bins));
+    workers = static_cast<unsigned int>(std::min<size_t>(workers, per_worker));
+    hist_bins = static_cast<uint32_t>(std::max<size_t>(1, std::min<size_t>(bins, budget / (static_cast<size_t>(labels_n) * workers))));
+
+    range(map, labels, width, height, stride, max_label);
+
+    std::vector<Accumulator> accs(workers);
+    for (Accumulator& acc : accs)
+    {
+        acc.count.assign(labels_n, 0);
+        acc.sum.assign(labels_n, 0.0);
+        acc.sum_sq.assign(labels_n, 0.0);
+        acc.min.assign(labels_n, std::numeric_limits<float>::infinity());
+        acc.max.assign(labels_n, -std::numeric_limits<float>::infinity());
+        acc.hist.assign(static_cast<size_t>(labels_n) * hist_bins, 0);
+    }
+
+    // Workers take bands of rows until none are left
+    std::atomic<uint32_t> next(0);
+    auto work = [&](unsigned int w)
+    {
+        uint32_t tile;
+        while ((tile = next++) < tiles)
+        {
+            uint32_t y0 = tile * DEFAULT_ROI_TILE_ROWS;
+            reduceRows(map, labels, width, stride, y0, std::min(height, y0 + DEFAULT_ROI_TILE_ROWS), accs[w]);
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (unsigned int w = 1; w < workers; w++)
+    {
+        pool.emplace_back(work, w);
+    }
+    work(0);
+    for (std::thread& t : pool)
+    {
+        t.join();
+    }
+
+    // Merge into the first accumulator
+    Accumulator& total = accs[0];
+    for (unsigned int w = 1; w < workers; w++)
+    {
+        const Accumulator& acc = accs[w];
+        for (uint32_t l = 1; l < labels_n; l++)
+        {
+            total.count[l] += acc.count[l];
+            total.sum[l] += acc.sum[l];
+            total.sum_sq[l] += acc.sum_sq[l];
+            total.min[l] = std::min(total.min[l], acc.min[l]);
+            total.max[l] = std::max(total.max[l], acc.max[l]);
+        }
+        for (size_t i = hist_bins; i < total.hist.size(); i++)
+        {
+            total.hist[i] += acc.hist[i];
+        }
+    }
+
+    for (uint32_t l = 1; l < labels_n; l++)
+    {
+        RoiSummary s;
+        s.label = l;
+        s.count = total.count[l];
+        if (s.count > 0)
+        {
+            s.mean = total.sum[l] / s.count;
+            s.std = std::sqrt(std::max(0.0, total.sum_sq[l] / s.count - s.mean * s.mean));
+            s.min = total.min[l];
+            s.max = total.max[l];
+            for (float p : percentiles)
+            {
+                s.percentiles.push_back(percentile(&total.hist[static_cast<size_t>(l) * hist_bins], s.count, p, s.min, s.max));
+            }
+        }
+        else
+        {
+            s.percentiles.assign(percentiles.size(), std::numeric_limits<float>::quiet_NaN());
+        }
+        summaries.push_back(s);
+    }
+    return summaries;
+}
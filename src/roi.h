@@ -0,0 +1,142 @@
+// *****************************************************************************
+//
+// roi.h
+// Regions of interest (leaves, plants) and per region statistics of a map.
+//
+// RoiMask turns shapes into a label image: every pixel holds the label of the
+// region it belongs to, 0 for none. Shapes are rectangles and polygons in
+// pixel coordinates, drawn in order so later ones cover earlier ones, or a
+// ready made label image (8 or 16 bit binary PGM) from a segmentation tool.
+// A mask file has one shape per line:
+//
+//     # label  x y width height
+//     rect 1   120 80 300 200
+//     # label  x1 y1 x2 y2 ...
+//     poly 2   500 100 640 120 600 300
+//     labels leaves.pgm
+//
+// RoiStats reduces a float map over a label image in one pass: count, mean,
+// standard deviation, min and max per label, and percentiles from a fixed
+// bin histogram over the range of the labelled pixels, found in a quick pass
+// before. NaN pixels are skipped. The image is cut into bands of rows that
+// worker threads take in turn, each with its own accumulators, merged at the
+// end. The histograms take labels * bins * 4 bytes per worker; with many
+// labels fewer workers, then fewer bins, are used to stay within
+// DEFAULT_ROI_HIST_MB.
+//
+// *****************************************************************************
+
+
+#ifndef __ROI_H__
+#define __ROI_H__
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#define DEFAULT_ROI_BINS 1000       // Histogram bins, percentiles resolve to (max - min) / bins
+#define DEFAULT_ROI_TILE_ROWS 64    // Rows per unit of work
+#define DEFAULT_ROI_HIST_MB 32      // Histograms of all workers together
+
+struct RoiSummary
+{
+    uint32_t label = 0;
+    uint64_t count = 0;             // Pixels that weren't NaN
+    double mean = 0.0;
+    double std = 0.0;
+    float min = 0.0f;
+    float max = 0.0f;
+    std::vector<float> percentiles; // In the order RoiStats was given them
+    double f0 = 0.0;                // Mean raw F0 and Fm levels, when the map
+    double fm = 0.0;                // came from an FvFmPreview
+};
+
+class RoiMask
+{
+    public:
+        RoiMask();
+
+        bool load(const std::string& file);
+        void clear();
+        bool isEmpty();
+
+        void addRect(uint16_t label, int32_t x, int32_t y, int32_t width, int32_t height);
+        void addPolygon(uint16_t label, const std::vector<float>& xy);
+
+        // Replaces all shapes. Labels are width * height, row by row.
+        void setLabels(const uint16_t* labels, uint32_t width, uint32_t height);
+
+        // Label image of the given size, null if a loaded label image has a
+        // different one. Rebuilt only when the size or the shapes change.
+        const uint16_t* getLabels(uint32_t width, uint32_t height);
+        uint16_t getMaxLabel();
+
+        // 16 bit binary PGM that a mask file can load back with "labels"
+        static bool savePgm(const std::string& file, const uint16_t* labels, uint32_t width, uint32_t height);
+
+    private:
+        struct Shape
+        {
+            uint16_t label;
+            bool rect;
+            std::vector<float> xy;  // x, y, width, height for a rect
+        };
+
+        bool loadPgm(const std::string& file);
+        void rasterize(uint32_t width, uint32_t height);
+        void fillPolygon(const Shape& shape);
+
+    private:
+        std::vector<Shape> shapes;
+        std::vector<uint16_t> fixed;    // Loaded label image, if any
+        uint32_t fixed_width;
+        uint32_t fixed_height;
+        std::vector<uint16_t> labels;
+        uint32_t width;
+        uint32_t height;
+        bool dirty;
+        uint16_t max_label;
+};
+
+class RoiStats
+{
+    public:
+        RoiStats(uint32_t _bins = DEFAULT_ROI_BINS);
+
+        // Percentiles from 0 to 100, 10/50/90 by default
+        void setPercentiles(const std::vector<float>& _percentiles);
+        const std::vector<float>& getPercentiles();
+
+        // 0 uses every core
+        void setThreads(unsigned int _threads);
+
+        // stride is in floats. One summary per label from 1 to max_label,
+        // empty labels included with a count of 0.
+        std::vector<RoiSummary> reduce(const float* map, const uint16_t* labels, uint32_t width, uint32_t height, uint32_t stride, uint16_t max_label);
+
+    private:
+        struct Accumulator
+        {
+            std::vector<uint64_t> count;
+            std::vector<double> sum;
+            std::vector<double> sum_sq;
+            std::vector<float> min;
+            std::vector<float> max;
+            std::vector<uint32_t> hist;     // bins per label
+        };
+
+        void range(const float* map, const uint16_t* labels, uint32_t width, uint32_t height, uint32_t stride, uint16_t max_label);
+        void reduceRows(const float* map, const uint16_t* labels, uint32_t width, uint32_t stride, uint32_t y0, uint32_t y1, Accumulator& acc);
+        float percentile(const uint32_t* hist, uint64_t count, float p, float lo, float hi);
+
+    private:
+        float min;          // Histogram range of the map being reduced
+        float max;
+        uint32_t bins;
+        uint32_t hist_bins; // Bins in use, bins or fewer
+        unsigned int threads;
+        std::vector<float> percentiles;
+};
+
+
+#endif // __ROI_H__
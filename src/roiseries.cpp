@@ -0,0 +1,708 @@
+#include "roiseries.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+
+struct SeriesColumn
+{
+    const char* name;
+    uint32_t size;
+    size_t offset;
+};
+
+// Payload order. wall_us and roi come first so the keys are one read.
+static const SeriesColumn COLUMNS[] =
+{
+    {"wall_us", 8, offsetof(SeriesRow, wall_us)},
+    {"roi", 4, offsetof(SeriesRow, roi)},
+    {"recording", 4, offsetof(SeriesRow, recording)},
+    {"count", 4, offsetof(SeriesRow, count)},
+    {"mean", 4, offsetof(SeriesRow, mean)},
+    {"std", 4, offsetof(SeriesRow, std)},
+    {"min", 4, offsetof(SeriesRow, min)},
+    {"max", 4, offsetof(SeriesRow, max)},
+    {"p10", 4, offsetof(SeriesRow, p10)},
+    {"p50", 4, offsetof(SeriesRow, p50)},
+    {"p90", 4, offsetof(SeriesRow, p90)},
+    {"f0", 4, offsetof(SeriesRow, f0)},
+    {"fm", 4, offsetof(SeriesRow, fm)},
+};
+static const uint32_t COLUMN_COUNT = sizeof(COLUMNS) / sizeof(COLUMNS[0]);
+static const uint32_t ROW_BYTES = 8 + 4 * (COLUMN_COUNT - 1);
+static const uint32_t KEY_BYTES = 12;   // wall_us and roi
+
+static uint32_t checksum(const uint8_t* data, size_t size)
+{
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < size; i++)
+    {
+        h = (h ^ data[i]) * 16777619u;
+    }
+    return h;
+}
+
+static bool readAll(int fd, void* data, size_t size, uint64_t offset)
+{
+    uint8_t* p = static_cast<uint8_t*>(data);
+    while (size > 0)
+    {
+        ssize_t n = pread(fd, p, size, offset);
+        if (n <= 0)
+        {
+            if (n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        p += n;
+        size -= n;
+        offset += n;
+    }
+    return true;
+}
+
+static bool writeAll(int fd, const void* data, size_t size, uint64_t offset)
+{
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    while (size > 0)
+    {
+        ssize_t n = pwrite(fd, p, size, offset);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        p += n;
+        size -= n;
+        offset += n;
+    }
+    return true;
+}
+
+static bool sortedLess(const SeriesRow& a, const SeriesRow& b)
+{
+    return (a.roi != b.roi) ? a.roi < b.roi : a.wall_us < b.wall_us;
+}
+
+static bool headerFits(const SeriesBlockHeader& header, uint64_t offset, uint64_t size)
+{
+    return header.magic == SERIES_BLOCK_MAGIC && header.payload_size == static_cast<uint64_t>(header.rows) * ROW_BYTES &&
+           offset + sizeof(header) + header.payload_size <= size;
+}
+
+static bool verifyBlock(int fd, uint64_t offset, const SeriesBlockHeader& header)
+{
+    std::vector<uint8_t> payload(header.payload_size);
+    return readAll(fd, payload.data(), payload.size(), offset + sizeof(header)) && checksum(payload.data(), payload.size()) == header.checksum;
+}
+
+// The next block from offset on whose header and checksum are good, or size
+// if there is none. Lets a scan step over a damaged block in the middle.
+static uint64_t findBlock(int fd, uint64_t offset, uint64_t size)
+{
+    const uint32_t magic = SERIES_BLOCK_MAGIC;
+    std::vector<uint8_t> window(1 << 20);
+    SeriesBlockHeader header;
+    while (offset + sizeof(header) <= size)
+    {
+        size_t n = static_cast<size_t>(std::min<uint64_t>(window.size(), size - offset));
+        if (!readAll(fd, window.data(), n, offset))
+        {
+            break;
+        }
+        for (size_t i = 0; i + sizeof(magic) <= n; i++)
+        {
+            if (memcmp(window.data() + i, &magic, sizeof(magic)) == 0 && readAll(fd, &header, sizeof(header), offset + i) &&
+                headerFits(header, offset + i, size) && verifyBlock(fd, offset + i, header))
+            {
+                return offset + i;
+            }
+        }
+        offset += n - (sizeof(magic) - 1);
+    }
+    return size;
+}
+
+// Walks the blocks after the file header and returns where the good ones
+// end. A block with a bad header is stepped over if a good block follows it,
+// and its bytes are added to damaged; if none does, it is the torn tail and
+// the walk ends there. With verify the last block's checksum is checked as
+// well, since a torn write can leave a complete looking header.
+static uint64_t scanBlocks(int fd, uint64_t offset, uint64_t size, bool verify, std::vector<SeriesBlockHeader>* headers, std::vector<uint64_t>* offsets,
+                           std::vector<SeriesDamage>* damaged = nullptr)
+{
+    SeriesBlockHeader header;
+    uint64_t last = 0;
+    uint64_t last_end = offset;
+    while (offset + sizeof(header) <= size && readAll(fd, &header, sizeof(header), offset))
+    {
+        if (!headerFits(header, offset, size))
+        {
+            uint64_t next = findBlock(fd, offset + 1, size);
+            if (next >= size)
+            {
+                break;
+            }
+            if (damaged != nullptr)
+            {
+                damaged->push_back({offset, next - offset});
+            }
+            offset = next;
+            continue;
+        }
+        if (headers != nullptr)
+        {
+            headers->push_back(header);
+            offsets->push_back(offset + sizeof(header));
+        }
+        last = offset;
+        offset += sizeof(header) + header.payload_size;
+        last_end = offset;
+    }
+
+    if (verify && last_end > last && last != 0)
+    {
+        readAll(fd, &header, sizeof(header), last);
+        if (!verifyBlock(fd, last, header))
+        {
+            if (headers != nullptr)
+            {
+                headers->pop_back();
+                offsets->pop_back();
+            }
+            return last;
+        }
+    }
+    return last_end;
+}
+
+static bool readFileHeader(int fd, uint64_t size, SeriesFileHeader& header)
+{
+    return size >= sizeof(header) && readAll(fd, &header, sizeof(header), 0) && header.magic == SERIES_MAGIC &&
+           header.version == SERIES_VERSION && header.columns == COLUMN_COUNT && header.header_size >= sizeof(header);
+}
+
+SeriesWriter::SeriesWriter(uint32_t _block_rows) :
+    fd(-1), block_rows(std::max(1u, _block_rows)), end(0), rows_total(0), blocks_total(0)
+{
+
+}
+
+SeriesWriter::~SeriesWriter()
+{
+    close();
+}
+
+bool SeriesWriter::open(const std::string& file)
+{
+    close();
+    fd = ::open(file.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+    {
+        std::cout << "SeriesWriter: unable to open " << file << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    uint64_t size = lseek(fd, 0, SEEK_END);
+    SeriesFileHeader header;
+    if (size == 0)
+    {
+        header.magic = SERIES_MAGIC;
+        header.version = SERIES_VERSION;
+        header.header_size = sizeof(header);
+        header.columns = COLUMN_COUNT;
+        header.created_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+        if (!writeAll(fd, &header, sizeof(header), 0))
+        {
+            std::cout << "SeriesWriter: unable to write " << file << ": " << strerror(errno) << std::endl;
+            ::close(fd);
+            fd = -1;
+            return false;
+        }
+        end = sizeof(header);
+    }
+    else if (readFileHeader(fd, size, header))
+    {
+        // Damage in the middle stays where it is, readers step over it too.
+        // Only a torn last block is cut off.
+        std::vector<SeriesDamage> damaged;
+        end = scanBlocks(fd, header.header_size, size, true, nullptr, nullptr, &damaged);
+        for (const SeriesDamage& d : damaged)
+        {
+            std::cout << "SeriesWriter: skipping " << d.size << " corrupt bytes at " << d.offset << " of " << file << ", keeping the blocks after them" << std::endl;
+        }
+        if (end < size)
+        {
+            std::cout << "SeriesWriter: dropping " << (size - end) << " bytes of a torn block at the end of " << file << std::endl;
+            if (ftruncate(fd, end) != 0)
+            {
+                std::cout << "SeriesWriter: unable to truncate " << file << ": " << strerror(errno) << std::endl;
+            }
+        }
+    }
+    else
+    {
+        std::cout << "SeriesWriter: " << file << " isn't a series file" << std::endl;
+        ::close(fd);
+        fd = -1;
+        return false;
+    }
+
+    path = file;
+    rows_total = 0;
+    blocks_total = 0;
+    pending.clear();
+    pending.reserve(block_rows);
+    return true;
+}
+
+void SeriesWriter::close()
+{
+    if (fd < 0)
+    {
+        return;
+    }
+    flush(true);
+    ::close(fd);
+    fd = -1;
+    path.clear();
+}
+
+bool SeriesWriter::isOpen()
+{
+    return fd >= 0;
+}
+
+const std::string& SeriesWriter::getFile()
+{
+    return path;
+}
+
+bool SeriesWriter::append(const SeriesRow& row)
+{
+    if (fd < 0)
+    {
+        return false;
+    }
+    pending.push_back(row);
+    rows_total++;
+    if (pending.size() >= block_rows)
+    {
+        return flush(false);
+    }
+    return true;
+}
+
+bool SeriesWriter::flush(bool sync)
+{
+    if (fd < 0)
+    {
+        return false;
+    }
+    bool ok = true;
+    if (!pending.empty())
+    {
+        ok = writeBlock(pending.data(), static_cast<uint32_t>(pending.size()));
+        pending.clear();
+    }
+    if (ok && sync)
+    {
+        ok = fdatasync(fd) == 0;
+    }
+    return ok;
+}
+
+uint64_t SeriesWriter::getRows()
+{
+    return rows_total;
+}
+
+uint64_t SeriesWriter::getBlocks()
+{
+    return blocks_total;
+}
+
+bool SeriesWriter::writeBlock(const SeriesRow* rows, uint32_t n)
+{
+    SeriesBlockHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = SERIES_BLOCK_MAGIC;
+    header.rows = n;
+    header.payload_size = n * ROW_BYTES;
+    header.min_wall_us = std::numeric_limits<int64_t>::max();
+    header.max_wall_us = std::numeric_limits<int64_t>::min();
+    header.min_roi = std::numeric_limits<uint32_t>::max();
+    header.max_roi = 0;
+    header.min_mean = std::numeric_limits<float>::infinity();
+    header.max_mean = -std::numeric_limits<float>::infinity();
+    bool sorted = true;
+    for (uint32_t i = 0; i < n; i++)
+    {
+        header.min_wall_us = std::min(header.min_wall_us, rows[i].wall_us);
+        header.max_wall_us = std::max(header.max_wall_us, rows[i].wall_us);
+        header.min_roi = std::min(header.min_roi, rows[i].roi);
+        header.max_roi = std::max(header.max_roi, rows[i].roi);
+        if (!std::isnan(rows[i].mean))
+        {
+            header.min_mean = std::min(header.min_mean, rows[i].mean);
+            header.max_mean = std::max(header.max_mean, rows[i].mean);
+        }
+        if (i > 0 && sortedLess(rows[i], rows[i - 1]))
+        {
+            sorted = false;
+        }
+    }
+    header.flags = sorted ? SERIES_SORTED : 0;
+
+    // Transpose into columns behind the header
+    buffer.resize(sizeof(header) + header.payload_size);
+    uint8_t* column = buffer.data() + sizeof(header);
+    for (uint32_t c = 0; c < COLUMN_COUNT; c++)
+    {
+        const SeriesColumn& col = COLUMNS[c];
+        for (uint32_t i = 0; i < n; i++)
+        {
+            memcpy(column + static_cast<size_t>(i) * col.size, reinterpret_cast<const uint8_t*>(rows + i) + col.offset, col.size);
+        }
+        column += static_cast<size_t>(n) * col.size;
+    }
+    header.checksum = checksum(buffer.data() + sizeof(header), header.payload_size);
+    memcpy(buffer.data(), &header, sizeof(header));
+
+    if (!writeAll(fd, buffer.data(), buffer.size(), end))
+    {
+        std::cout << "SeriesWriter: unable to write " << path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    end += buffer.size();
+    blocks_total++;
+    return true;
+}
+
+bool SeriesWriter::quarantine(const std::string& file, const std::vector<SeriesDamage>& damaged)
+{
+    std::string out_file = file + ".corrupt";
+    int in = ::open(file.c_str(), O_RDONLY);
+    int out = ::open(out_file.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    bool ok = in >= 0 && out >= 0;
+    std::vector<uint8_t> bytes;
+    for (size_t i = 0; ok && i < damaged.size(); i++)
+    {
+        bytes.resize(damaged[i].size);
+        ok = readAll(in, bytes.data(), bytes.size(), damaged[i].offset) && writeAll(out, bytes.data(), bytes.size(), lseek(out, 0, SEEK_END));
+    }
+    ok = ok && fdatasync(out) == 0;
+    if (in >= 0)
+    {
+        ::close(in);
+    }
+    if (out >= 0)
+    {
+        ::close(out);
+    }
+
+    if (!ok)
+    {
+        std::cout << "SeriesWriter: unable to save the corrupt parts of " << file << " to " << out_file << ", not compacting" << std::endl;
+        return false;
+    }
+    std::cout << "SeriesWriter: " << damaged.size() << " corrupt part(s) of " << file << " saved to " << out_file << std::endl;
+    return true;
+}
+
+bool SeriesWriter::compact(const std::string& file, uint32_t block_rows)
+{
+    SeriesReader reader;
+    if (!reader.open(file))
+    {
+        return false;
+    }
+    // Blocks that fail their checksum and damage between blocks don't make
+    // it into the compacted file. Their bytes are kept in file.corrupt.
+    std::vector<SeriesDamage> damaged = reader.getDamaged();
+    std::vector<SeriesRow> rows;
+    rows.reserve(reader.getRows());
+    for (size_t b = 0; b < reader.getBlocks(); b++)
+    {
+        if (!reader.readBlock(b, rows))
+        {
+            const SeriesBlockHeader& h = reader.getBlockHeader(b);
+            std::cout << "SeriesWriter: block " << b << " of " << file << " is corrupt, " << h.rows << " rows left out" << std::endl;
+            damaged.push_back({reader.getBlockOffset(b), sizeof(h) + h.payload_size});
+        }
+    }
+    size_t blocks_before = reader.getBlocks();
+    reader.close();
+
+    if (!damaged.empty() && !quarantine(file, damaged))
+    {
+        return false;
+    }
+
+    // Stable, so rows of the same region and time keep their order
+    std::stable_sort(rows.begin(), rows.end(), sortedLess);
+
+    std::string tmp = file + ".compact";
+    unlink(tmp.c_str());
+    SeriesWriter writer(block_rows);
+    if (!writer.open(tmp))
+    {
+        return false;
+    }
+    for (size_t i = 0; i < rows.size(); i += block_rows)
+    {
+        uint32_t n = static_cast<uint32_t>(std::min<size_t>(block_rows, rows.size() - i));
+        if (!writer.writeBlock(rows.data() + i, n))
+        {
+            writer.close();
+            unlink(tmp.c_str());
+            return false;
+        }
+    }
+    size_t blocks_after = writer.getBlocks();
+    writer.close();
+
+    if (rename(tmp.c_str(), file.c_str()) != 0)
+    {
+        std::cout << "SeriesWriter: unable to replace " << file << ": " << strerror(errno) << std::endl;
+        unlink(tmp.c_str());
+        return false;
+    }
+    std::cout << "SeriesWriter: compacted " << file << ", " << rows.size() << " rows from " << blocks_before << " into " << blocks_after << " blocks" << std::endl;
+    return true;
+}
+
+SeriesReader::SeriesReader() :
+    fd(-1), end(0), rows_total(0)
+{
+
+}
+
+SeriesReader::~SeriesReader()
+{
+    close();
+}
+
+bool SeriesReader::open(const std::string& file)
+{
+    close();
+    fd = ::open(file.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        std::cout << "SeriesReader: unable to open " << file << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    SeriesFileHeader header;
+    if (!readFileHeader(fd, lseek(fd, 0, SEEK_END), header))
+    {
+        std::cout << "SeriesReader: " << file << " isn't a series file" << std::endl;
+        close();
+        return false;
+    }
+    end = header.header_size;
+    refresh();
+    return true;
+}
+
+void SeriesReader::close()
+{
+    if (fd >= 0)
+    {
+        ::close(fd);
+        fd = -1;
+    }
+    blocks.clear();
+    damaged.clear();
+    rows_total = 0;
+    end = 0;
+}
+
+void SeriesReader::refresh()
+{
+    if (fd < 0)
+    {
+        return;
+    }
+    // A block still being written is picked up by the next refresh
+    std::vector<SeriesBlockHeader> headers;
+    std::vector<uint64_t> offsets;
+    size_t known = damaged.size();
+    end = scanBlocks(fd, end, lseek(fd, 0, SEEK_END), false, &headers, &offsets, &damaged);
+    for (size_t i = known; i < damaged.size(); i++)
+    {
+        std::cout << "SeriesReader: skipping " << damaged[i].size << " corrupt bytes at " << damaged[i].offset << std::endl;
+    }
+    for (size_t i = 0; i < headers.size(); i++)
+    {
+        blocks.push_back({headers[i], offsets[i]});
+        rows_total += headers[i].rows;
+    }
+}
+
+size_t SeriesReader::getBlocks()
+{
+    return blocks.size();
+}
+
+uint64_t SeriesReader::getRows()
+{
+    return rows_total;
+}
+
+const SeriesBlockHeader& SeriesReader::getBlockHeader(size_t index)
+{
+    return blocks[index].header;
+}
+
+uint64_t SeriesReader::getBlockOffset(size_t index)
+{
+    return blocks[index].offset - sizeof(SeriesBlockHeader);
+}
+
+const std::vector<SeriesDamage>& SeriesReader::getDamaged()
+{
+    return damaged;
+}
+
+bool SeriesReader::readPayload(const Block& block, std::vector<uint8_t>& out)
+{
+    out.resize(block.header.payload_size);
+    return readAll(fd, out.data(), out.size(), block.offset) && checksum(out.data(), out.size()) == block.header.checksum;
+}
+
+// Gathers row i of a block from its columns
+static void gatherRow(const uint8_t* payload, uint32_t rows, uint32_t i, SeriesRow& row)
+{
+    const uint8_t* column = payload;
+    for (uint32_t c = 0; c < COLUMN_COUNT; c++)
+    {
+        memcpy(reinterpret_cast<uint8_t*>(&row) + COLUMNS[c].offset, column + static_cast<size_t>(i) * COLUMNS[c].size, COLUMNS[c].size);
+        column += static_cast<size_t>(rows) * COLUMNS[c].size;
+    }
+}
+
+bool SeriesReader::readBlock(size_t index, std::vector<SeriesRow>& out)
+{
+    if (index >= blocks.size() || !readPayload(blocks[index], payload))
+    {
+        return false;
+    }
+    uint32_t rows = blocks[index].header.rows;
+    size_t first = out.size();
+    out.resize(first + rows);
+    for (uint32_t i = 0; i < rows; i++)
+    {
+        gatherRow(payload.data(), rows, i, out[first + i]);
+    }
+    return true;
+}
+
+bool SeriesReader::query(const SeriesQuery& q, std::vector<SeriesRow>& out, SeriesQueryStats* stats)
+{
+    SeriesQueryStats local;
+    SeriesQueryStats& s = (stats != nullptr) ? *stats : local;
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    bool filter_mean = q.mean_min > -std::numeric_limits<float>::infinity() || q.mean_max < std::numeric_limits<float>::infinity();
+    std::vector<uint32_t> matches;
+    for (const Block& block : blocks)
+    {
+        const SeriesBlockHeader& h = block.header;
+        if (h.max_roi < q.roi_min || h.min_roi > q.roi_max || h.max_wall_us < q.from_us || h.min_wall_us > q.to_us ||
+            (filter_mean && (h.max_mean < q.mean_min || h.min_mean > q.mean_max)))
+        {
+            s.blocks_skipped++;
+            continue;
+        }
+
+        // Keys first, the rest of the block only if a row matches
+        size_t key_size = static_cast<size_t>(h.rows) * KEY_BYTES;
+        keys.resize(key_size);
+        if (!readAll(fd, keys.data(), key_size, block.offset))
+        {
+            return false;
+        }
+        s.blocks_scanned++;
+        s.bytes_read += key_size;
+        const int64_t* wall = reinterpret_cast<const int64_t*>(keys.data());
+        const uint32_t* roi = reinterpret_cast<const uint32_t*>(keys.data() + static_cast<size_t>(h.rows) * 8);
+
+        uint32_t i0 = 0, i1 = h.rows;
+        if (h.flags & SERIES_SORTED)
+        {
+            i0 = static_cast<uint32_t>(std::lower_bound(roi, roi + h.rows, q.roi_min) - roi);
+            i1 = static_cast<uint32_t>(std::upper_bound(roi + i0, roi + h.rows, q.roi_max) - roi);
+        }
+        matches.clear();
+        for (uint32_t i = i0; i < i1; i++)
+        {
+            if (roi[i] >= q.roi_min && roi[i] <= q.roi_max && wall[i] >= q.from_us && wall[i] <= q.to_us)
+            {
+                matches.push_back(i);
+            }
+        }
+        if (matches.empty())
+        {
+            continue;
+        }
+
+        // A narrow run of a large block (a sorted one, usually) reads just
+        // that slice of each column. The checksum needs the whole payload,
+        // so only full reads are verified.
+        uint32_t first = matches.front();
+        uint32_t span = matches.back() - first + 1;
+        if (span * 4 < h.rows)
+        {
+            payload.resize(static_cast<size_t>(span) * ROW_BYTES);
+            uint8_t* column = payload.data();
+            uint64_t offset = block.offset;
+            for (uint32_t c = 0; c < COLUMN_COUNT; c++)
+            {
+                if (!readAll(fd, column, static_cast<size_t>(span) * COLUMNS[c].size, offset + static_cast<uint64_t>(first) * COLUMNS[c].size))
+                {
+                    return false;
+                }
+                column += static_cast<size_t>(span) * COLUMNS[c].size;
+                offset += static_cast<uint64_t>(h.rows) * COLUMNS[c].size;
+            }
+            s.bytes_read += payload.size();
+        }
+        else
+        {
+            if (!readPayload(block, payload))
+            {
+                std::cout << "SeriesReader: block at " << block.offset << " is corrupt, skipping it" << std::endl;
+                s.blocks_corrupt++;
+                continue;
+            }
+            s.bytes_read += h.payload_size;
+            first = 0;
+            span = h.rows;
+        }
+        s.blocks_read++;
+        for (uint32_t i : matches)
+        {
+            SeriesRow row;
+            gatherRow(payload.data(), span, i - first, row);
+            if (!filter_mean || (row.mean >= q.mean_min && row.mean <= q.mean_max))
+            {
+                out.push_back(row);
+                s.rows++;
+            }
+        }
+    }
+    return true;
+}
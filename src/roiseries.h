@@ -0,0 +1,204 @@
+// *****************************************************************************
+//
+// roiseries.h
+// Append-only columnar store for per region results over time, so long
+// experiments can be queried ("ROI 12 over the last week") without parsing
+// roi.csv or going back to the frames.
+//
+// The file starts with a SeriesFileHeader, followed by blocks. A block is a
+// SeriesBlockHeader and a payload with one column after the other, each
+// column holding that field of every row in the block (see SeriesRow for the
+// order). The block header keeps the min/max time, region and mean of its
+// rows, so a query reads just the headers, then only the time and region
+// columns of blocks that may match, and the remaining columns only where
+// rows do. A block whose rows are sorted by (region, time) is flagged, and
+// queries binary search it instead of scanning.
+//
+// Blocks are written whole with one pwrite. A crash can leave a torn block
+// at the end, which fails its magic, size or checksum: readers stop before
+// it and SeriesWriter::open cuts it off before appending. Only the tail is
+// ever cut. Damage in the middle of the file is reported and stepped over,
+// up to the next block that verifies, and the blocks after it are kept.
+// Queries skip a block that fails its checksum; compaction leaves it out and
+// saves the damaged bytes to <file>.corrupt.
+//
+// Live appends make many small blocks (one per sequence) with wide time
+// ranges per region. SeriesWriter::compact rewrites a file sorted by region
+// and time into large blocks, which is where a per region query gains the
+// most. Don't compact a file that a writer has open.
+//
+// *****************************************************************************
+
+
+#ifndef __ROISERIES_H__
+#define __ROISERIES_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <vector>
+
+#define SERIES_MAGIC 0x53524D50         // "PMRS"
+#define SERIES_BLOCK_MAGIC 0x4B4C4250   // "PBLK"
+#define SERIES_VERSION 1
+#define SERIES_SORTED 1                 // Block flag, rows sorted by (roi, wall_us)
+
+#define DEFAULT_SERIES_BLOCK_ROWS 4096      // Rows buffered before a block is written
+#define DEFAULT_SERIES_COMPACT_ROWS 65536   // Rows per block after compaction
+
+struct SeriesRow
+{
+    int64_t wall_us;        // System clock at the end of the sequence
+    uint32_t roi;           // Region label
+    uint32_t recording;
+    uint32_t count;         // Pixels that weren't NaN
+    float mean;             // Fv/Fm
+    float std;
+    float min;
+    float max;
+    float p10;              // First three RoiStats percentiles,
+    float p50;              // 10/50/90 unless changed
+    float p90;
+    float f0;               // Mean raw levels
+    float fm;
+};
+
+struct SeriesFileHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t header_size;   // Offset of the first block
+    uint32_t columns;
+    int64_t created_us;
+};
+
+struct SeriesBlockHeader
+{
+    uint32_t magic;
+    uint32_t rows;
+    uint32_t payload_size;  // Bytes of column data after this header
+    uint32_t checksum;      // FNV-1a of the payload
+    int64_t min_wall_us;
+    int64_t max_wall_us;
+    uint32_t min_roi;
+    uint32_t max_roi;
+    float min_mean;         // NaN means are left out
+    float max_mean;
+    uint32_t flags;
+    uint32_t reserved;
+};
+
+// Rows matching every range, bounds included
+struct SeriesQuery
+{
+    uint32_t roi_min = 0;
+    uint32_t roi_max = std::numeric_limits<uint32_t>::max();
+    int64_t from_us = std::numeric_limits<int64_t>::min();
+    int64_t to_us = std::numeric_limits<int64_t>::max();
+    float mean_min = -std::numeric_limits<float>::infinity();
+    float mean_max = std::numeric_limits<float>::infinity();
+};
+
+// Bytes between blocks that aren't a good block
+struct SeriesDamage
+{
+    uint64_t offset;
+    uint64_t size;
+};
+
+struct SeriesQueryStats
+{
+    uint64_t blocks_skipped = 0;    // Ruled out by the header
+    uint64_t blocks_scanned = 0;    // Key columns read
+    uint64_t blocks_read = 0;       // Read whole, some rows matched
+    uint64_t blocks_corrupt = 0;    // Failed the checksum, left out
+    uint64_t bytes_read = 0;
+    uint64_t rows = 0;
+};
+
+class SeriesWriter
+{
+    public:
+        SeriesWriter(uint32_t _block_rows = DEFAULT_SERIES_BLOCK_ROWS);
+        ~SeriesWriter();
+
+        // Creates the file or appends to it, cutting off a torn last block
+        bool open(const std::string& file);
+        void close();
+        bool isOpen();
+        const std::string& getFile();
+
+        // Buffered, a block is written every block_rows rows and on flush()
+        bool append(const SeriesRow& row);
+        bool flush(bool sync = true);
+
+        uint64_t getRows();         // Written or buffered since open
+        uint64_t getBlocks();       // Written since open
+
+        // Rewrites file sorted by (roi, wall_us) into blocks of block_rows,
+        // through a temporary file renamed over it
+        static bool compact(const std::string& file, uint32_t block_rows = DEFAULT_SERIES_COMPACT_ROWS);
+
+    private:
+        bool writeBlock(const SeriesRow* rows, uint32_t n);
+        static bool quarantine(const std::string& file, const std::vector<SeriesDamage>& damaged);
+
+    private:
+        std::string path;
+        int fd;
+        uint32_t block_rows;
+        uint64_t end;               // Where the next block goes
+        std::vector<SeriesRow> pending;
+        std::vector<uint8_t> buffer;
+        uint64_t rows_total;
+        uint64_t blocks_total;
+};
+
+class SeriesReader
+{
+    public:
+        SeriesReader();
+        ~SeriesReader();
+
+        bool open(const std::string& file);
+        void close();
+
+        // Picks up blocks appended since open
+        void refresh();
+
+        size_t getBlocks();
+        uint64_t getRows();
+        const SeriesBlockHeader& getBlockHeader(size_t index);
+        uint64_t getBlockOffset(size_t index);     // Of its header
+
+        // Skipped byte ranges, in file order
+        const std::vector<SeriesDamage>& getDamaged();
+
+        // Appends the matching rows to out, in file order
+        bool query(const SeriesQuery& q, std::vector<SeriesRow>& out, SeriesQueryStats* stats = nullptr);
+
+        // Every row of a block
+        bool readBlock(size_t index, std::vector<SeriesRow>& out);
+
+    private:
+        struct Block
+        {
+            SeriesBlockHeader header;
+            uint64_t offset;        // Of the payload
+        };
+
+        bool readPayload(const Block& block, std::vector<uint8_t>& payload);
+
+    private:
+        int fd;
+        uint64_t end;               // Past the last good block
+        std::vector<Block> blocks;
+        std::vector<SeriesDamage> damaged;
+        uint64_t rows_total;
+        std::vector<uint8_t> keys;
+        std::vector<uint8_t> payload;
+};
+
+
+#endif // __ROISERIES_H__
@@ -0,0 +1,491 @@
+#include "scheduler.h"
+#include "sequence.h"
+#include "serialport.h"
+#include "tools.h"
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+static const char* LEDS_OFF = "0 0 0";
+
+bool Protocol::load(const std::string& file, std::string& error)
+{
+    std::ifstream in(file);
+    if (!in)
+    {
+        error = "unable to open " + file;
+        return false;
+    }
+
+    repeat = 1;
+    period = 0.0;
+    steps.clear();
+
+    std::string line;
+    int line_no = 0;
+    while (std::getline(in, line))
+    {
+        line_no++;
+        line = line.substr(0, line.find('#'));
+
+        std::stringstream ss(line);
+        std::string keyword;
+        if (!(ss >> keyword))
+        {
+            continue;
+        }
+
+        std::stringstream where;
+        where << file << ":" << line_no << ": ";
+
+        ProtocolStep step = {ProtocolStep::WAIT, 0.0, 0, ""};
+        if (keyword == "repeat")
+        {
+            std::string every;
+            if (!(ss >> repeat))
+            {
+                error = where.str() + "repeat needs a count";
+                return false;
+            }
+            if (ss >> every && (every != "every" || !(ss >> period) || period < 0))
+            {
+                error = where.str() + "expected 'every <seconds>'";
+                return false;
+            }
+            continue;
+        }
+        else if (keyword == "dark" || keyword == "wait")
+        {
+            step.kind = (keyword == "dark") ? ProtocolStep::DARK : ProtocolStep::WAIT;
+            if (!(ss >> step.seconds) || step.seconds < 0)
+            {
+                error = where.str() + keyword + " needs a duration in seconds";
+                return false;
+            }
+        }
+        else if (keyword == "send" || keyword == "pam")
+        {
+            step.kind = (keyword == "send") ? ProtocolStep::SEND : ProtocolStep::PAM;
+            if (step.kind == ProtocolStep::PAM && (!(ss >> step.frames) || step.frames <= 0))
+            {
+                error = where.str() + "pam needs a frame count";
+                return false;
+            }
+
+            std::getline(ss, step.command);
+            std::vector<SerialCommand> cmds;
+            if (!Sequence::parse(step.command, cmds))
+            {
+                error = where.str() + "malformed command string";
+                return false;
+            }
+        }
+        else if (keyword == "induction")
+        {
+            PamSettings settings;
+            double seconds, interval;
+            uint32_t dac;
+            while (ss >> seconds)
+            {
+                if (!(ss >> dac >> interval) || seconds <= 0 || interval <= 0)
+                {
+                    error = where.str() + "induction phases are 'seconds dac interval'";
+                    return false;
+                }
+                settings.phases.push_back({static_cast<uint32_t>(seconds * 1000), dac, static_cast<uint32_t>(interval * 1000)});
+            }
+            if (settings.phases.empty() || !ss.eof())
+            {
+                error = where.str() + "induction needs at least one 'seconds dac interval' phase";
+                return false;
+            }
+
+            std::vector<SerialCommand> cmds = Sequence::build(settings);
+            step.kind = ProtocolStep::PAM;
+            step.frames = Sequence::triggerCount(cmds);
+            step.command = Sequence::format(cmds);
+        }
+        else if (keyword == "rlc")
+        {
+            // One phase per light level with its pulse at the end
+            PamSettings settings;
+            double seconds;
+            uint32_t dac;
+            if (!(ss >> seconds) || seconds <= 0)
+            {
+                error = where.str() + "rlc needs a step length in seconds";
+                return false;
+            }
+            while (ss >> dac)
+            {
+                settings.phases.push_back({static_cast<uint32_t>(seconds * 1000), dac, static_cast<uint32_t>(seconds * 1000)});
+            }
+            if (settings.phases.size() < LIGHTCURVE_MIN_STEPS || !ss.eof())
+            {
+                error = where.str() + "rlc needs at least " + std::to_string(LIGHTCURVE_MIN_STEPS) + " DAC settings";
+                return false;
+            }
+
+            std::vector<SerialCommand> cmds = Sequence::build(settings);
+            step.kind = ProtocolStep::PAM;
+            step.frames = Sequence::triggerCount(cmds);
+            step.command = Sequence::format(cmds);
+        }
+        else
+        {
+            error = where.str() + "unknown step '" + keyword + "'";
+            return false;
+        }
+
+        steps.push_back(step);
+    }
+
+    if (steps.empty())
+    {
+        error = file + " has no steps";
+        return false;
+    }
+
+    return true;
+}
+
+double Protocol::stepLength(const ProtocolStep& step) const
+{
+    switch (step.kind)
+    {
+        case ProtocolStep::DARK:
+        case ProtocolStep::WAIT:
+            return step.seconds;
+
+        case ProtocolStep::PAM:
+        {
+            std::vector<SerialCommand> cmds;
+            Sequence::parse(step.command, cmds);
+            return (Sequence::duration(cmds) + SCHEDULER_PAM_MARGIN) / 1000.0;
+        }
+
+        default:
+            return 0.0;
+    }
+}
+
+double Protocol::length() const
+{
+    double total = 0.0;
+    for (auto& step : steps)
+    {
+        total += stepLength(step);
+    }
+    return total;
+}
+
+Scheduler::Scheduler(Receiver* _receiver) :
+    receiver(_receiver),
+    running(false),
+    armed(false),
+    waiting(0),
+    awaited(0),
+    tokens(0),
+    t0(0),
+    period(0)
+{
+
+}
+
+Scheduler::~Scheduler()
+{
+    stop();
+}
+
+bool Scheduler::load(const std::string& file)
+{
+    if (running)
+    {
+        return false;
+    }
+
+    std::string error;
+    if (!protocol.load(file, error))
+    {
+        std::cout << "Protocol: " << error << std::endl;
+        return false;
+    }
+
+    std::cout << "Protocol: " << protocol.steps.size() << " steps, " << protocol.length() << " s per repetition" << std::endl;
+    return true;
+}
+
+bool Scheduler::start(const std::string& log_path)
+{
+    if (running || protocol.steps.empty())
+    {
+        return false;
+    }
+
+    // A run that finished by itself still has its wheel thread
+    stop();
+
+    // A restarted run appends, so the header only goes in a new file
+    {
+        std::lock_guard<std::mutex> lock(log_mtx);
+        if (!Tools::appendCsv(log_file, log_path, "wall_time_us,repetition,step,event,planned_ms,actual_ms,error_us,duration_us"))
+        {
+            return false;
+        }
+    }
+
+    // Period is start to start, but never shorter than the steps themselves
+    double length = protocol.length();
+    period = static_cast<int64_t>(std::max(protocol.period, length) * 1e9);
+    if (protocol.period > 0 && protocol.period < length)
+    {
+        std::cout << "Protocol: period " << protocol.period << " s is shorter than the steps, using " << length << " s" << std::endl;
+    }
+
+    running = true;
+    t0 = TimerWheel::now() + static_cast<int64_t>(SCHEDULER_START_DELAY) * 1000000;
+    wheel.start();
+    scheduleRepetition(0, t0);
+
+    return true;
+}
+
+void Scheduler::stop()
+{
+    running = false;
+    waiting = 0;
+    SerialPort::instance().forget(awaited);
+    wheel.stop();
+    wheel.cancelAll();
+
+    std::lock_guard<std::mutex> lock(log_mtx);
+    if (log_file.is_open())
+    {
+        log_file.close();
+    }
+}
+
+bool Scheduler::isRunning()
+{
+    return running;
+}
+
+void Scheduler::setFinishedCallback(FinishedCallback cb)
+{
+    on_finished = cb;
+}
+
+void Scheduler::scheduleRepetition(unsigned int rep, int64_t base)
+{
+    if (!running)
+    {
+        return;
+    }
+
+    // With a period, queue the next repetition when this one starts, so only
+    // two are ever on the wheel. Back to back repetitions follow on from the
+    // last step instead.
+    unsigned int next = rep + 1;
+    if (protocol.period > 0 && (protocol.repeat == 0 || next < protocol.repeat))
+    {
+        int64_t next_base = base + period;
+        wheel.schedule(base, [this, next, next_base](int64_t, int64_t) { scheduleRepetition(next, next_base); });
+    }
+
+    scheduleStep(rep, 0, base);
+}
+
+void Scheduler::scheduleStep(unsigned int rep, size_t index, int64_t planned)
+{
+    // Queues steps up to the end of the repetition, or up to a PAM step whose
+    // end the controller will report. The rest is queued once it does.
+    while (running)
+    {
+        if (index == protocol.steps.size())
+        {
+            unsigned int next = rep + 1;
+            if (protocol.repeat != 0 && next >= protocol.repeat)
+            {
+                wheel.schedule(planned, [this, rep](int64_t p, int64_t a) { finish(rep, p, a); });
+            }
+            else if (protocol.period <= 0)
+            {
+                wheel.schedule(planned - leadOf(0), [this, next, planned](int64_t, int64_t) { scheduleRepetition(next, planned); });
+            }
+            return;
+        }
+
+        const ProtocolStep& step = protocol.steps[index];
+        bool waits = (step.kind == ProtocolStep::PAM) && SerialPort::instance().hasReplies();
+        if (step.kind == ProtocolStep::PAM)
+        {
+            int64_t arm = planned - leadOf(index);
+            wheel.schedule(arm, [this, rep, index](int64_t p, int64_t a) { armPam(rep, index, p, a); });
+        }
+        wheel.schedule(planned, [this, rep, index, waits](int64_t p, int64_t a) { runStep(rep, index, waits, p, a); });
+
+        if (waits)
+        {
+            return;
+        }
+        planned += static_cast<int64_t>(protocol.stepLength(step) * 1e9);
+        index++;
+    }
+}
+
+int64_t Scheduler::leadOf(size_t index)
+{
+    // After the last step comes the first one of the next repetition
+    index = (index < protocol.steps.size()) ? index : 0;
+    if (protocol.steps[index].kind == ProtocolStep::PAM)
+    {
+        return static_cast<int64_t>(SCHEDULER_ARM_LEAD) * 1000000;
+    }
+    return 0;
+}
+
+void Scheduler::advance(uint64_t token, unsigned int rep, size_t index, int64_t planned)
+{
+    // The controller's DONE and the fallback timer race, the first one wins
+    if (waiting.compare_exchange_strong(token, 0))
+    {
+        awaited = 0;
+        scheduleStep(rep, index + 1, planned);
+    }
+}
+
+void Scheduler::armPam(unsigned int rep, size_t index, int64_t planned, int64_t actual)
+{
+    const ProtocolStep& step = protocol.steps[index];
+
+    if (!receiver->isConnected())
+    {
+        log(rep, index, "arm-disconnected", planned, actual, TimerWheel::now());
+        return;
+    }
+
+    if (receiver->getState() == Receiver::MULTIFRAME)
+    {
+        // The previous sequence hasn't finished, firing now would mix frames
+        log(rep, index, "arm-busy", planned, actual, TimerWheel::now());
+        return;
+    }
+
+    receiver->setFrameCount(step.frames);
+    receiver->setSequence(step.command);
+    receiver->startRecording();
+    armed = true;
+    log(rep, index, "arm", planned, actual, TimerWheel::now());
+}
+
+void Scheduler::runStep(unsigned int rep, size_t index, bool waits, int64_t planned, int64_t actual)
+{
+    const ProtocolStep& step = protocol.steps[index];
+    const char* event = "wait";
+
+    switch (step.kind)
+    {
+        case ProtocolStep::DARK:
+            Tools::sendSerialString(LEDS_OFF);
+            event = "dark";
+            break;
+
+        case ProtocolStep::SEND:
+            Tools::sendSerialString(step.command);
+            event = "send";
+            break;
+
+        case ProtocolStep::PAM:
+            if (!armed.exchange(false) || receiver->getState() != Receiver::MULTIFRAME)
+            {
+                event = "pam-skipped";
+                break;
+            }
+            if (waits)
+            {
+                sendPam(rep, index, planned, actual);
+                return;
+            }
+            Tools::sendSerialString(step.command);
+            event = "pam";
+            break;
+
+        default:
+            break;
+    }
+
+    log(rep, index, event, planned, actual, TimerWheel::now());
+
+    // Nothing will report this step done, carry on with the plan
+    if (waits)
+    {
+        scheduleStep(rep, index + 1, planned + static_cast<int64_t>(protocol.stepLength(step) * 1e9));
+    }
+}
+
+void Scheduler::sendPam(unsigned int rep, size_t index, int64_t planned, int64_t actual)
+{
+    const ProtocolStep& step = protocol.steps[index];
+
+    // The next step starts when the controller reports the sequence done,
+    // or after the full margin if it never does
+    int64_t fallback = planned + static_cast<int64_t>(protocol.stepLength(step) * 1e9);
+    int64_t lead = leadOf(index + 1);
+    uint64_t token = ++tokens;
+    waiting = token;
+
+    uint64_t id = SerialPort::instance().send(step.command, [this, token, rep, index, planned, actual, fallback, lead](const SerialEvent& e)
+    {
+        if (e.kind == SerialEvent::DONE)
+        {
+            log(rep, index, "mcu-done", planned, actual, e.at_ns);
+            int64_t next = std::min(fallback, e.at_ns + static_cast<int64_t>(SCHEDULER_DONE_MARGIN) * 1000000 + lead);
+            wheel.schedule(next - lead, [this, token, rep, index, next](int64_t, int64_t) { advance(token, rep, index, next); });
+        }
+        else if (e.kind == SerialEvent::ERROR)
+        {
+            log(rep, index, "mcu-rejected", planned, actual, e.at_ns);
+        }
+    });
+    awaited = id;
+    log(rep, index, (id != 0) ? "pam" : "pam-send-failed", planned, actual, TimerWheel::now());
+
+    wheel.schedule(fallback - lead, [this, token, rep, index, fallback](int64_t, int64_t) { advance(token, rep, index, fallback); });
+}
+
+void Scheduler::log(unsigned int rep, size_t index, const char* event, int64_t planned, int64_t actual, int64_t done)
+{
+    auto wall = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+
+    std::lock_guard<std::mutex> lock(log_mtx);
+
+    std::stringstream ss;
+    ss << std::fixed << std::setprecision(3)
+       << wall << "," << rep << "," << index << "," << event << ","
+       << (planned - t0) / 1e6 << "," << (actual - t0) / 1e6 << ","
+       << (actual - planned) / 1e3 << "," << (done - actual) / 1e3;
+
+    if (log_file.is_open())
+    {
+        log_file << ss.str() << std::endl;
+    }
+    std::cout << "Scheduler: " << ss.str() << std::endl;
+}
+
+void Scheduler::finish(unsigned int rep, int64_t planned, int64_t actual)
+{
+    log(rep, protocol.steps.size(), "done", planned, actual, actual);
+    running = false;
+
+    {
+        std::lock_guard<std::mutex> lock(log_mtx);
+        log_file.close();
+    }
+
+    if (on_finished)
+    {
+        on_finished();
+    }
+}
@@ -0,0 +1,140 @@
+// *****************************************************************************
+//
+// scheduler.h
+// Runs experiment protocols unattended: dark adaptation, PAM sequences and
+// raw LED commands, repeated on a fixed period. Steps are placed on a timer
+// wheel so they start within a millisecond of plan, and every step's planned
+// and actual start is logged.
+//
+// Protocol files have one step per line, '#' starts a comment:
+//
+//     repeat 144 every 1800      # 144 repetitions, one every 30 min
+//     dark 1200                  # LEDs off for 20 min
+//     pam 5 1 0 800 5 0 0 ...    # 5 frame PAM sequence with this command string
+//     wait 60
+//     send 0 0 1000              # Raw command, e.g. actinic light on
+//     induction 300 1000 30 120 0 30
+//
+// "induction" is a PAM sequence built by Sequence::build: Fv/Fm, then phases
+// of "seconds torch-dac pulse-interval-seconds", here 5 min of actinic light
+// and 2 min of dark recovery with a saturating pulse every 30 s.
+//
+//     rlc 10 100 200 400 700 1000 1500 2000
+//
+// "rlc" is a rapid light curve: steps of the given length (s) at each torch
+// DAC setting, each ending in a saturating pulse (see lightcurve.h).
+//
+// "repeat 0" repeats until stopped. Without "every" repetitions run back to
+// back.
+//
+// When the LED controller answers (see serialport.h), the step after a PAM
+// sequence starts as soon as the controller reports it done, otherwise after
+// the sequence length and SCHEDULER_PAM_MARGIN. With "every" repetitions
+// still start on the period.
+//
+// After the last step the log is closed and the finished callback runs, on
+// the wheel thread. Call stop() (not from the callback) to join the thread.
+//
+// *****************************************************************************
+
+
+#ifndef __SCHEDULER_H__
+#define __SCHEDULER_H__
+
+#include <atomic>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "receiver.h"
+#include "timerwheel.h"
+
+// The camera is switched to triggered mode this long before the LED sequence
+// is sent, so reconfiguring it doesn't eat into the planned start.
+#define SCHEDULER_ARM_LEAD 500      // (ms)
+
+// Allowance after a PAM sequence for the last frames to arrive
+#define SCHEDULER_PAM_MARGIN 1000   // (ms)
+
+// The same once the LED controller has reported the sequence done
+#define SCHEDULER_DONE_MARGIN 100   // (ms)
+
+// Delay from start() to the first step
+#define SCHEDULER_START_DELAY 1000  // (ms)
+
+struct ProtocolStep
+{
+    enum KIND
+    {
+        DARK,
+        WAIT,
+        SEND,
+        PAM
+    };
+
+    int kind;
+    double seconds;         // DARK, WAIT
+    int frames;             // PAM
+    std::string command;    // SEND, PAM
+};
+
+struct Protocol
+{
+    unsigned int repeat = 1;
+    double period = 0.0;    // (s) start to start
+    std::vector<ProtocolStep> steps;
+
+    bool load(const std::string& file, std::string& error);
+
+    // Step length and offset from the start of a repetition (s)
+    double stepLength(const ProtocolStep& step) const;
+    double length() const;
+};
+
+class Scheduler
+{
+    public:
+        typedef std::function<void()> FinishedCallback;
+
+        Scheduler(Receiver* _receiver);
+        ~Scheduler();
+
+        bool load(const std::string& file);
+        bool start(const std::string& log_path);
+        void stop();
+        bool isRunning();
+        void setFinishedCallback(FinishedCallback cb);
+
+    private:
+        void scheduleRepetition(unsigned int rep, int64_t base);
+        void scheduleStep(unsigned int rep, size_t index, int64_t planned);
+        void runStep(unsigned int rep, size_t index, bool waits, int64_t planned, int64_t actual);
+        void sendPam(unsigned int rep, size_t index, int64_t planned, int64_t actual);
+        void advance(uint64_t token, unsigned int rep, size_t index, int64_t planned);
+        int64_t leadOf(size_t index);
+        void armPam(unsigned int rep, size_t index, int64_t planned, int64_t actual);
+        void log(unsigned int rep, size_t index, const char* event, int64_t planned, int64_t actual, int64_t done);
+        void finish(unsigned int rep, int64_t planned, int64_t actual);
+
+    private:
+        Receiver* receiver;
+        Protocol protocol;
+        TimerWheel wheel;
+        FinishedCallback on_finished;
+
+        std::ofstream log_file;
+        std::mutex log_mtx;
+
+        std::atomic<bool> running;
+        std::atomic<bool> armed;    // Camera was put in triggered mode for the next PAM step
+        std::atomic<uint64_t> waiting;  // Token of the PAM step waiting for DONE, 0 if none
+        std::atomic<uint64_t> awaited;  // Its command string
+        uint64_t tokens;
+        int64_t t0;
+        int64_t period;     // (ns)
+};
+
+
+#endif // __SCHEDULER_H__
@@ -0,0 +1,409 @@
+#include "segmentation.h"
+#include <algorithm>
+#include <iostream>
+#include <limits>
+#include <thread>
+
+// Bands narrower than this aren't worth a thread
+#define MIN_BAND_ROWS 32
+
+Segmenter::Segmenter(float _threshold, uint32_t _radius, uint32_t _min_area) :
+    threshold_fraction(_threshold), radius(_radius), min_area(_min_area), threads(0), last_threshold(0)
+{
+
+}
+
+void Segmenter::setThreshold(float _threshold)
+{
+    threshold_fraction = _threshold;
+}
+
+void Segmenter::setRadius(uint32_t _radius)
+{
+    radius = _radius;
+}
+
+void Segmenter::setMinArea(uint32_t _min_area)
+{
+    min_area = _min_area;
+}
+
+void Segmenter::setThreads(unsigned int _threads)
+{
+    threads = _threads;
+}
+
+uint32_t Segmenter::getLastThreshold()
+{
+    return last_threshold;
+}
+
+template<typename F>
+void Segmenter::parallel(const std::vector<uint32_t>& bands, F fn)
+{
+    std::vector<std::thread> pool;
+    for (size_t k = 1; k + 1 < bands.size(); k++)
+    {
+        pool.emplace_back(fn, k, bands[k], bands[k + 1]);
+    }
+    fn(0, bands[0], bands[1]);
+    for (std::thread& t : pool)
+    {
+        t.join();
+    }
+}
+
+uint32_t Segmenter::otsu(const ImageView& image)
+{
+    // 256 bins over the significant bits
+    uint32_t shift = image.bits > 8 ? image.bits - 8 : 0;
+    std::vector<uint64_t> hist(256, 0);
+    for (uint32_t y = 0; y < image.height; y++)
+    {
+        const uint8_t* row = image.data + static_cast<size_t>(y) * image.stride;
+        for (uint32_t x = 0; x < image.width; x++)
+        {
+            uint32_t v = (image.bytesPerPixel() == 2) ? reinterpret_cast<const uint16_t*>(row)[x] : row[x];
+            hist[std::min<uint32_t>(255, v >> shift)]++;
+        }
+    }
+
+    // Maximise the between class variance
+    double total = static_cast<double>(image.pixels());
+    double sum = 0.0;
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        sum += static_cast<double>(i) * hist[i];
+    }
+    double sum_b = 0.0, weight_b = 0.0, best = -1.0;
+    uint32_t level = 0;
+    for (uint32_t t = 0; t < 256; t++)
+    {
+        weight_b += hist[t];
+        double weight_f = total - weight_b;
+        if (weight_b == 0.0 || weight_f == 0.0)
+        {
+            continue;
+        }
+        sum_b += static_cast<double>(t) * hist[t];
+        double mean_b = sum_b / weight_b;
+        double mean_f = (sum - sum_b) / weight_f;
+        double between = weight_b * weight_f * (mean_b - mean_f) * (mean_b - mean_f);
+        if (between > best)
+        {
+            best = between;
+            level = t + 1;
+        }
+    }
+    return level << shift;
+}
+
+void Segmenter::threshold(const ImageView& image, uint32_t level, uint8_t* out, uint32_t y0, uint32_t y1)
+{
+    for (uint32_t y = y0; y < y1; y++)
+    {
+        const uint8_t* row = image.data + static_cast<size_t>(y) * image.stride;
+        uint8_t* o = out + static_cast<size_t>(y) * image.width;
+        if (image.bytesPerPixel() == 2)
+        {
+            const uint16_t* p = reinterpret_cast<const uint16_t*>(row);
+            for (uint32_t x = 0; x < image.width; x++)
+            {
+                o[x] = p[x] >= level;
+            }
+        }
+        else
+        {
+            for (uint32_t x = 0; x < image.width; x++)
+            {
+                o[x] = row[x] >= level;
+            }
+        }
+    }
+}
+
+// out[x] = in[x] op in[x + k] over a run, written as plain loops so they vectorise
+static inline void combine(uint8_t* out, const uint8_t* in, size_t n, bool dilate)
+{
+    if (dilate)
+    {
+        for (size_t x = 0; x < n; x++)
+        {
+            out[x] |= in[x];
+        }
+    }
+    else
+    {
+        for (size_t x = 0; x < n; x++)
+        {
+            out[x] &= in[x];
+        }
+    }
+}
+
+void Segmenter::morph(const uint8_t* in, uint8_t* out, uint32_t width, uint32_t height, uint32_t y0, uint32_t y1, bool vertical, bool dilate)
+{
+    // One direction of a separable min (erosion) or max (dilation), as a
+    // whole row combined with its shifted neighbours. The window is cut off
+    // at the image edge.
+    const int64_t r = radius;
+    for (uint32_t y = y0; y < y1; y++)
+    {
+        uint8_t* o = out + static_cast<size_t>(y) * width;
+        if (vertical)
+        {
+            int64_t top = std::max<int64_t>(0, y - r);
+            int64_t bottom = std::min<int64_t>(height - 1, y + r);
+            std::copy(in + top * width, in + (top + 1) * width, o);
+            for (int64_t yy = top + 1; yy <= bottom; yy++)
+            {
+                combine(o, in + yy * width, width, dilate);
+            }
+        }
+        else
+        {
+            const uint8_t* row = in + static_cast<size_t>(y) * width;
+            std::copy(row, row + width, o);
+            for (int64_t k = 1; k <= r && k < width; k++)
+            {
+                combine(o, row + k, width - k, dilate);     // Right neighbours
+                combine(o + k, row, width - k, dilate);     // Left neighbours
+            }
+        }
+    }
+}
+
+int32_t Segmenter::find(int32_t i)
+{
+    // Path halving
+    while (parent[i] != i)
+    {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
+
+int32_t Segmenter::findConst(int32_t i) const
+{
+    while (parent[i] != i)
+    {
+        i = parent[i];
+    }
+    return i;
+}
+
+int32_t Segmenter::unite(int32_t a, int32_t b)
+{
+    // The smaller index is the root, so a component's root is its first
+    // pixel in raster order
+    a = find(a);
+    b = find(b);
+    if (a < b)
+    {
+        parent[b] = a;
+        return a;
+    }
+    parent[a] = b;
+    return b;
+}
+
+void Segmenter::labelBand(const uint8_t* in, uint32_t width, uint32_t y0, uint32_t y1)
+{
+    for (uint32_t y = y0; y < y1; y++)
+    {
+        int32_t base = static_cast<int32_t>(y * width);
+        int32_t run_root = -1;      // Root of the run the previous pixel is in
+        for (uint32_t x = 0; x < width; x++)
+        {
+            int32_t i = base + x;
+            if (!in[i])
+            {
+                parent[i] = -1;
+                run_root = -1;
+                continue;
+            }
+
+            // Pixels along a run join its root directly, without a find
+            bool left = run_root >= 0;
+            if (left)
+            {
+                parent[i] = run_root;
+            }
+            else
+            {
+                parent[i] = i;
+                run_root = i;
+            }
+            if (y == y0)
+            {
+                continue;
+            }
+
+            // If the pixel above is set it already joins its left and right,
+            // and if the left pixel's upper neighbour is set too the two
+            // are joined already
+            int32_t up = i - width;
+            if (in[up])
+            {
+                if (!(left && in[up - 1]))
+                {
+                    run_root = unite(run_root, up);
+                }
+                continue;
+            }
+            if (x > 0 && !left && in[up - 1])
+            {
+                run_root = unite(run_root, up - 1);
+            }
+            if (x + 1 < width && in[up + 1])
+            {
+                run_root = unite(run_root, up + 1);
+            }
+        }
+    }
+}
+
+uint32_t Segmenter::segment(const ImageView& fm, std::vector<uint16_t>& labels)
+{
+    const uint32_t width = fm.width;
+    const uint32_t height = fm.height;
+    const size_t pixels = fm.pixels();
+    labels.assign(pixels, 0);
+    if (fm.data == nullptr || pixels == 0 || pixels > static_cast<size_t>(std::numeric_limits<int32_t>::max()))
+    {
+        return 0;
+    }
+
+    // Contiguous bands, one per worker
+    unsigned int workers = (threads > 0) ? threads : std::max(1u, std::thread::hardware_concurrency());
+    workers = std::max(1u, std::min(workers, height / MIN_BAND_ROWS));
+    std::vector<uint32_t> bands;
+    for (unsigned int k = 0; k <= workers; k++)
+    {
+        bands.push_back(static_cast<uint32_t>(static_cast<uint64_t>(height) * k / workers));
+    }
+
+    last_threshold = (threshold_fraction > 0.0f) ? static_cast<uint32_t>(threshold_fraction * fm.maxValue()) : otsu(fm);
+    mask.resize(pixels);
+    scratch.resize(pixels);
+    parallel(bands, [&](size_t, uint32_t y0, uint32_t y1) { threshold(fm, last_threshold, mask.data(), y0, y1); });
+
+    // Opening: erode then dilate, each as a row pass and a column pass
+    if (radius > 0)
+    {
+        for (bool dilate : {false, true})
+        {
+            parallel(bands, [&](size_t, uint32_t y0, uint32_t y1) { morph(mask.data(), scratch.data(), width, height, y0, y1, false, dilate); });
+            parallel(bands, [&](size_t, uint32_t y0, uint32_t y1) { morph(scratch.data(), mask.data(), width, height, y0, y1, true, dilate); });
+        }
+    }
+
+    // Union-find per band. Each band only writes its own pixels.
+    parent.resize(pixels);
+    parallel(bands, [&](size_t, uint32_t y0, uint32_t y1) { labelBand(mask.data(), width, y0, y1); });
+
+    // Join components across band edges
+    for (size_t k = 1; k + 1 < bands.size(); k++)
+    {
+        int32_t row = static_cast<int32_t>(bands[k] * width);
+        for (uint32_t x = 0; x < width; x++)
+        {
+            int32_t i = row + x;
+            if (!mask[i])
+            {
+                continue;
+            }
+            for (int32_t dx = -1; dx <= 1; dx++)
+            {
+                int64_t nx = static_cast<int64_t>(x) + dx;
+                if (nx >= 0 && nx < width && mask[i - width + dx])
+                {
+                    unite(i, i - width + dx);
+                }
+            }
+        }
+    }
+
+    // Roots of every pixel, read only so the bands can share the forest
+    roots.resize(pixels);
+    std::vector<uint32_t> band_roots(workers, 0);
+    parallel(bands, [&](size_t k, uint32_t y0, uint32_t y1)
+    {
+        for (size_t i = static_cast<size_t>(y0) * width; i < static_cast<size_t>(y1) * width; i++)
+        {
+            roots[i] = (parent[i] < 0) ? -1 : findConst(i);
+            band_roots[k] += (roots[i] == static_cast<int32_t>(i));
+        }
+    });
+
+    // Number the components in raster order. A root is the first pixel of
+    // its component, so it is numbered by its own band.
+    std::vector<uint32_t> first(workers, 0);
+    uint32_t components = 0;
+    for (unsigned int k = 0; k < workers; k++)
+    {
+        first[k] = components;
+        components += band_roots[k];
+    }
+    parallel(bands, [&](size_t k, uint32_t y0, uint32_t y1)
+    {
+        uint32_t next = first[k];
+        for (size_t i = static_cast<size_t>(y0) * width; i < static_cast<size_t>(y1) * width; i++)
+        {
+            if (roots[i] == static_cast<int32_t>(i))
+            {
+                parent[i] = next++;
+            }
+        }
+    });
+    parallel(bands, [&](size_t, uint32_t y0, uint32_t y1)
+    {
+        for (size_t i = static_cast<size_t>(y0) * width; i < static_cast<size_t>(y1) * width; i++)
+        {
+            if (roots[i] >= 0)
+            {
+                roots[i] = parent[roots[i]];
+            }
+        }
+    });
+
+    // Drop small components and renumber the rest
+    std::vector<uint32_t> area(components, 0);
+    for (size_t i = 0; i < pixels; i++)
+    {
+        if (roots[i] >= 0)
+        {
+            area[roots[i]]++;
+        }
+    }
+    std::vector<uint16_t> remap(components, 0);
+    uint32_t kept = 0;
+    uint32_t overflow = 0;
+    for (uint32_t c = 0; c < components; c++)
+    {
+        if (area[c] < min_area)
+        {
+            continue;
+        }
+        if (kept == std::numeric_limits<uint16_t>::max())
+        {
+            overflow++;
+            continue;
+        }
+        remap[c] = ++kept;
+    }
+    if (overflow > 0)
+    {
+        std::cout << "Segmenter: " << overflow << " components past the label limit were dropped" << std::endl;
+    }
+
+    parallel(bands, [&](size_t, uint32_t y0, uint32_t y1)
+    {
+        for (size_t i = static_cast<size_t>(y0) * width; i < static_cast<size_t>(y1) * width; i++)
+        {
+            labels[i] = (roots[i] >= 0) ? remap[roots[i]] : 0;
+        }
+    });
+    return kept;
+}
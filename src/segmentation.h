@@ -0,0 +1,75 @@
+// *****************************************************************************
+//
+// segmentation.h
+// Plant/background segmentation of an Fm frame into a label image, so that
+// ROI statistics run without hand drawn masks.
+//
+// 1. Threshold. Pixels at or above it are plant. The threshold is a fraction
+//    of full scale, or 0 to pick it with Otsu's method from the histogram.
+// 2. Opening (erosion then dilation) with a (2 * radius + 1) square, which
+//    removes specks and thin bridges between neighbouring leaves.
+// 3. 8-connected component labelling with union-find. Each thread labels a
+//    band of rows, the band edges are merged, and final labels are numbered
+//    in raster order. Components smaller than min_area are dropped.
+//
+// Labels are 1..n with 0 for background. Past 65535 components the rest are
+// dropped too.
+//
+// *****************************************************************************
+
+
+#ifndef __SEGMENTATION_H__
+#define __SEGMENTATION_H__
+
+#include <cstdint>
+#include <vector>
+
+#include "fluorescence.h"
+
+#define DEFAULT_SEGMENT_THRESHOLD 0.0f  // 0 for Otsu
+#define DEFAULT_SEGMENT_RADIUS 1        // (px) of the opening
+#define DEFAULT_SEGMENT_MIN_AREA 50     // (px) smaller components are dropped
+
+class Segmenter
+{
+    public:
+        Segmenter(float _threshold = DEFAULT_SEGMENT_THRESHOLD, uint32_t _radius = DEFAULT_SEGMENT_RADIUS, uint32_t _min_area = DEFAULT_SEGMENT_MIN_AREA);
+
+        void setThreshold(float _threshold);
+        void setRadius(uint32_t _radius);
+        void setMinArea(uint32_t _min_area);
+        void setThreads(unsigned int _threads);     // 0 uses every core
+
+        // labels becomes width * height. Returns the number of components.
+        uint32_t segment(const ImageView& fm, std::vector<uint16_t>& labels);
+
+        // Raw value the last frame was thresholded at
+        uint32_t getLastThreshold();
+
+    private:
+        uint32_t otsu(const ImageView& image);
+        void threshold(const ImageView& image, uint32_t level, uint8_t* mask, uint32_t y0, uint32_t y1);
+        void morph(const uint8_t* in, uint8_t* out, uint32_t width, uint32_t height, uint32_t y0, uint32_t y1, bool vertical, bool dilate);
+        void labelBand(const uint8_t* mask, uint32_t width, uint32_t y0, uint32_t y1);
+        int32_t find(int32_t i);
+        int32_t findConst(int32_t i) const;
+        int32_t unite(int32_t a, int32_t b);     // Returns the joined root
+
+        // Runs fn(band, y0, y1) on each band of rows, one thread per band
+        template<typename F>
+        void parallel(const std::vector<uint32_t>& bands, F fn);
+
+    private:
+        float threshold_fraction;
+        uint32_t radius;
+        uint32_t min_area;
+        unsigned int threads;
+        uint32_t last_threshold;
+        std::vector<uint8_t> mask;
+        std::vector<uint8_t> scratch;
+        std::vector<int32_t> parent;    // Union-find over pixel indexes, -1 for background
+        std::vector<int32_t> roots;     // Root of each pixel, then its component
+};
+
+
+#endif // __SEGMENTATION_H__
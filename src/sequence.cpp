@@ -0,0 +1,242 @@
+#include "sequence.h"
+#include <sstream>
+#include <algorithm>
+#include <map>
+
+bool Sequence::parse(const std::string& str, std::vector<SerialCommand>& cmds)
+{
+    cmds.clear();
+
+    std::stringstream ss(str);
+    long action, time, value;
+    while (ss >> action)
+    {
+        if (!(ss >> time >> value) || action < 0 || time < 0 || value < 0)
+        {
+            cmds.clear();
+            return false;
+        }
+        cmds.push_back({static_cast<int>(action), static_cast<uint32_t>(time), static_cast<uint32_t>(value)});
+    }
+
+    // Anything left over that isn't a number is malformed
+    return ss.eof() && !cmds.empty();
+}
+
+uint32_t Sequence::duration(const std::vector<SerialCommand>& cmds)
+{
+    uint32_t end = 0;
+    for (auto& c : cmds)
+    {
+        uint32_t t = c.time;
+        if (c.action == ACTION_PULSE)
+        {
+            t += (c.value + 999) / 1000;
+        }
+        end = std::max(end, t);
+    }
+    return end;
+}
+
+unsigned int Sequence::triggerCount(const std::vector<SerialCommand>& cmds)
+{
+    return std::count_if(cmds.begin(), cmds.end(), [](const SerialCommand& c) { return c.action == ACTION_TRIGGER; });
+}
+
+std::vector<double> Sequence::triggerTimes(const std::vector<SerialCommand>& cmds)
+{
+    std::vector<double> times;
+    for (auto& c : cmds)
+    {
+        if (c.action == ACTION_TRIGGER)
+        {
+            times.push_back(c.time);
+        }
+    }
+    std::sort(times.begin(), times.end());
+    return times;
+}
+
+// Commands in time order, triggers after the LED commands of the same
+// millisecond so a flash and its trigger go together
+static std::vector<SerialCommand> timeOrder(const std::vector<SerialCommand>& cmds)
+{
+    std::vector<SerialCommand> sorted = cmds;
+    std::stable_sort(sorted.begin(), sorted.end(), [](const SerialCommand& a, const SerialCommand& b)
+    {
+        if (a.time != b.time)
+        {
+            return a.time < b.time;
+        }
+        return (a.action != ACTION_TRIGGER) && (b.action == ACTION_TRIGGER);
+    });
+    return sorted;
+}
+
+std::vector<int> Sequence::frameRoles(const std::vector<SerialCommand>& cmds)
+{
+    std::vector<SerialCommand> sorted = timeOrder(cmds);
+    std::vector<int> roles;
+    bool light_adapted = false;     // Actinic light has been on
+    uint32_t torch = 0;
+    double pulse_start = -1.0, pulse_end = -1.0;
+    bool saturating = false;
+    for (auto& c : sorted)
+    {
+        switch (c.action)
+        {
+            case ACTION_TORCH:
+                torch = c.value;
+                light_adapted = light_adapted || torch > 0;
+                break;
+
+            case ACTION_PULSE:
+                pulse_start = c.time;
+                pulse_end = c.time + c.value / 1000.0;
+                saturating = c.value >= SATURATING_PULSE_MIN;
+                break;
+
+            case ACTION_TRIGGER:
+            {
+                bool in_pulse = c.time >= pulse_start && c.time < pulse_end;
+                if (in_pulse && saturating)
+                {
+                    roles.push_back(light_adapted ? FRAME_FMP : FRAME_FM);
+                }
+                else if (in_pulse || c.time == pulse_start)
+                {
+                    roles.push_back(light_adapted ? FRAME_FP : FRAME_F0);
+                }
+                else
+                {
+                    roles.push_back(torch > 0 ? FRAME_ACTINIC : FRAME_DARK);
+                }
+                break;
+            }
+
+            default:
+                break;
+        }
+    }
+    return roles;
+}
+
+std::vector<uint32_t> Sequence::actinicLevels(const std::vector<SerialCommand>& cmds)
+{
+    // Time spent at each torch setting since the last saturating pulse. The
+    // light goes off briefly around each pulse, so the longest wins.
+    std::vector<SerialCommand> sorted = timeOrder(cmds);
+    std::map<uint32_t, uint64_t> exposure;
+    auto longest = [&exposure](uint32_t fallback)
+    {
+        uint32_t level = fallback;
+        uint64_t best = 0;
+        for (auto& e : exposure)
+        {
+            if (e.second > best)
+            {
+                best = e.second;
+                level = e.first;
+            }
+        }
+        return level;
+    };
+
+    std::vector<uint32_t> levels;
+    uint32_t torch = 0;
+    uint32_t since = 0;
+    uint32_t pulse_level = 0;
+    double pulse_end = -1.0;
+    for (auto& c : sorted)
+    {
+        exposure[torch] += c.time - since;
+        since = c.time;
+        switch (c.action)
+        {
+            case ACTION_TORCH:
+                torch = c.value;
+                break;
+
+            case ACTION_PULSE:
+                if (c.value >= SATURATING_PULSE_MIN)
+                {
+                    pulse_level = longest(torch);
+                    pulse_end = c.time + c.value / 1000.0;
+                    exposure.clear();
+                }
+                break;
+
+            case ACTION_TRIGGER:
+                levels.push_back((c.time < pulse_end) ? pulse_level : longest(torch));
+                break;
+
+            default:
+                break;
+        }
+    }
+    return levels;
+}
+
+// One measuring flash and saturating pulse pair starting at time, laid out
+// as in protocol.txt. Returns the time the pulse ends.
+static uint32_t addPulsePair(const PamSettings& settings, uint32_t time, std::vector<SerialCommand>& cmds)
+{
+    uint32_t pulse_ms = (settings.saturating_pulse + 999) / 1000;
+    cmds.push_back({ACTION_DAC, time, settings.measuring_dac});
+    cmds.push_back({ACTION_PULSE, time + 100, settings.measuring_pulse});
+    cmds.push_back({ACTION_TRIGGER, time + 100, 0});
+    cmds.push_back({ACTION_DAC, time + 199, settings.saturating_dac});
+    cmds.push_back({ACTION_PULSE, time + 200, settings.saturating_pulse});
+    cmds.push_back({ACTION_TRIGGER, time + 200 + pulse_ms * 3 / 4, 0});     // Past the rise of the fluorescence
+    return time + 200 + pulse_ms;
+}
+
+std::vector<SerialCommand> Sequence::build(const PamSettings& settings)
+{
+    std::vector<SerialCommand> cmds;
+
+    // Dark adapted: background, F0 and Fm
+    cmds.push_back({ACTION_TRIGGER, 0, 0});
+    uint32_t time = addPulsePair(settings, 0, cmds);
+
+    // The pair takes the actinic light off for its length
+    const uint32_t pair_ms = 200 + (settings.saturating_pulse + 999) / 1000;
+    for (auto& phase : settings.phases)
+    {
+        uint32_t start = time + 100;
+        uint32_t end = start + phase.duration;
+        cmds.push_back({ACTION_TORCH, start, phase.dac});
+        time = start;
+        if (phase.pulse_interval > pair_ms)
+        {
+            for (uint32_t t = start + phase.pulse_interval - pair_ms; t + pair_ms <= end; t += phase.pulse_interval)
+            {
+                if (phase.dac > 0)
+                {
+                    cmds.push_back({ACTION_TORCH, t, 0});
+                }
+                time = addPulsePair(settings, t, cmds);
+                if (phase.dac > 0 && time < end)
+                {
+                    cmds.push_back({ACTION_TORCH, time, phase.dac});
+                }
+            }
+        }
+        time = std::max(time, end);
+    }
+    if (!settings.phases.empty())
+    {
+        cmds.push_back({ACTION_TORCH, time, 0});
+    }
+    return cmds;
+}
+
+std::string Sequence::format(const std::vector<SerialCommand>& cmds)
+{
+    std::stringstream ss;
+    for (size_t i = 0; i < cmds.size(); i++)
+    {
+        ss << (i > 0 ? " " : "") << cmds[i].action << " " << cmds[i].time << " " << cmds[i].value;
+    }
+    return ss.str();
+}
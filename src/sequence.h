@@ -0,0 +1,112 @@
+// *****************************************************************************
+//
+// sequence.h
+// Parsing of the LED controller command strings.
+//
+// A command string is a list of "action time value" triplets, e.g. the first
+// line of protocol.txt:
+//
+//     1 0 800    5 0 0   2 100 512 ...
+//
+// Times are in milliseconds from the start of the sequence. The actions the
+// current firmware understands are listed below.
+//
+// Sequence::build writes the string for a quenching analysis: the Fv/Fm
+// block of protocol.txt (dark frame, F0 under a measuring flash, Fm during a
+// saturating pulse), then actinic phases with a saturating pulse every
+// pulse_interval. For each pulse the actinic light goes off, F' is taken
+// under a measuring flash and Fm' during the pulse, and the light comes
+// back on. frameRoles() tells the frames of any command string apart from
+// the LED state at each trigger.
+//
+// *****************************************************************************
+
+
+#ifndef __SEQUENCE_H__
+#define __SEQUENCE_H__
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+enum SerialAction
+{
+    ACTION_TORCH = 0,       // Continuous LED, value is the DAC setting
+    ACTION_DAC = 1,         // Set the LED DAC for the following pulses
+    ACTION_PULSE = 2,       // LED pulse, value is its length (us)
+    ACTION_TRIGGER = 5      // Camera trigger (one frame)
+};
+
+struct SerialCommand
+{
+    int action;
+    uint32_t time;      // (ms)
+    uint32_t value;
+};
+
+// What a frame of a sequence shows
+enum FrameRole
+{
+    FRAME_DARK = 0,     // No light, background for the others
+    FRAME_F0,           // Measuring flash, dark adapted
+    FRAME_FM,           // Saturating pulse, dark adapted
+    FRAME_FP,           // F', measuring flash after actinic light
+    FRAME_FMP,          // Fm', saturating pulse after actinic light
+    FRAME_ACTINIC       // Actinic light only
+};
+
+// Pulses at least this long are saturating, shorter ones measuring flashes
+#define SATURATING_PULSE_MIN 50000  // (us)
+
+#define DEFAULT_MEASURING_DAC 800
+#define DEFAULT_MEASURING_PULSE 512         // (us)
+#define DEFAULT_SATURATING_DAC 2500
+#define DEFAULT_SATURATING_PULSE 400000     // (us)
+
+struct ActinicPhase
+{
+    uint32_t duration;          // (ms)
+    uint32_t dac;               // Torch setting, 0 for a dark recovery phase
+    uint32_t pulse_interval;    // (ms) between saturating pulses
+};
+
+struct PamSettings
+{
+    uint32_t measuring_dac = DEFAULT_MEASURING_DAC;
+    uint32_t measuring_pulse = DEFAULT_MEASURING_PULSE;
+    uint32_t saturating_dac = DEFAULT_SATURATING_DAC;
+    uint32_t saturating_pulse = DEFAULT_SATURATING_PULSE;
+    std::vector<ActinicPhase> phases;   // None for a plain Fv/Fm sequence
+};
+
+namespace Sequence
+{
+    // Returns false if the string isn't a whole number of triplets
+    bool parse(const std::string& str, std::vector<SerialCommand>& cmds);
+
+    // Time from the start of the sequence until the last command (including
+    // the length of the last LED pulse) has finished (ms)
+    uint32_t duration(const std::vector<SerialCommand>& cmds);
+
+    // Number of camera triggers in the sequence
+    unsigned int triggerCount(const std::vector<SerialCommand>& cmds);
+
+    // Camera trigger times in ascending order (ms)
+    std::vector<double> triggerTimes(const std::vector<SerialCommand>& cmds);
+
+    // FrameRole of each trigger, in trigger order
+    std::vector<int> frameRoles(const std::vector<SerialCommand>& cmds);
+
+    // Torch setting each frame's sample was adapted to: the one on for
+    // longest before the saturating pulse the frame belongs to, 0 for dark
+    std::vector<uint32_t> actinicLevels(const std::vector<SerialCommand>& cmds);
+
+    // Commands for a dark adapted Fv/Fm followed by the actinic phases
+    std::vector<SerialCommand> build(const PamSettings& settings);
+
+    // Command string the controller takes, the inverse of parse()
+    std::string format(const std::vector<SerialCommand>& cmds);
+}
+
+
+#endif // __SEQUENCE_H__
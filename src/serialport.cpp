@@ -0,0 +1,331 @@
+#include "serialport.h"
+#include "metrics.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+SerialPort& SerialPort::instance()
+{
+    static SerialPort port;
+    return port;
+}
+
+SerialPort::SerialPort() :
+    target(DEFAULT_LED_TARGET), next_id(0), replies(false)
+{
+    const char* env = getenv("PAM_LED");
+    if (env != nullptr && *env != 0)
+    {
+        target = env;
+    }
+}
+
+SerialPort::~SerialPort()
+{
+    close();
+}
+
+int64_t SerialPort::now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool SerialPort::open(const std::string& _target)
+{
+    std::lock_guard<std::mutex> lock(port_mtx);
+    if (transport && _target == target && !transport->isBroken())
+    {
+        return true;
+    }
+    closePort();
+    target = _target;
+    return openPort();
+}
+
+void SerialPort::close()
+{
+    std::lock_guard<std::mutex> lock(port_mtx);
+    closePort();
+}
+
+bool SerialPort::isOpen()
+{
+    std::lock_guard<std::mutex> lock(port_mtx);
+    return transport && !transport->isBroken();
+}
+
+std::string SerialPort::getTarget()
+{
+    std::lock_guard<std::mutex> lock(port_mtx);
+    return target;
+}
+
+bool SerialPort::hasReplies()
+{
+    return replies;
+}
+
+bool SerialPort::openPort()
+{
+    std::string error;
+    std::unique_ptr<LedTransport> t = LedTransport::create(target, error);
+    if (!t)
+    {
+        std::cout << "Serial: " << error << std::endl;
+        return false;
+    }
+
+    line.clear();
+    replies = false;
+    if (!t->open([this](const char* data, size_t n) { receive(data, n); }))
+    {
+        return false;
+    }
+    std::cout << "Serial: LED controller on " << target << " (" << t->name() << ")" << std::endl;
+    transport = std::move(t);
+    return true;
+}
+
+void SerialPort::closePort()
+{
+    if (transport)
+    {
+        transport->close();
+        transport.reset();
+    }
+    dropAll("port closed");
+}
+
+uint64_t SerialPort::send(std::string str, Completion done)
+{
+    static Counter* sent = Metrics::instance().counter("pam_serial_commands_total", "Command strings sent to the LED controller");
+    static Counter* failed = Metrics::instance().counter("pam_serial_errors_total", "Command strings that could not be sent");
+
+    // Make sure str is terminated with "\r\n"
+    if (str.find("\r\n") == std::string::npos)
+    {
+        str.erase(std::remove(str.begin(), str.end(), '\n'), str.cend());
+        str.erase(std::remove(str.begin(), str.end(), '\r'), str.cend());
+        str.append("\r\n");
+    }
+
+    std::lock_guard<std::mutex> lock(port_mtx);
+    if (transport && transport->isBroken())
+    {
+        closePort();
+    }
+    if (!transport && !openPort())
+    {
+        failed->inc();
+        return 0;
+    }
+
+    // Queued before writing, so a quick reply always finds it
+    uint64_t id;
+    std::vector<Pending> dropped;
+    {
+        std::lock_guard<std::mutex> plock(mtx);
+        id = ++next_id;
+        pending.push_back({id, now(), false, done});
+        while (pending.size() > SERIAL_MAX_PENDING)
+        {
+            dropped.push_back(std::move(pending.front()));
+            pending.pop_front();
+        }
+    }
+    for (const Pending& p : dropped)
+    {
+        complete(p, {SerialEvent::DROPPED, p.id, p.sent_ns, now(), "never answered"});
+    }
+
+    if (!transport->write(str))
+    {
+        std::cout << "Serial: write to " << target << " failed" << std::endl;
+        failed->inc();
+        std::lock_guard<std::mutex> plock(mtx);
+        auto it = std::find_if(pending.begin(), pending.end(), [id](const Pending& p) { return p.id == id; });
+        if (it != pending.end())
+        {
+            pending.erase(it);
+        }
+        cv.notify_all();
+        return 0;
+    }
+    sent->inc();
+
+    std::lock_guard<std::mutex> plock(mtx);
+    auto it = std::find_if(pending.begin(), pending.end(), [id](const Pending& p) { return p.id == id; });
+    if (it != pending.end() && !it->acked)
+    {
+        it->sent_ns = now();
+    }
+    return id;
+}
+
+void SerialPort::forget(uint64_t id)
+{
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        for (Pending& p : pending)
+        {
+            if (p.id == id)
+            {
+                p.done = nullptr;
+            }
+        }
+    }
+
+    // A completion taken off the list just before may still be running
+    std::lock_guard<std::mutex> lock(done_mtx);
+}
+
+bool SerialPort::waitDone(uint64_t id, int timeout_ms)
+{
+    std::unique_lock<std::mutex> lock(mtx);
+    return cv.wait_for(lock, std::chrono::milliseconds(timeout_ms), [this, id]()
+    {
+        return std::none_of(pending.begin(), pending.end(), [id](const Pending& p) { return p.id == id; });
+    });
+}
+
+void SerialPort::setEventCallback(Completion cb)
+{
+    std::lock_guard<std::mutex> lock(done_mtx);
+    on_event = cb;
+}
+
+void SerialPort::complete(const Pending& p, const SerialEvent& e)
+{
+    if (p.done)
+    {
+        std::lock_guard<std::mutex> lock(done_mtx);
+        p.done(e);
+    }
+}
+
+void SerialPort::dropAll(const std::string& reason)
+{
+    std::deque<Pending> dropped;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        dropped.swap(pending);
+        cv.notify_all();
+    }
+    for (const Pending& p : dropped)
+    {
+        complete(p, {SerialEvent::DROPPED, p.id, p.sent_ns, now(), reason});
+    }
+}
+
+void SerialPort::handleLine(const std::string& reply, int64_t at)
+{
+    static Counter* acks = Metrics::instance().counter("pam_serial_acks_total", "Command strings the LED controller accepted");
+    static Counter* dones = Metrics::instance().counter("pam_serial_done_total", "Sequences the LED controller reported finished");
+    static Counter* rejected = Metrics::instance().counter("pam_serial_rejected_total", "Command strings the LED controller rejected");
+    static Counter* unmatched = Metrics::instance().counter("pam_serial_unmatched_total", "Replies with no command string waiting for them");
+    static Counter* events = Metrics::instance().counter("pam_serial_events_total", "EVENT lines from the LED controller");
+    static MetricsHistogram* ack_ms = Metrics::instance().histogram("pam_serial_ack_ms", "Time from the end of a command string to its OK",
+        {1.0, 2.0, 5.0, 10.0, 20.0, 50.0, 100.0, 250.0, 1000.0});
+    static MetricsHistogram* done_ms = Metrics::instance().histogram("pam_serial_done_ms", "Time from the end of a command string to its DONE",
+        {10.0, 100.0, 1000.0, 5000.0, 10000.0, 60000.0, 300000.0, 1800000.0});
+
+    std::string word = reply.substr(0, reply.find(' '));
+    int kind;
+    if (word == "OK")
+    {
+        kind = SerialEvent::ACK;
+    }
+    else if (word == "DONE")
+    {
+        kind = SerialEvent::DONE;
+    }
+    else if (word == "ERR")
+    {
+        kind = SerialEvent::ERROR;
+    }
+    else if (word == "EVENT")
+    {
+        events->inc();
+        std::lock_guard<std::mutex> lock(done_mtx);
+        if (on_event)
+        {
+            on_event({SerialEvent::EVENT, 0, at, at, reply});
+        }
+        else
+        {
+            std::cout << "Serial: " << reply << std::endl;
+        }
+        return;
+    }
+    else
+    {
+        std::cout << "Serial: " << reply << std::endl;
+        return;
+    }
+    replies = true;
+
+    Pending finished = {0, 0, false, nullptr};
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto it = std::find_if(pending.begin(), pending.end(), [kind](const Pending& p) { return p.acked == (kind == SerialEvent::DONE); });
+        if (it == pending.end())
+        {
+            unmatched->inc();
+            std::cout << "Serial: unexpected reply '" << reply << "'" << std::endl;
+            return;
+        }
+
+        double ms = (at - it->sent_ns) / 1e6;
+        if (kind == SerialEvent::ACK)
+        {
+            it->acked = true;
+            acks->inc();
+            ack_ms->observe(ms);
+            return;
+        }
+
+        if (kind == SerialEvent::DONE)
+        {
+            dones->inc();
+            done_ms->observe(ms);
+        }
+        else
+        {
+            rejected->inc();
+            std::cout << "Serial: command string " << it->id << " rejected: " << reply << std::endl;
+        }
+        finished = std::move(*it);
+        pending.erase(it);
+        cv.notify_all();
+    }
+    complete(finished, {kind, finished.id, finished.sent_ns, at, reply});
+}
+
+void SerialPort::receive(const char* data, size_t n)
+{
+    if (data == nullptr)
+    {
+        dropAll("port went away");
+        return;
+    }
+
+    int64_t at = now();
+    for (size_t k = 0; k < n; k++)
+    {
+        char c = data[k];
+        if (c == '\n' || c == '\r')
+        {
+            if (!line.empty())
+            {
+                handleLine(line, at);
+                line.clear();
+            }
+        }
+        else if (line.size() < SERIAL_LINE_MAX)
+        {
+            line.push_back(c);
+        }
+    }
+}
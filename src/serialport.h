@@ -0,0 +1,132 @@
+// *****************************************************************************
+//
+// serialport.h
+// Link to the LED controller. The link stays open, commands are written from
+// the caller's thread and the transport's reader hands over the controller's
+// replies, one per line:
+//
+//     OK [n]        command string accepted (n commands parsed)
+//     DONE          the sequence has finished
+//     ERR [reason]  command string rejected
+//     EVENT [what]  something happened at the controller, unprompted (e.g.
+//                   its trigger input fired)
+//
+// The controller handles one command string at a time, so replies are
+// matched to sent strings in order: OK to the oldest one not yet accepted,
+// DONE to the oldest accepted one. Send to OK and send to DONE times go to
+// metrics. EVENT lines go to the event callback instead. Firmware that
+// doesn't reply still works, nothing is ever acked
+// and hasReplies() stays false so callers keep to their fixed timing.
+//
+// The transport comes from the target string (see ledtransport.h): the
+// PAM_LED environment variable, or DEFAULT_LED_TARGET, until open() picks
+// another one. Other lines are logged. The link is reopened on the next send
+// after it goes away.
+//
+// *****************************************************************************
+
+
+#ifndef __SERIALPORT_H__
+#define __SERIALPORT_H__
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "ledtransport.h"
+
+#define SERIAL_MAX_PENDING 64       // Unanswered command strings kept for matching
+#define SERIAL_LINE_MAX 256         // Longer reply lines are cut
+
+struct SerialEvent
+{
+    enum KIND
+    {
+        ACK,
+        DONE,
+        ERROR,
+        DROPPED,    // Never answered, the port closed or too many were pending
+        EVENT       // Not for a command string, id is 0
+    };
+
+    int kind;
+    uint64_t id;            // Of the command string
+    int64_t sent_ns;        // steady_clock
+    int64_t at_ns;
+    std::string text;       // Reply line
+};
+
+class SerialPort
+{
+    public:
+        typedef std::function<void(const SerialEvent&)> Completion;
+
+        static SerialPort& instance();
+        ~SerialPort();
+
+        bool open(const std::string& _target);
+        void close();
+        bool isOpen();
+        std::string getTarget();
+
+        // Appends "\r\n" if missing and writes the whole string. Returns the
+        // id of the command string, 0 if it couldn't be sent. done is called
+        // on the reader thread with its DONE, ERROR or DROPPED event.
+        uint64_t send(std::string str, Completion done = nullptr);
+
+        // Drops the completion of a command string. Once this returns it
+        // won't be called.
+        void forget(uint64_t id);
+
+        // Blocks until the command string is done, rejected or dropped
+        bool waitDone(uint64_t id, int timeout_ms);
+
+        // The controller has answered at least once since the port opened
+        bool hasReplies();
+
+        // Called on the reader thread for every EVENT line, null to stop.
+        // Once this returns the previous callback won't be called.
+        void setEventCallback(Completion cb);
+
+    private:
+        SerialPort();
+
+        struct Pending
+        {
+            uint64_t id;
+            int64_t sent_ns;
+            bool acked;
+            Completion done;
+        };
+
+        bool openPort();
+        void closePort();
+        void receive(const char* data, size_t n);
+        void handleLine(const std::string& reply, int64_t at);
+        void dropAll(const std::string& reason);
+        void complete(const Pending& p, const SerialEvent& e);
+
+        static int64_t now();
+
+    private:
+        std::string target;
+        std::unique_ptr<LedTransport> transport;
+        std::string line;       // Reply being read
+
+        std::mutex port_mtx;    // Opening, closing and writing
+        std::mutex mtx;         // Pending list
+        std::mutex done_mtx;    // Held while a completion or on_event runs
+        Completion on_event;
+        std::condition_variable cv;
+        std::deque<Pending> pending;
+        uint64_t next_id;
+        std::atomic<bool> replies;
+};
+
+
+#endif // __SERIALPORT_H__
@@ -0,0 +1,506 @@
+#include "sessionwriter.h"
+#include "metrics.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+
+static uint64_t alignUp(uint64_t n)
+{
+    return (n + SESSION_ALIGN - 1) / SESSION_ALIGN * SESSION_ALIGN;
+}
+
+static uint64_t alignDown(uint64_t n)
+{
+    return n / SESSION_ALIGN * SESSION_ALIGN;
+}
+
+SessionWriter::SessionWriter(uint32_t _depth, uint32_t _sync_every) :
+    fd(-1),
+    direct(false),
+    use_uring(false),
+    depth(std::max(1u, _depth)),
+    sync_every(std::max(1u, _sync_every)),
+    chunk(DEFAULT_SESSION_CHUNK),
+    allocated(0),
+    next_offset(0),
+    pool(depth),
+    running(false),
+    failed(false),
+    queued_total(0),
+    completed_total(0),
+    synced_total(0),
+    sync_target(0),
+    bytes_written(0),
+    dropped(0)
+{
+
+}
+
+SessionWriter::~SessionWriter()
+{
+    close();
+    releaseSlots();
+}
+
+void SessionWriter::releaseSlots()
+{
+    for (auto& slot : pool)
+    {
+        free(slot.data);
+        slot.data = nullptr;
+        slot.capacity = 0;
+    }
+}
+
+bool SessionWriter::open(const std::string& file, uint64_t _chunk)
+{
+    if (fd >= 0)
+    {
+        return false;
+    }
+
+    // O_DIRECT isn't supported everywhere (tmpfs, some FUSE mounts)
+    fd = ::open(file.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+    direct = fd >= 0;
+    if (fd < 0 && errno == EINVAL)
+    {
+        fd = ::open(file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    }
+    if (fd < 0)
+    {
+        std::cout << "SessionWriter: unable to open " << file << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    path = file;
+    chunk = alignUp(std::max<uint64_t>(_chunk, SESSION_ALIGN));
+    allocated = 0;
+    failed = false;
+    queued_total = completed_total = synced_total = sync_target = 0;
+    bytes_written = 0;
+    dropped = 0;
+
+    // Header block, written synchronously
+    uint8_t* block = nullptr;
+    if (posix_memalign(reinterpret_cast<void**>(&block), SESSION_ALIGN, SESSION_ALIGN) != 0)
+    {
+        ::close(fd);
+        fd = -1;
+        return false;
+    }
+    memset(block, 0, SESSION_ALIGN);
+    SessionHeader header;
+    header.magic = SESSION_MAGIC;
+    header.version = SESSION_VERSION;
+    header.header_size = SESSION_ALIGN;
+    header.align = SESSION_ALIGN;
+    header.created_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    memcpy(block, &header, sizeof(header));
+
+    bool ok = reserve(SESSION_ALIGN) && pwrite(fd, block, SESSION_ALIGN, 0) == SESSION_ALIGN;
+    free(block);
+    if (!ok)
+    {
+        std::cout << "SessionWriter: unable to write " << file << ": " << strerror(errno) << std::endl;
+        ::close(fd);
+        fd = -1;
+        return false;
+    }
+    next_offset = SESSION_ALIGN;
+
+    use_uring = false;
+#ifdef PAM_HAVE_LIBURING
+    use_uring = io_uring_queue_init(depth, &ring, 0) == 0;
+#endif
+
+    free_slots.clear();
+    for (auto& slot : pool)
+    {
+        free_slots.push_back(&slot);
+    }
+
+    running = true;
+    thread = std::thread(&SessionWriter::run, this);
+
+    std::cout << "SessionWriter: " << file << " (" << getBackend() << (direct ? ", O_DIRECT" : "") << ")" << std::endl;
+    return true;
+}
+
+void SessionWriter::close()
+{
+    if (fd < 0)
+    {
+        return;
+    }
+
+    flush();
+
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        running = false;
+    }
+    work_cv.notify_all();
+    if (thread.joinable())
+    {
+        thread.join();
+    }
+
+#ifdef PAM_HAVE_LIBURING
+    if (use_uring)
+    {
+        io_uring_queue_exit(&ring);
+    }
+#endif
+
+    // Give back the unused part of the last chunk
+    if (ftruncate(fd, next_offset) != 0)
+    {
+        std::cout << "SessionWriter: unable to trim " << path << ": " << strerror(errno) << std::endl;
+    }
+    fsync(fd);
+    ::close(fd);
+    fd = -1;
+}
+
+bool SessionWriter::isOpen()
+{
+    return fd >= 0;
+}
+
+void SessionWriter::setCompletionCallback(CompletionCallback cb)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    on_complete = cb;
+}
+
+const char* SessionWriter::getBackend()
+{
+    return use_uring ? "io_uring" : "pwrite";
+}
+
+bool SessionWriter::isDirect()
+{
+    return direct;
+}
+
+uint64_t SessionWriter::getBytesWritten()
+{
+    return bytes_written;
+}
+
+uint64_t SessionWriter::getDropped()
+{
+    return dropped;
+}
+
+bool SessionWriter::write(FrameHeader header, const uint8_t* data, uint32_t size, bool wait)
+{
+    static Counter* dropped_total = Metrics::instance().counter("pam_session_dropped_total", "Frames dropped because every session write buffer was busy");
+
+    std::unique_lock<std::mutex> lock(mtx);
+    if (fd < 0 || failed)
+    {
+        return false;
+    }
+
+    if (free_slots.empty())
+    {
+        if (!wait)
+        {
+            dropped++;
+            dropped_total->inc();
+            return false;
+        }
+        done_cv.wait(lock, [this]() { return !free_slots.empty() || failed; });
+        if (failed)
+        {
+            return false;
+        }
+    }
+
+    Slot* slot = free_slots.back();
+    free_slots.pop_back();
+    lock.unlock();
+
+    // Buffers only grow, so after the first frame this never allocates
+    uint64_t record = alignUp(sizeof(FrameHeader) + size);
+    if (slot->capacity < record)
+    {
+        free(slot->data);
+        slot->data = nullptr;
+        slot->capacity = 0;
+        if (posix_memalign(reinterpret_cast<void**>(&slot->data), SESSION_ALIGN, record) != 0)
+        {
+            // Nothing was placed in the file yet, so only this frame is lost
+            std::cout << "SessionWriter: out of memory for a " << record << " byte record" << std::endl;
+            lock.lock();
+            free_slots.push_back(slot);
+            dropped++;
+            dropped_total->inc();
+            done_cv.notify_all();
+            return false;
+        }
+        slot->capacity = record;
+    }
+
+    header.magic = FRAME_MAGIC;
+    header.record_size = static_cast<uint32_t>(record);
+    header.data_size = size;
+    memcpy(slot->data, &header, sizeof(header));
+    memcpy(slot->data + sizeof(header), data, size);
+    memset(slot->data + sizeof(header) + size, 0, record - sizeof(header) - size);
+    slot->size = record;
+    slot->queued = std::chrono::steady_clock::now();
+
+    // The offset is taken with the enqueue, so records stay in queue order
+    // whatever order the writes complete in, and a frame that loses the race
+    // with close() leaves no hole behind
+    lock.lock();
+    if (!running || failed)
+    {
+        free_slots.push_back(slot);
+        done_cv.notify_all();
+        return false;
+    }
+    slot->offset = next_offset;
+    next_offset += record;
+    queue.push_back(slot);
+    queued_total++;
+    lock.unlock();
+    work_cv.notify_one();
+
+    return true;
+}
+
+bool SessionWriter::flush(unsigned int timeout_ms)
+{
+    std::unique_lock<std::mutex> lock(mtx);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    uint64_t target = queued_total;
+    sync_target = std::max(sync_target, target);
+    work_cv.notify_one();
+    auto done = [this, target]() { return synced_total >= target || failed; };
+    if (timeout_ms == 0)
+    {
+        done_cv.wait(lock, done);
+    }
+    else if (!done_cv.wait_for(lock, std::chrono::milliseconds(timeout_ms), done))
+    {
+        return false;
+    }
+    return !failed;
+}
+
+uint64_t SessionWriter::getPending()
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    return queued_total - completed_total;
+}
+
+bool SessionWriter::reserve(uint64_t end)
+{
+    // Grow a chunk at a time so the filesystem isn't updating the size on
+    // every record
+    if (end <= allocated)
+    {
+        return true;
+    }
+
+    // Not posix_fallocate, which falls back to writing zeros. Filesystems
+    // without fallocate just grow as we write.
+    uint64_t target = (end + chunk - 1) / chunk * chunk;
+    if (fallocate(fd, 0, allocated, target - allocated) != 0 && errno != EOPNOTSUPP)
+    {
+        return false;
+    }
+    allocated = target;
+    return true;
+}
+
+bool SessionWriter::writeSlot(Slot* slot, size_t done)
+{
+    while (done < slot->size)
+    {
+        ssize_t n = pwrite(fd, slot->data + done, slot->size - done, slot->offset + done);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return false;
+        }
+
+        // O_DIRECT needs the rest to start on a block again, the part of the
+        // block already written is simply written twice
+        size_t next = direct ? alignDown(done + n) : done + n;
+        if (next == done)
+        {
+            return false;
+        }
+        done = next;
+    }
+    return true;
+}
+
+bool SessionWriter::writeBatch(std::vector<Slot*>& batch)
+{
+#ifdef PAM_HAVE_LIBURING
+    if (use_uring)
+    {
+        // Everything in the batch goes in flight at once, the device can
+        // merge and reorder them
+        unsigned int submitted = 0;
+        for (Slot* slot : batch)
+        {
+            struct io_uring_sqe* sqe = io_uring_get_sqe(&ring);
+            if (sqe == nullptr)
+            {
+                break;
+            }
+            io_uring_prep_write(sqe, fd, slot->data, slot->size, slot->offset);
+            io_uring_sqe_set_data(sqe, slot);
+            submitted++;
+        }
+        io_uring_submit(&ring);
+
+        bool ok = submitted == batch.size();
+        for (unsigned int i = 0; i < submitted; i++)
+        {
+            struct io_uring_cqe* cqe = nullptr;
+            if (io_uring_wait_cqe(&ring, &cqe) != 0)
+            {
+                return false;
+            }
+            Slot* slot = static_cast<Slot*>(io_uring_cqe_get_data(cqe));
+
+            // Short writes are finished synchronously, from the last whole
+            // block under O_DIRECT
+            if (cqe->res < 0)
+            {
+                ok = false;
+            }
+            else if (static_cast<size_t>(cqe->res) < slot->size)
+            {
+                size_t done = direct ? alignDown(cqe->res) : cqe->res;
+                ok = writeSlot(slot, done) && ok;
+            }
+            io_uring_cqe_seen(&ring, cqe);
+        }
+        return ok;
+    }
+#endif
+
+    for (Slot* slot : batch)
+    {
+        if (!writeSlot(slot))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void SessionWriter::run()
+{
+    static Counter* frames_total = Metrics::instance().counter("pam_session_frames_total", "Frames written to the session file");
+    static Counter* bytes_total = Metrics::instance().counter("pam_session_bytes_total", "Bytes written to the session file");
+    static Counter* syncs_total = Metrics::instance().counter("pam_session_syncs_total", "fdatasync calls on the session file");
+    static MetricsHistogram* latency_ms = Metrics::instance().histogram("pam_session_write_latency_ms", "Time from queueing a frame until it was written",
+        {0.5, 1.0, 2.0, 5.0, 10.0, 20.0, 50.0, 100.0, 500.0});
+
+    std::unique_lock<std::mutex> lock(mtx);
+    uint64_t since_sync = 0;
+
+    while (true)
+    {
+        work_cv.wait(lock, [this]() { return !queue.empty() || !running || sync_target > synced_total; });
+
+        if (queue.empty())
+        {
+            if (sync_target > synced_total && completed_total >= sync_target)
+            {
+                lock.unlock();
+                bool ok = fdatasync(fd) == 0;
+                syncs_total->inc();
+                lock.lock();
+                failed = failed || !ok;
+                synced_total = completed_total;
+                since_sync = 0;
+                done_cv.notify_all();
+                continue;
+            }
+            if (!running)
+            {
+                break;
+            }
+            continue;
+        }
+
+        std::vector<Slot*> batch(queue.begin(), queue.end());
+        queue.clear();
+        uint64_t end = batch.back()->offset + batch.back()->size;
+        for (Slot* slot : batch)
+        {
+            end = std::max(end, slot->offset + slot->size);
+        }
+        CompletionCallback cb = on_complete;
+        lock.unlock();
+
+        bool ok = reserve(end) && writeBatch(batch);
+
+        auto now = std::chrono::steady_clock::now();
+        uint64_t bytes = 0;
+        for (Slot* slot : batch)
+        {
+            double us = std::chrono::duration<double, std::micro>(now - slot->queued).count();
+            latency_ms->observe(us / 1000.0);
+            if (cb)
+            {
+                cb(us);
+            }
+            bytes += slot->size;
+        }
+        frames_total->inc(batch.size());
+        bytes_total->inc(bytes);
+        bytes_written += bytes;
+
+        since_sync += batch.size();
+        bool sync = since_sync >= sync_every;
+        if (sync && ok)
+        {
+            ok = fdatasync(fd) == 0;
+            syncs_total->inc();
+            since_sync = 0;
+        }
+
+        lock.lock();
+        if (!ok && !failed)
+        {
+            std::cout << "SessionWriter: write to " << path << " failed: " << strerror(errno) << std::endl;
+        }
+        failed = failed || !ok;
+        for (Slot* slot : batch)
+        {
+            free_slots.push_back(slot);
+        }
+        completed_total += batch.size();
+        if (sync)
+        {
+            synced_total = completed_total;
+        }
+        if (failed)
+        {
+            synced_total = queued_total;
+        }
+        done_cv.notify_all();
+    }
+}
@@ -0,0 +1,159 @@
+// *****************************************************************************
+//
+// sessionwriter.h
+// Writes recorded frames into one preallocated session file instead of a PNG
+// per frame, so the card only sees large sequential writes and no file
+// creation while recording.
+//
+// The file starts with a SESSION_ALIGN sized header block, followed by one
+// record per frame. A record is a FrameHeader, the raw image data, and zero
+// padding up to a multiple of SESSION_ALIGN. Every write is aligned, so the
+// file is opened with O_DIRECT where the filesystem allows it. Space is
+// reserved with fallocate in large chunks and the file is trimmed to its real
+// length on close. After a crash the tail is zeros, so readers stop at the
+// first record without FRAME_MAGIC.
+//
+// Writes are queued into a fixed pool of aligned buffers and issued by a
+// writer thread, through io_uring when built with PAM_HAVE_LIBURING and with
+// pwrite otherwise. fdatasync is batched every sync_every frames and on
+// flush().
+//
+// *****************************************************************************
+
+
+#ifndef __SESSIONWRITER_H__
+#define __SESSIONWRITER_H__
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef PAM_HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+#define SESSION_MAGIC 0x53534D50    // "PMSS"
+#define FRAME_MAGIC 0x464D4150      // "PAMF"
+#define SESSION_VERSION 1
+#define SESSION_ALIGN 4096
+
+#define DEFAULT_WRITER_DEPTH 8                      // Frames queued or in flight
+#define DEFAULT_SYNC_FRAMES 16                      // Frames between fdatasync calls
+#define DEFAULT_SESSION_CHUNK (1ULL << 30)          // fallocate step (bytes)
+
+struct SessionHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t header_size;   // Offset of the first record
+    uint32_t align;
+    int64_t created_us;     // System clock
+};
+
+struct FrameHeader
+{
+    uint32_t magic;
+    uint32_t record_size;   // Header, data and padding
+    uint32_t data_size;
+    uint32_t width;
+    uint32_t height;
+    uint32_t pixel_type;    // PvPixelType
+    uint32_t bits;          // Significant bits per pixel
+    uint32_t stride;        // Bytes per row
+    uint32_t recording;     // Recording number within the session
+    uint32_t frame;         // Frame number within the recording
+    uint64_t block_id;
+    uint64_t timestamp;     // Device ticks
+    int64_t wall_us;        // System clock at retrieval
+};
+
+class SessionWriter
+{
+    public:
+        // Called on the writer thread with the time from write() until the
+        // frame was on disk (or handed to the kernel with O_DIRECT off)
+        typedef std::function<void(double latency_us)> CompletionCallback;
+
+        SessionWriter(uint32_t _depth = DEFAULT_WRITER_DEPTH, uint32_t _sync_every = DEFAULT_SYNC_FRAMES);
+        ~SessionWriter();
+
+        bool open(const std::string& file, uint64_t chunk = DEFAULT_SESSION_CHUNK);
+        void close();
+        bool isOpen();
+
+        // Copies the frame into a free buffer and queues it. Without wait it
+        // returns false straight away if every buffer is busy and the frame
+        // is dropped.
+        bool write(FrameHeader header, const uint8_t* data, uint32_t size, bool wait = false);
+
+        // Blocks until everything queued so far is written and synced. With
+        // a timeout it returns false if that took longer.
+        bool flush(unsigned int timeout_ms = 0);
+
+        void setCompletionCallback(CompletionCallback cb);
+        const char* getBackend();
+        bool isDirect();
+        uint64_t getBytesWritten();
+        uint64_t getDropped();
+        uint64_t getPending();      // Queued but not yet written
+
+    private:
+        struct Slot
+        {
+            uint8_t* data = nullptr;
+            size_t capacity = 0;
+            size_t size = 0;
+            uint64_t offset = 0;
+            std::chrono::steady_clock::time_point queued;
+        };
+
+        void run();
+        bool reserve(uint64_t end);
+        bool writeBatch(std::vector<Slot*>& batch);
+        bool writeSlot(Slot* slot, size_t done = 0);  // From byte done on
+        void releaseSlots();
+
+    private:
+        std::string path;
+        int fd;
+        bool direct;
+        bool use_uring;
+#ifdef PAM_HAVE_LIBURING
+        struct io_uring ring;
+#endif
+
+        uint32_t depth;
+        uint32_t sync_every;
+        uint64_t chunk;
+        uint64_t allocated;     // Bytes reserved with fallocate
+        uint64_t next_offset;   // Where the next record goes
+
+        std::vector<Slot> pool;
+        std::vector<Slot*> free_slots;
+        std::deque<Slot*> queue;
+
+        std::thread thread;
+        std::mutex mtx;
+        std::condition_variable work_cv;
+        std::condition_variable done_cv;
+        bool running;
+        bool failed;
+        uint64_t queued_total;
+        uint64_t completed_total;
+        uint64_t synced_total;
+        uint64_t sync_target;
+
+        std::atomic<uint64_t> bytes_written;
+        std::atomic<uint64_t> dropped;
+        CompletionCallback on_complete;
+};
+
+
+#endif // __SESSIONWRITER_H__
@@ -0,0 +1,185 @@
+#include "shmfeed.h"
+#include <climits>
+#include <ctime>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+int64_t shmFeedNow()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+}
+
+ShmReader::ShmReader() :
+    fd(-1),
+    base(nullptr),
+    length(0),
+    header(nullptr),
+    last_seq(0),
+    skipped(0)
+{
+
+}
+
+ShmReader::~ShmReader()
+{
+    close();
+}
+
+bool ShmReader::open(const std::string& _name)
+{
+    close();
+    name = _name;
+
+    fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(ShmFeedHeader))
+    {
+        close();
+        return false;
+    }
+
+    void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED)
+    {
+        close();
+        return false;
+    }
+    base = static_cast<uint8_t*>(p);
+    length = st.st_size;
+    header = reinterpret_cast<ShmFeedHeader*>(base);
+
+    if (header->magic != SHM_FEED_MAGIC || header->version != SHM_FEED_VERSION ||
+        SHM_FEED_ALIGN + static_cast<size_t>(header->slot_count) * header->slot_stride > length)
+    {
+        close();
+        return false;
+    }
+
+    // Start from whatever is newest now
+    last_seq = header->last_seq.load(std::memory_order_acquire);
+    return true;
+}
+
+void ShmReader::close()
+{
+    if (base != nullptr)
+    {
+        munmap(base, length);
+    }
+    if (fd >= 0)
+    {
+        ::close(fd);
+    }
+    base = nullptr;
+    header = nullptr;
+    length = 0;
+    fd = -1;
+}
+
+bool ShmReader::isOpen()
+{
+    return header != nullptr;
+}
+
+uint64_t ShmReader::getSkipped()
+{
+    return skipped;
+}
+
+bool ShmReader::claim(uint64_t seq, ShmFrame& frame)
+{
+    const ShmSlot* slot = reinterpret_cast<const ShmSlot*>(base + SHM_FEED_ALIGN + ((seq - 1) % header->slot_count) * header->slot_stride);
+    if (slot->end.load(std::memory_order_acquire) != seq)
+    {
+        return false;
+    }
+
+    frame.seq = seq;
+    frame.slot = slot;
+    frame.data = reinterpret_cast<const uint8_t*>(slot) + header->data_offset;
+    return true;
+}
+
+bool ShmReader::next(ShmFrame& frame, int timeout_ms)
+{
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    while (true)
+    {
+        // The publisher resized or went away, follow it to the new segment
+        if (header == nullptr || header->closed.load(std::memory_order_acquire))
+        {
+            if (!open(name))
+            {
+                return false;
+            }
+        }
+
+        uint32_t notify = header->notify.load(std::memory_order_acquire);
+        uint64_t newest = header->last_seq.load(std::memory_order_acquire);
+        if (newest > last_seq)
+        {
+            // One slot is kept back, the publisher may be writing it
+            uint64_t seq = last_seq + 1;
+            if (newest - seq >= header->slot_count - 1)
+            {
+                seq = newest;
+            }
+            skipped += seq - last_seq - 1;
+            last_seq = seq;
+            if (claim(seq, frame))
+            {
+                return true;
+            }
+            skipped++;
+            continue;
+        }
+
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (now.tv_sec > deadline.tv_sec || (now.tv_sec == deadline.tv_sec && now.tv_nsec >= deadline.tv_nsec))
+        {
+            return false;
+        }
+        struct timespec wait;
+        wait.tv_sec = deadline.tv_sec - now.tv_sec;
+        wait.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+        if (wait.tv_nsec < 0)
+        {
+            wait.tv_sec--;
+            wait.tv_nsec += 1000000000L;
+        }
+
+        // Not FUTEX_PRIVATE_FLAG, the word is shared between processes
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(&header->notify), FUTEX_WAIT, notify, &wait, nullptr, 0);
+    }
+}
+
+bool ShmReader::isValid(const ShmFrame& frame)
+{
+    if (frame.slot == nullptr)
+    {
+        return false;
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return frame.slot->begin.load(std::memory_order_relaxed) == frame.seq;
+}
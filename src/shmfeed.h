@@ -0,0 +1,115 @@
+// *****************************************************************************
+//
+// shmfeed.h
+// Live frames for other local processes through a POSIX shared memory ring,
+// and the reader side of it. This header only needs the standard library, so
+// analysis tools can build shmfeed.cpp on its own (see ShmPublisher for the
+// writing side).
+//
+// The segment starts with a ShmFeedHeader padded to SHM_FEED_ALIGN, followed
+// by slot_count slots of slot_stride bytes. Each slot is a ShmSlot with the
+// frame description, then the pixels at data_offset. Frame n (from 1) goes
+// into slot (n - 1) % slot_count.
+//
+// Readers map the segment read-only and use the pixels in place. A slot is
+// guarded like a seqlock: the publisher sets begin to the frame number before
+// writing and end after. A frame is intact while begin still matches after
+// the reader is done with it. The notify word is a futex bumped for every
+// frame, so readers can sleep until the next one.
+//
+// If the frame size grows the publisher marks the segment closed and creates
+// a new one under the same name. ShmReader reopens it by itself.
+//
+// *****************************************************************************
+
+
+#ifndef __SHMFEED_H__
+#define __SHMFEED_H__
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#define SHM_FEED_MAGIC 0x44454546   // "FEED"
+#define SHM_FEED_VERSION 1
+#define SHM_FEED_ALIGN 4096
+#define SHM_SLOT_DATA_OFFSET 128
+
+#define DEFAULT_SHM_NAME "/pam-feed"
+#define DEFAULT_SHM_SLOTS 8
+
+struct ShmFeedHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slot_count;
+    uint32_t slot_stride;           // Bytes from one slot to the next
+    uint32_t data_offset;           // Bytes from a slot to its pixels
+    uint32_t data_capacity;         // Largest frame a slot holds
+    std::atomic<uint32_t> closed;   // Set when the publisher is gone or resized
+    std::atomic<uint32_t> notify;   // Futex word, bumped after every frame
+    std::atomic<uint64_t> last_seq; // Newest complete frame, 0 before the first
+};
+
+struct ShmSlot
+{
+    std::atomic<uint64_t> begin;    // Frame being written
+    std::atomic<uint64_t> end;      // Frame completely written
+    uint32_t width;
+    uint32_t height;
+    uint32_t pixel_type;            // PvPixelType
+    uint32_t bits;                  // Significant bits per pixel
+    uint32_t stride;                // Bytes per row
+    uint32_t data_size;
+    uint64_t block_id;
+    uint64_t timestamp;             // Device ticks
+    int64_t wall_us;                // System clock at retrieval
+    int64_t publish_ns;             // CLOCK_MONOTONIC when published
+};
+
+struct ShmFrame
+{
+    uint64_t seq = 0;
+    const ShmSlot* slot = nullptr;
+    const uint8_t* data = nullptr;
+};
+
+class ShmReader
+{
+    public:
+        ShmReader();
+        ~ShmReader();
+
+        bool open(const std::string& _name = DEFAULT_SHM_NAME);
+        void close();
+        bool isOpen();
+
+        // The next frame after the last one returned, waiting up to
+        // timeout_ms for it. If the reader fell more than a ring behind it
+        // jumps to the newest frame and counts the ones it missed.
+        bool next(ShmFrame& frame, int timeout_ms);
+
+        // Call after using the pixels. False if the publisher started
+        // overwriting the slot in the meantime.
+        bool isValid(const ShmFrame& frame);
+
+        uint64_t getSkipped();
+
+    private:
+        bool claim(uint64_t seq, ShmFrame& frame);
+
+    private:
+        std::string name;
+        int fd;
+        uint8_t* base;
+        size_t length;
+        ShmFeedHeader* header;
+        uint64_t last_seq;
+        uint64_t skipped;
+};
+
+// Monotonic clock shared by publisher and readers, for latency
+int64_t shmFeedNow();
+
+
+#endif // __SHMFEED_H__
@@ -0,0 +1,138 @@
+#include "shmpublisher.h"
+#include "metrics.h"
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+ShmPublisher::ShmPublisher(const std::string& _name, uint32_t _slot_count) :
+    name(_name),
+    slot_count(std::max<uint32_t>(2, _slot_count)),
+    fd(-1),
+    base(nullptr),
+    length(0),
+    header(nullptr),
+    seq(0)
+{
+
+}
+
+ShmPublisher::~ShmPublisher()
+{
+    close();
+}
+
+const std::string& ShmPublisher::getName()
+{
+    return name;
+}
+
+bool ShmPublisher::create(uint32_t capacity)
+{
+    close();
+
+    uint64_t stride = (SHM_SLOT_DATA_OFFSET + static_cast<uint64_t>(capacity) + SHM_FEED_ALIGN - 1) / SHM_FEED_ALIGN * SHM_FEED_ALIGN;
+    length = SHM_FEED_ALIGN + stride * slot_count;
+
+    // Start clean, an old segment may still be mapped by readers
+    shm_unlink(name.c_str());
+    fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0 || ftruncate(fd, length) != 0)
+    {
+        std::cout << "ShmPublisher: unable to create " << name << ": " << strerror(errno) << std::endl;
+        close();
+        return false;
+    }
+
+    void* p = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED)
+    {
+        std::cout << "ShmPublisher: unable to map " << name << ": " << strerror(errno) << std::endl;
+        close();
+        return false;
+    }
+    base = static_cast<uint8_t*>(p);
+
+    // ftruncate leaves it zeroed, which is a valid state for every atomic
+    header = reinterpret_cast<ShmFeedHeader*>(base);
+    header->slot_count = slot_count;
+    header->slot_stride = static_cast<uint32_t>(stride);
+    header->data_offset = SHM_SLOT_DATA_OFFSET;
+    header->data_capacity = static_cast<uint32_t>(stride - SHM_SLOT_DATA_OFFSET);
+    header->version = SHM_FEED_VERSION;
+    std::atomic_thread_fence(std::memory_order_release);
+    header->magic = SHM_FEED_MAGIC;
+
+    seq = 0;
+    std::cout << "ShmPublisher: " << name << ", " << slot_count << " slots of " << header->data_capacity << " bytes" << std::endl;
+    return true;
+}
+
+void ShmPublisher::close()
+{
+    if (header != nullptr)
+    {
+        // Wake readers so they notice
+        header->closed.store(1, std::memory_order_release);
+        header->notify.fetch_add(1, std::memory_order_release);
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(&header->notify), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+        shm_unlink(name.c_str());
+    }
+    if (base != nullptr)
+    {
+        munmap(base, length);
+    }
+    if (fd >= 0)
+    {
+        ::close(fd);
+    }
+    base = nullptr;
+    header = nullptr;
+    length = 0;
+    fd = -1;
+}
+
+bool ShmPublisher::publish(const FrameHeader& frame, const uint8_t* data, uint32_t size)
+{
+    static Counter* frames_total = Metrics::instance().counter("pam_shm_frames_total", "Frames published to the shared memory feed");
+    static Counter* bytes_total = Metrics::instance().counter("pam_shm_bytes_total", "Bytes published to the shared memory feed");
+
+    if ((header == nullptr || size > header->data_capacity) && !create(size))
+    {
+        return false;
+    }
+
+    seq++;
+    ShmSlot* slot = reinterpret_cast<ShmSlot*>(base + SHM_FEED_ALIGN + ((seq - 1) % slot_count) * header->slot_stride);
+
+    // Readers still on the old frame see begin move and drop it
+    slot->begin.store(seq, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    slot->width = frame.width;
+    slot->height = frame.height;
+    slot->pixel_type = frame.pixel_type;
+    slot->bits = frame.bits;
+    slot->stride = frame.stride;
+    slot->data_size = size;
+    slot->block_id = frame.block_id;
+    slot->timestamp = frame.timestamp;
+    slot->wall_us = frame.wall_us;
+    memcpy(reinterpret_cast<uint8_t*>(slot) + SHM_SLOT_DATA_OFFSET, data, size);
+    slot->publish_ns = shmFeedNow();
+
+    slot->end.store(seq, std::memory_order_release);
+    header->last_seq.store(seq, std::memory_order_release);
+    header->notify.fetch_add(1, std::memory_order_release);
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&header->notify), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+
+    frames_total->inc();
+    bytes_total->inc(size);
+    return true;
+}
@@ -0,0 +1,44 @@
+// *****************************************************************************
+//
+// shmpublisher.h
+// Writing side of the shared memory live feed (layout in shmfeed.h). The
+// segment is created on the first frame with slots sized for it. It is
+// replaced if a later frame doesn't fit, and unlinked on close.
+//
+// *****************************************************************************
+
+
+#ifndef __SHMPUBLISHER_H__
+#define __SHMPUBLISHER_H__
+
+#include <cstdint>
+#include <string>
+
+#include "shmfeed.h"
+#include "sessionwriter.h"
+
+class ShmPublisher
+{
+    public:
+        ShmPublisher(const std::string& _name = DEFAULT_SHM_NAME, uint32_t _slot_count = DEFAULT_SHM_SLOTS);
+        ~ShmPublisher();
+
+        bool publish(const FrameHeader& frame, const uint8_t* data, uint32_t size);
+        void close();
+        const std::string& getName();
+
+    private:
+        bool create(uint32_t capacity);
+
+    private:
+        std::string name;
+        uint32_t slot_count;
+        int fd;
+        uint8_t* base;
+        size_t length;
+        ShmFeedHeader* header;
+        uint64_t seq;
+};
+
+
+#endif // __SHMPUBLISHER_H__
@@ -1,10 +1,18 @@
 #include "signalhandler.h"
 #include <signal.h>
 #include <cassert>
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
 
 // Single instance
 SignalHandler* g_handler = NULL;
 
+// Self-pipe. The handler only writes the logical signal to it, everything
+// else happens when the owner reads it back.
+static int g_pipe[2] = {-1, -1};
+
 void POSIX_handleFunc(int);
 int POSIX_physicalToLogical(int);
 int POSIX_logicalToPhysical(int);
@@ -15,6 +23,10 @@ SignalHandler::SignalHandler(int _mask) : mask(_mask)
     assert(g_handler == NULL);
     g_handler = this;
 
+    bool piped = pipe2(g_pipe, O_NONBLOCK | O_CLOEXEC) == 0;
+    assert(piped);
+    (void)piped;
+
     // Connect signals
     for (int i = 0; i < num_signals; i++)
     {
@@ -40,6 +52,11 @@ SignalHandler::~SignalHandler()
             signal(POSIX_logicalToPhysical(logical), SIG_DFL);
         }
     }
+
+    close(g_pipe[0]);
+    close(g_pipe[1]);
+    g_pipe[0] = g_pipe[1] = -1;
+    g_handler = NULL;
 }
 
 
@@ -54,6 +71,7 @@ int POSIX_logicalToPhysical(int signal)
     // bind it to a SIGTERM. Anyway the signal will never be raised
     case SignalHandler::SIG_CLOSE: return SIGTERM;
     case SignalHandler::SIG_RELOAD: return SIGHUP;
+    case SignalHandler::SIG_USER: return SIGUSR1;
     default: 
         return -1; // SIG_ERR = -1
     }
@@ -66,17 +84,48 @@ int POSIX_physicalToLogical(int signal)
     case SIGINT: return SignalHandler::SIG_INT;
     case SIGTERM: return SignalHandler::SIG_TERM;
     case SIGHUP: return SignalHandler::SIG_RELOAD;
+    case SIGUSR1: return SignalHandler::SIG_USER;
     default:
         return SignalHandler::SIG_UNHANDLED;
     }
 }
 
+int SignalHandler::getSignalFd()
+{
+    return g_pipe[0];
+}
+
+int SignalHandler::dispatchSignals()
+{
+    int count = 0;
+    unsigned char signo;
+    while (read(g_pipe[0], &signo, 1) == 1)
+    {
+        handleSignal(signo);
+        count++;
+    }
+    return count;
+}
+
+int SignalHandler::waitForSignals(int timeout_ms)
+{
+    struct pollfd pfd = {g_pipe[0], POLLIN, 0};
+    if (poll(&pfd, 1, timeout_ms) <= 0)
+    {
+        return 0;
+    }
+    return dispatchSignals();
+}
+
 void POSIX_handleFunc(int signal)
 {
-    if (g_handler)
+    // Only async-signal-safe calls in here
+    int saved_errno = errno;
+    unsigned char signo = POSIX_physicalToLogical(signal);
+    if (write(g_pipe[1], &signo, 1) < 0)
     {
-        int signo = POSIX_physicalToLogical(signal);
-        g_handler->handleSignal(signo);
+        // Pipe full, there are enough pending already
     }
+    errno = saved_errno;
 }
 
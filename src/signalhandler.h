@@ -4,6 +4,11 @@
 * Interface class for handling signals.
 * Qt application can inherit from this class and implement handleSingle().
 *
+* The POSIX handler only writes the signal to a pipe. handleSignal() is
+* called later, outside signal context, from dispatchSignals() or
+* waitForSignals(). A Qt application watches getSignalFd() with a
+* QSocketNotifier, anything else polls it from a thread of its own.
+*
 * Credit to user948581 - https://stackoverflow.com/questions/7581343
 */
 class SignalHandler
@@ -20,6 +25,7 @@ class SignalHandler
             SIG_TERM      = 4,
             SIG_CLOSE     = 8,
             SIG_RELOAD    = 16,
+            SIG_USER      = 32,
             DEFAULT_SIGNALS = SIG_INT | SIG_TERM | SIG_CLOSE
         };
         static const int num_signals = 6;
@@ -27,6 +33,13 @@ class SignalHandler
         // Implement this is child
         virtual bool handleSignal(int signal) = 0;
 
+        // Readable while signals are pending
+        int getSignalFd();
+
+        // Calls handleSignal() for each pending signal, returns how many
+        int dispatchSignals();
+        int waitForSignals(int timeout_ms);
+
     private:
         int mask;
 };
@@ -0,0 +1,208 @@
+#include "timerwheel.h"
+#include <algorithm>
+#include <cerrno>
+#include <time.h>
+#include <pthread.h>
+
+TimerWheel::TimerWheel(uint32_t _tick_us, uint32_t _slots) :
+    tick_ns(static_cast<int64_t>(_tick_us) * 1000),
+    buckets(_slots > 0 ? _slots : 1),
+    origin(now()),
+    current_tick(0),
+    count(0),
+    generation(0),
+    running(false)
+{
+
+}
+
+TimerWheel::~TimerWheel()
+{
+    stop();
+}
+
+int64_t TimerWheel::now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+uint64_t TimerWheel::tickOf(int64_t t)
+{
+    return (t <= origin) ? 0 : static_cast<uint64_t>((t - origin) / tick_ns);
+}
+
+std::chrono::steady_clock::time_point TimerWheel::timeOf(uint64_t tick)
+{
+    return std::chrono::steady_clock::time_point(std::chrono::nanoseconds(origin + static_cast<int64_t>(tick) * tick_ns));
+}
+
+void TimerWheel::start()
+{
+    if (running)
+    {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        current_tick = std::max(current_tick, tickOf(now()));
+    }
+
+    running = true;
+    thread = std::thread(&TimerWheel::run, this);
+
+    // Best effort: real-time priority needs CAP_SYS_NICE, without it we just
+    // run at normal priority.
+    sched_param param;
+    param.sched_priority = 50;
+    pthread_setschedparam(thread.native_handle(), SCHED_FIFO, &param);
+}
+
+void TimerWheel::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        running = false;
+    }
+    cv.notify_all();
+
+    if (thread.joinable())
+    {
+        thread.join();
+    }
+}
+
+void TimerWheel::cancelAll()
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    for (auto& slot : buckets)
+    {
+        slot.clear();
+    }
+    count = 0;
+}
+
+size_t TimerWheel::pending()
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    return count;
+}
+
+void TimerWheel::schedule(int64_t deadline, Callback cb)
+{
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+
+        // Anything already due goes in the tick being processed next
+        uint64_t tick = std::max(tickOf(deadline), current_tick);
+        buckets[tick % buckets.size()].push_back({deadline, tick, cb});
+        count++;
+        generation++;
+    }
+    cv.notify_all();
+}
+
+void TimerWheel::waitPrecise(int64_t deadline)
+{
+    // Sleep most of the way, then spin. clock_nanosleep on CLOCK_MONOTONIC
+    // matches steady_clock on Linux.
+    int64_t wake = deadline - WHEEL_SPIN_NS;
+    if (wake > now())
+    {
+        timespec ts;
+        ts.tv_sec = wake / 1000000000;
+        ts.tv_nsec = wake % 1000000000;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR)
+        {
+        }
+    }
+
+    while (now() < deadline)
+    {
+    }
+}
+
+void TimerWheel::run()
+{
+    const uint64_t n = buckets.size();
+    std::unique_lock<std::mutex> lock(mtx);
+
+    while (running)
+    {
+        // Next occupied tick within one revolution of the wheel. Timers in a
+        // slot may belong to later revolutions, so check their tick too.
+        bool found = false;
+        uint64_t next = current_tick;
+        for (uint64_t i = 0; i < n && !found && count > 0; i++)
+        {
+            uint64_t tick = current_tick + i;
+            for (auto& t : buckets[tick % n])
+            {
+                if (t.tick <= tick)
+                {
+                    found = true;
+                    next = tick;
+                    break;
+                }
+            }
+        }
+
+        if (!found)
+        {
+            // Nothing due this revolution. Sleep it out (or until a new
+            // timer arrives) and skip the empty ticks. If a timer did arrive
+            // it may sit in one of those ticks, so rescan from here instead.
+            uint64_t seen = generation;
+            cv.wait_until(lock, timeOf(current_tick + n));
+            if (generation == seen)
+            {
+                current_tick = std::max(current_tick, std::min(current_tick + n, tickOf(now())));
+            }
+            continue;
+        }
+
+        // Wake at the start of the tick. A new timer may arrive meanwhile
+        // and be earlier, in which case rescan.
+        if (std::chrono::steady_clock::now() < timeOf(next))
+        {
+            cv.wait_until(lock, timeOf(next));
+            if (std::chrono::steady_clock::now() < timeOf(next))
+            {
+                continue;
+            }
+        }
+
+        // Pull out everything due in this tick
+        std::vector<Timer> due;
+        std::vector<Timer>& slot = buckets[next % n];
+        for (auto it = slot.begin(); it != slot.end();)
+        {
+            if (it->tick <= next)
+            {
+                due.push_back(*it);
+                it = slot.erase(it);
+                count--;
+            }
+            else
+            {
+                it++;
+            }
+        }
+        current_tick = next + 1;
+
+        std::sort(due.begin(), due.end(), [](const Timer& a, const Timer& b) { return a.deadline < b.deadline; });
+
+        // Run callbacks unlocked so they can schedule more timers
+        lock.unlock();
+        for (auto& t : due)
+        {
+            if (!running)
+            {
+                break;
+            }
+            waitPrecise(t.deadline);
+            t.cb(t.deadline, now());
+        }
+        lock.lock();
+    }
+}
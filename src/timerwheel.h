@@ -0,0 +1,81 @@
+// *****************************************************************************
+//
+// timerwheel.h
+// Hashed timer wheel with a single dispatch thread.
+//
+// Timers are bucketed by tick (1 ms by default). The thread sleeps on a
+// condition variable until just before the next occupied tick, then sleeps to
+// within SPIN_NS of each deadline and spins the rest of the way, so callbacks
+// start well inside a millisecond of their deadline.
+//
+// Callbacks run on the wheel thread, one at a time, in deadline order. Long
+// callbacks delay the ones behind them; the actual start time is passed to
+// each callback so lateness can be logged.
+//
+// *****************************************************************************
+
+
+#ifndef __TIMERWHEEL_H__
+#define __TIMERWHEEL_H__
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define DEFAULT_WHEEL_TICK_US 1000
+#define DEFAULT_WHEEL_SLOTS 1024
+#define WHEEL_SPIN_NS 200000    // Busy wait for the last part of each deadline
+
+class TimerWheel
+{
+    public:
+        // Times are steady_clock nanoseconds
+        typedef std::function<void(int64_t planned, int64_t actual)> Callback;
+
+        TimerWheel(uint32_t _tick_us = DEFAULT_WHEEL_TICK_US, uint32_t _slots = DEFAULT_WHEEL_SLOTS);
+        ~TimerWheel();
+
+        void start();
+        void stop();
+        void cancelAll();
+        size_t pending();
+
+        // Deadlines in the past fire as soon as possible
+        void schedule(int64_t deadline, Callback cb);
+
+        static int64_t now();
+
+    private:
+        struct Timer
+        {
+            int64_t deadline;
+            uint64_t tick;
+            Callback cb;
+        };
+
+        void run();
+        uint64_t tickOf(int64_t t);
+        std::chrono::steady_clock::time_point timeOf(uint64_t tick);
+        void waitPrecise(int64_t deadline);
+
+    private:
+        int64_t tick_ns;
+        std::vector<std::vector<Timer>> buckets;
+        int64_t origin;
+        uint64_t current_tick;
+        size_t count;
+        uint64_t generation;    // Bumped on every schedule()
+
+        std::mutex mtx;
+        std::condition_variable cv;
+        std::atomic<bool> running;
+        std::thread thread;
+};
+
+
+#endif // __TIMERWHEEL_H__
@@ -3,16 +3,17 @@
 
 #include <string>
 #include <sstream>
+#include <fstream>
 #include <iostream>
 #include <iomanip>
 #include <stdio.h>
 #include <unistd.h>
 #include <fcntl.h>
-#include <termios.h> // Contains POSIX terminal control definitions
 #include <errno.h>
 #include <cstring>
 #include <algorithm>
-#include <sys/ioctl.h>
+
+#include "serialport.h"
 
 namespace Tools
 {
@@ -47,60 +48,31 @@ namespace Tools
         return ss.str();
     }
 
-    inline int sendSerialString(std::string str)
+    // Opens a CSV file for appending, writing the header line first if the
+    // file is new or empty. Returns false if it could not be opened.
+    inline bool appendCsv(std::ofstream& out, const std::string& path, const std::string& header)
     {
-        // We wouldn't want to be opening/closing the serial port (file) repeatedly in a loop but since 
-        // in practice this will only get called sporadically it makes things simpler.
-
-        // Make sure str is terminated with "\r\n"
-        size_t pos = 0;
-        if(str.find("\r\n") == std::string::npos)
+        out.clear();
+        out.open(path, std::ios::app);
+        if (!out.is_open())
         {
-            str.erase(std::remove(str.begin(), str.end(), '\n'), str.cend());
-            str.erase(std::remove(str.begin(), str.end(), '\r'), str.cend());
-            str.append("\r\n");
+            std::cout << "Unable to open " << path << std::endl;
+            return false;
         }
 
-        // Open tty
-        char byte;
-        int fd = open("/dev/ttyUSB0", O_WRONLY);
-        
-        // Flush the serial i/o buffers.
-        // Occasionally there will be some garbage which tends to throw off the MCU and image acquisition.
-        ioctl(fd, TCFLSH, 2);
-
-        struct termios tty;
-
-        // Read in existing settings, and handle any error
-        if(tcgetattr(fd, &tty) != 0) {
-            printf("Error %i from tcgetattr: %s\n", errno, strerror(errno));
-            return 1;
-        }
-
-        tty.c_cflag &= ~PARENB; // Clear parity bit, disabling parity (most common)
-        tty.c_cflag &= ~CSTOPB; // Clear stop field, only one stop bit used in communication (most common)
-        tty.c_cflag &= ~CSIZE; // Clear all bits that set the data size 
-        tty.c_cflag |= CS8; // 8 bits per byte (most common)
-        tty.c_cflag &= ~CRTSCTS; // Disable RTS/CTS hardware flow control (most common)
-        tty.c_cflag |= CREAD | CLOCAL; // Turn on READ & ignore ctrl lines (CLOCAL = 1)
-        tty.c_oflag &= ~OPOST; // Prevent special interpretation of output bytes (e.g. newline chars)
-        tty.c_oflag &= ~ONLCR; // Prevent conversion of newline to carriage return/line feed
-
-        // Set in/out baud rate to be 9600
-        cfsetispeed(&tty, B9600);
-        cfsetospeed(&tty, B9600);
-
-        // Save tty settings, also checking for error
-        if (tcsetattr(fd, TCSANOW, &tty) != 0) {
-            printf("Error %i from tcsetattr: %s\n", errno, strerror(errno));
-            return 1;
+        out.seekp(0, std::ios::end);
+        if (out.tellp() == 0)
+        {
+            out << header << std::endl;
         }
+        return true;
+    }
 
-        // write string
-        write(fd, str.c_str(), str.size());
-
-        close(fd);
-        return 0;
+    // Sends a command string to the LED controller. The port stays open and
+    // replies are read in the background, see serialport.h.
+    inline int sendSerialString(std::string str)
+    {
+        return (SerialPort::instance().send(str) != 0) ? 0 : 1;
     }
 
     // Approximate the irradiance based on the LED current.
@@ -109,6 +81,19 @@ namespace Tools
     {
         return 1818.4 * i + 135.26;
     }
+
+    // LED current for a DAC setting (mV): 2.40 V drives the nominal 2.067 A,
+    // as in getVset() of src-experimentation/main.cpp.
+    static inline float dacCurrent(const float& dac)
+    {
+        return std::min(std::max(dac, 0.0f) / 2400.0f, 1.0f) * 2.067f;
+    }
+
+    // PAR of the LED at a DAC setting, 0 when it is off
+    static inline float dacIrradiance(const float& dac)
+    {
+        return (dac > 0) ? irradiance(dacCurrent(dac)) : 0.0f;
+    }
 }
 
 #endif // __TOOLS_H__
\ No newline at end of file
@@ -0,0 +1,93 @@
+#include "watchdog.h"
+#include "receiver.h"
+#include <iostream>
+
+Watchdog::Watchdog(Receiver* _receiver) :
+    receiver(_receiver),
+    running(false),
+    last_frames(0)
+{
+
+}
+
+Watchdog::~Watchdog()
+{
+    stop();
+}
+
+void Watchdog::start()
+{
+    if (thread.joinable())
+    {
+        return;
+    }
+
+    running = true;
+    last_frames = receiver->getFramesReceived();
+    last_progress = std::chrono::steady_clock::now();
+    thread = std::thread(&Watchdog::run, this);
+}
+
+void Watchdog::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        running = false;
+    }
+    cv.notify_all();
+
+    if (thread.joinable())
+    {
+        thread.join();
+    }
+}
+
+void Watchdog::run()
+{
+    std::unique_lock<std::mutex> lock(mtx);
+
+    while (running)
+    {
+        cv.wait_for(lock, std::chrono::milliseconds(WATCHDOG_INTERVAL));
+        if (!running)
+        {
+            break;
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        uint64_t frames = receiver->getFramesReceived();
+        if (frames != last_frames || receiver->getState() != Receiver::CONTINIOUS)
+        {
+            last_frames = frames;
+            last_progress = now;
+        }
+
+        const char* reason = nullptr;
+        if (receiver->isLinkLost())
+        {
+            reason = "link lost";
+        }
+        else if (now - last_progress > std::chrono::milliseconds(WATCHDOG_STALL_TIMEOUT))
+        {
+            reason = "stream stalled";
+        }
+
+        if (reason == nullptr)
+        {
+            // Remember what to restore if the link goes later
+            receiver->snapshotSettings();
+            continue;
+        }
+
+        std::cout << "Watchdog: " << reason << ", reconnecting" << std::endl;
+
+        // Recovery retries until it succeeds or we are stopped, don't hold
+        // up stop() meanwhile
+        lock.unlock();
+        receiver->recover([this]() { std::lock_guard<std::mutex> l(mtx); return !running; });
+        lock.lock();
+
+        last_frames = receiver->getFramesReceived();
+        last_progress = std::chrono::steady_clock::now();
+    }
+}
@@ -0,0 +1,55 @@
+// *****************************************************************************
+//
+// watchdog.h
+// Keeps the camera link alive over long unattended runs. A low rate thread
+// checks that the device is still connected and that the viewfinder stream
+// is still delivering frames. If either check fails it asks the Receiver to
+// recover. The Receiver then reconnects the same device and stream objects,
+// restores the last good settings and returns to the previous mode.
+//
+// While triggered (recording) or paused no frames are expected, so only the
+// link is checked then.
+//
+// *****************************************************************************
+
+
+#ifndef __WATCHDOG_H__
+#define __WATCHDOG_H__
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+#define WATCHDOG_INTERVAL 500       // (ms) between checks
+#define WATCHDOG_STALL_TIMEOUT 5000 // (ms) without a viewfinder frame
+
+class Receiver;
+
+class Watchdog
+{
+    public:
+        Watchdog(Receiver* _receiver);
+        ~Watchdog();
+
+        void start();
+        void stop();
+
+    private:
+        void run();
+
+    private:
+        Receiver* receiver;
+        std::thread thread;
+        std::mutex mtx;
+        std::condition_variable cv;
+        bool running;
+
+        uint64_t last_frames;
+        std::chrono::steady_clock::time_point last_progress;
+};
+
+
+#endif // __WATCHDOG_H__